@@ -0,0 +1,313 @@
+/*
+ * This is a quick benchmark for concurrent file lookups in PhysicsFS. It
+ *  mounts whatever you give it, finds every file in the search path, and
+ *  then has a growing number of threads open, read and close those files
+ *  as fast as they can, first with PhysicsFS serializing them, then with
+ *  PHYSFS_allowConcurrentReads(1). If the concurrent numbers don't go up
+ *  with the thread count, something is holding a lock it shouldn't.
+ *
+ * Run it like this:
+ *   ./physfsbench [-t maxthreads] [-s seconds] [-i] archive1.zip archive2.zip /path/to/a/real/dir etc...
+ *
+ *  -t sets the highest thread count to try (default 16; we go by doubling).
+ *  -s sets how long each run lasts (default 2 seconds).
+ *  -i turns on the search path index (see PHYSFS_indexSearchPath()).
+ *
+ * To build it on Linux:
+ *  gcc -Wall -O2 -o physfsbench extras/physfsbench.c -lphysfs -lpthread
+ *
+ * This file is public domain; use it however you like. It comes with NO
+ *  WARRANTY.
+ *
+ * Unless otherwise stated, the rest of PhysicsFS falls under the zlib license.
+ *  Please see LICENSE.txt in the root of the source tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "physfs.h"
+
+#define READ_BUFFER_SIZE (64 * 1024)
+#define MAX_THREADS 256
+
+typedef struct
+{
+    char **files;
+    size_t count;
+    size_t allocated;
+} FileList;
+
+typedef struct
+{
+    pthread_t thread;
+    const FileList *list;
+    size_t start;
+    volatile const int *running;
+    unsigned long opens;
+    unsigned long long bytes;
+    int failed;
+} BenchThread;
+
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double) tv.tv_sec) + (((double) tv.tv_usec) / 1000000.0);
+} /* now */
+
+
+static int addFile(FileList *list, const char *path)
+{
+    char *dup;
+
+    if (list->count == list->allocated)
+    {
+        const size_t newalloc = list->allocated ? list->allocated * 2 : 256;
+        void *ptr = realloc(list->files, newalloc * sizeof (char *));
+        if (ptr == NULL)
+            return 0;
+        list->files = (char **) ptr;
+        list->allocated = newalloc;
+    } /* if */
+
+    dup = (char *) malloc(strlen(path) + 1);
+    if (dup == NULL)
+        return 0;
+    strcpy(dup, path);
+    list->files[list->count++] = dup;
+    return 1;
+} /* addFile */
+
+
+static PHYSFS_EnumerateCallbackResult collectFiles(void *data,
+                                    const char *origdir, const char *fname)
+{
+    FileList *list = (FileList *) data;
+    const size_t len = strlen(origdir) + strlen(fname) + 2;
+    char *path = (char *) malloc(len);
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    PHYSFS_Stat statbuf;
+
+    if (path == NULL)
+        return PHYSFS_ENUM_ERROR;
+
+    snprintf(path, len, "%s%s%s", origdir, *origdir ? "/" : "", fname);
+    if (!PHYSFS_stat(path, &statbuf))
+        retval = PHYSFS_ENUM_OK;  /* weird, but skip it. */
+    else if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+    {
+        if (!PHYSFS_enumerate(path, collectFiles, list))
+            retval = PHYSFS_ENUM_ERROR;
+    } /* else if */
+    else if (statbuf.filetype == PHYSFS_FILETYPE_REGULAR)
+    {
+        if (!addFile(list, path))
+            retval = PHYSFS_ENUM_ERROR;
+    } /* else if */
+
+    free(path);
+    return retval;
+} /* collectFiles */
+
+
+static void *benchThread(void *arg)
+{
+    BenchThread *bt = (BenchThread *) arg;
+    const FileList *list = bt->list;
+    size_t i = bt->start;
+    char *buf = (char *) malloc(READ_BUFFER_SIZE);
+
+    if (buf == NULL)
+    {
+        bt->failed = 1;
+        return NULL;
+    } /* if */
+
+    while (*bt->running)
+    {
+        PHYSFS_File *f = PHYSFS_openRead(list->files[i]);
+        PHYSFS_sint64 br;
+
+        if (f == NULL)
+        {
+            bt->failed = 1;
+            break;
+        } /* if */
+
+        while ((br = PHYSFS_readBytes(f, buf, READ_BUFFER_SIZE)) > 0)
+            bt->bytes += (unsigned long long) br;
+
+        PHYSFS_close(f);
+        bt->opens++;
+
+        if (++i >= list->count)
+            i = 0;
+    } /* while */
+
+    free(buf);
+    return NULL;
+} /* benchThread */
+
+
+static int runBench(const FileList *list, const int numthreads,
+                    const double seconds, double *opsPerSec, double *mbPerSec)
+{
+    static BenchThread threads[MAX_THREADS];
+    volatile int running = 1;
+    unsigned long long bytes = 0;
+    unsigned long opens = 0;
+    double start, elapsed;
+    int failed = 0;
+    int i;
+
+    memset(threads, '\0', sizeof (threads));
+
+    start = now();
+    for (i = 0; i < numthreads; i++)
+    {
+        threads[i].list = list;
+        threads[i].start = (list->count / numthreads) * i;
+        threads[i].running = &running;
+        if (pthread_create(&threads[i].thread, NULL, benchThread, &threads[i]) != 0)
+        {
+            fprintf(stderr, "couldn't create thread #%d.\n", i);
+            running = 0;  /* just wait for the ones we have. */
+            break;
+        } /* if */
+    } /* for */
+
+    while ((running) && ((now() - start) < seconds))
+    {
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = 10000;
+        select(0, NULL, NULL, NULL, &tv);
+    } /* while */
+
+    running = 0;
+
+    while (--i >= 0)
+    {
+        pthread_join(threads[i].thread, NULL);
+        opens += threads[i].opens;
+        bytes += threads[i].bytes;
+        failed |= threads[i].failed;
+    } /* while */
+
+    elapsed = now() - start;
+    *opsPerSec = ((double) opens) / elapsed;
+    *mbPerSec = (((double) bytes) / (1024.0 * 1024.0)) / elapsed;
+    return !failed;
+} /* runBench */
+
+
+int main(int argc, char **argv)
+{
+    FileList list;
+    double seconds = 2.0;
+    int maxthreads = 16;
+    int useIndex = 0;
+    int mounted = 0;
+    int concurrent;
+    int argi;
+    size_t i;
+
+    memset(&list, '\0', sizeof (list));
+
+    if (!PHYSFS_init(argv[0]))
+    {
+        fprintf(stderr, "PHYSFS_init(): %s\n",
+                PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+        return 1;
+    } /* if */
+
+    for (argi = 1; argi < argc; argi++)
+    {
+        const char *arg = argv[argi];
+        if ((strcmp(arg, "-t") == 0) && (argi + 1 < argc))
+        {
+            maxthreads = atoi(argv[++argi]);
+            if (maxthreads < 1)
+                maxthreads = 1;
+            else if (maxthreads > MAX_THREADS)
+                maxthreads = MAX_THREADS;
+        } /* if */
+        else if ((strcmp(arg, "-s") == 0) && (argi + 1 < argc))
+            seconds = atof(argv[++argi]);
+        else if (strcmp(arg, "-i") == 0)
+            useIndex = 1;
+        else if (!PHYSFS_mount(arg, NULL, 1))
+        {
+            fprintf(stderr, "Couldn't mount '%s': %s\n", arg,
+                    PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+        } /* else if */
+        else
+        {
+            mounted++;
+        } /* else */
+    } /* for */
+
+    if (mounted == 0)
+    {
+        fprintf(stderr, "USAGE: %s [-t maxthreads] [-s seconds] [-i] <archives to mount>\n", argv[0]);
+        PHYSFS_deinit();
+        return 1;
+    } /* if */
+
+    if (useIndex)
+        PHYSFS_indexSearchPath(1);
+
+    if (!PHYSFS_enumerate("/", collectFiles, &list))
+    {
+        fprintf(stderr, "Couldn't enumerate the search path: %s\n",
+                PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+    } /* if */
+    else if (list.count == 0)
+    {
+        fprintf(stderr, "No files in the search path!\n");
+    } /* else if */
+    else
+    {
+        printf("%d mounted, %lu files, %.1f seconds per run%s.\n", mounted,
+               (unsigned long) list.count, seconds,
+               useIndex ? ", indexed" : "");
+        printf("%-12s %8s %14s %12s\n", "mode", "threads", "opens/sec", "MB/sec");
+
+        for (concurrent = 0; concurrent <= 1; concurrent++)
+        {
+            int threads;
+            if (!PHYSFS_allowConcurrentReads(concurrent))
+            {
+                printf("%-12s (not available: %s)\n", "concurrent",
+                       PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+                break;
+            } /* if */
+
+            for (threads = 1; threads <= maxthreads; threads *= 2)
+            {
+                double ops, mb;
+                if (!runBench(&list, threads, seconds, &ops, &mb))
+                    fprintf(stderr, "(some reads failed in this run!)\n");
+                printf("%-12s %8d %14.0f %12.1f\n",
+                       concurrent ? "concurrent" : "serialized",
+                       threads, ops, mb);
+                fflush(stdout);
+            } /* for */
+        } /* for */
+    } /* else */
+
+    for (i = 0; i < list.count; i++)
+        free(list.files[i]);
+    free(list.files);
+
+    PHYSFS_deinit();
+    return 0;
+} /* main */
+
+/* end of physfsbench.c ... */
@@ -47,10 +47,44 @@ typedef struct __PHYSFS_DIRHANDLE__
     char *root;  /* subdirectory of archiver to use as root of archive (NULL for actual root) */
     size_t rootlen;  /* subdirectory of archiver to use as root of archive (NULL for actual root) */
     const PHYSFS_Archiver *funcs;  /* Ptr to archiver info for this handle. */
+    int searchOrder;  /* position in search path; lower values are searched first. */
+    struct __PHYSFS_SEARCHINDEXNODE__ *indexNodes;  /* NULL if not in the search path index. */
+    size_t indexNodeCount;  /* number of items in indexNodes. */
+    PHYSFS_uint64 *lookupFilter;  /* NULL if we can't rule paths out. */
+    size_t lookupFilterMask;  /* words in lookupFilter, minus one. */
+    int pins;  /* enumerates or closes using this unlocked; can't free it. */
+    int checkSymlinks;  /* zero if this can't have symlinks for verifyPath() to find. */
+    struct __PHYSFS_SYMLINKCACHE__ *symlinkCache;  /* DIR only; NULL until needed. */
     struct __PHYSFS_DIRHANDLE__ *next;  /* linked list stuff. */
 } DirHandle;
 
 
+/*
+ * The search path index maps full paths in the interpolated tree to the
+ *  DirHandles that can provide them, so lookups don't have to ask every
+ *  mounted archive in turn. Only archives that use __PHYSFS_DirTree (so we
+ *  can see everything they contain up front) are indexed; everything else
+ *  is still probed on every lookup.
+ */
+typedef struct __PHYSFS_SEARCHINDEXNODE__
+{
+    PHYSFS_uint32 hash;  /* __PHYSFS_hashString() of the full path. */
+    PHYSFS_uint32 prefixlen;  /* chars of dh->mountPoint that start the path. */
+    DirHandle *dh;  /* DirHandle that provides this path. */
+    const __PHYSFS_DirTreeEntry *entry;  /* NULL for mountpoint elements. */
+    struct __PHYSFS_SEARCHINDEXNODE__ *next;  /* next item in hash bucket. */
+} SearchIndexNode;
+
+typedef struct
+{
+    SearchIndexNode **buckets;  /* each bucket is sorted by searchOrder. */
+    size_t bucketCount;  /* always a power of two. */
+    size_t nodeCount;  /* total nodes linked into buckets. */
+    size_t unindexed;  /* search path entries that aren't in the index. */
+    PHYSFS_uint32 generation;  /* searchPathGeneration this index matches. */
+} SearchIndex;
+
+
 typedef struct __PHYSFS_FILEHANDLE__
 {
     PHYSFS_Io *io;  /* Instance data unique to the archiver for this file. */
@@ -64,17 +98,34 @@ typedef struct __PHYSFS_FILEHANDLE__
 } FileHandle;
 
 
+#ifdef __PHYSFS_THREAD_LOCAL
+/* Each thread keeps its last error in thread-local storage, so BAIL_IF
+   and friends never touch a lock. PHYSFS_deinit() can't reach into other
+   threads' storage to reset them, so it bumps errorGeneration instead, and
+   a state from an older generation reads as PHYSFS_ERR_OK. */
+typedef struct
+{
+    PHYSFS_ErrorCode code;
+    PHYSFS_uint32 generation;
+} ErrState;
+#else
 typedef struct __PHYSFS_ERRSTATETYPE__
 {
     void *tid;
     PHYSFS_ErrorCode code;
     struct __PHYSFS_ERRSTATETYPE__ *next;
 } ErrState;
+#endif
 
 
 /* General PhysicsFS state ... */
 static int initialized = 0;
+#ifdef __PHYSFS_THREAD_LOCAL
+static __PHYSFS_THREAD_LOCAL ErrState threadErrorState;
+static volatile PHYSFS_uint32 errorGeneration = 1;
+#else
 static ErrState *errorStates = NULL;
+#endif
 static DirHandle *searchPath = NULL;
 static DirHandle *writeDir = NULL;
 static FileHandle *openWriteList = NULL;
@@ -82,7 +133,24 @@ static FileHandle *openReadList = NULL;
 static char *baseDir = NULL;
 static char *userDir = NULL;
 static char *prefDir = NULL;
+static char *archiveIndexDir = NULL;
 static int allowSymLinks = 0;
+static int searchPathIndexed = 0;
+static int mapArchives = 0;
+static int verifyChecksums = 0;
+static PHYSFS_ResolveMode resolveMode = PHYSFS_RESOLVE_ON_OPEN;
+static int preloadThreads = 0;
+static int decoderThreads = 0;
+static PHYSFS_uint64 preloadCompressed = 0;
+static PHYSFS_uint64 preloadDecompressed = 0;
+static PHYSFS_uint64 preloadTicks = 0;
+static SearchIndex searchIndex;
+static PHYSFS_uint32 searchPathGeneration = 0;
+static unsigned int lookupFilterRejected = 0;
+static unsigned int lookupFilterFalsePositives = 0;
+static PHYSFS_uint32 symlinkCacheGeneration = 0;
+static struct __PHYSFS_MOUNTTRIENODE__ *mountTrie = NULL;
+static PHYSFS_uint32 mountTrieGeneration = 0;
 static PHYSFS_Archiver **archivers = NULL;
 static PHYSFS_ArchiveInfo **archiveInfo = NULL;
 static volatile size_t numArchivers = 0;
@@ -92,6 +160,28 @@ static size_t longest_root = 0;
 static void *errorLock = NULL;     /* protects error message list.        */
 static void *stateLock = NULL;     /* protects other PhysFS static state. */
 
+/*
+ * Concurrent reads: when enabled, the search path is guarded by a
+ *  reader/writer lock, so openRead, stat, enumerate, etc only need a shared
+ *  lock and don't serialize on stateLock. Anything that changes the search
+ *  path still holds stateLock (so writers serialize against each other and
+ *  against everything else that uses it), and additionally holds the write
+ *  lock for the moment it actually changes things. That's the lock order,
+ *  too: stateLock, then searchPathLock. Readers never grab stateLock while
+ *  holding the read lock, and openReadList gets its own mutex since readers
+ *  add to it and close removes from it.
+ *
+ * We need real atomics here, since readers pin DirHandles without stateLock.
+ */
+#if defined(PHYSFS_HAVE_PLATFORM_RWLOCK) && !defined(PHYSFS_NEED_ATOMIC_OP_FALLBACK)
+#define PHYSFS_HAVE_CONCURRENT_READS 1
+static void *searchPathLock = NULL;   /* shared by readers of searchPath. */
+static void *openReadListLock = NULL; /* protects openReadList, when shared. */
+static void *symlinkCacheLock = NULL; /* protects symlink caches, when shared. */
+static int searchPathWriteLocked = 0;  /* only touched with stateLock held. */
+#endif
+static volatile int concurrentReads = 0;
+
 /* allocator ... */
 static int externalAllocator = 0;
 PHYSFS_Allocator allocator;
@@ -120,6 +210,78 @@ int __PHYSFS_ATOMIC_DECR(int *ptrval)
 #endif
 
 
+/*
+ * Anything that only reads the search path brackets itself with these.
+ *  Returns non-zero if we got the shared lock, zero if we're holding
+ *  stateLock instead (which is what happens when concurrent reads are
+ *  disabled). Hand the return value to releaseSearchPathRead().
+ */
+static int grabSearchPathRead(void)
+{
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    while (1)
+    {
+        /* the mode can flip while we wait, so check again once we're in. */
+        if (concurrentReads)
+        {
+            __PHYSFS_platformGrabReadLock(searchPathLock);
+            if (concurrentReads)
+                return 1;
+            __PHYSFS_platformReleaseRWLock(searchPathLock);
+        } /* if */
+        else
+        {
+            __PHYSFS_platformGrabMutex(stateLock);
+            if (!concurrentReads)
+                return 0;
+            __PHYSFS_platformReleaseMutex(stateLock);
+        } /* else */
+    } /* while */
+#else
+    __PHYSFS_platformGrabMutex(stateLock);
+    return 0;
+#endif
+} /* grabSearchPathRead */
+
+
+static void releaseSearchPathRead(const int shared)
+{
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (shared)
+    {
+        __PHYSFS_platformReleaseRWLock(searchPathLock);
+        return;
+    } /* if */
+#endif
+    __PHYSFS_platformReleaseMutex(stateLock);
+} /* releaseSearchPathRead */
+
+
+/*
+ * The mutex that protects openReadList. Only call this with stateLock or
+ *  the search path lock held, so concurrentReads can't change under you.
+ */
+static void *openReadListMutex(void)
+{
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (concurrentReads)
+        return openReadListLock;
+#endif
+    return stateLock;
+} /* openReadListMutex */
+
+
+/* Same idea as openReadListMutex(), but for the DIR symlink caches. */
+static void *symlinkCacheMutex(void)
+{
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (concurrentReads)
+        return symlinkCacheLock;
+#endif
+    return stateLock;
+} /* symlinkCacheMutex */
+
+
 
 /* PHYSFS_Io implementation for i/o to physical filesystem... */
 
@@ -162,9 +324,30 @@ static PHYSFS_sint64 nativeIo_length(PHYSFS_Io *io)
     return __PHYSFS_platformFileLength(info->handle);
 } /* nativeIo_length */
 
+static PHYSFS_Io *wrapNativeHandle(void *handle, const char *path,
+                                   const int mode);
+
 static PHYSFS_Io *nativeIo_duplicate(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+
+#ifdef PHYSFS_HAVE_PLATFORM_DUPLICATE
+    /* archivers duplicate their Io for every member they open, so don't
+       reopen the file each time; readers can share one OS-level handle. */
+    if (info->mode == 'r')
+    {
+        /* if the platform can't share this one, open it again below. */
+        void *handle = __PHYSFS_platformDuplicate(info->handle);
+        if (handle != NULL)
+        {
+            PHYSFS_Io *retval = wrapNativeHandle(handle, info->path, info->mode);
+            if (!retval)
+                __PHYSFS_platformClose(handle);
+            return retval;
+        } /* if */
+    } /* if */
+#endif
+
     return __PHYSFS_createNativeIo(info->path, info->mode);
 } /* nativeIo_duplicate */
 
@@ -183,6 +366,21 @@ static void nativeIo_destroy(PHYSFS_Io *io)
     allocator.Free(io);
 } /* nativeIo_destroy */
 
+#ifdef PHYSFS_HAVE_PLATFORM_READAT
+static PHYSFS_sint64 nativeIo_readAt(PHYSFS_Io *io, void *buf,
+                                     PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+    return __PHYSFS_platformReadAt(info->handle, buf, len, offset);
+} /* nativeIo_readAt */
+
+static void nativeIo_hint(PHYSFS_Io *io, PHYSFS_IoHint hint)
+{
+    NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+    __PHYSFS_platformHint(info->handle, hint);
+} /* nativeIo_hint */
+#endif
+
 static const PHYSFS_Io __PHYSFS_nativeIoInterface =
 {
     CURRENT_PHYSFS_IO_API_VERSION, NULL,
@@ -193,33 +391,32 @@ static const PHYSFS_Io __PHYSFS_nativeIoInterface =
     nativeIo_length,
     nativeIo_duplicate,
     nativeIo_flush,
-    nativeIo_destroy
+    nativeIo_destroy,
+#ifdef PHYSFS_HAVE_PLATFORM_READAT
+    nativeIo_readAt,
+    NULL,  /* map: archives that want this are mapped as memory Ios. */
+    nativeIo_hint
+#else
+    NULL,
+    NULL,
+    NULL
+#endif
 };
 
-PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
+/* Wrap an open platform handle in a PHYSFS_Io. Doesn't close (handle) on failure. */
+static PHYSFS_Io *wrapNativeHandle(void *handle, const char *path,
+                                   const int mode)
 {
     PHYSFS_Io *io = NULL;
     NativeIoInfo *info = NULL;
-    void *handle = NULL;
     char *pathdup = NULL;
 
-    assert((mode == 'r') || (mode == 'w') || (mode == 'a'));
-
     io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
+    GOTO_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, wrapNativeHandle_failed);
     info = (NativeIoInfo *) allocator.Malloc(sizeof (NativeIoInfo));
-    GOTO_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
+    GOTO_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, wrapNativeHandle_failed);
     pathdup = (char *) allocator.Malloc(strlen(path) + 1);
-    GOTO_IF(!pathdup, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
-
-    if (mode == 'r')
-        handle = __PHYSFS_platformOpenRead(path);
-    else if (mode == 'w')
-        handle = __PHYSFS_platformOpenWrite(path);
-    else if (mode == 'a')
-        handle = __PHYSFS_platformOpenAppend(path);
-
-    GOTO_IF_ERRPASS(!handle, createNativeIo_failed);
+    GOTO_IF(!pathdup, PHYSFS_ERR_OUT_OF_MEMORY, wrapNativeHandle_failed);
 
     strcpy(pathdup, path);
     info->handle = handle;
@@ -227,14 +424,37 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
     info->mode = mode;
     memcpy(io, &__PHYSFS_nativeIoInterface, sizeof (*io));
     io->opaque = info;
+    if (mode != 'r')
+        io->readAt = NULL;  /* the handle might not be readable at all. */
     return io;
 
-createNativeIo_failed:
-    if (handle != NULL) __PHYSFS_platformClose(handle);
-    if (pathdup != NULL) allocator.Free(pathdup);
+wrapNativeHandle_failed:
     if (info != NULL) allocator.Free(info);
     if (io != NULL) allocator.Free(io);
     return NULL;
+} /* wrapNativeHandle */
+
+
+PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
+{
+    PHYSFS_Io *io = NULL;
+    void *handle = NULL;
+
+    assert((mode == 'r') || (mode == 'w') || (mode == 'a'));
+
+    if (mode == 'r')
+        handle = __PHYSFS_platformOpenRead(path);
+    else if (mode == 'w')
+        handle = __PHYSFS_platformOpenWrite(path);
+    else if (mode == 'a')
+        handle = __PHYSFS_platformOpenAppend(path);
+
+    BAIL_IF_ERRPASS(!handle, NULL);
+
+    io = wrapNativeHandle(handle, path, mode);
+    if (!io)
+        __PHYSFS_platformClose(handle);
+    return io;
 } /* __PHYSFS_createNativeIo */
 
 
@@ -247,6 +467,7 @@ typedef struct __PHYSFS_MemoryIoInfo
     PHYSFS_uint64 pos;
     PHYSFS_Io *parent;
     int refcount;
+    int mapped;  /* non-zero if (buf) is a file mapped by the platform. */
     void (*destruct)(void *);
 } MemoryIoInfo;
 
@@ -293,21 +514,16 @@ static PHYSFS_sint64 memoryIo_length(PHYSFS_Io *io)
     return (PHYSFS_sint64) info->len;
 } /* memoryIo_length */
 
-static PHYSFS_Io *memoryIo_duplicate(PHYSFS_Io *io)
+/* make a new Io over (buf) (which is in (parent)'s buffer) that shares it. */
+static PHYSFS_Io *memoryIoChild(PHYSFS_Io *parent, const PHYSFS_uint8 *buf,
+                                const PHYSFS_uint64 len)
 {
-    MemoryIoInfo *info = (MemoryIoInfo *) io->opaque;
+    MemoryIoInfo *info = (MemoryIoInfo *) parent->opaque;
     MemoryIoInfo *newinfo = NULL;
-    PHYSFS_Io *parent = info->parent;
     PHYSFS_Io *retval = NULL;
 
     /* avoid deep copies. */
-    assert((!parent) || (!((MemoryIoInfo *) parent->opaque)->parent) );
-
-    /* share the buffer between duplicates. */
-    if (parent != NULL)  /* dup the parent, increment its refcount. */
-        return parent->duplicate(parent);
-
-    /* we're the parent. */
+    assert(!info->parent);
 
     retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
     BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
@@ -321,20 +537,53 @@ static PHYSFS_Io *memoryIo_duplicate(PHYSFS_Io *io)
     (void) __PHYSFS_ATOMIC_INCR(&info->refcount);
 
     memset(newinfo, '\0', sizeof (*info));
-    newinfo->buf = info->buf;
-    newinfo->len = info->len;
+    newinfo->buf = buf;
+    newinfo->len = len;
     newinfo->pos = 0;
-    newinfo->parent = io;
+    newinfo->parent = parent;
     newinfo->refcount = 0;
     newinfo->destruct = NULL;
 
-    memcpy(retval, io, sizeof (*retval));
+    memcpy(retval, parent, sizeof (*retval));
     retval->opaque = newinfo;
     return retval;
+} /* memoryIoChild */
+
+static PHYSFS_Io *memoryIo_duplicate(PHYSFS_Io *io)
+{
+    MemoryIoInfo *info = (MemoryIoInfo *) io->opaque;
+
+    /* share the buffer between duplicates: the parent holds the refcount,
+       and duplicates (and slices) of it all point back to it. */
+    return memoryIoChild(info->parent ? info->parent : io, info->buf, info->len);
 } /* memoryIo_duplicate */
 
 static int memoryIo_flush(PHYSFS_Io *io) { return 1;  /* it's read-only. */ }
 
+static PHYSFS_sint64 memoryIo_readAt(PHYSFS_Io *io, void *buf,
+                                     PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    const MemoryIoInfo *info = (const MemoryIoInfo *) io->opaque;
+
+    if (offset >= info->len)
+        return 0;  /* at or past EOF; nothing to do. */
+
+    if (len > (info->len - offset))
+        len = info->len - offset;
+
+    memcpy(buf, info->buf + offset, (size_t) len);
+    return (PHYSFS_sint64) len;
+} /* memoryIo_readAt */
+
+static const void *memoryIo_map(PHYSFS_Io *io, PHYSFS_uint64 offset,
+                                PHYSFS_uint64 len)
+{
+    const MemoryIoInfo *info = (const MemoryIoInfo *) io->opaque;
+    if ((offset > info->len) || (len > (info->len - offset)))
+        return NULL;
+    return info->buf + offset;
+} /* memoryIo_map */
+
 static void memoryIo_destroy(PHYSFS_Io *io)
 {
     MemoryIoInfo *info = (MemoryIoInfo *) io->opaque;
@@ -342,8 +591,8 @@ static void memoryIo_destroy(PHYSFS_Io *io)
 
     if (parent != NULL)
     {
-        assert(info->buf == ((MemoryIoInfo *) info->parent->opaque)->buf);
-        assert(info->len == ((MemoryIoInfo *) info->parent->opaque)->len);
+        assert(info->buf >= ((MemoryIoInfo *) info->parent->opaque)->buf);
+        assert(info->len <= ((MemoryIoInfo *) info->parent->opaque)->len);
         assert(info->refcount == 0);
         assert(info->destruct == NULL);
         allocator.Free(info);
@@ -359,11 +608,20 @@ static void memoryIo_destroy(PHYSFS_Io *io)
     {
         void (*destruct)(void *) = info->destruct;
         void *buf = (void *) info->buf;
+        const PHYSFS_uint64 len = info->len;
+        const int mapped = info->mapped;
         io->opaque = NULL;  /* kill this here in case of race. */
         allocator.Free(info);
         allocator.Free(io);
         if (destruct != NULL)
             destruct(buf);
+        #ifdef PHYSFS_HAVE_PLATFORM_MMAP
+        if (mapped)
+            __PHYSFS_platformUnmapFile(buf, len);
+        #else
+        (void) mapped;
+        (void) len;
+        #endif
     } /* if */
 } /* memoryIo_destroy */
 
@@ -378,7 +636,10 @@ static const PHYSFS_Io __PHYSFS_memoryIoInterface =
     memoryIo_length,
     memoryIo_duplicate,
     memoryIo_flush,
-    memoryIo_destroy
+    memoryIo_destroy,
+    memoryIo_readAt,
+    memoryIo_map,
+    NULL
 };
 
 PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
@@ -411,695 +672,2312 @@ createMemoryIo_failed:
 } /* __PHYSFS_createMemoryIo */
 
 
-/* PHYSFS_Io implementation for i/o to a PHYSFS_File... */
-
-static PHYSFS_sint64 handleIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+PHYSFS_Io *__PHYSFS_createMemoryIoSlice(PHYSFS_Io *io, PHYSFS_uint64 pos,
+                                        PHYSFS_uint64 len)
 {
-    return PHYSFS_readBytes((PHYSFS_File *) io->opaque, buf, len);
-} /* handleIo_read */
+    const MemoryIoInfo *info;
 
-static PHYSFS_sint64 handleIo_write(PHYSFS_Io *io, const void *buffer,
-                                    PHYSFS_uint64 len)
-{
-    return PHYSFS_writeBytes((PHYSFS_File *) io->opaque, buffer, len);
-} /* handleIo_write */
+    if (io->destroy != memoryIo_destroy)
+        return NULL;  /* not one of ours. */
 
-static int handleIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+    info = (const MemoryIoInfo *) io->opaque;
+    if ((pos > info->len) || (len > (info->len - pos)))
+        return NULL;
+
+    return memoryIoChild(info->parent ? info->parent : io, info->buf + pos, len);
+} /* __PHYSFS_createMemoryIoSlice */
+
+
+const void *__PHYSFS_ioMap(PHYSFS_Io *io, PHYSFS_uint64 offset,
+                           PHYSFS_uint64 len)
 {
-    return PHYSFS_seek((PHYSFS_File *) io->opaque, offset);
-} /* handleIo_seek */
+    return __PHYSFS_ioHas(io, map) ? io->map(io, offset, len) : NULL;
+} /* __PHYSFS_ioMap */
 
-static PHYSFS_sint64 handleIo_tell(PHYSFS_Io *io)
+
+void __PHYSFS_ioHint(PHYSFS_Io *io, PHYSFS_IoHint hint)
 {
-    return PHYSFS_tell((PHYSFS_File *) io->opaque);
-} /* handleIo_tell */
+    if (__PHYSFS_ioHas(io, hint))
+        io->hint(io, hint);
+} /* __PHYSFS_ioHint */
 
-static PHYSFS_sint64 handleIo_length(PHYSFS_Io *io)
+
+/* PHYSFS_Io implementation for a piece of another Io that has readAt()... */
+
+typedef struct __PHYSFS_ViewIoInfo
 {
-    return PHYSFS_fileLength((PHYSFS_File *) io->opaque);
-} /* handleIo_length */
+    PHYSFS_Io *parent;  /* not owned; must outlive us. */
+    PHYSFS_uint64 start;
+    PHYSFS_uint64 len;
+    PHYSFS_uint64 pos;
+} ViewIoInfo;
 
-static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
+static PHYSFS_sint64 viewIo_readAt(PHYSFS_Io *io, void *buf,
+                                   PHYSFS_uint64 len, PHYSFS_uint64 offset)
 {
-    /*
-     * There's no duplicate at the PHYSFS_File level, so we break the
-     *  abstraction. We're allowed to: we're physfs.c!
-     */
-    FileHandle *origfh = (FileHandle *) io->opaque;
-    FileHandle *newfh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-    PHYSFS_Io *retval = NULL;
+    const ViewIoInfo *info = (const ViewIoInfo *) io->opaque;
+    PHYSFS_Io *parent = info->parent;
 
-    GOTO_IF(!newfh, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
-    memset(newfh, '\0', sizeof (*newfh));
+    if (offset >= info->len)
+        return 0;  /* at or past EOF; nothing to do. */
 
-    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
+    if (len > (info->len - offset))
+        len = info->len - offset;
 
-#if 0  /* we don't buffer the duplicate, at least not at the moment. */
-    if (origfh->buffer != NULL)
-    {
-        newfh->buffer = (PHYSFS_uint8 *) allocator.Malloc(origfh->bufsize);
-        if (!newfh->buffer)
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
-        newfh->bufsize = origfh->bufsize;
-    } /* if */
-#endif
+    return parent->readAt(parent, buf, len, info->start + offset);
+} /* viewIo_readAt */
 
-    newfh->io = origfh->io->duplicate(origfh->io);
-    GOTO_IF_ERRPASS(!newfh->io, handleIo_dupe_failed);
+static PHYSFS_sint64 viewIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    ViewIoInfo *info = (ViewIoInfo *) io->opaque;
+    const PHYSFS_sint64 rc = viewIo_readAt(io, buf, len, info->pos);
+    if (rc > 0)
+        info->pos += (PHYSFS_uint64) rc;
+    return rc;
+} /* viewIo_read */
 
-    newfh->forReading = origfh->forReading;
-    newfh->dirHandle = origfh->dirHandle;
+static PHYSFS_sint64 viewIo_write(PHYSFS_Io *io, const void *buffer,
+                                  PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_OPEN_FOR_READING, -1);
+} /* viewIo_write */
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    if (newfh->forReading)
-    {
-        newfh->next = openReadList;
-        openReadList = newfh;
-    } /* if */
-    else
-    {
-        newfh->next = openWriteList;
-        openWriteList = newfh;
-    } /* else */
-    __PHYSFS_platformReleaseMutex(stateLock);
+static int viewIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    ViewIoInfo *info = (ViewIoInfo *) io->opaque;
+    BAIL_IF(offset > info->len, PHYSFS_ERR_PAST_EOF, 0);
+    info->pos = offset;
+    return 1;
+} /* viewIo_seek */
 
-    memcpy(retval, io, sizeof (PHYSFS_Io));
-    retval->opaque = newfh;
-    return retval;
-    
-handleIo_dupe_failed:
-    if (newfh)
-    {
-        if (newfh->io != NULL) newfh->io->destroy(newfh->io);
-        if (newfh->buffer != NULL) allocator.Free(newfh->buffer);
-        allocator.Free(newfh);
-    } /* if */
+static PHYSFS_sint64 viewIo_tell(PHYSFS_Io *io)
+{
+    const ViewIoInfo *info = (const ViewIoInfo *) io->opaque;
+    return (PHYSFS_sint64) info->pos;
+} /* viewIo_tell */
 
-    return NULL;
-} /* handleIo_duplicate */
+static PHYSFS_sint64 viewIo_length(PHYSFS_Io *io)
+{
+    const ViewIoInfo *info = (const ViewIoInfo *) io->opaque;
+    return (PHYSFS_sint64) info->len;
+} /* viewIo_length */
 
-static int handleIo_flush(PHYSFS_Io *io)
+static PHYSFS_Io *viewIo_duplicate(PHYSFS_Io *io)
 {
-    return PHYSFS_flush((PHYSFS_File *) io->opaque);
-} /* handleIo_flush */
+    const ViewIoInfo *info = (const ViewIoInfo *) io->opaque;
+    /* the range was fine before, so this can only fail for lack of memory. */
+    return __PHYSFS_createIoView(info->parent, info->start, info->len);
+} /* viewIo_duplicate */
 
-static void handleIo_destroy(PHYSFS_Io *io)
+static int viewIo_flush(PHYSFS_Io *io) { return 1;  /* it's read-only. */ }
+
+static void viewIo_destroy(PHYSFS_Io *io)
 {
-    if (io->opaque != NULL)
-        PHYSFS_close((PHYSFS_File *) io->opaque);
+    allocator.Free(io->opaque);
     allocator.Free(io);
-} /* handleIo_destroy */
+} /* viewIo_destroy */
 
-static const PHYSFS_Io __PHYSFS_handleIoInterface =
+static const void *viewIo_map(PHYSFS_Io *io, PHYSFS_uint64 offset,
+                              PHYSFS_uint64 len)
+{
+    const ViewIoInfo *info = (const ViewIoInfo *) io->opaque;
+    if ((offset > info->len) || (len > (info->len - offset)))
+        return NULL;
+    return __PHYSFS_ioMap(info->parent, info->start + offset, len);
+} /* viewIo_map */
+
+static void viewIo_hint(PHYSFS_Io *io, PHYSFS_IoHint hint)
+{
+    const ViewIoInfo *info = (const ViewIoInfo *) io->opaque;
+    __PHYSFS_ioHint(info->parent, hint);
+} /* viewIo_hint */
+
+static const PHYSFS_Io __PHYSFS_viewIoInterface =
 {
     CURRENT_PHYSFS_IO_API_VERSION, NULL,
-    handleIo_read,
-    handleIo_write,
-    handleIo_seek,
-    handleIo_tell,
-    handleIo_length,
-    handleIo_duplicate,
-    handleIo_flush,
-    handleIo_destroy
+    viewIo_read,
+    viewIo_write,
+    viewIo_seek,
+    viewIo_tell,
+    viewIo_length,
+    viewIo_duplicate,
+    viewIo_flush,
+    viewIo_destroy,
+    viewIo_readAt,
+    viewIo_map,
+    viewIo_hint
 };
 
-static PHYSFS_Io *__PHYSFS_createHandleIo(PHYSFS_File *f)
+PHYSFS_Io *__PHYSFS_createIoView(PHYSFS_Io *io, PHYSFS_uint64 pos,
+                                 PHYSFS_uint64 len)
 {
-    PHYSFS_Io *io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    BAIL_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    memcpy(io, &__PHYSFS_handleIoInterface, sizeof (*io));
-    io->opaque = f;
-    return io;
-} /* __PHYSFS_createHandleIo */
+    PHYSFS_Io *retval = NULL;
+    ViewIoInfo *info = NULL;
+    const void *ptr;
 
+    /* if it's all in memory already, just read it from there. */
+    ptr = __PHYSFS_ioMap(io, pos, len);
+    if (ptr != NULL)
+        return __PHYSFS_createMemoryIo(ptr, len, NULL);
 
-/* functions ... */
+    if (!__PHYSFS_ioHas(io, readAt))
+        return NULL;
 
-typedef struct
-{
-    char **list;
-    PHYSFS_uint32 size;
-    PHYSFS_ErrorCode errcode;
-} EnumStringListCallbackData;
+    if (io->destroy == viewIo_destroy)  /* avoid stacking views. */
+    {
+        const ViewIoInfo *parentinfo = (const ViewIoInfo *) io->opaque;
+        if ((pos > parentinfo->len) || (len > (parentinfo->len - pos)))
+            return NULL;
+        io = parentinfo->parent;
+        pos += parentinfo->start;
+    } /* if */
 
-static void enumStringListCallback(void *data, const char *str)
-{
-    void *ptr;
-    char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, createIoView_failed);
+    info = (ViewIoInfo *) allocator.Malloc(sizeof (ViewIoInfo));
+    GOTO_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, createIoView_failed);
 
-    if (pecd->errcode)
+    info->parent = io;
+    info->start = pos;
+    info->len = len;
+    info->pos = 0;
+
+    memcpy(retval, &__PHYSFS_viewIoInterface, sizeof (*retval));
+    retval->opaque = info;
+    return retval;
+
+createIoView_failed:
+    if (retval != NULL) allocator.Free(retval);
+    return NULL;
+} /* __PHYSFS_createIoView */
+
+
+PHYSFS_Io *__PHYSFS_createMappedIo(const char *path)
+{
+#ifndef PHYSFS_HAVE_PLATFORM_MMAP
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+#else
+    PHYSFS_Io *io;
+    PHYSFS_uint64 len = 0;
+    void *buf;
+    void *handle = __PHYSFS_platformOpenRead(path);
+    BAIL_IF_ERRPASS(!handle, NULL);
+
+    /* the mapping outlives the file handle, so we can close it right away. */
+    buf = __PHYSFS_platformMapFile(handle, &len, 0);
+    __PHYSFS_platformClose(handle);
+    BAIL_IF_ERRPASS(!buf, NULL);
+
+    io = __PHYSFS_createMemoryIo(buf, len, NULL);
+    if (!io)
+    {
+        __PHYSFS_platformUnmapFile(buf, len);
+        return NULL;
+    } /* if */
+
+    ((MemoryIoInfo *) io->opaque)->mapped = 1;
+    return io;
+#endif
+} /* __PHYSFS_createMappedIo */
+
+
+/*
+ * The file cache: decompressed contents of small archive entries, so
+ *  reopening one is a memory Io duplicate instead of decompressing it all
+ *  again. Items are keyed by (archive, entry) pointers from the archiver,
+ *  which is why archivers must call __PHYSFS_fileCacheForget() when they
+ *  close: the next archive could get the same pointers.
+ *
+ * It's split into shards, each with its own lock, hash table and LRU list,
+ *  so threads opening different files don't all wait on one lock. Each
+ *  shard gets an equal slice of the capacity. The cache holds one
+ *  reference to each item's memory Io; an evicted item's buffer is freed
+ *  when the last file using it is closed.
+ */
+#define FILE_CACHE_SHARDS 8
+#define FILE_CACHE_BUCKETS 256  /* per shard; must be a power of two. */
+
+typedef struct FileCacheItem
+{
+    const void *archive;
+    const void *entry;
+    PHYSFS_Io *io;  /* a memory Io; we hold a reference to its buffer. */
+    PHYSFS_uint64 len;
+    struct FileCacheItem *hashnext;
+    struct FileCacheItem *prev;  /* LRU list; most recently used first. */
+    struct FileCacheItem *next;
+} FileCacheItem;
+
+typedef struct
+{
+    void *lock;
+    FileCacheItem *buckets[FILE_CACHE_BUCKETS];
+    FileCacheItem *mru;
+    FileCacheItem *lru;
+    PHYSFS_uint64 used;
+    PHYSFS_uint64 capacity;
+} FileCacheShard;
+
+static FileCacheShard *fileCache = NULL;  /* FILE_CACHE_SHARDS of them. */
+static volatile size_t fileCacheMaxFile = 0;  /* 0 if the cache is off. */
+static int fileCacheHits = 0;
+static int fileCacheMisses = 0;
+static int fileCacheEvictions = 0;
+
+static PHYSFS_uint32 fileCacheHash(const void *archive, const void *entry)
+{
+    PHYSFS_uint32 x = (PHYSFS_uint32) (((size_t) archive) >> 4);
+    x = (x * 0x9E3779B1) ^ ((PHYSFS_uint32) (((size_t) entry) >> 3));
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    return x;
+} /* fileCacheHash */
+
+
+/* shard lock must be held. */
+static void fileCacheUnlink(FileCacheShard *shard, FileCacheItem *item,
+                            const PHYSFS_uint32 hash)
+{
+    FileCacheItem **prev = &shard->buckets[(hash / FILE_CACHE_SHARDS) & (FILE_CACHE_BUCKETS - 1)];
+    while (*prev != item)
+        prev = &(*prev)->hashnext;
+    *prev = item->hashnext;
+
+    if (item->prev) item->prev->next = item->next; else shard->mru = item->next;
+    if (item->next) item->next->prev = item->prev; else shard->lru = item->prev;
+    shard->used -= item->len;
+} /* fileCacheUnlink */
+
+
+/* shard lock must be held. Drops the cache's reference to the buffer. */
+static void fileCacheRemove(FileCacheShard *shard, FileCacheItem *item)
+{
+    fileCacheUnlink(shard, item, fileCacheHash(item->archive, item->entry));
+    item->io->destroy(item->io);
+    allocator.Free(item);
+} /* fileCacheRemove */
+
+
+/* shard lock must be held. Evict until (len) more bytes fit. */
+static void fileCacheMakeRoom(FileCacheShard *shard, const PHYSFS_uint64 len)
+{
+    while ((shard->lru != NULL) && ((shard->used + len) > shard->capacity))
+    {
+        fileCacheRemove(shard, shard->lru);
+        (void) __PHYSFS_ATOMIC_INCR(&fileCacheEvictions);
+    } /* while */
+} /* fileCacheMakeRoom */
+
+
+int __PHYSFS_fileCacheWants(const PHYSFS_uint64 len)
+{
+    if ((fileCache == NULL) || (fileCacheMaxFile == 0))
+        return 0;  /* the cache is off, so nothing is worth caching. */
+    return (len <= (PHYSFS_uint64) fileCacheMaxFile);
+} /* __PHYSFS_fileCacheWants */
+
+
+PHYSFS_Io *__PHYSFS_fileCacheFind(const void *archive, const void *entry)
+{
+    const PHYSFS_uint32 hash = fileCacheHash(archive, entry);
+    FileCacheShard *shard;
+    FileCacheItem *item;
+    PHYSFS_Io *retval = NULL;
+
+    if (fileCache == NULL)
+        return NULL;
+
+    shard = &fileCache[hash % FILE_CACHE_SHARDS];
+    __PHYSFS_platformGrabMutex(shard->lock);
+    item = shard->buckets[(hash / FILE_CACHE_SHARDS) & (FILE_CACHE_BUCKETS - 1)];
+    for (; item != NULL; item = item->hashnext)
+    {
+        if ((item->archive == archive) && (item->entry == entry))
+            break;
+    } /* for */
+
+    if (item != NULL)
+    {
+        retval = item->io->duplicate(item->io);
+        if ((retval != NULL) && (item != shard->mru))  /* move to front. */
+        {
+            item->prev->next = item->next;
+            if (item->next) item->next->prev = item->prev; else shard->lru = item->prev;
+            item->prev = NULL;
+            item->next = shard->mru;
+            shard->mru->prev = item;
+            shard->mru = item;
+        } /* if */
+    } /* if */
+    __PHYSFS_platformReleaseMutex(shard->lock);
+
+    (void) __PHYSFS_ATOMIC_INCR(retval ? &fileCacheHits : &fileCacheMisses);
+    return retval;
+} /* __PHYSFS_fileCacheFind */
+
+
+void __PHYSFS_fileCacheAdd(const void *archive, const void *entry,
+                           PHYSFS_Io *io)
+{
+    const PHYSFS_uint32 hash = fileCacheHash(archive, entry);
+    const PHYSFS_sint64 len = io->length(io);
+    FileCacheShard *shard;
+    FileCacheItem *item;
+    size_t bucket;
+
+    if ((fileCache == NULL) || (len < 0) || (!__PHYSFS_fileCacheWants((PHYSFS_uint64) len)))
         return;
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
+    shard = &fileCache[hash % FILE_CACHE_SHARDS];
+    bucket = (hash / FILE_CACHE_SHARDS) & (FILE_CACHE_BUCKETS - 1);
+
+    __PHYSFS_platformGrabMutex(shard->lock);
+
+    for (item = shard->buckets[bucket]; item != NULL; item = item->hashnext)
+    {
+        if ((item->archive == archive) && (item->entry == entry))
+            break;  /* someone else beat us to it; keep theirs. */
+    } /* for */
+
+    if ((item == NULL) && (((PHYSFS_uint64) len) <= shard->capacity))
+    {
+        item = (FileCacheItem *) allocator.Malloc(sizeof (FileCacheItem));
+        if (item != NULL)  /* not caching isn't an error. */
+        {
+            item->io = io->duplicate(io);
+            if (item->io == NULL)
+                allocator.Free(item);
+            else
+            {
+                fileCacheMakeRoom(shard, (PHYSFS_uint64) len);
+                item->archive = archive;
+                item->entry = entry;
+                item->len = (PHYSFS_uint64) len;
+                item->hashnext = shard->buckets[bucket];
+                shard->buckets[bucket] = item;
+                item->prev = NULL;
+                item->next = shard->mru;
+                if (shard->mru) shard->mru->prev = item; else shard->lru = item;
+                shard->mru = item;
+                shard->used += item->len;
+            } /* else */
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(shard->lock);
+} /* __PHYSFS_fileCacheAdd */
+
+
+void __PHYSFS_fileCacheForget(const void *archive)
+{
+    size_t i;
+
+    if (fileCache == NULL)
+        return;
+
+    for (i = 0; i < FILE_CACHE_SHARDS; i++)
+    {
+        FileCacheShard *shard = &fileCache[i];
+        FileCacheItem *item;
+        __PHYSFS_platformGrabMutex(shard->lock);
+        item = shard->mru;
+        while (item != NULL)
+        {
+            FileCacheItem *next = item->next;
+            if (item->archive == archive)
+                fileCacheRemove(shard, item);
+            item = next;
+        } /* while */
+        __PHYSFS_platformReleaseMutex(shard->lock);
+    } /* for */
+} /* __PHYSFS_fileCacheForget */
+
+
+static void freeFileCache(void)
+{
+    size_t i;
+
+    if (fileCache == NULL)
+        return;
+
+    fileCacheMaxFile = 0;
+    for (i = 0; i < FILE_CACHE_SHARDS; i++)
+    {
+        FileCacheShard *shard = &fileCache[i];
+        while (shard->mru != NULL)
+            fileCacheRemove(shard, shard->mru);
+        if (shard->lock != NULL)
+            __PHYSFS_platformDestroyMutex(shard->lock);
+    } /* for */
+
+    allocator.Free(fileCache);
+    fileCache = NULL;
+} /* freeFileCache */
+
+
+/*
+ * Preloading and parallel decoding: archivers split work into tasks,
+ *  spread over a few threads. The calling thread works too, so one thread
+ *  (or a platform without threads) just runs every task itself.
+ */
+typedef struct
+{
+    void (*fn)(void *data, int task);
+    void *data;
+    int count;
+    int next;  /* bumped atomically; each value is one task to run. */
+} TaskPool;
+
+static void runTaskPool(void *_pool)
+{
+    TaskPool *pool = (TaskPool *) _pool;
+    while (1)
+    {
+        const int task = __PHYSFS_ATOMIC_INCR(&pool->next) - 1;
+        if (task >= pool->count)
+            break;
+        pool->fn(pool->data, task);
+    } /* while */
+} /* runTaskPool */
+
+
+PHYSFS_uint64 __PHYSFS_runTasks(const int threads, void *data,
+                                const int count,
+                                void (*fn)(void *data, int task))
+{
+    TaskPool pool;
+    #ifdef PHYSFS_HAVE_PLATFORM_THREADS
+    void *workers[PHYSFS_MAX_PRELOAD_THREADS];
+    const PHYSFS_uint64 start = __PHYSFS_platformTicks();
+    int wanted = threads;
+    int total = 0;
+    int i;
+    #endif
+
+    pool.fn = fn;
+    pool.data = data;
+    pool.count = count;
+    pool.next = 0;
+
+    #ifndef PHYSFS_HAVE_PLATFORM_THREADS
+    (void) threads;
+    runTaskPool(&pool);
+    return 0;
+    #else
+    if (wanted < 0)
+        wanted = __PHYSFS_platformCPUCount();
+    if (wanted > count)
+        wanted = count;
+    if (wanted > PHYSFS_MAX_PRELOAD_THREADS)
+        wanted = PHYSFS_MAX_PRELOAD_THREADS;
+
+    /* if we can't start as many as we wanted, the rest just do more. */
+    for (i = 1; i < wanted; i++)
+    {
+        workers[total] = __PHYSFS_platformCreateThread(runTaskPool, &pool);
+        if (workers[total] == NULL)
+            break;
+        total++;
+    } /* for */
+
+    runTaskPool(&pool);
+
+    for (i = 0; i < total; i++)
+        __PHYSFS_platformWaitThread(workers[i]);
+
+    return __PHYSFS_platformTicks() - start;
+    #endif
+} /* __PHYSFS_runTasks */
+
+
+void __PHYSFS_addPreloadStats(const PHYSFS_uint64 compressed,
+                              const PHYSFS_uint64 decompressed,
+                              const PHYSFS_uint64 ms)
+{
+    __PHYSFS_platformGrabMutex(stateLock);
+    preloadCompressed += compressed;
+    preloadDecompressed += decompressed;
+    preloadTicks += ms;
+    __PHYSFS_platformReleaseMutex(stateLock);
+} /* __PHYSFS_addPreloadStats */
+
+
+/* PHYSFS_Io implementation for i/o to a PHYSFS_File... */
+
+static PHYSFS_sint64 handleIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    return PHYSFS_readBytes((PHYSFS_File *) io->opaque, buf, len);
+} /* handleIo_read */
+
+static PHYSFS_sint64 handleIo_write(PHYSFS_Io *io, const void *buffer,
+                                    PHYSFS_uint64 len)
+{
+    return PHYSFS_writeBytes((PHYSFS_File *) io->opaque, buffer, len);
+} /* handleIo_write */
+
+static int handleIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    return PHYSFS_seek((PHYSFS_File *) io->opaque, offset);
+} /* handleIo_seek */
+
+static PHYSFS_sint64 handleIo_tell(PHYSFS_Io *io)
+{
+    return PHYSFS_tell((PHYSFS_File *) io->opaque);
+} /* handleIo_tell */
+
+static PHYSFS_sint64 handleIo_length(PHYSFS_Io *io)
+{
+    return PHYSFS_fileLength((PHYSFS_File *) io->opaque);
+} /* handleIo_length */
+
+static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
+{
+    /*
+     * There's no duplicate at the PHYSFS_File level, so we break the
+     *  abstraction. We're allowed to: we're physfs.c!
+     */
+    FileHandle *origfh = (FileHandle *) io->opaque;
+    FileHandle *newfh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+    PHYSFS_Io *retval = NULL;
+
+    GOTO_IF(!newfh, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
+    memset(newfh, '\0', sizeof (*newfh));
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
+
+#if 0  /* we don't buffer the duplicate, at least not at the moment. */
+    if (origfh->buffer != NULL)
+    {
+        newfh->buffer = (PHYSFS_uint8 *) allocator.Malloc(origfh->bufsize);
+        if (!newfh->buffer)
+            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
+        newfh->bufsize = origfh->bufsize;
+    } /* if */
+#endif
+
+    newfh->io = origfh->io->duplicate(origfh->io);
+    GOTO_IF_ERRPASS(!newfh->io, handleIo_dupe_failed);
+
+    newfh->forReading = origfh->forReading;
+    newfh->dirHandle = origfh->dirHandle;
+
+    if (newfh->forReading)
+    {
+        /* archivers call this from openRead, maybe under a shared lock. */
+        void *listLock = openReadListMutex();
+        __PHYSFS_platformGrabMutex(listLock);
+        newfh->next = openReadList;
+        openReadList = newfh;
+        __PHYSFS_platformReleaseMutex(listLock);
+    } /* if */
+    else
+    {
+        __PHYSFS_platformGrabMutex(stateLock);
+        newfh->next = openWriteList;
+        openWriteList = newfh;
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* else */
+
+    memcpy(retval, io, sizeof (PHYSFS_Io));
+    retval->opaque = newfh;
+    return retval;
+    
+handleIo_dupe_failed:
+    if (newfh)
+    {
+        if (newfh->io != NULL) newfh->io->destroy(newfh->io);
+        if (newfh->buffer != NULL) allocator.Free(newfh->buffer);
+        allocator.Free(newfh);
+    } /* if */
+
+    return NULL;
+} /* handleIo_duplicate */
+
+static int handleIo_flush(PHYSFS_Io *io)
+{
+    return PHYSFS_flush((PHYSFS_File *) io->opaque);
+} /* handleIo_flush */
+
+static void handleIo_destroy(PHYSFS_Io *io)
+{
+    if (io->opaque != NULL)
+        PHYSFS_close((PHYSFS_File *) io->opaque);
+    allocator.Free(io);
+} /* handleIo_destroy */
+
+/* these skip the PHYSFS_File's buffer, which is fine, since it's read-only. */
+static PHYSFS_sint64 handleIo_readAt(PHYSFS_Io *io, void *buf,
+                                     PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    FileHandle *fh = (FileHandle *) io->opaque;
+    return fh->io->readAt(fh->io, buf, len, offset);
+} /* handleIo_readAt */
+
+static const void *handleIo_map(PHYSFS_Io *io, PHYSFS_uint64 offset,
+                                PHYSFS_uint64 len)
+{
+    FileHandle *fh = (FileHandle *) io->opaque;
+    return __PHYSFS_ioMap(fh->io, offset, len);
+} /* handleIo_map */
+
+static void handleIo_hint(PHYSFS_Io *io, PHYSFS_IoHint hint)
+{
+    FileHandle *fh = (FileHandle *) io->opaque;
+    __PHYSFS_ioHint(fh->io, hint);
+} /* handleIo_hint */
+
+static const PHYSFS_Io __PHYSFS_handleIoInterface =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    handleIo_read,
+    handleIo_write,
+    handleIo_seek,
+    handleIo_tell,
+    handleIo_length,
+    handleIo_duplicate,
+    handleIo_flush,
+    handleIo_destroy,
+    handleIo_readAt,
+    handleIo_map,
+    handleIo_hint
+};
+
+static PHYSFS_Io *__PHYSFS_createHandleIo(PHYSFS_File *f)
+{
+    const FileHandle *fh = (const FileHandle *) f;
+    PHYSFS_Io *io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memcpy(io, &__PHYSFS_handleIoInterface, sizeof (*io));
+    io->opaque = f;
+
+    /* we can only offer readAt() if the file's own Io does; duplicates
+       copy this struct, so they'll match. */
+    if ((!fh->forReading) || (!__PHYSFS_ioHas(fh->io, readAt)))
+        io->readAt = NULL;
+    if (!fh->forReading)
+        io->map = NULL;
+    return io;
+} /* __PHYSFS_createHandleIo */
+
+
+/* functions ... */
+
+typedef struct
+{
+    char **list;
+    PHYSFS_uint32 size;
+    PHYSFS_ErrorCode errcode;
+} EnumStringListCallbackData;
+
+static void enumStringListCallback(void *data, const char *str)
+{
+    void *ptr;
+    char *newstr;
+    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+
+    if (pecd->errcode)
+        return;
+
+    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
+    newstr = (char *) allocator.Malloc(strlen(str) + 1);
+    if (ptr != NULL)
+        pecd->list = (char **) ptr;
+
+    if ((ptr == NULL) || (newstr == NULL))
+    {
+        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        pecd->list[pecd->size] = NULL;
+        PHYSFS_freeList(pecd->list);
+        return;
+    } /* if */
+
+    strcpy(newstr, str);
+    pecd->list[pecd->size] = newstr;
+    pecd->size++;
+} /* enumStringListCallback */
+
+
+static char **doEnumStringList(void (*func)(PHYSFS_StringCallback, void *))
+{
+    EnumStringListCallbackData ecd;
+    memset(&ecd, '\0', sizeof (ecd));
+    ecd.list = (char **) allocator.Malloc(sizeof (char *));
+    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    func(enumStringListCallback, &ecd);
+
+    if (ecd.errcode)
+    {
+        PHYSFS_setErrorCode(ecd.errcode);
+        return NULL;
+    } /* if */
+
+    ecd.list[ecd.size] = NULL;
+    return ecd.list;
+} /* doEnumStringList */
+
+
+static void __PHYSFS_bubble_sort(void *a, size_t lo, size_t hi,
+                                 int (*cmpfn)(void *, size_t, size_t),
+                                 void (*swapfn)(void *, size_t, size_t))
+{
+    size_t i;
+    int sorted;
+
+    do
+    {
+        sorted = 1;
+        for (i = lo; i < hi; i++)
+        {
+            if (cmpfn(a, i, i + 1) > 0)
+            {
+                swapfn(a, i, i + 1);
+                sorted = 0;
+            } /* if */
+        } /* for */
+    } while (!sorted);
+} /* __PHYSFS_bubble_sort */
+
+
+static void __PHYSFS_quick_sort(void *a, size_t lo, size_t hi,
+                         int (*cmpfn)(void *, size_t, size_t),
+                         void (*swapfn)(void *, size_t, size_t))
+{
+    size_t i;
+    size_t j;
+    size_t v;
+
+    if ((hi - lo) <= PHYSFS_QUICKSORT_THRESHOLD)
+        __PHYSFS_bubble_sort(a, lo, hi, cmpfn, swapfn);
+    else
+    {
+        i = (hi + lo) / 2;
+
+        if (cmpfn(a, lo, i) > 0) swapfn(a, lo, i);
+        if (cmpfn(a, lo, hi) > 0) swapfn(a, lo, hi);
+        if (cmpfn(a, i, hi) > 0) swapfn(a, i, hi);
+
+        j = hi - 1;
+        swapfn(a, i, j);
+        i = lo;
+        v = j;
+        while (1)
+        {
+            while(cmpfn(a, ++i, v) < 0) { /* do nothing */ }
+            while(cmpfn(a, --j, v) > 0) { /* do nothing */ }
+            if (j < i)
+                break;
+            swapfn(a, i, j);
+        } /* while */
+        if (i != (hi-1))
+            swapfn(a, i, hi-1);
+        __PHYSFS_quick_sort(a, lo, j, cmpfn, swapfn);
+        __PHYSFS_quick_sort(a, i+1, hi, cmpfn, swapfn);
+    } /* else */
+} /* __PHYSFS_quick_sort */
+
+
+void __PHYSFS_sort(void *entries, size_t max,
+                   int (*cmpfn)(void *, size_t, size_t),
+                   void (*swapfn)(void *, size_t, size_t))
+{
+    /*
+     * Quicksort w/ Bubblesort fallback algorithm inspired by code from here:
+     *   https://www.cs.ubc.ca/spider/harrison/Java/sorting-demo.html
+     */
+    if (max > 0)
+        __PHYSFS_quick_sort(entries, 0, max - 1, cmpfn, swapfn);
+} /* __PHYSFS_sort */
+
+
+#ifdef __PHYSFS_THREAD_LOCAL
+static inline ErrState *findErrorForCurrentThread(void)
+{
+    ErrState *err = &threadErrorState;
+    return (err->generation == errorGeneration) ? err : NULL;
+} /* findErrorForCurrentThread */
+
+#else
+
+static ErrState *findErrorForCurrentThread(void)
+{
+    ErrState *i;
+    void *tid;
+
+    if (errorLock != NULL)
+        __PHYSFS_platformGrabMutex(errorLock);
+
+    if (errorStates != NULL)
+    {
+        tid = __PHYSFS_platformGetThreadID();
+
+        for (i = errorStates; i != NULL; i = i->next)
+        {
+            if (i->tid == tid)
+            {
+                if (errorLock != NULL)
+                    __PHYSFS_platformReleaseMutex(errorLock);
+                return i;
+            } /* if */
+        } /* for */
+    } /* if */
+
+    if (errorLock != NULL)
+        __PHYSFS_platformReleaseMutex(errorLock);
+
+    return NULL;   /* no error available. */
+} /* findErrorForCurrentThread */
+#endif
+
+
+/* this doesn't reset the error state. */
+static inline PHYSFS_ErrorCode currentErrorCode(void)
+{
+    const ErrState *err = findErrorForCurrentThread();
+    return err ? err->code : PHYSFS_ERR_OK;
+} /* currentErrorCode */
+
+
+PHYSFS_ErrorCode PHYSFS_getLastErrorCode(void)
+{
+    ErrState *err = findErrorForCurrentThread();
+    const PHYSFS_ErrorCode retval = (err) ? err->code : PHYSFS_ERR_OK;
+    if (err)
+        err->code = PHYSFS_ERR_OK;
+    return retval;
+} /* PHYSFS_getLastErrorCode */
+
+
+PHYSFS_DECL const char *PHYSFS_getErrorByCode(PHYSFS_ErrorCode code)
+{
+    switch (code)
+    {
+        case PHYSFS_ERR_OK: return "no error";
+        case PHYSFS_ERR_OTHER_ERROR: return "unknown error";
+        case PHYSFS_ERR_OUT_OF_MEMORY: return "out of memory";
+        case PHYSFS_ERR_NOT_INITIALIZED: return "not initialized";
+        case PHYSFS_ERR_IS_INITIALIZED: return "already initialized";
+        case PHYSFS_ERR_ARGV0_IS_NULL: return "argv[0] is NULL";
+        case PHYSFS_ERR_UNSUPPORTED: return "unsupported";
+        case PHYSFS_ERR_PAST_EOF: return "past end of file";
+        case PHYSFS_ERR_FILES_STILL_OPEN: return "files still open";
+        case PHYSFS_ERR_INVALID_ARGUMENT: return "invalid argument";
+        case PHYSFS_ERR_NOT_MOUNTED: return "not mounted";
+        case PHYSFS_ERR_NOT_FOUND: return "not found";
+        case PHYSFS_ERR_SYMLINK_FORBIDDEN: return "symlinks are forbidden";
+        case PHYSFS_ERR_NO_WRITE_DIR: return "write directory is not set";
+        case PHYSFS_ERR_OPEN_FOR_READING: return "file open for reading";
+        case PHYSFS_ERR_OPEN_FOR_WRITING: return "file open for writing";
+        case PHYSFS_ERR_NOT_A_FILE: return "not a file";
+        case PHYSFS_ERR_READ_ONLY: return "read-only filesystem";
+        case PHYSFS_ERR_CORRUPT: return "corrupted";
+        case PHYSFS_ERR_SYMLINK_LOOP: return "infinite symbolic link loop";
+        case PHYSFS_ERR_IO: return "i/o error";
+        case PHYSFS_ERR_PERMISSION: return "permission denied";
+        case PHYSFS_ERR_NO_SPACE: return "no space available for writing";
+        case PHYSFS_ERR_BAD_FILENAME: return "filename is illegal or insecure";
+        case PHYSFS_ERR_BUSY: return "tried to modify a file the OS needs";
+        case PHYSFS_ERR_DIR_NOT_EMPTY: return "directory isn't empty";
+        case PHYSFS_ERR_OS_ERROR: return "OS reported an error";
+        case PHYSFS_ERR_DUPLICATE: return "duplicate resource";
+        case PHYSFS_ERR_BAD_PASSWORD: return "bad password";
+        case PHYSFS_ERR_APP_CALLBACK: return "app callback reported error";
+    } /* switch */
+
+    return NULL;  /* don't know this error code. */
+} /* PHYSFS_getErrorByCode */
+
+
+void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
+{
+    ErrState *err;
+
+    if (!errcode)
+        return;
+
+#ifdef __PHYSFS_THREAD_LOCAL
+    err = &threadErrorState;
+    err->generation = errorGeneration;
+#else
+    err = findErrorForCurrentThread();
+    if (err == NULL)
+    {
+        err = (ErrState *) allocator.Malloc(sizeof (ErrState));
+        if (err == NULL)
+            return;   /* uhh...? */
+
+        memset(err, '\0', sizeof (ErrState));
+        err->tid = __PHYSFS_platformGetThreadID();
+
+        if (errorLock != NULL)
+            __PHYSFS_platformGrabMutex(errorLock);
+
+        err->next = errorStates;
+        errorStates = err;
+
+        if (errorLock != NULL)
+            __PHYSFS_platformReleaseMutex(errorLock);
+    } /* if */
+#endif
+
+    err->code = errcode;
+} /* PHYSFS_setErrorCode */
+
+
+const char *PHYSFS_getLastError(void)
+{
+    const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+    return (err) ? PHYSFS_getErrorByCode(err) : NULL;
+} /* PHYSFS_getLastError */
+
+
+/* MAKE SURE that errorLock is held before calling this! */
+static void freeErrorStates(void)
+{
+#ifdef __PHYSFS_THREAD_LOCAL
+    errorGeneration++;  /* every thread's state is stale now. */
+    if (errorGeneration == 0)
+        errorGeneration++;  /* zero is what fresh threads start with. */
+#else
+    ErrState *i;
+    ErrState *next;
+
+    for (i = errorStates; i != NULL; i = next)
+    {
+        next = i->next;
+        allocator.Free(i);
+    } /* for */
+
+    errorStates = NULL;
+#endif
+} /* freeErrorStates */
+
+
+void PHYSFS_getLinkedVersion(PHYSFS_Version *ver)
+{
+    if (ver != NULL)
+    {
+        ver->major = PHYSFS_VER_MAJOR;
+        ver->minor = PHYSFS_VER_MINOR;
+        ver->patch = PHYSFS_VER_PATCH;
+    } /* if */
+} /* PHYSFS_getLinkedVersion */
+
+
+static const char *find_filename_extension(const char *fname)
+{
+    const char *retval = NULL;
+    if (fname != NULL)
+    {
+        const char *p = strchr(fname, '.');
+        retval = p;
+
+        while (p != NULL)
+        {
+            p = strchr(p + 1, '.');
+            if (p != NULL)
+                retval = p;
+        } /* while */
+
+        if (retval != NULL)
+            retval++;  /* skip '.' */
+    } /* if */
+
+    return retval;
+} /* find_filename_extension */
+
+
+static DirHandle *tryOpenDir(PHYSFS_Io *io, const PHYSFS_Archiver *funcs,
+                             const char *d, int forWriting, int *_claimed)
+{
+    DirHandle *retval = NULL;
+    void *opaque = NULL;
+
+    if (io != NULL)
+        BAIL_IF_ERRPASS(!io->seek(io, 0), NULL);
+
+    opaque = funcs->openArchive(io, d, forWriting, _claimed);
+    if (opaque != NULL)
+    {
+        retval = (DirHandle *) allocator.Malloc(sizeof (DirHandle));
+        if (retval == NULL)
+            funcs->closeArchive(opaque);
+        else
+        {
+            memset(retval, '\0', sizeof (DirHandle));
+            retval->mountPoint = NULL;
+            retval->funcs = funcs;
+            retval->opaque = opaque;
+            retval->checkSymlinks = funcs->info.supportsSymlinks;
+
+            /* a tree knows up front if the archiver put symlinks in it. */
+            if ((funcs->enumerate == __PHYSFS_DirTreeEnumerate) &&
+                (!((const __PHYSFS_DirTree *) opaque)->has_symlinks))
+                retval->checkSymlinks = 0;
+        } /* else */
+    } /* if */
+
+    return retval;
+} /* tryOpenDir */
+
+
+static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
+{
+    DirHandle *retval = NULL;
+    PHYSFS_Archiver **i;
+    const char *ext;
+    int created_io = 0;
+    int claimed = 0;
+    PHYSFS_ErrorCode errcode;
+
+    assert((io != NULL) || (d != NULL));
+
+    if (io == NULL)
+    {
+        /* file doesn't exist, etc? Just fail out. */
+        PHYSFS_Stat statbuf;
+        BAIL_IF_ERRPASS(!__PHYSFS_platformStat(d, &statbuf, 1), NULL);
+
+        /* DIR gets first shot (unlike the rest, it doesn't deal with files). */
+        if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+        {
+            retval = tryOpenDir(io, &__PHYSFS_Archiver_DIR, d, forWriting, &claimed);
+            if (retval || claimed)
+                return retval;
+        } /* if */
+
+        if ((mapArchives) && (!forWriting))
+            io = __PHYSFS_createMappedIo(d);  /* just read it if this fails. */
+        if (io == NULL)
+            io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
+        BAIL_IF_ERRPASS(!io, NULL);
+        created_io = 1;
+    } /* if */
+
+    ext = find_filename_extension(d);
+    if (ext != NULL)
+    {
+        /* Look for archivers with matching file extensions first... */
+        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
+        {
+            if (PHYSFS_utf8stricmp(ext, (*i)->info.extension) == 0)
+                retval = tryOpenDir(io, *i, d, forWriting, &claimed);
+        } /* for */
+
+        /* failing an exact file extension match, try all the others... */
+        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
+        {
+            if (PHYSFS_utf8stricmp(ext, (*i)->info.extension) != 0)
+                retval = tryOpenDir(io, *i, d, forWriting, &claimed);
+        } /* for */
+    } /* if */
+
+    else  /* no extension? Try them all. */
+    {
+        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
+            retval = tryOpenDir(io, *i, d, forWriting, &claimed);
+    } /* else */
+
+    errcode = claimed ? currentErrorCode() : PHYSFS_ERR_UNSUPPORTED;
+
+    if ((!retval) && (created_io))
+        io->destroy(io);
+
+    BAIL_IF(!retval, errcode, NULL);
+    return retval;
+} /* openDirectory */
+
+
+/*
+ * Make a platform-independent path string sane. Doesn't actually check the
+ *  file hierarchy, it just cleans up the string.
+ *  (dst) must be a buffer at least as big as (src), as this is where the
+ *  cleaned up string is deposited.
+ * If there are illegal bits in the path (".." entries, etc) then we
+ *  return zero and (dst) is undefined. Non-zero if the path was sanitized.
+ */
+static int sanitizePlatformIndependentPath(const char *src, char *dst)
+{
+    char *prev;
+    char ch;
+
+    while (*src == '/')  /* skip initial '/' chars... */
+        src++;
+
+    /* Make sure the entire string isn't "." or ".." */
+    if ((strcmp(src, ".") == 0) || (strcmp(src, "..") == 0))
+        BAIL(PHYSFS_ERR_BAD_FILENAME, 0);
+
+    prev = dst;
+    do
+    {
+        ch = *(src++);
+
+        if ((ch == ':') || (ch == '\\'))  /* illegal chars in a physfs path. */
+            BAIL(PHYSFS_ERR_BAD_FILENAME, 0);
+
+        if (ch == '/')   /* path separator. */
+        {
+            *dst = '\0';  /* "." and ".." are illegal pathnames. */
+            if ((strcmp(prev, ".") == 0) || (strcmp(prev, "..") == 0))
+                BAIL(PHYSFS_ERR_BAD_FILENAME, 0);
+
+            while (*src == '/')   /* chop out doubles... */
+                src++;
+
+            if (*src == '\0') /* ends with a pathsep? */
+                break;  /* we're done, don't add final pathsep to dst. */
+
+            prev = dst + 1;
+        } /* if */
+
+        *(dst++) = ch;
+    } while (ch != '\0');
+
+    return 1;
+} /* sanitizePlatformIndependentPath */
+
+
+static inline size_t dirHandleRootLen(const DirHandle *h)
+{
+    return h ? h->rootlen : 0;
+} /* dirHandleRootLen */
+
+static inline int sanitizePlatformIndependentPathWithRoot(const DirHandle *h, const char *src, char *dst)
+{
+    return sanitizePlatformIndependentPath(src, dst + dirHandleRootLen(h));
+} /* sanitizePlatformIndependentPathWithRoot */
+
+
+
+/*
+ * Figure out if (fname) is part of (h)'s mountpoint. (fname) must be an
+ *  output from sanitizePlatformIndependentPath(), so that it is in a known
+ *  state.
+ *
+ * This only finds legitimate segments of a mountpoint. If the mountpoint is
+ *  "/a/b/c" and (fname) is "/a/b/c", "/", or "/a/b/c/d", then the results are
+ *  all zero. "/a/b" will succeed, though.
+ */
+static int partOfMountPoint(DirHandle *h, char *fname)
+{
+    int rc;
+    size_t len, mntpntlen;
+
+    if (h->mountPoint == NULL)
+        return 0;
+    else if (*fname == '\0')
+        return 1;
+
+    len = strlen(fname);
+    mntpntlen = strlen(h->mountPoint);
+    if (len > mntpntlen)  /* can't be a subset of mountpoint. */
+        return 0;
+
+    /* if true, must be not a match or a complete match, but not a subset. */
+    if ((len + 1) == mntpntlen)
+        return 0;
+
+    rc = strncmp(fname, h->mountPoint, len); /* !!! FIXME: case insensitive? */
+    if (rc != 0)
+        return 0;  /* not a match. */
+
+    /* make sure /a/b matches /a/b/ and not /a/bc ... */
+    return h->mountPoint[len] == '/';
+} /* partOfMountPoint */
+
+
+static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
+                                  const char *mountPoint, int forWriting)
+{
+    DirHandle *dirHandle = NULL;
+    char *tmpmntpnt = NULL;
+
+    assert(newDir != NULL);  /* should have caught this higher up. */
+
+    if (mountPoint != NULL)
+    {
+        const size_t len = strlen(mountPoint) + 1;
+        tmpmntpnt = (char *) __PHYSFS_smallAlloc(len);
+        GOTO_IF(!tmpmntpnt, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
+        if (!sanitizePlatformIndependentPath(mountPoint, tmpmntpnt))
+            goto badDirHandle;
+        mountPoint = tmpmntpnt;  /* sanitized version. */
+    } /* if */
+
+    dirHandle = openDirectory(io, newDir, forWriting);
+    GOTO_IF_ERRPASS(!dirHandle, badDirHandle);
+
+    dirHandle->dirName = (char *) allocator.Malloc(strlen(newDir) + 1);
+    GOTO_IF(!dirHandle->dirName, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
+    strcpy(dirHandle->dirName, newDir);
+
+    if ((mountPoint != NULL) && (*mountPoint != '\0'))
+    {
+        dirHandle->mountPoint = (char *)allocator.Malloc(strlen(mountPoint)+2);
+        if (!dirHandle->mountPoint)
+            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
+        strcpy(dirHandle->mountPoint, mountPoint);
+        strcat(dirHandle->mountPoint, "/");
+    } /* if */
+
+    __PHYSFS_smallFree(tmpmntpnt);
+    return dirHandle;
+
+badDirHandle:
+    if (dirHandle != NULL)
+    {
+        dirHandle->funcs->closeArchive(dirHandle->opaque);
+        allocator.Free(dirHandle->dirName);
+        allocator.Free(dirHandle->mountPoint);
+        allocator.Free(dirHandle);
+    } /* if */
+
+    __PHYSFS_smallFree(tmpmntpnt);
+    return NULL;
+} /* createDirHandle */
+
+
+/*
+ * DIR mounts keep a small cache of path elements that verifyPath() already
+ *  stat()'d and found to be real directories, so it doesn't have to lstat()
+ *  every parent of every path on every lookup. This only knows about
+ *  changes made through PhysicsFS: PHYSFS_mkdir() and PHYSFS_delete() throw
+ *  out every DIR mount's cache (they might share a directory with the write
+ *  dir), but if something else swaps a directory for a symlink while it's
+ *  mounted, we won't notice until it falls out of the cache.
+ *
+ * Each cache is direct-mapped and never grows. Hold symlinkCacheMutex() to
+ *  touch any of this.
+ */
+#define SYMLINK_CACHE_SIZE 128  /* must be a power of two. */
+
+typedef struct
+{
+    PHYSFS_uint32 hash;  /* __PHYSFS_hashString() of path. */
+    char *path;  /* NULL if this slot is empty. */
+} SymlinkCacheEntry;
+
+typedef struct __PHYSFS_SYMLINKCACHE__
+{
+    PHYSFS_uint32 generation;  /* symlinkCacheGeneration this matches. */
+    SymlinkCacheEntry entries[SYMLINK_CACHE_SIZE];
+} SymlinkCache;
+
+
+static void clearSymlinkCache(SymlinkCache *cache)
+{
+    size_t i;
+    for (i = 0; i < SYMLINK_CACHE_SIZE; i++)
+    {
+        allocator.Free(cache->entries[i].path);
+        cache->entries[i].path = NULL;
+    } /* for */
+} /* clearSymlinkCache */
+
+
+static void freeSymlinkCache(DirHandle *h)
+{
+    if (h->symlinkCache != NULL)
+    {
+        clearSymlinkCache(h->symlinkCache);
+        allocator.Free(h->symlinkCache);
+        h->symlinkCache = NULL;
+    } /* if */
+} /* freeSymlinkCache */
+
+
+/* Call this after PhysicsFS changes anything in a physical directory. */
+static void invalidateSymlinkCaches(void)
+{
+    void *lock = symlinkCacheMutex();
+    __PHYSFS_platformGrabMutex(lock);
+    symlinkCacheGeneration++;
+    __PHYSFS_platformReleaseMutex(lock);
+} /* invalidateSymlinkCaches */
+
+
+/*
+ * Returns non-zero if (path) is known to be a real directory in (h). If
+ *  not, (*generation) is set to what you'll need to hand to
+ *  addToSymlinkCache() once you've checked it yourself.
+ */
+static int symlinkCacheHas(DirHandle *h, const char *path,
+                           const PHYSFS_uint32 hash, PHYSFS_uint32 *generation)
+{
+    void *lock = symlinkCacheMutex();
+    SymlinkCache *cache;
+    int retval = 0;
+
+    __PHYSFS_platformGrabMutex(lock);
+    cache = h->symlinkCache;
+    if (cache == NULL)
+    {
+        cache = (SymlinkCache *) allocator.Malloc(sizeof (SymlinkCache));
+        if (cache != NULL)
+        {
+            memset(cache, '\0', sizeof (SymlinkCache));
+            cache->generation = symlinkCacheGeneration;
+            h->symlinkCache = cache;
+        } /* if */
+    } /* if */
+
+    else if (cache->generation != symlinkCacheGeneration)
+    {
+        clearSymlinkCache(cache);
+        cache->generation = symlinkCacheGeneration;
+    } /* else if */
+
+    else
+    {
+        const SymlinkCacheEntry *entry = &cache->entries[hash & (SYMLINK_CACHE_SIZE - 1)];
+        retval = ((entry->path) && (entry->hash == hash) && (strcmp(entry->path, path) == 0));
+    } /* else */
+
+    *generation = symlinkCacheGeneration;
+    __PHYSFS_platformReleaseMutex(lock);
+    return retval;
+} /* symlinkCacheHas */
+
+
+static void addToSymlinkCache(DirHandle *h, const char *path,
+                              const PHYSFS_uint32 hash,
+                              const PHYSFS_uint32 generation)
+{
+    void *lock = symlinkCacheMutex();
+    SymlinkCache *cache;
+
+    __PHYSFS_platformGrabMutex(lock);
+    cache = h->symlinkCache;
+
+    /* if something changed since the caller looked, this might be stale. */
+    if ((cache != NULL) && (generation == symlinkCacheGeneration) &&
+        (cache->generation == generation))
+    {
+        SymlinkCacheEntry *entry = &cache->entries[hash & (SYMLINK_CACHE_SIZE - 1)];
+        const size_t len = strlen(path) + 1;
+        char *ptr = (char *) allocator.Realloc(entry->path, len);
+        if (ptr != NULL)  /* if we're out of memory, just don't cache it. */
+        {
+            memcpy(ptr, path, len);
+            entry->path = ptr;
+            entry->hash = hash;
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(lock);
+} /* addToSymlinkCache */
+
+
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int dirHandleBusy(const DirHandle *dh, const FileHandle *openList)
+{
+    const FileHandle *i;
+
+    BAIL_IF(dh->pins > 0, PHYSFS_ERR_FILES_STILL_OPEN, 1);
+
+    for (i = openList; i != NULL; i = i->next)
+        BAIL_IF(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN, 1);
+
+    return 0;
+} /* dirHandleBusy */
+
+
+static void destroyDirHandle(DirHandle *dh)
+{
+    dh->funcs->closeArchive(dh->opaque);
+
+    if (dh->root) allocator.Free(dh->root);
+    freeSymlinkCache(dh);
+    allocator.Free(dh->lookupFilter);
+    allocator.Free(dh->dirName);
+    allocator.Free(dh->mountPoint);
+    allocator.Free(dh);
+} /* destroyDirHandle */
+
+
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int freeDirHandle(DirHandle *dh, FileHandle *openList)
+{
+    if (dh == NULL)
+        return 1;
+
+    BAIL_IF_ERRPASS(dirHandleBusy(dh, openList), 0);
+    destroyDirHandle(dh);
+    return 1;
+} /* freeDirHandle */
+
+
+/* The search path index. MAKE SURE you hold stateLock for all of these! */
+
+static inline int searchIndexIsCurrent(void)
+{
+    return ((searchIndex.buckets != NULL) &&
+            (searchIndex.generation == searchPathGeneration));
+} /* searchIndexIsCurrent */
+
+
+/* This has to produce the same values as __PHYSFS_hashString(). */
+static PHYSFS_uint32 searchIndexHash(PHYSFS_uint32 hash, const char *str,
+                                     size_t len)
+{
+    while (len--)
+    {
+        const char ch = *(str++);
+        hash = ((hash << 5) + hash) ^ ch;
+    } /* while */
+    return hash;
+} /* searchIndexHash */
+
+
+/*
+ * Only trees we can trust to answer "not here" without asking the archiver
+ *  get indexed: case-insensitive trees would need case folding here too,
+ *  a root changes what paths the archive provides, and symlinks can make
+ *  verifyPath() reject paths that aren't in the tree at all.
+ */
+static int dirHandleIndexable(const DirHandle *h)
+{
+    const __PHYSFS_DirTree *tree = (const __PHYSFS_DirTree *) h->opaque;
+    if (h->funcs->enumerate != __PHYSFS_DirTreeEnumerate)
+        return 0;
+    else if (h->root != NULL)
+        return 0;
+    return ((tree->case_sensitive) && (!tree->has_symlinks));
+} /* dirHandleIndexable */
+
+
+static int searchIndexNodeMatches(const SearchIndexNode *node,
+                                  const char *path)
+{
+    const size_t prefixlen = (size_t) node->prefixlen;
+
+    if ((prefixlen) && (strncmp(path, node->dh->mountPoint, prefixlen) != 0))
+        return 0;
 
-    if ((ptr == NULL) || (newstr == NULL))
+    path += prefixlen;
+    if (node->entry == NULL)
+        return (*path == '\0');
+
+    if (prefixlen)
     {
-        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-        pecd->list[pecd->size] = NULL;
-        PHYSFS_freeList(pecd->list);
-        return;
+        if (*path != '/')
+            return 0;
+        path++;
     } /* if */
 
-    strcpy(newstr, str);
-    pecd->list[pecd->size] = newstr;
-    pecd->size++;
-} /* enumStringListCallback */
+    return __PHYSFS_DirTreeIsPath((const __PHYSFS_DirTree *) node->dh->opaque,
+                                  node->entry, path);
+} /* searchIndexNodeMatches */
 
 
-static char **doEnumStringList(void (*func)(PHYSFS_StringCallback, void *))
+/* (entry)'s full path, in (*buf), which grows as needed. NULL if no memory. */
+static const char *dirTreeEntryPath(const __PHYSFS_DirTree *tree,
+                                    const __PHYSFS_DirTreeEntry *entry,
+                                    char **buf, size_t *buflen)
 {
-    EnumStringListCallbackData ecd;
-    memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    func(enumStringListCallback, &ecd);
-
-    if (ecd.errcode)
+    const size_t len = __PHYSFS_DirTreePath(tree, entry, *buf, *buflen);
+    if (len >= *buflen)
     {
-        PHYSFS_setErrorCode(ecd.errcode);
-        return NULL;
+        const size_t newlen = len + 64;
+        char *ptr = (char *) ((*buf) ? allocator.Realloc(*buf, newlen) : allocator.Malloc(newlen));
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        *buf = ptr;
+        *buflen = newlen;
+        __PHYSFS_DirTreePath(tree, entry, ptr, newlen);
     } /* if */
+    return *buf;
+} /* dirTreeEntryPath */
 
-    ecd.list[ecd.size] = NULL;
-    return ecd.list;
-} /* doEnumStringList */
 
+static SearchIndexNode *findSearchIndexNode(SearchIndexNode *node,
+                                            const PHYSFS_uint32 hash,
+                                            const char *path)
+{
+    for (; node != NULL; node = node->next)
+    {
+        if ((node->hash == hash) && (searchIndexNodeMatches(node, path)))
+            break;
+    } /* for */
+    return node;
+} /* findSearchIndexNode */
 
-static void __PHYSFS_bubble_sort(void *a, size_t lo, size_t hi,
-                                 int (*cmpfn)(void *, size_t, size_t),
-                                 void (*swapfn)(void *, size_t, size_t))
+
+static void linkSearchIndexNode(SearchIndexNode **buckets, size_t bucketCount,
+                                SearchIndexNode *node)
 {
-    size_t i;
-    int sorted;
+    const int order = node->dh->searchOrder;
+    SearchIndexNode **ptr = &buckets[node->hash & (bucketCount - 1)];
+    while ((*ptr != NULL) && ((*ptr)->dh->searchOrder < order))
+        ptr = &(*ptr)->next;
+    node->next = *ptr;
+    *ptr = node;
+} /* linkSearchIndexNode */
 
-    do
+
+static void unlinkSearchIndexNode(SearchIndexNode *node)
+{
+    const size_t bucket = node->hash & (searchIndex.bucketCount - 1);
+    SearchIndexNode **ptr = &searchIndex.buckets[bucket];
+    while (*ptr != node)
     {
-        sorted = 1;
-        for (i = lo; i < hi; i++)
-        {
-            if (cmpfn(a, i, i + 1) > 0)
-            {
-                swapfn(a, i, i + 1);
-                sorted = 0;
-            } /* if */
-        } /* for */
-    } while (!sorted);
-} /* __PHYSFS_bubble_sort */
+        assert(*ptr != NULL);
+        ptr = &(*ptr)->next;
+    } /* while */
+    *ptr = node->next;
+} /* unlinkSearchIndexNode */
 
 
-static void __PHYSFS_quick_sort(void *a, size_t lo, size_t hi,
-                         int (*cmpfn)(void *, size_t, size_t),
-                         void (*swapfn)(void *, size_t, size_t))
+static int growSearchIndex(const size_t nodes)
 {
+    size_t bucketCount = searchIndex.bucketCount ? searchIndex.bucketCount : 64;
+    SearchIndexNode **buckets;
     size_t i;
-    size_t j;
-    size_t v;
 
-    if ((hi - lo) <= PHYSFS_QUICKSORT_THRESHOLD)
-        __PHYSFS_bubble_sort(a, lo, hi, cmpfn, swapfn);
-    else
-    {
-        i = (hi + lo) / 2;
+    while (bucketCount < nodes)
+        bucketCount *= 2;
 
-        if (cmpfn(a, lo, i) > 0) swapfn(a, lo, i);
-        if (cmpfn(a, lo, hi) > 0) swapfn(a, lo, hi);
-        if (cmpfn(a, i, hi) > 0) swapfn(a, i, hi);
+    if ((searchIndex.buckets != NULL) && (bucketCount == searchIndex.bucketCount))
+        return 1;  /* big enough already. */
 
-        j = hi - 1;
-        swapfn(a, i, j);
-        i = lo;
-        v = j;
-        while (1)
+    buckets = (SearchIndexNode **) allocator.Malloc(bucketCount * sizeof (SearchIndexNode *));
+    BAIL_IF(!buckets, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(buckets, '\0', bucketCount * sizeof (SearchIndexNode *));
+
+    for (i = 0; i < searchIndex.bucketCount; i++)
+    {
+        SearchIndexNode *node = searchIndex.buckets[i];
+        while (node != NULL)
         {
-            while(cmpfn(a, ++i, v) < 0) { /* do nothing */ }
-            while(cmpfn(a, --j, v) > 0) { /* do nothing */ }
-            if (j < i)
-                break;
-            swapfn(a, i, j);
+            SearchIndexNode *next = node->next;
+            linkSearchIndexNode(buckets, bucketCount, node);
+            node = next;
         } /* while */
-        if (i != (hi-1))
-            swapfn(a, i, hi-1);
-        __PHYSFS_quick_sort(a, lo, j, cmpfn, swapfn);
-        __PHYSFS_quick_sort(a, i+1, hi, cmpfn, swapfn);
-    } /* else */
-} /* __PHYSFS_quick_sort */
+    } /* for */
 
+    allocator.Free(searchIndex.buckets);
+    searchIndex.buckets = buckets;
+    searchIndex.bucketCount = bucketCount;
+    return 1;
+} /* growSearchIndex */
 
-void __PHYSFS_sort(void *entries, size_t max,
-                   int (*cmpfn)(void *, size_t, size_t),
-                   void (*swapfn)(void *, size_t, size_t))
+
+static void removeFromSearchIndex(DirHandle *h)
 {
-    /*
-     * Quicksort w/ Bubblesort fallback algorithm inspired by code from here:
-     *   https://www.cs.ubc.ca/spider/harrison/Java/sorting-demo.html
-     */
-    if (max > 0)
-        __PHYSFS_quick_sort(entries, 0, max - 1, cmpfn, swapfn);
-} /* __PHYSFS_sort */
+    size_t i;
+
+    if (h->indexNodes == NULL)
+    {
+        assert(searchIndex.unindexed > 0);
+        searchIndex.unindexed--;
+        return;
+    } /* if */
 
+    for (i = 0; i < h->indexNodeCount; i++)
+        unlinkSearchIndexNode(&h->indexNodes[i]);
 
-static ErrState *findErrorForCurrentThread(void)
+    searchIndex.nodeCount -= h->indexNodeCount;
+    allocator.Free(h->indexNodes);
+    h->indexNodes = NULL;
+    h->indexNodeCount = 0;
+} /* removeFromSearchIndex */
+
+
+static int addToSearchIndex(DirHandle *h)
 {
-    ErrState *i;
-    void *tid;
+    const __PHYSFS_DirTree *tree = (const __PHYSFS_DirTree *) h->opaque;
+    const char *mntpnt = h->mountPoint;
+    SearchIndexNode *nodes;
+    SearchIndexNode *node;
+    PHYSFS_uint32 mnthash = 5381;
+    char *pathbuf = NULL;
+    size_t pathbuflen = 0;
+    size_t prefixlen = 0;
+    size_t total = 0;
+    size_t i;
 
-    if (errorLock != NULL)
-        __PHYSFS_platformGrabMutex(errorLock);
+    assert(h->indexNodes == NULL);
 
-    if (errorStates != NULL)
+    if (!dirHandleIndexable(h))
     {
-        tid = __PHYSFS_platformGetThreadID();
+        searchIndex.unindexed++;
+        return 1;
+    } /* if */
 
-        for (i = errorStates; i != NULL; i = i->next)
-        {
-            if (i->tid == tid)
-            {
-                if (errorLock != NULL)
-                    __PHYSFS_platformReleaseMutex(errorLock);
-                return i;
-            } /* if */
-        } /* for */
+    /* one node per element of the mountpoint, plus one per tree entry. */
+    for (i = 0; mntpnt && mntpnt[i]; i++)
+        total += (mntpnt[i] == '/');
+
+    total += tree->entries;
+
+    if (total == 0)  /* empty archive; cheaper to just probe it. */
+    {
+        searchIndex.unindexed++;
+        return 1;
     } /* if */
 
-    if (errorLock != NULL)
-        __PHYSFS_platformReleaseMutex(errorLock);
+    BAIL_IF_ERRPASS(!growSearchIndex(searchIndex.nodeCount + total), 0);
+    nodes = (SearchIndexNode *) allocator.Malloc(total * sizeof (SearchIndexNode));
+    BAIL_IF(!nodes, PHYSFS_ERR_OUT_OF_MEMORY, 0);
 
-    return NULL;   /* no error available. */
-} /* findErrorForCurrentThread */
+    /* mountpoint elements look like directories that this archive provides. */
+    node = nodes;
+    for (i = 0; mntpnt && mntpnt[i]; i++)
+    {
+        if (mntpnt[i] == '/')
+        {
+            mnthash = searchIndexHash(mnthash, mntpnt + prefixlen, i - prefixlen);
+            prefixlen = i;
+            node->hash = mnthash;
+            node->prefixlen = (PHYSFS_uint32) prefixlen;
+            node->dh = h;
+            node->entry = NULL;
+            node++;
+        } /* if */
+    } /* for */
 
+    if (prefixlen)
+        mnthash = searchIndexHash(mnthash, "/", 1);
 
-/* this doesn't reset the error state. */
-static inline PHYSFS_ErrorCode currentErrorCode(void)
-{
-    const ErrState *err = findErrorForCurrentThread();
-    return err ? err->code : PHYSFS_ERR_OK;
-} /* currentErrorCode */
+    for (i = 1; i <= tree->entries; i++)
+    {
+        const __PHYSFS_DirTreeEntry *entry = (const __PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeEntryAt(tree, (PHYSFS_uint32) i);
+        const char *path = dirTreeEntryPath(tree, entry, &pathbuf, &pathbuflen);
+        if (!path)
+        {
+            if (pathbuf)
+                allocator.Free(pathbuf);
+            allocator.Free(nodes);
+            return 0;
+        } /* if */
+        node->hash = searchIndexHash(mnthash, path, strlen(path));
+        node->prefixlen = (PHYSFS_uint32) prefixlen;
+        node->dh = h;
+        node->entry = entry;
+        node++;
+    } /* for */
 
+    if (pathbuf)
+        allocator.Free(pathbuf);
 
-PHYSFS_ErrorCode PHYSFS_getLastErrorCode(void)
-{
-    ErrState *err = findErrorForCurrentThread();
-    const PHYSFS_ErrorCode retval = (err) ? err->code : PHYSFS_ERR_OK;
-    if (err)
-        err->code = PHYSFS_ERR_OK;
-    return retval;
-} /* PHYSFS_getLastErrorCode */
+    assert(node == nodes + total);
 
+    for (i = 0; i < total; i++)
+        linkSearchIndexNode(searchIndex.buckets, searchIndex.bucketCount, &nodes[i]);
 
-PHYSFS_DECL const char *PHYSFS_getErrorByCode(PHYSFS_ErrorCode code)
+    searchIndex.nodeCount += total;
+    h->indexNodes = nodes;
+    h->indexNodeCount = total;
+    return 1;
+} /* addToSearchIndex */
+
+
+static void freeSearchIndex(void)
 {
-    switch (code)
+    DirHandle *i;
+    for (i = searchPath; i != NULL; i = i->next)
     {
-        case PHYSFS_ERR_OK: return "no error";
-        case PHYSFS_ERR_OTHER_ERROR: return "unknown error";
-        case PHYSFS_ERR_OUT_OF_MEMORY: return "out of memory";
-        case PHYSFS_ERR_NOT_INITIALIZED: return "not initialized";
-        case PHYSFS_ERR_IS_INITIALIZED: return "already initialized";
-        case PHYSFS_ERR_ARGV0_IS_NULL: return "argv[0] is NULL";
-        case PHYSFS_ERR_UNSUPPORTED: return "unsupported";
-        case PHYSFS_ERR_PAST_EOF: return "past end of file";
-        case PHYSFS_ERR_FILES_STILL_OPEN: return "files still open";
-        case PHYSFS_ERR_INVALID_ARGUMENT: return "invalid argument";
-        case PHYSFS_ERR_NOT_MOUNTED: return "not mounted";
-        case PHYSFS_ERR_NOT_FOUND: return "not found";
-        case PHYSFS_ERR_SYMLINK_FORBIDDEN: return "symlinks are forbidden";
-        case PHYSFS_ERR_NO_WRITE_DIR: return "write directory is not set";
-        case PHYSFS_ERR_OPEN_FOR_READING: return "file open for reading";
-        case PHYSFS_ERR_OPEN_FOR_WRITING: return "file open for writing";
-        case PHYSFS_ERR_NOT_A_FILE: return "not a file";
-        case PHYSFS_ERR_READ_ONLY: return "read-only filesystem";
-        case PHYSFS_ERR_CORRUPT: return "corrupted";
-        case PHYSFS_ERR_SYMLINK_LOOP: return "infinite symbolic link loop";
-        case PHYSFS_ERR_IO: return "i/o error";
-        case PHYSFS_ERR_PERMISSION: return "permission denied";
-        case PHYSFS_ERR_NO_SPACE: return "no space available for writing";
-        case PHYSFS_ERR_BAD_FILENAME: return "filename is illegal or insecure";
-        case PHYSFS_ERR_BUSY: return "tried to modify a file the OS needs";
-        case PHYSFS_ERR_DIR_NOT_EMPTY: return "directory isn't empty";
-        case PHYSFS_ERR_OS_ERROR: return "OS reported an error";
-        case PHYSFS_ERR_DUPLICATE: return "duplicate resource";
-        case PHYSFS_ERR_BAD_PASSWORD: return "bad password";
-        case PHYSFS_ERR_APP_CALLBACK: return "app callback reported error";
-    } /* switch */
+        allocator.Free(i->indexNodes);
+        i->indexNodes = NULL;
+        i->indexNodeCount = 0;
+    } /* for */
 
-    return NULL;  /* don't know this error code. */
-} /* PHYSFS_getErrorByCode */
+    allocator.Free(searchIndex.buckets);
+    memset(&searchIndex, '\0', sizeof (searchIndex));
+} /* freeSearchIndex */
 
 
-void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
+static int buildSearchIndex(void)
 {
-    ErrState *err;
+    DirHandle *i;
 
-    if (!errcode)
-        return;
+    freeSearchIndex();
+    if (!growSearchIndex(0))
+        return 0;
 
-    err = findErrorForCurrentThread();
-    if (err == NULL)
+    for (i = searchPath; i != NULL; i = i->next)
     {
-        err = (ErrState *) allocator.Malloc(sizeof (ErrState));
-        if (err == NULL)
-            return;   /* uhh...? */
+        if (!addToSearchIndex(i))
+        {
+            freeSearchIndex();
+            return 0;
+        } /* if */
+    } /* for */
 
-        memset(err, '\0', sizeof (ErrState));
-        err->tid = __PHYSFS_platformGetThreadID();
+    searchIndex.generation = searchPathGeneration;
+    return 1;
+} /* buildSearchIndex */
 
-        if (errorLock != NULL)
-            __PHYSFS_platformGrabMutex(errorLock);
 
-        err->next = errorStates;
-        errorStates = err;
+/*
+ * Lookup filters: a Bloom filter over every full path a DirTree-based
+ *  archive provides, so lookups can skip archives that definitely don't
+ *  have a path with a few bit tests instead of verifyPath() and a failed
+ *  call into the archiver. Unlike the search path index, these are built
+ *  once at mount time and work for archives with a root set, too. Each path
+ *  sets four bits in a single 64-bit word, so a test is one memory access;
+ *  at 16 bits per path that's about 0.5% false positives.
+ *
+ * Only case-sensitive trees are filtered: a case-insensitive archiver will
+ *  find paths that hash differently than anything in its tree.
+ */
+#ifndef PHYSFS_LOOKUP_FILTER_BITS
+#define PHYSFS_LOOKUP_FILTER_BITS 16  /* bits of filter per path. */
+#endif
 
-        if (errorLock != NULL)
-            __PHYSFS_platformReleaseMutex(errorLock);
-    } /* if */
+static inline PHYSFS_uint32 lookupFilterMix(PHYSFS_uint32 x)
+{
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+    return x;
+} /* lookupFilterMix */
 
-    err->code = errcode;
-} /* PHYSFS_setErrorCode */
 
+/* (hash) is __PHYSFS_hashString() of the full path. */
+static inline PHYSFS_uint64 lookupFilterBits(const PHYSFS_uint32 hash)
+{
+    const PHYSFS_uint32 x = lookupFilterMix(hash + 0x9E3779B9);
+    return (((PHYSFS_uint64) 1) << (x & 63)) |
+           (((PHYSFS_uint64) 1) << ((x >> 6) & 63)) |
+           (((PHYSFS_uint64) 1) << ((x >> 12) & 63)) |
+           (((PHYSFS_uint64) 1) << ((x >> 18) & 63));
+} /* lookupFilterBits */
 
-const char *PHYSFS_getLastError(void)
+
+static inline void lookupFilterAdd(PHYSFS_uint64 *filter, const size_t mask,
+                                   const PHYSFS_uint32 hash)
 {
-    const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
-    return (err) ? PHYSFS_getErrorByCode(err) : NULL;
-} /* PHYSFS_getLastError */
+    filter[lookupFilterMix(hash) & mask] |= lookupFilterBits(hash);
+} /* lookupFilterAdd */
+
+
+/* returns zero if (h) definitely doesn't provide the path. */
+static inline int lookupFilterMayHave(const DirHandle *h,
+                                      const PHYSFS_uint32 hash)
+{
+    const PHYSFS_uint64 bits = lookupFilterBits(hash);
+    return ((h->lookupFilter[lookupFilterMix(hash) & h->lookupFilterMask] & bits) == bits);
+} /* lookupFilterMayHave */
+
+
+/* lookups can happen under a shared lock, so count with atomics then. */
+static void countLookupFilterEvent(unsigned int *counter)
+{
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (concurrentReads)
+    {
+        __PHYSFS_ATOMIC_INCR((int *) counter);
+        return;
+    } /* if */
+#endif
+    (*counter)++;
+} /* countLookupFilterEvent */
 
 
-/* MAKE SURE that errorLock is held before calling this! */
-static void freeErrorStates(void)
-{
-    ErrState *i;
-    ErrState *next;
+/*
+ * Build a filter for (h) as if its root were (root), which may be NULL.
+ *  Returns NULL if (h) can't be filtered, or if we're out of memory; either
+ *  way, lookups just ask the archiver like they always did.
+ */
+static PHYSFS_uint64 *buildLookupFilter(const DirHandle *h, const char *root,
+                                        size_t *_mask)
+{
+    const __PHYSFS_DirTree *tree = (const __PHYSFS_DirTree *) h->opaque;
+    const char *mntpnt = h->mountPoint;
+    const size_t rootlen = root ? strlen(root) : 0;
+    PHYSFS_uint64 *filter;
+    PHYSFS_uint32 mnthash = 5381;
+    char *pathbuf = NULL;
+    size_t pathbuflen = 0;
+    size_t prefixlen = 0;
+    size_t words = 1;
+    size_t total = 0;
+    size_t mask;
+    size_t i;
+
+    if (h->funcs->enumerate != __PHYSFS_DirTreeEnumerate)
+        return NULL;
+    else if (!tree->case_sensitive)
+        return NULL;
+    else if (tree->image)
+        return NULL;  /* mapped so mounting doesn't read every entry. */
+
+    for (i = 0; mntpnt && mntpnt[i]; i++)
+        total += (mntpnt[i] == '/');
+    total += tree->entries;
+
+    while ((words * 64) < (total * PHYSFS_LOOKUP_FILTER_BITS))
+        words <<= 1;
+    mask = words - 1;
+
+    filter = (PHYSFS_uint64 *) allocator.Malloc(words * sizeof (PHYSFS_uint64));
+    if (!filter)
+        return NULL;
+    memset(filter, '\0', words * sizeof (PHYSFS_uint64));
+
+    /* every element of the mountpoint looks like a directory we provide. */
+    for (i = 0; mntpnt && mntpnt[i]; i++)
+    {
+        if (mntpnt[i] == '/')
+        {
+            mnthash = searchIndexHash(mnthash, mntpnt + prefixlen, i - prefixlen);
+            prefixlen = i;
+            lookupFilterAdd(filter, mask, mnthash);
+        } /* if */
+    } /* for */
+
+    if (prefixlen)
+        mnthash = searchIndexHash(mnthash, "/", 1);
 
-    for (i = errorStates; i != NULL; i = next)
+    for (i = 1; i <= tree->entries; i++)
     {
-        next = i->next;
-        allocator.Free(i);
+        const __PHYSFS_DirTreeEntry *entry = (const __PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeEntryAt(tree, (PHYSFS_uint32) i);
+        const char *name = dirTreeEntryPath(tree, entry, &pathbuf, &pathbuflen);
+        if (!name)
+        {
+            if (pathbuf)
+                allocator.Free(pathbuf);
+            allocator.Free(filter);
+            return NULL;
+        } /* if */
+        else if (root)  /* only things under the root, minus the root. */
+        {
+            if ((strncmp(name, root, rootlen) != 0) || (name[rootlen] != '/'))
+                continue;
+            name += rootlen + 1;
+        } /* else if */
+        lookupFilterAdd(filter, mask, searchIndexHash(mnthash, name, strlen(name)));
     } /* for */
 
-    errorStates = NULL;
-} /* freeErrorStates */
+    if (pathbuf)
+        allocator.Free(pathbuf);
 
+    *_mask = mask;
+    return filter;
+} /* buildLookupFilter */
 
-void PHYSFS_getLinkedVersion(PHYSFS_Version *ver)
-{
-    if (ver != NULL)
-    {
-        ver->major = PHYSFS_VER_MAJOR;
-        ver->minor = PHYSFS_VER_MINOR;
-        ver->patch = PHYSFS_VER_PATCH;
-    } /* if */
-} /* PHYSFS_getLinkedVersion */
 
+/*
+ * The mount trie: every mountpoint in the search path, one node per path
+ *  element, so a lookup can find the DirHandles that could possibly have a
+ *  path by walking down it once, instead of comparing the path against
+ *  every DirHandle's mountpoint. A path that ends partway down the trie
+ *  (inside one or more mountpoints) could come from anything mounted below
+ *  there, too, so each node keeps both lists. Everything is in search path
+ *  order, so the cursor only has to merge a handful of sorted lists.
+ *
+ * This is rebuilt from scratch by endSearchPathChange(); if that fails, or
+ *  the mountpoints nest too deep for the cursor, lookups walk the whole
+ *  search path like they always did.
+ */
+#define MOUNT_TRIE_MAX_LISTS 32
 
-static const char *find_filename_extension(const char *fname)
+typedef struct
 {
-    const char *retval = NULL;
-    if (fname != NULL)
-    {
-        const char *p = strchr(fname, '.');
-        retval = p;
+    DirHandle **items;  /* NULL-terminated, in search path order. */
+    size_t count;
+    size_t allocated;
+} MountTrieList;
 
-        while (p != NULL)
-        {
-            p = strchr(p + 1, '.');
-            if (p != NULL)
-                retval = p;
-        } /* while */
+typedef struct __PHYSFS_MOUNTTRIENODE__
+{
+    const char *name;  /* this path element; points into a mountPoint. */
+    size_t namelen;
+    struct __PHYSFS_MOUNTTRIENODE__ **children;  /* sorted by name. */
+    size_t numChildren;
+    MountTrieList here;  /* mounted exactly at this node. */
+    MountTrieList below;  /* mounted somewhere under this node. */
+} MountTrieNode;
 
-        if (retval != NULL)
-            retval++;  /* skip '.' */
+static int appendToMountTrieList(MountTrieList *list, DirHandle *dh)
+{
+    if (list->count + 1 >= list->allocated)
+    {
+        const size_t newalloc = list->allocated ? list->allocated * 2 : 4;
+        void *ptr = allocator.Realloc(list->items, newalloc * sizeof (DirHandle *));
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        list->items = (DirHandle **) ptr;
+        list->allocated = newalloc;
     } /* if */
 
-    return retval;
-} /* find_filename_extension */
+    list->items[list->count++] = dh;
+    list->items[list->count] = NULL;
+    return 1;
+} /* appendToMountTrieList */
 
 
-static DirHandle *tryOpenDir(PHYSFS_Io *io, const PHYSFS_Archiver *funcs,
-                             const char *d, int forWriting, int *_claimed)
+static void freeMountTrieNode(MountTrieNode *node)
 {
-    DirHandle *retval = NULL;
-    void *opaque = NULL;
+    size_t i;
+    for (i = 0; i < node->numChildren; i++)
+        freeMountTrieNode(node->children[i]);
+    allocator.Free(node->children);
+    allocator.Free(node->here.items);
+    allocator.Free(node->below.items);
+    allocator.Free(node);
+} /* freeMountTrieNode */
 
-    if (io != NULL)
-        BAIL_IF_ERRPASS(!io->seek(io, 0), NULL);
 
-    opaque = funcs->openArchive(io, d, forWriting, _claimed);
-    if (opaque != NULL)
+static void freeMountTrie(void)
+{
+    if (mountTrie != NULL)
     {
-        retval = (DirHandle *) allocator.Malloc(sizeof (DirHandle));
-        if (retval == NULL)
-            funcs->closeArchive(opaque);
-        else
-        {
-            memset(retval, '\0', sizeof (DirHandle));
-            retval->mountPoint = NULL;
-            retval->funcs = funcs;
-            retval->opaque = opaque;
-        } /* else */
+        freeMountTrieNode(mountTrie);
+        mountTrie = NULL;
     } /* if */
-
-    return retval;
-} /* tryOpenDir */
+} /* freeMountTrie */
 
 
-static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
+static int cmpMountTrieName(const MountTrieNode *node, const char *name,
+                            const size_t namelen)
 {
-    DirHandle *retval = NULL;
-    PHYSFS_Archiver **i;
-    const char *ext;
-    int created_io = 0;
-    int claimed = 0;
-    PHYSFS_ErrorCode errcode;
+    const size_t len = (node->namelen < namelen) ? node->namelen : namelen;
+    const int rc = memcmp(node->name, name, len);
+    if (rc != 0)
+        return rc;
+    return (node->namelen < namelen) ? -1 : ((node->namelen > namelen) ? 1 : 0);
+} /* cmpMountTrieName */
 
-    assert((io != NULL) || (d != NULL));
 
-    if (io == NULL)
-    {
-        /* file doesn't exist, etc? Just fail out. */
-        PHYSFS_Stat statbuf;
-        BAIL_IF_ERRPASS(!__PHYSFS_platformStat(d, &statbuf, 1), NULL);
+/* Binary search; (*_pos) is where it would go if it's not there. */
+static MountTrieNode *findMountTrieChild(const MountTrieNode *node,
+                                         const char *name,
+                                         const size_t namelen, size_t *_pos)
+{
+    size_t lo = 0;
+    size_t hi = node->numChildren;
 
-        /* DIR gets first shot (unlike the rest, it doesn't deal with files). */
-        if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
-        {
-            retval = tryOpenDir(io, &__PHYSFS_Archiver_DIR, d, forWriting, &claimed);
-            if (retval || claimed)
-                return retval;
-        } /* if */
+    while (lo < hi)
+    {
+        const size_t mid = lo + ((hi - lo) / 2);
+        const int rc = cmpMountTrieName(node->children[mid], name, namelen);
+        if (rc == 0)
+            return node->children[mid];
+        else if (rc < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } /* while */
 
-        io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
-        BAIL_IF_ERRPASS(!io, NULL);
-        created_io = 1;
-    } /* if */
+    if (_pos)
+        *_pos = lo;
+    return NULL;
+} /* findMountTrieChild */
 
-    ext = find_filename_extension(d);
-    if (ext != NULL)
-    {
-        /* Look for archivers with matching file extensions first... */
-        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
-        {
-            if (PHYSFS_utf8stricmp(ext, (*i)->info.extension) == 0)
-                retval = tryOpenDir(io, *i, d, forWriting, &claimed);
-        } /* for */
 
-        /* failing an exact file extension match, try all the others... */
-        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
-        {
-            if (PHYSFS_utf8stricmp(ext, (*i)->info.extension) != 0)
-                retval = tryOpenDir(io, *i, d, forWriting, &claimed);
-        } /* for */
-    } /* if */
+static MountTrieNode *addMountTrieChild(MountTrieNode *node, const char *name,
+                                        const size_t namelen)
+{
+    MountTrieNode *child;
+    void *ptr;
+    size_t pos = 0;
 
-    else  /* no extension? Try them all. */
-    {
-        for (i = archivers; (*i != NULL) && (retval == NULL) && !claimed; i++)
-            retval = tryOpenDir(io, *i, d, forWriting, &claimed);
-    } /* else */
+    child = findMountTrieChild(node, name, namelen, &pos);
+    if (child != NULL)
+        return child;
 
-    errcode = claimed ? currentErrorCode() : PHYSFS_ERR_UNSUPPORTED;
+    ptr = allocator.Realloc(node->children, (node->numChildren + 1) * sizeof (MountTrieNode *));
+    BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    node->children = (MountTrieNode **) ptr;
 
-    if ((!retval) && (created_io))
-        io->destroy(io);
+    child = (MountTrieNode *) allocator.Malloc(sizeof (MountTrieNode));
+    BAIL_IF(!child, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(child, '\0', sizeof (MountTrieNode));
+    child->name = name;
+    child->namelen = namelen;
 
-    BAIL_IF(!retval, errcode, NULL);
-    return retval;
-} /* openDirectory */
+    memmove(&node->children[pos + 1], &node->children[pos],
+            (node->numChildren - pos) * sizeof (MountTrieNode *));
+    node->children[pos] = child;
+    node->numChildren++;
+    return child;
+} /* addMountTrieChild */
 
 
-/*
- * Make a platform-independent path string sane. Doesn't actually check the
- *  file hierarchy, it just cleans up the string.
- *  (dst) must be a buffer at least as big as (src), as this is where the
- *  cleaned up string is deposited.
- * If there are illegal bits in the path (".." entries, etc) then we
- *  return zero and (dst) is undefined. Non-zero if the path was sanitized.
- */
-static int sanitizePlatformIndependentPath(const char *src, char *dst)
+/* MAKE SURE you hold stateLock and the search path write lock! */
+static int buildMountTrie(void)
 {
-    char *prev;
-    char ch;
+    MountTrieNode *ancestors[MOUNT_TRIE_MAX_LISTS];
+    MountTrieNode *root;
+    DirHandle *i;
 
-    while (*src == '/')  /* skip initial '/' chars... */
-        src++;
+    freeMountTrie();
 
-    /* Make sure the entire string isn't "." or ".." */
-    if ((strcmp(src, ".") == 0) || (strcmp(src, "..") == 0))
-        BAIL(PHYSFS_ERR_BAD_FILENAME, 0);
+    root = (MountTrieNode *) allocator.Malloc(sizeof (MountTrieNode));
+    BAIL_IF(!root, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(root, '\0', sizeof (MountTrieNode));
 
-    prev = dst;
-    do
+    /* walking in search path order keeps every list sorted for free. */
+    for (i = searchPath; i != NULL; i = i->next)
     {
-        ch = *(src++);
+        MountTrieNode *node = root;
+        const char *ptr = i->mountPoint;  /* "a/b/", or NULL for the root. */
+        size_t depth = 0;
+        size_t j;
 
-        if ((ch == ':') || (ch == '\\'))  /* illegal chars in a physfs path. */
-            BAIL(PHYSFS_ERR_BAD_FILENAME, 0);
-
-        if (ch == '/')   /* path separator. */
+        while ((ptr != NULL) && (*ptr != '\0'))
         {
-            *dst = '\0';  /* "." and ".." are illegal pathnames. */
-            if ((strcmp(prev, ".") == 0) || (strcmp(prev, "..") == 0))
-                BAIL(PHYSFS_ERR_BAD_FILENAME, 0);
-
-            while (*src == '/')   /* chop out doubles... */
-                src++;
-
-            if (*src == '\0') /* ends with a pathsep? */
-                break;  /* we're done, don't add final pathsep to dst. */
+            const char *end = strchr(ptr, '/');
+            const size_t len = end ? (size_t) (end - ptr) : strlen(ptr);
+
+            /* the cursor needs a list per level, plus two. Give up. */
+            if (depth >= MOUNT_TRIE_MAX_LISTS - 2)
+                goto buildMountTrie_failed;
+
+            ancestors[depth++] = node;
+            node = addMountTrieChild(node, ptr, len);
+            if (node == NULL)
+                goto buildMountTrie_failed;
+            ptr = end ? end + 1 : NULL;
+        } /* while */
 
-            prev = dst + 1;
-        } /* if */
+        if (!appendToMountTrieList(&node->here, i))
+            goto buildMountTrie_failed;
 
-        *(dst++) = ch;
-    } while (ch != '\0');
+        for (j = 0; j < depth; j++)
+        {
+            if (!appendToMountTrieList(&ancestors[j]->below, i))
+                goto buildMountTrie_failed;
+        } /* for */
+    } /* for */
 
+    mountTrie = root;
+    mountTrieGeneration = searchPathGeneration;
     return 1;
-} /* sanitizePlatformIndependentPath */
 
+buildMountTrie_failed:
+    freeMountTrieNode(root);
+    return 0;
+} /* buildMountTrie */
 
-static inline size_t dirHandleRootLen(const DirHandle *h)
+
+/*
+ * Bracket the part of a search path change that readers must not see
+ *  half-done. You must already hold stateLock, and you can't call out to
+ *  anything that reads the search path in between.
+ */
+static void beginSearchPathChange(void)
 {
-    return h ? h->rootlen : 0;
-} /* dirHandleRootLen */
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if ((concurrentReads) && (!searchPathWriteLocked))
+    {
+        __PHYSFS_platformGrabWriteLock(searchPathLock);
+        searchPathWriteLocked = 1;
+    } /* if */
+#endif
+} /* beginSearchPathChange */
 
-static inline int sanitizePlatformIndependentPathWithRoot(const DirHandle *h, const char *src, char *dst)
+
+static void endSearchPathChange(void)
 {
-    return sanitizePlatformIndependentPath(src, dst + dirHandleRootLen(h));
-} /* sanitizePlatformIndependentPathWithRoot */
+    if ((mountTrie == NULL) || (mountTrieGeneration != searchPathGeneration))
+    {
+        if (!buildMountTrie())  /* not fatal, they'll walk the search path. */
+            freeMountTrie();
+    } /* if */
 
+    /* shared readers can't build the index on demand, so do it for them. */
+    if ((concurrentReads) && (searchPathIndexed) && (!searchIndexIsCurrent()))
+        buildSearchIndex();  /* not fatal if this fails, they'll probe. */
+
+#ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (searchPathWriteLocked)
+    {
+        searchPathWriteLocked = 0;
+        __PHYSFS_platformReleaseRWLock(searchPathLock);
+    } /* if */
+#endif
+} /* endSearchPathChange */
 
 
 /*
- * Figure out if (fname) is part of (h)'s mountpoint. (fname) must be an
- *  output from sanitizePlatformIndependentPath(), so that it is in a known
- *  state.
- *
- * This only finds legitimate segments of a mountpoint. If the mountpoint is
- *  "/a/b/c" and (fname) is "/a/b/c", "/", or "/a/b/c/d", then the results are
- *  all zero. "/a/b" will succeed, though.
+ * Walks the DirHandles that might provide (path), in search path order.
+ *  Without a usable index, this is every DirHandle whose mountpoint is a
+ *  parent of (path), or under (path), and whose lookup filter doesn't rule
+ *  (path) out. With one, indexed DirHandles that don't have (path) are
+ *  skipped, and if nothing in the search path is unindexed, we don't walk
+ *  it at all.
  */
-static int partOfMountPoint(DirHandle *h, char *fname)
+typedef struct
 {
-    int rc;
-    size_t len, mntpntlen;
-
-    if (h->mountPoint == NULL)
-        return 0;
-    else if (*fname == '\0')
-        return 1;
+    const char *path;
+    PHYSFS_uint32 hash;
+    SearchIndexNode *node;  /* next indexed DirHandle that has (path). */
+    DirHandle *next;  /* next DirHandle to consider, if not using the trie. */
+    DirHandle **lists[MOUNT_TRIE_MAX_LISTS];  /* from the mount trie. */
+    size_t numLists;
+    int useTrie;
+    int walk;  /* zero if only the index needs asking. */
+    int useIndex;
+    int useFilters;
+    int visited;  /* non-zero once we've handed out a DirHandle. */
+    int filtered;  /* non-zero if a lookup filter ruled anything out. */
+    int filterPassed;  /* last DirHandle handed out got past its filter. */
+} SearchPathCursor;
+
+static inline void addMountTrieList(SearchPathCursor *cursor,
+                                    const MountTrieList *list)
+{
+    if (list->count > 0)
+        cursor->lists[cursor->numLists++] = list->items;
+} /* addMountTrieList */
+
+
+static void initMountTrieLists(SearchPathCursor *cursor, const char *path)
+{
+    const MountTrieNode *node = mountTrie;
+
+    addMountTrieList(cursor, &node->here);
+    if (*path == '\0')  /* everything is under the root. */
+    {
+        addMountTrieList(cursor, &node->below);
+        return;
+    } /* if */
 
-    len = strlen(fname);
-    mntpntlen = strlen(h->mountPoint);
-    if (len > mntpntlen)  /* can't be a subset of mountpoint. */
-        return 0;
+    while (1)
+    {
+        const char *end = strchr(path, '/');
+        const size_t len = end ? (size_t) (end - path) : strlen(path);
 
-    /* if true, must be not a match or a complete match, but not a subset. */
-    if ((len + 1) == mntpntlen)
-        return 0;
+        node = findMountTrieChild(node, path, len, NULL);
+        if (node == NULL)
+            return;  /* nothing else is mounted along (path). */
 
-    rc = strncmp(fname, h->mountPoint, len); /* !!! FIXME: case insensitive? */
-    if (rc != 0)
-        return 0;  /* not a match. */
+        addMountTrieList(cursor, &node->here);
+        if (end == NULL)
+        {
+            /* (path) is part of everything mounted under here, too. */
+            addMountTrieList(cursor, &node->below);
+            return;
+        } /* if */
 
-    /* make sure /a/b matches /a/b/ and not /a/bc ... */
-    return h->mountPoint[len] == '/';
-} /* partOfMountPoint */
+        path = end + 1;
+    } /* while */
+} /* initMountTrieLists */
 
 
-static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
-                                  const char *mountPoint, int forWriting)
+static void initSearchPathCursor(SearchPathCursor *cursor, const char *path)
 {
-    DirHandle *dirHandle = NULL;
-    char *tmpmntpnt = NULL;
-
-    assert(newDir != NULL);  /* should have caught this higher up. */
+    memset(cursor, '\0', sizeof (*cursor));
+    cursor->path = path;
+    cursor->next = searchPath;
+    cursor->walk = 1;
 
-    if (mountPoint != NULL)
+    if ((mountTrie != NULL) && (mountTrieGeneration == searchPathGeneration))
     {
-        const size_t len = strlen(mountPoint) + 1;
-        tmpmntpnt = (char *) __PHYSFS_smallAlloc(len);
-        GOTO_IF(!tmpmntpnt, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
-        if (!sanitizePlatformIndependentPath(mountPoint, tmpmntpnt))
-            goto badDirHandle;
-        mountPoint = tmpmntpnt;  /* sanitized version. */
+        cursor->useTrie = 1;
+        initMountTrieLists(cursor, path);
     } /* if */
 
-    dirHandle = openDirectory(io, newDir, forWriting);
-    GOTO_IF_ERRPASS(!dirHandle, badDirHandle);
+    /* "" is the root of the tree, and nobody indexes or filters it. */
+    if (*path == '\0')
+        return;
 
-    dirHandle->dirName = (char *) allocator.Malloc(strlen(newDir) + 1);
-    GOTO_IF(!dirHandle->dirName, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
-    strcpy(dirHandle->dirName, newDir);
+    cursor->hash = __PHYSFS_hashString(path);
+    cursor->useFilters = 1;
+
+    if (!searchPathIndexed)
+        return;
+    else if (!searchIndexIsCurrent())
+    {
+        /* can't build it under a shared lock; endSearchPathChange() tried. */
+        if ((concurrentReads) || (!buildSearchIndex()))
+            return;  /* not fatal, we'll just probe everything. */
+    } /* else if */
+
+    cursor->useIndex = 1;
+    cursor->node = findSearchIndexNode(searchIndex.buckets[cursor->hash & (searchIndex.bucketCount - 1)], cursor->hash, path);
+    if (searchIndex.unindexed == 0)
+        cursor->walk = 0;  /* the index knows about everything. */
+} /* initSearchPathCursor */
+
+
+/* the next DirHandle whose mountpoint fits, in search path order. */
+static DirHandle *nextMountCandidate(SearchPathCursor *cursor)
+{
+    DirHandle *retval = NULL;
+    size_t best = 0;
+    size_t i;
 
-    if ((mountPoint != NULL) && (*mountPoint != '\0'))
+    if (!cursor->walk)
+        return NULL;
+    else if (!cursor->useTrie)
     {
-        dirHandle->mountPoint = (char *)allocator.Malloc(strlen(mountPoint)+2);
-        if (!dirHandle->mountPoint)
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
-        strcpy(dirHandle->mountPoint, mountPoint);
-        strcat(dirHandle->mountPoint, "/");
-    } /* if */
-
-    __PHYSFS_smallFree(tmpmntpnt);
-    return dirHandle;
+        retval = cursor->next;
+        if (retval != NULL)
+            cursor->next = retval->next;
+        return retval;
+    } /* else if */
 
-badDirHandle:
-    if (dirHandle != NULL)
+    for (i = 0; i < cursor->numLists; i++)
     {
-        dirHandle->funcs->closeArchive(dirHandle->opaque);
-        allocator.Free(dirHandle->dirName);
-        allocator.Free(dirHandle->mountPoint);
-        allocator.Free(dirHandle);
-    } /* if */
+        DirHandle *dh = *cursor->lists[i];
+        if ((dh != NULL) && ((!retval) || (dh->searchOrder < retval->searchOrder)))
+        {
+            retval = dh;
+            best = i;
+        } /* if */
+    } /* for */
 
-    __PHYSFS_smallFree(tmpmntpnt);
-    return NULL;
-} /* createDirHandle */
+    if (retval != NULL)
+        cursor->lists[best]++;
+    return retval;
+} /* nextMountCandidate */
 
 
-/* MAKE SURE you've got the stateLock held before calling this! */
-static int freeDirHandle(DirHandle *dh, FileHandle *openList)
+static DirHandle *nextSearchPathCandidate(SearchPathCursor *cursor)
 {
-    FileHandle *i;
+    DirHandle *retval;
 
-    if (dh == NULL)
-        return 1;
+    /* we're only called again if the last one didn't have it after all. */
+    if (cursor->filterPassed)
+    {
+        cursor->filterPassed = 0;
+        countLookupFilterEvent(&lookupFilterFalsePositives);
+    } /* if */
 
-    for (i = openList; i != NULL; i = i->next)
-        BAIL_IF(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN, 0);
+    while ((retval = nextMountCandidate(cursor)) != NULL)
+    {
+        if ((!cursor->useIndex) || (retval->indexNodes == NULL))
+        {
+            if ((cursor->useFilters) && (retval->lookupFilter != NULL))
+            {
+                if (!lookupFilterMayHave(retval, cursor->hash))
+                {
+                    countLookupFilterEvent(&lookupFilterRejected);
+                    cursor->filtered = 1;
+                    continue;
+                } /* if */
+                cursor->filterPassed = 1;
+            } /* if */
+            cursor->visited = 1;
+            return retval;  /* not indexed, have to ask it. */
+        } /* if */
+        else if ((cursor->node) && (cursor->node->dh == retval))
+            break;
+    } /* while */
 
-    dh->funcs->closeArchive(dh->opaque);
+    if (retval == NULL)
+    {
+        if (cursor->node == NULL)
+        {
+            /* nobody was asked, so nobody reported why it's missing. */
+            if ((!cursor->visited) && ((cursor->useIndex) || (cursor->useTrie) || (cursor->filtered)))
+                PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+            return NULL;
+        } /* if */
+        retval = cursor->node->dh;
+    } /* if */
+
+    cursor->node = findSearchIndexNode(cursor->node->next, cursor->hash, cursor->path);
+    cursor->visited = 1;
+    return retval;
+} /* nextSearchPathCandidate */
 
-    if (dh->root) allocator.Free(dh->root);
-    allocator.Free(dh->dirName);
-    allocator.Free(dh->mountPoint);
-    allocator.Free(dh);
-    return 1;
-} /* freeDirHandle */
 
 
 static char *calculateBaseDir(const char *argv0)
@@ -1142,6 +3020,20 @@ static int initializeMutexes(void)
     if (stateLock == NULL)
         goto initializeMutexes_failed;
 
+    #ifdef PHYSFS_HAVE_CONCURRENT_READS
+    searchPathLock = __PHYSFS_platformCreateRWLock();
+    if (searchPathLock == NULL)
+        goto initializeMutexes_failed;
+
+    openReadListLock = __PHYSFS_platformCreateMutex();
+    if (openReadListLock == NULL)
+        goto initializeMutexes_failed;
+
+    symlinkCacheLock = __PHYSFS_platformCreateMutex();
+    if (symlinkCacheLock == NULL)
+        goto initializeMutexes_failed;
+    #endif
+
     return 1;  /* success. */
 
 initializeMutexes_failed:
@@ -1151,11 +3043,81 @@ initializeMutexes_failed:
     if (stateLock != NULL)
         __PHYSFS_platformDestroyMutex(stateLock);
 
+    #ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (searchPathLock != NULL)
+        __PHYSFS_platformDestroyRWLock(searchPathLock);
+    if (openReadListLock != NULL)
+        __PHYSFS_platformDestroyMutex(openReadListLock);
+    searchPathLock = openReadListLock = NULL;
+    #endif
+
     errorLock = stateLock = NULL;
     return 0;  /* failed. */
 } /* initializeMutexes */
 
 
+/*
+ * CRC-32 (the one zlib and .zip files use), sliced by 8: eight tables, so
+ *  each step folds in eight bytes with eight lookups instead of one byte
+ *  at a time. crc32Table[0] is the usual byte-at-a-time table, and
+ *  crc32Table[n][i] is crc32Table[n-1][i] pushed through one more zero byte.
+ */
+static PHYSFS_uint32 crc32Table[8][256];
+
+static void initCrc32Table(void)
+{
+    PHYSFS_uint32 i, j;
+
+    for (i = 0; i < 256; i++)
+    {
+        PHYSFS_uint32 crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        crc32Table[0][i] = crc;
+    } /* for */
+
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+        {
+            const PHYSFS_uint32 prev = crc32Table[j - 1][i];
+            crc32Table[j][i] = (prev >> 8) ^ crc32Table[0][prev & 0xFF];
+        } /* for */
+    } /* for */
+} /* initCrc32Table */
+
+
+PHYSFS_uint32 __PHYSFS_crc32(PHYSFS_uint32 crc, const void *_buf, size_t len)
+{
+    const PHYSFS_uint8 *buf = (const PHYSFS_uint8 *) _buf;
+
+    crc = ~crc;
+
+    while (len >= 8)
+    {
+        const PHYSFS_uint32 lo = crc ^ (((PHYSFS_uint32) buf[0]) |
+                                        (((PHYSFS_uint32) buf[1]) << 8) |
+                                        (((PHYSFS_uint32) buf[2]) << 16) |
+                                        (((PHYSFS_uint32) buf[3]) << 24));
+        const PHYSFS_uint32 hi = ((PHYSFS_uint32) buf[4]) |
+                                 (((PHYSFS_uint32) buf[5]) << 8) |
+                                 (((PHYSFS_uint32) buf[6]) << 16) |
+                                 (((PHYSFS_uint32) buf[7]) << 24);
+        crc = crc32Table[7][lo & 0xFF] ^ crc32Table[6][(lo >> 8) & 0xFF] ^
+              crc32Table[5][(lo >> 16) & 0xFF] ^ crc32Table[4][lo >> 24] ^
+              crc32Table[3][hi & 0xFF] ^ crc32Table[2][(hi >> 8) & 0xFF] ^
+              crc32Table[1][(hi >> 16) & 0xFF] ^ crc32Table[0][hi >> 24];
+        buf += 8;
+        len -= 8;
+    } /* while */
+
+    while (len--)
+        crc = crc32Table[0][(crc ^ *(buf++)) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+} /* __PHYSFS_crc32 */
+
+
 static int doRegisterArchiver(const PHYSFS_Archiver *_archiver);
 
 static int initStaticArchivers(void)
@@ -1254,6 +3216,8 @@ int PHYSFS_init(const char *argv0)
 
     if (!initStaticArchivers()) goto initFailed;
 
+    initCrc32Table();
+
     initialized = 1;
 
     /* This makes sure that the error subsystem is initialized. */
@@ -1300,6 +3264,9 @@ static void freeSearchPath(void)
     DirHandle *next = NULL;
 
     closeFileHandleList(&openReadList);
+    freeSearchIndex();
+    freeMountTrie();
+    searchPathGeneration++;
 
     if (searchPath != NULL)
     {
@@ -1378,6 +3345,7 @@ static int doDeinit(void)
     freeSearchPath();
     freeArchivers();
     freeErrorStates();
+    freeFileCache();
 
     if (baseDir != NULL)
     {
@@ -1397,6 +3365,12 @@ static int doDeinit(void)
         prefDir = NULL;
     } /* if */
 
+    if (archiveIndexDir != NULL)
+    {
+        allocator.Free(archiveIndexDir);
+        archiveIndexDir = NULL;
+    } /* if */
+
     if (archiveInfo != NULL)
     {
         allocator.Free(archiveInfo);
@@ -1411,11 +3385,28 @@ static int doDeinit(void)
 
     longest_root = 0;
     allowSymLinks = 0;
+    searchPathIndexed = 0;
+    mapArchives = 0;
+    verifyChecksums = 0;
+    resolveMode = PHYSFS_RESOLVE_ON_OPEN;
+    preloadThreads = 0;
+    decoderThreads = 0;
+    preloadCompressed = preloadDecompressed = preloadTicks = 0;
+    concurrentReads = 0;
+    lookupFilterRejected = lookupFilterFalsePositives = 0;
+    fileCacheHits = fileCacheMisses = fileCacheEvictions = 0;
     initialized = 0;
 
     if (errorLock) __PHYSFS_platformDestroyMutex(errorLock);
     if (stateLock) __PHYSFS_platformDestroyMutex(stateLock);
 
+    #ifdef PHYSFS_HAVE_CONCURRENT_READS
+    if (searchPathLock) __PHYSFS_platformDestroyRWLock(searchPathLock);
+    if (openReadListLock) __PHYSFS_platformDestroyMutex(openReadListLock);
+    if (symlinkCacheLock) __PHYSFS_platformDestroyMutex(symlinkCacheLock);
+    searchPathLock = openReadListLock = symlinkCacheLock = NULL;
+    #endif
+
     if (allocator.Deinit != NULL)
         allocator.Deinit();
 
@@ -1740,21 +3731,26 @@ int PHYSFS_setWriteDir(const char *newDir)
 {
     int retval = 1;
 
+    DirHandle *dh = NULL;
+
     __PHYSFS_platformGrabMutex(stateLock);
 
     if (writeDir != NULL)
     {
         BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(writeDir, openWriteList),
                             stateLock, 0);
-        writeDir = NULL;
     } /* if */
 
     if (newDir != NULL)
     {
-        writeDir = createDirHandle(NULL, newDir, NULL, 1);
-        retval = (writeDir != NULL);
+        dh = createDirHandle(NULL, newDir, NULL, 1);
+        retval = (dh != NULL);
     } /* if */
 
+    beginSearchPathChange();  /* PHYSFS_stat() looks at writeDir. */
+    writeDir = dh;
+    endSearchPathChange();
+
     __PHYSFS_platformReleaseMutex(stateLock);
 
     return retval;
@@ -1773,33 +3769,53 @@ int PHYSFS_setRoot(const char *archive, const char *subdir)
     {
         if ((i->dirName != NULL) && (strcmp(archive, i->dirName) == 0))
         {
-            if (!subdir || (strcmp(subdir, "/") == 0))
-            {
-                if (i->root)
-                    allocator.Free(i->root);
-                i->root = NULL;
-                i->rootlen = 0;
-            } /* if */
-            else
+            PHYSFS_uint64 *filter;
+            PHYSFS_uint64 *oldFilter;
+            size_t filterMask = 0;
+            int indexCurrent;
+            char *ptr = NULL;
+
+            if (subdir && (strcmp(subdir, "/") != 0))
             {
                 const size_t len = strlen(subdir) + 1;
-                char *ptr = (char *) allocator.Malloc(len);
+                ptr = (char *) allocator.Malloc(len);
                 BAIL_IF_MUTEX(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
                 if (!sanitizePlatformIndependentPath(subdir, ptr))
                 {
                     allocator.Free(ptr);
                     BAIL_MUTEX_ERRPASS(stateLock, 0);
                 } /* if */
+            } /* if */
 
-                if (i->root)
-                    allocator.Free(i->root);
-                i->root = ptr;
-                i->rootlen = strlen(i->root);  /* in case sanitizePlatformIndependentPath changed subdir */
+            /* a root changes what paths this archive provides. */
+            filter = buildLookupFilter(i, ptr, &filterMask);
 
-                if (longest_root < i->rootlen)
-                    longest_root = i->rootlen;
-            } /* else */
+            beginSearchPathChange();
+
+            /* a root changes what this archive provides; reindex it below. */
+            indexCurrent = searchIndexIsCurrent();
+            if (indexCurrent)
+                removeFromSearchIndex(i);
+            searchPathGeneration++;
+
+            if (i->root)
+                allocator.Free(i->root);
+            i->root = ptr;
+            i->rootlen = ptr ? strlen(ptr) : 0;  /* in case sanitizePlatformIndependentPath changed subdir */
 
+            /* swap the filter in now, free the old one after readers can't see it. */
+            oldFilter = i->lookupFilter;
+            i->lookupFilter = filter;
+            i->lookupFilterMask = filterMask;
+
+            if (longest_root < i->rootlen)
+                longest_root = i->rootlen;
+
+            if ((indexCurrent) && (addToSearchIndex(i)))
+                searchIndex.generation = searchPathGeneration;
+
+            endSearchPathChange();
+            allocator.Free(oldFilter);
             break;
         } /* if */
     } /* for */
@@ -1831,11 +3847,16 @@ static int doMount(PHYSFS_Io *io, const char *fname,
         prev = i;
     } /* for */
 
+    /* opening the archive can be slow; readers can keep going meanwhile. */
     dh = createDirHandle(io, fname, mountPoint, 0);
     BAIL_IF_MUTEX_ERRPASS(!dh, stateLock, 0);
+    dh->lookupFilter = buildLookupFilter(dh, NULL, &dh->lookupFilterMask);
+
+    beginSearchPathChange();
 
     if (appendToPath)
     {
+        dh->searchOrder = prev ? prev->searchOrder + 1 : 0;
         if (prev == NULL)
             searchPath = dh;
         else
@@ -1843,10 +3864,24 @@ static int doMount(PHYSFS_Io *io, const char *fname,
     } /* if */
     else
     {
+        dh->searchOrder = searchPath ? searchPath->searchOrder - 1 : 0;
         dh->next = searchPath;
         searchPath = dh;
     } /* else */
 
+    /* if the index was up to date, keep it that way. */
+    if (searchIndexIsCurrent())
+    {
+        searchPathGeneration++;
+        if (addToSearchIndex(dh))
+            searchIndex.generation = searchPathGeneration;
+    } /* if */
+    else
+    {
+        searchPathGeneration++;  /* rebuilt on demand. */
+    } /* else */
+
+    endSearchPathChange();
     __PHYSFS_platformReleaseMutex(stateLock);
     return 1;
 } /* doMount */
@@ -1857,7 +3892,7 @@ int PHYSFS_mountIo(PHYSFS_Io *io, const char *fname,
 {
     BAIL_IF(!io, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    BAIL_IF(io->version != 0, PHYSFS_ERR_UNSUPPORTED, 0);
+    BAIL_IF(io->version > CURRENT_PHYSFS_IO_API_VERSION, PHYSFS_ERR_UNSUPPORTED, 0);
     return doMount(io, fname, mountPoint, appendToPath);
 } /* PHYSFS_mountIo */
 
@@ -1942,15 +3977,35 @@ int PHYSFS_unmount(const char *oldDir)
     {
         if (strcmp(i->dirName, oldDir) == 0)
         {
+            int indexCurrent;
+
+            beginSearchPathChange();
+            if (dirHandleBusy(i, openReadList))
+            {
+                endSearchPathChange();
+                BAIL_MUTEX_ERRPASS(stateLock, 0);
+            } /* if */
+
+            indexCurrent = searchIndexIsCurrent();
             next = i->next;
-            BAIL_IF_MUTEX_ERRPASS(!freeDirHandle(i, openReadList),
-                                stateLock, 0);
+
+            /* if this fails, the index stays stale and gets rebuilt later. */
+            if (indexCurrent)
+                removeFromSearchIndex(i);
+            searchPathGeneration++;
 
             if (prev == NULL)
                 searchPath = next;
             else
                 prev->next = next;
 
+            if (indexCurrent)
+                searchIndex.generation = searchPathGeneration;
+
+            endSearchPathChange();
+
+            /* nothing can reach it now. Closing it might close files, too. */
+            destroyDirHandle(i);
             BAIL_MUTEX_ERRPASS(stateLock, 1);
         } /* if */
         prev = i;
@@ -2096,19 +4151,310 @@ int PHYSFS_setSaneConfig(const char *organization, const char *appName,
     } /* if */
 
     return 1;
-} /* PHYSFS_setSaneConfig */
+} /* PHYSFS_setSaneConfig */
+
+
+void PHYSFS_permitSymbolicLinks(int allow)
+{
+    allowSymLinks = allow;
+} /* PHYSFS_permitSymbolicLinks */
+
+
+int PHYSFS_symbolicLinksPermitted(void)
+{
+    return allowSymLinks;
+} /* PHYSFS_symbolicLinksPermitted */
+
+
+int PHYSFS_indexSearchPath(int enable)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    __PHYSFS_platformGrabMutex(stateLock);
+    beginSearchPathChange();
+    searchPathIndexed = enable ? 1 : 0;
+    if (!searchPathIndexed)
+        freeSearchIndex();  /* it'll be rebuilt on demand if reenabled. */
+    endSearchPathChange();
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return 1;
+} /* PHYSFS_indexSearchPath */
+
+
+int PHYSFS_allowConcurrentReads(int allow)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    #ifndef PHYSFS_HAVE_CONCURRENT_READS
+    BAIL_IF(allow, PHYSFS_ERR_UNSUPPORTED, 0);
+    #else
+    /* hold both locks, so readers in either mode are out of the way. */
+    __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_platformGrabWriteLock(searchPathLock);
+    concurrentReads = allow ? 1 : 0;
+    if ((concurrentReads) && (searchPathIndexed) && (!searchIndexIsCurrent()))
+        buildSearchIndex();  /* shared readers can't build it themselves. */
+    __PHYSFS_platformReleaseRWLock(searchPathLock);
+    __PHYSFS_platformReleaseMutex(stateLock);
+    #endif
+
+    return 1;
+} /* PHYSFS_allowConcurrentReads */
+
+
+int PHYSFS_concurrentReadsAllowed(void)
+{
+    return concurrentReads;
+} /* PHYSFS_concurrentReadsAllowed */
+
+
+int PHYSFS_mapArchives(int enable)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    #ifndef PHYSFS_HAVE_PLATFORM_MMAP
+    BAIL_IF(enable, PHYSFS_ERR_UNSUPPORTED, 0);
+    #endif
+
+    mapArchives = enable ? 1 : 0;
+    return 1;
+} /* PHYSFS_mapArchives */
+
+
+int PHYSFS_archivesMapped(void)
+{
+    return mapArchives;
+} /* PHYSFS_archivesMapped */
+
+
+int PHYSFS_searchPathIndexed(void)
+{
+    return searchPathIndexed;
+} /* PHYSFS_searchPathIndexed */
+
+
+void PHYSFS_getLookupFilterStats(PHYSFS_uint32 *rejected,
+                                 PHYSFS_uint32 *falsePositives)
+{
+    if (rejected)
+        *rejected = (PHYSFS_uint32) lookupFilterRejected;
+    if (falsePositives)
+        *falsePositives = (PHYSFS_uint32) lookupFilterFalsePositives;
+} /* PHYSFS_getLookupFilterStats */
+
+
+int PHYSFS_setFileCache(PHYSFS_uint64 capacity, PHYSFS_uint64 maxFileSize)
+{
+    PHYSFS_uint64 shardCapacity = capacity / FILE_CACHE_SHARDS;
+    size_t i;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    if ((fileCache == NULL) && (shardCapacity > 0))
+    {
+        const size_t len = sizeof (FileCacheShard) * FILE_CACHE_SHARDS;
+        FileCacheShard *shards = (FileCacheShard *) allocator.Malloc(len);
+        GOTO_IF(!shards, PHYSFS_ERR_OUT_OF_MEMORY, setFileCache_failed);
+        memset(shards, '\0', len);
+        for (i = 0; i < FILE_CACHE_SHARDS; i++)
+        {
+            shards[i].lock = __PHYSFS_platformCreateMutex();
+            if (!shards[i].lock)
+            {
+                while (i--)
+                    __PHYSFS_platformDestroyMutex(shards[i].lock);
+                allocator.Free(shards);
+                goto setFileCache_failed;
+            } /* if */
+        } /* for */
+        fileCache = shards;
+    } /* if */
+
+    /* no single file gets more than its shard can hold. */
+    if (maxFileSize > shardCapacity)
+        maxFileSize = shardCapacity;
+    if (!__PHYSFS_ui64FitsAddressSpace(maxFileSize))
+        maxFileSize = (PHYSFS_uint64) ((size_t) -1);
+    fileCacheMaxFile = (size_t) maxFileSize;
+
+    /* shrink (or empty) the shards if we have to. We keep the shards
+       themselves until PHYSFS_deinit(), since other threads might be
+       looking at them right now. */
+    for (i = 0; (fileCache != NULL) && (i < FILE_CACHE_SHARDS); i++)
+    {
+        FileCacheShard *shard = &fileCache[i];
+        __PHYSFS_platformGrabMutex(shard->lock);
+        shard->capacity = shardCapacity;
+        fileCacheMakeRoom(shard, 0);
+        __PHYSFS_platformReleaseMutex(shard->lock);
+    } /* for */
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return 1;
+
+setFileCache_failed:
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return 0;
+} /* PHYSFS_setFileCache */
+
+
+void PHYSFS_getFileCacheStats(PHYSFS_uint32 *hits, PHYSFS_uint32 *misses,
+                              PHYSFS_uint32 *evictions)
+{
+    if (hits)
+        *hits = (PHYSFS_uint32) fileCacheHits;
+    if (misses)
+        *misses = (PHYSFS_uint32) fileCacheMisses;
+    if (evictions)
+        *evictions = (PHYSFS_uint32) fileCacheEvictions;
+} /* PHYSFS_getFileCacheStats */
+
+
+int PHYSFS_verifyChecksums(int enable)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    verifyChecksums = enable ? 1 : 0;
+    return 1;
+} /* PHYSFS_verifyChecksums */
+
+
+int PHYSFS_checksumsVerified(void)
+{
+    return verifyChecksums;
+} /* PHYSFS_checksumsVerified */
+
+
+int PHYSFS_verifyArchive(const char *archive)
+{
+    DirHandle *i;
+    int shared;
+    int retval = 0;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!archive, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    /* holding the search path keeps anyone from unmounting it under us. */
+    shared = grabSearchPathRead();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, archive) == 0)
+            break;
+    } /* for */
+
+    if (i == NULL)
+        PHYSFS_setErrorCode(PHYSFS_ERR_NOT_MOUNTED);
+
+    #if PHYSFS_SUPPORTS_ZIP  /* (funcs) is a copy, so compare a method. */
+    else if (i->funcs->openArchive == __PHYSFS_Archiver_ZIP.openArchive)
+        retval = __PHYSFS_zipVerify(i->opaque);
+    #endif
+
+    else  /* nothing else keeps checksums we know how to check. */
+        PHYSFS_setErrorCode(PHYSFS_ERR_UNSUPPORTED);
+
+    releaseSearchPathRead(shared);
+
+    return retval;
+} /* PHYSFS_verifyArchive */
+
+
+int PHYSFS_setResolveMode(PHYSFS_ResolveMode mode)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF((mode != PHYSFS_RESOLVE_ON_OPEN) &&
+            (mode != PHYSFS_RESOLVE_ON_MOUNT) &&
+            (mode != PHYSFS_RESOLVE_IN_BACKGROUND),
+            PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    #ifndef PHYSFS_HAVE_PLATFORM_THREADS
+    BAIL_IF(mode == PHYSFS_RESOLVE_IN_BACKGROUND, PHYSFS_ERR_UNSUPPORTED, 0);
+    #endif
+
+    resolveMode = mode;
+    return 1;
+} /* PHYSFS_setResolveMode */
+
+
+PHYSFS_ResolveMode PHYSFS_getResolveMode(void)
+{
+    return resolveMode;
+} /* PHYSFS_getResolveMode */
+
+
+int PHYSFS_preloadArchives(int threads)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    preloadThreads = threads;
+    return 1;
+} /* PHYSFS_preloadArchives */
+
+
+int PHYSFS_archivesPreloaded(void)
+{
+    return preloadThreads;
+} /* PHYSFS_archivesPreloaded */
+
+
+void PHYSFS_getPreloadStats(PHYSFS_uint64 *compressed,
+                            PHYSFS_uint64 *decompressed,
+                            PHYSFS_uint64 *milliseconds)
+{
+    if (stateLock)
+        __PHYSFS_platformGrabMutex(stateLock);
+    if (compressed)
+        *compressed = preloadCompressed;
+    if (decompressed)
+        *decompressed = preloadDecompressed;
+    if (milliseconds)
+        *milliseconds = preloadTicks;
+    if (stateLock)
+        __PHYSFS_platformReleaseMutex(stateLock);
+} /* PHYSFS_getPreloadStats */
+
+
+int PHYSFS_setDecoderThreads(int threads)
+{
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    decoderThreads = threads;
+    return 1;
+} /* PHYSFS_setDecoderThreads */
 
 
-void PHYSFS_permitSymbolicLinks(int allow)
+int PHYSFS_getDecoderThreads(void)
 {
-    allowSymLinks = allow;
-} /* PHYSFS_permitSymbolicLinks */
+    return decoderThreads;
+} /* PHYSFS_getDecoderThreads */
 
 
-int PHYSFS_symbolicLinksPermitted(void)
+int PHYSFS_setArchiveIndexDir(const char *dir)
 {
-    return allowSymLinks;
-} /* PHYSFS_symbolicLinksPermitted */
+    char *ptr = NULL;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+
+    if (dir != NULL)
+    {
+        ptr = (char *) allocator.Malloc(strlen(dir) + 1);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        strcpy(ptr, dir);
+    } /* if */
+
+    /* mounting reads this while holding stateLock. */
+    __PHYSFS_platformGrabMutex(stateLock);
+    if (archiveIndexDir != NULL)
+        allocator.Free(archiveIndexDir);
+    archiveIndexDir = ptr;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return 1;
+} /* PHYSFS_setArchiveIndexDir */
+
+
+const char *PHYSFS_getArchiveIndexDir(void)
+{
+    return archiveIndexDir;
+} /* PHYSFS_getArchiveIndexDir */
 
 
 /*
@@ -2176,20 +4522,44 @@ static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
     } /* if */
 
     start = fname;
-    if (!allowSymLinks)
+    if ((!allowSymLinks) && (h->checkSymlinks))
     {
+        const int useCache = (h->funcs == &__PHYSFS_Archiver_DIR);
+        PHYSFS_uint32 hash = 5381;
+
         while (1)
         {
             PHYSFS_Stat statbuf;
+            PHYSFS_uint32 generation = 0;
             int rc = 0;
             end = strchr(start, '/');
 
-            if (end != NULL) *end = '\0';
+            if (end != NULL)
+            {
+                *end = '\0';
+                if (useCache)
+                {
+                    hash = searchIndexHash(hash, start - (start != fname), end - start + (start != fname));
+                    if (symlinkCacheHas(h, fname, hash, &generation))
+                    {
+                        *end = '/';
+                        start = end + 1;
+                        continue;  /* already know it's a real directory. */
+                    } /* if */
+                } /* if */
+            } /* if */
+
             rc = h->funcs->stat(h->opaque, fname, &statbuf);
             if (rc)
+            {
                 rc = (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK);
+                if ((useCache) && (end != NULL) && (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY))
+                    addToSymlinkCache(h, fname, hash, generation);
+            } /* if */
             else if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
+            {
                 retval = 0;
+            } /* else if */
 
             if (end != NULL) *end = '/';
 
@@ -2287,6 +4657,7 @@ int PHYSFS_mkdir(const char *_dname)
     dname = (char *) __PHYSFS_smallAlloc(len);
     BAIL_IF_MUTEX(!dname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
     retval = doMkdir(_dname, dname);
+    invalidateSymlinkCaches();
     __PHYSFS_platformReleaseMutex(stateLock);
     __PHYSFS_smallFree(dname);
     return retval;
@@ -2315,6 +4686,7 @@ int PHYSFS_delete(const char *_fname)
     fname = (char *) __PHYSFS_smallAlloc(len);
     BAIL_IF_MUTEX(!fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
     retval = doDelete(_fname, fname);
+    invalidateSymlinkCaches();
     __PHYSFS_platformReleaseMutex(stateLock);
     __PHYSFS_smallFree(fname);
     return retval;
@@ -2327,18 +4699,25 @@ static DirHandle *getRealDirHandle(const char *_fname)
     char *allocated_fname = NULL;
     char *fname = NULL;
     size_t len;
+    int shared;
 
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    shared = grabSearchPathRead();
     len = strlen(_fname) + longest_root + 2;
     allocated_fname = __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, NULL);
+    if (!allocated_fname)
+    {
+        releaseSearchPathRead(shared);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
     fname = allocated_fname + longest_root + 1;
     if (sanitizePlatformIndependentPath(_fname, fname))
     {
+        SearchPathCursor cursor;
         DirHandle *i;
-        for (i = searchPath; i != NULL; i = i->next)
+        initSearchPathCursor(&cursor, fname);
+        while ((i = nextSearchPathCandidate(&cursor)) != NULL)
         {
             char *arcfname = fname;
             if (partOfMountPoint(i, arcfname))
@@ -2355,10 +4734,10 @@ static DirHandle *getRealDirHandle(const char *_fname)
                     break;
                 } /* if */
             } /* if */
-        } /* for */
+        } /* while */
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPathRead(shared);
     __PHYSFS_smallFree(allocated_fname);
     return retval;
 } /* getRealDirHandle */
@@ -2550,27 +4929,116 @@ static PHYSFS_EnumerateCallbackResult enumCallbackFilterSymLinks(void *_data,
 } /* enumCallbackFilterSymLinks */
 
 
+/* Broke out to seperate function so PHYSFS_enumerate() can pin (i). */
+static PHYSFS_EnumerateCallbackResult enumerateDirHandle(DirHandle *i,
+                                    char *fname, PHYSFS_EnumerateCallback cb,
+                                    const char *_fn, void *data,
+                                    SymlinkFilterData *filterdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    char *arcfname = fname;
+
+    if (partOfMountPoint(i, arcfname))
+        retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
+
+    else if (verifyPath(i, &arcfname, 0))
+    {
+        PHYSFS_Stat statbuf;
+        if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
+        {
+            if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
+                return PHYSFS_ENUM_OK;  /* no such dir in this archive, skip it. */
+        } /* if */
+
+        if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
+            return PHYSFS_ENUM_OK;  /* not a directory in this archive, skip it. */
+
+        else if ((!allowSymLinks) && (i->checkSymlinks))
+        {
+            filterdata->dirhandle = i;
+            filterdata->arcfname = arcfname;
+            filterdata->errcode = PHYSFS_ERR_OK;
+            retval = i->funcs->enumerate(i->opaque, arcfname,
+                                         enumCallbackFilterSymLinks,
+                                         _fn, filterdata);
+            if (retval == PHYSFS_ENUM_ERROR)
+            {
+                if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
+                    PHYSFS_setErrorCode(filterdata->errcode);
+            } /* if */
+        } /* else if */
+        else
+        {
+            retval = i->funcs->enumerate(i->opaque, arcfname, cb, _fn, data);
+        } /* else */
+    } /* else if */
+
+    return retval;
+} /* enumerateDirHandle */
+
+
+/*
+ * With concurrent reads, the app's callback runs without the search path
+ *  lock, so it can mount things, or block on something, without stalling
+ *  (or deadlocking) everyone else. The DirHandle being enumerated is pinned
+ *  meanwhile, so it can't be unmounted out from under us.
+ */
+typedef struct UnlockedEnumData
+{
+    PHYSFS_EnumerateCallback callback;
+    void *callbackData;
+    int shared;  /* what grabSearchPathRead() last gave us. */
+} UnlockedEnumData;
+
+static PHYSFS_EnumerateCallbackResult enumCallbackUnlocked(void *_data,
+                                    const char *origdir, const char *fname)
+{
+    UnlockedEnumData *data = (UnlockedEnumData *) _data;
+    PHYSFS_EnumerateCallbackResult retval;
+    releaseSearchPathRead(data->shared);
+    retval = data->callback(data->callbackData, origdir, fname);
+    data->shared = grabSearchPathRead();
+    return retval;
+} /* enumCallbackUnlocked */
+
+
 int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
 {
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    UnlockedEnumData unlocked;
     size_t len;
+    size_t rootspace;
     char *allocated_fname;
+    char *grown_fname = NULL;
     char *fname;
 
     BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    unlocked.shared = grabSearchPathRead();
+    if (unlocked.shared)
+    {
+        unlocked.callback = cb;
+        unlocked.callbackData = data;
+        cb = enumCallbackUnlocked;
+        data = &unlocked;
+    } /* if */
 
-    len = strlen(_fn) + longest_root + 2;
+    rootspace = longest_root;
+    len = strlen(_fn) + rootspace + 2;
     allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
+    if (!allocated_fname)
+    {
+        releaseSearchPathRead(unlocked.shared);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+    fname = allocated_fname + rootspace + 1;
     if (!sanitizePlatformIndependentPath(_fn, fname))
         retval = PHYSFS_ENUM_STOP;
     else
     {
         DirHandle *i;
+        DirHandle *next;
         SymlinkFilterData filterdata;
 
         if (!allowSymLinks)
@@ -2580,52 +5048,44 @@ int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
             filterdata.callbackData = data;
         } /* if */
 
-        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = next)
         {
-            char *arcfname = fname;
-
-            if (partOfMountPoint(i, arcfname))
-                retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
-
-            else if (verifyPath(i, &arcfname, 0))
+            /*
+             * verifyPath() puts the root in front of fname. With concurrent
+             *  reads, a PHYSFS_setRoot() can happen while the app's callback
+             *  runs, so this root might not fit in front of it anymore.
+             */
+            if (i->rootlen > rootspace)
             {
-                PHYSFS_Stat statbuf;
-                if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
+                const size_t fnamelen = strlen(fname);
+                char *ptr = (char *) allocator.Malloc(fnamelen + i->rootlen + 2);
+                if (!ptr)
                 {
-                    if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
-                        continue;  /* no such dir in this archive, skip it. */
+                    PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+                    retval = PHYSFS_ENUM_ERROR;
+                    break;
                 } /* if */
+                memcpy(ptr + i->rootlen + 1, fname, fnamelen + 1);
+                if (grown_fname)
+                    allocator.Free(grown_fname);
+                grown_fname = ptr;
+                rootspace = i->rootlen;
+                fname = grown_fname + rootspace + 1;
+            } /* if */
 
-                if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
-                    continue;  /* not a directory in this archive, skip it. */
-
-                else if ((!allowSymLinks) && (i->funcs->info.supportsSymlinks))
-                {
-                    filterdata.dirhandle = i;
-                    filterdata.arcfname = arcfname;
-                    filterdata.errcode = PHYSFS_ERR_OK;
-                    retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 enumCallbackFilterSymLinks,
-                                                 _fn, &filterdata);
-                    if (retval == PHYSFS_ENUM_ERROR)
-                    {
-                        if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
-                            PHYSFS_setErrorCode(filterdata.errcode);
-                    } /* if */
-                } /* else if */
-                else
-                {
-                    retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 cb, _fn, data);
-                } /* else */
-            } /* else if */
+            (void) __PHYSFS_ATOMIC_INCR(&i->pins);
+            retval = enumerateDirHandle(i, fname, cb, _fn, data, &filterdata);
+            next = i->next;  /* we hold the lock again, so this is current. */
+            (void) __PHYSFS_ATOMIC_DECR(&i->pins);
         } /* for */
 
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPathRead(unlocked.shared);
 
     __PHYSFS_smallFree(allocated_fname);
+    if (grown_fname)
+        allocator.Free(grown_fname);
 
     return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
 } /* PHYSFS_enumerate */
@@ -2761,24 +5221,35 @@ PHYSFS_File *PHYSFS_openRead(const char *_fname)
     char *allocated_fname;
     char *fname;
     size_t len;
+    int shared;
 
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    shared = grabSearchPathRead();
 
-    BAIL_IF_MUTEX(!searchPath, PHYSFS_ERR_NOT_FOUND, stateLock, 0);
+    if (!searchPath)
+    {
+        releaseSearchPathRead(shared);
+        BAIL(PHYSFS_ERR_NOT_FOUND, 0);
+    } /* if */
 
     len = strlen(_fname) + longest_root + 2;
     allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
+    if (!allocated_fname)
+    {
+        releaseSearchPathRead(shared);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
     fname = allocated_fname + longest_root + 1;
 
     if (sanitizePlatformIndependentPath(_fname, fname))
     {
         PHYSFS_Io *io = NULL;
+        SearchPathCursor cursor;
         DirHandle *i;
 
-        for (i = searchPath; i != NULL; i = i->next)
+        initSearchPathCursor(&cursor, fname);
+        while ((i = nextSearchPathCandidate(&cursor)) != NULL)
         {
             char *arcfname = fname;
             if (verifyPath(i, &arcfname, 0))
@@ -2787,7 +5258,7 @@ PHYSFS_File *PHYSFS_openRead(const char *_fname)
                 if (io)
                     break;
             } /* if */
-        } /* for */
+        } /* while */
 
         if (io)
         {
@@ -2799,17 +5270,20 @@ PHYSFS_File *PHYSFS_openRead(const char *_fname)
             } /* if */
             else
             {
+                void *listLock = openReadListMutex();
                 memset(fh, '\0', sizeof (FileHandle));
                 fh->io = io;
                 fh->forReading = 1;
                 fh->dirHandle = i;
+                __PHYSFS_platformGrabMutex(listLock);
                 fh->next = openReadList;
                 openReadList = fh;
+                __PHYSFS_platformReleaseMutex(listLock);
             } /* else */
         } /* if */
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPathRead(shared);
     __PHYSFS_smallFree(allocated_fname);
     return ((PHYSFS_File *) fh);
 } /* PHYSFS_openRead */
@@ -2859,12 +5333,80 @@ static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
 } /* closeHandleInOpenList */
 
 
+static int removeFromOpenList(FileHandle **list, FileHandle *handle)
+{
+    FileHandle *prev = NULL;
+    FileHandle *i;
+
+    for (i = *list; i != NULL; i = i->next)
+    {
+        if (i == handle)  /* handle is in this list? */
+        {
+            if (prev == NULL)
+                *list = handle->next;
+            else
+                prev->next = handle->next;
+            return 1;
+        } /* if */
+        prev = i;
+    } /* for */
+
+    return 0;
+} /* removeFromOpenList */
+
+
+/*
+ * PHYSFS_close() for concurrent reads; call it with the search path's read
+ *  lock held, and it releases it. Read handles are destroyed with no lock
+ *  held at all, as their Io might close other files, and readers can't grab
+ *  the search path lock again. The DirHandle stays pinned until we're done,
+ *  so it can't be unmounted out from under the Io.
+ */
+static int closeShared(FileHandle *handle)
+{
+    void *listLock = openReadListMutex();
+    DirHandle *dh = NULL;
+    int rc;
+
+    __PHYSFS_platformGrabMutex(listLock);
+    if (removeFromOpenList(&openReadList, handle))
+    {
+        dh = (DirHandle *) handle->dirHandle;
+        (void) __PHYSFS_ATOMIC_INCR(&dh->pins);
+    } /* if */
+    __PHYSFS_platformReleaseMutex(listLock);
+    releaseSearchPathRead(1);
+
+    if (dh != NULL)
+    {
+        handle->io->destroy(handle->io);
+        if (handle->buffer != NULL)
+            allocator.Free(handle->buffer);
+        allocator.Free(handle);
+        (void) __PHYSFS_ATOMIC_DECR(&dh->pins);
+        return 1;
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    /* -1 == close failure. 0 == not found. 1 == success. */
+    rc = closeHandleInOpenList(&openWriteList, handle);
+    BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+    BAIL_IF(!rc, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    return 1;
+} /* closeShared */
+
+
 int PHYSFS_close(PHYSFS_File *_handle)
 {
     FileHandle *handle = (FileHandle *) _handle;
     int rc;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    /* with concurrent reads off, this just grabs stateLock, as ever. */
+    if (grabSearchPathRead())
+        return closeShared(handle);
 
     /* -1 == close failure. 0 == not found. 1 == success. */
     rc = closeHandleInOpenList(&openReadList, handle);
@@ -3075,6 +5617,22 @@ PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle)
 } /* PHYSFS_filelength */
 
 
+const void *PHYSFS_getFileMemory(PHYSFS_File *handle, PHYSFS_uint64 *len)
+{
+    const FileHandle *fh = (const FileHandle *) handle;
+    const MemoryIoInfo *info;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, NULL);
+    BAIL_IF(fh->io->destroy != memoryIo_destroy, PHYSFS_ERR_UNSUPPORTED, NULL);
+
+    info = (const MemoryIoInfo *) fh->io->opaque;
+    if (len != NULL)
+        *len = info->len;
+    return info->buf;
+} /* PHYSFS_getFileMemory */
+
+
 int PHYSFS_setBuffer(PHYSFS_File *handle, PHYSFS_uint64 _bufsize)
 {
     FileHandle *fh = (FileHandle *) handle;
@@ -3146,6 +5704,7 @@ int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
     char *allocated_fname;
     char *fname;
     size_t len;
+    int shared;
 
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!stat, PHYSFS_ERR_INVALID_ARGUMENT, 0);
@@ -3158,48 +5717,361 @@ int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
     stat->filetype = PHYSFS_FILETYPE_OTHER;
     stat->readonly = 1;
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    len = strlen(_fname) + longest_root + 2;
-    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
+    shared = grabSearchPathRead();
+    len = strlen(_fname) + longest_root + 2;
+    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
+    if (!allocated_fname)
+    {
+        releaseSearchPathRead(shared);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+    fname = allocated_fname + longest_root + 1;
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        if (*fname == '\0')
+        {
+            stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+            stat->readonly = !writeDir; /* Writeable if we have a writeDir */
+            retval = 1;
+        } /* if */
+        else
+        {
+            SearchPathCursor cursor;
+            DirHandle *i;
+            int exists = 0;
+            initSearchPathCursor(&cursor, fname);
+            while ((!exists) && ((i = nextSearchPathCandidate(&cursor)) != NULL))
+            {
+                char *arcfname = fname;
+                exists = partOfMountPoint(i, arcfname);
+                if (exists)
+                {
+                    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+                    stat->readonly = 1;
+                    retval = 1;
+                } /* if */
+                else if (verifyPath(i, &arcfname, 0))
+                {
+                    retval = i->funcs->stat(i->opaque, arcfname, stat);
+                    if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
+                        exists = 1;
+                } /* else if */
+            } /* while */
+        } /* else */
+    } /* if */
+
+    releaseSearchPathRead(shared);
+    __PHYSFS_smallFree(allocated_fname);
+    return retval;
+} /* PHYSFS_stat */
+
+
+/*
+ * PHYSFS_statMany() sorts the paths so everything in the same directory is
+ *  together, then asks each archive about each directory once: one
+ *  mountpoint check, one verifyPath() (and its symlink walk), then a stat()
+ *  for each file. Paths are resolved in search path order, so the results
+ *  are the same as calling PHYSFS_stat() on each one.
+ */
+typedef struct
+{
+    char *path;  /* sanitized. */
+    size_t dirlen;  /* chars before the last '/' in path, or zero. */
+    PHYSFS_uint32 hash;  /* __PHYSFS_hashString() of path. */
+    size_t index;  /* where this goes in the app's arrays. */
+    int resolved;  /* non-zero once an archive answered for it. */
+} StatManyItem;
+
+static int statManySortCmp(void *_a, size_t one, size_t two)
+{
+    const StatManyItem *a = ((const StatManyItem *) _a) + one;
+    const StatManyItem *b = ((const StatManyItem *) _a) + two;
+    const size_t len = (a->dirlen < b->dirlen) ? a->dirlen : b->dirlen;
+    const int rc = memcmp(a->path, b->path, len);
+    if (rc != 0)
+        return rc;
+    else if (a->dirlen != b->dirlen)
+        return (a->dirlen < b->dirlen) ? -1 : 1;
+    return (a->index < b->index) ? -1 : ((a->index > b->index) ? 1 : 0);
+} /* statManySortCmp */
+
+static inline int statManySameDir(const StatManyItem *a,
+                                  const StatManyItem *b)
+{
+    return ( (a->dirlen == b->dirlen) &&
+             (memcmp(a->path, b->path, a->dirlen) == 0) );
+} /* statManySameDir */
+
+static void statManySortSwap(void *_a, size_t one, size_t two)
+{
+    StatManyItem *a = (StatManyItem *) _a;
+    StatManyItem tmp;
+    memcpy(&tmp, &a[one], sizeof (StatManyItem));
+    memcpy(&a[one], &a[two], sizeof (StatManyItem));
+    memcpy(&a[two], &tmp, sizeof (StatManyItem));
+} /* statManySortSwap */
+
+
+/* returns non-zero if (item) is settled for good, one way or another. */
+static int statManyFinish(DirHandle *h, StatManyItem *item, const int rc,
+                          const PHYSFS_Stat *st, PHYSFS_Stat *out, int *found)
+{
+    if (rc)
+    {
+        if ((st->filetype == PHYSFS_FILETYPE_SYMLINK) && (!allowSymLinks) && (h->checkSymlinks))
+            return 0;  /* verifyPath() would have refused this; keep looking. */
+        if (out)
+            memcpy(&out[item->index], st, sizeof (PHYSFS_Stat));
+        found[item->index] = 1;
+        return 1;
+    } /* if */
+
+    /* PHYSFS_stat() stops looking if an archive reports a real error. */
+    return (currentErrorCode() != PHYSFS_ERR_NOT_FOUND);
+} /* statManyFinish */
+
+
+/* does this one path the slow way, exactly like PHYSFS_stat() would. */
+static int statManyOne(DirHandle *h, StatManyItem *item, char *arcfname,
+                       PHYSFS_Stat *out, int *found)
+{
+    PHYSFS_Stat st;
+    strcpy(arcfname, item->path);
+    if (partOfMountPoint(h, arcfname))
+    {
+        memset(&st, '\0', sizeof (st));
+        st.filesize = st.modtime = st.createtime = st.accesstime = -1;
+        st.filetype = PHYSFS_FILETYPE_DIRECTORY;
+        st.readonly = 1;
+        return statManyFinish(h, item, 1, &st, out, found);
+    } /* if */
+    else if (verifyPath(h, &arcfname, 0))
+    {
+        const int rc = h->funcs->stat(h->opaque, arcfname, &st);
+        return statManyFinish(h, item, rc, &st, out, found);
+    } /* else if */
+    return 0;
+} /* statManyOne */
+
+
+/* Ask (h) about every unresolved path in (items), which share a directory. */
+static size_t statManyGroup(DirHandle *h, StatManyItem *items,
+                            const size_t count, char *arcfname,
+                            PHYSFS_Stat *out, int *found)
+{
+    const char *dir = items[0].path;
+    const size_t dirlen = items[0].dirlen;
+    size_t resolved = 0;
+    size_t arclen;
+    char *arcdir;
+    size_t i;
+
+    if (h->mountPoint != NULL)
+    {
+        const char *mntpnt = h->mountPoint;
+        const size_t mntlen = strlen(mntpnt) - 1;  /* minus the '/'. */
+        const int under = ( (dirlen >= mntlen) &&
+                            (strncmp(dir, mntpnt, mntlen) == 0) &&
+                            ((dirlen == mntlen) || (dir[mntlen] == '/')) );
+        if (!under)
+        {
+            /* this dir is above the mountpoint, if anything, so only the
+               mountpoint's own path elements can match. Do those the slow way. */
+            if ((dirlen >= mntlen) || ((dirlen > 0) && ((strncmp(dir, mntpnt, dirlen) != 0) || (mntpnt[dirlen] != '/'))))
+                return 0;
+
+            for (i = 0; i < count; i++)
+            {
+                StatManyItem *item = &items[i];
+                const size_t len = strlen(item->path);
+                if (item->resolved)
+                    continue;
+                else if ((len > mntlen) || (strncmp(item->path, mntpnt, len) != 0) || (mntpnt[len] != '/'))
+                    continue;
+                else if (statManyOne(h, item, arcfname, out, found))
+                {
+                    item->resolved = 1;
+                    resolved++;
+                } /* else if */
+            } /* for */
+            return resolved;
+        } /* if */
+    } /* if */
+
+    /* one verifyPath() for the whole directory. */
+    memcpy(arcfname, dir, dirlen);
+    arcfname[dirlen] = '\0';
+    arcdir = arcfname;
+    if (!verifyPath(h, &arcdir, 0))
+        return 0;  /* dir is missing, or has a forbidden symlink. */
+    arclen = strlen(arcdir);
+
+    for (i = 0; i < count; i++)
+    {
+        StatManyItem *item = &items[i];
+        const char *name = item->path + (dirlen ? dirlen + 1 : 0);
+        PHYSFS_Stat st;
+        int rc;
+
+        if (item->resolved)
+            continue;
+        else if ((h->lookupFilter) && (!lookupFilterMayHave(h, item->hash)))
+        {
+            countLookupFilterEvent(&lookupFilterRejected);
+            continue;
+        } /* else if */
+
+        if (arclen == 0)
+            strcpy(arcdir, name);
+        else
+        {
+            arcdir[arclen] = '/';
+            strcpy(arcdir + arclen + 1, name);
+        } /* else */
+
+        rc = h->funcs->stat(h->opaque, arcdir, &st);
+        if (statManyFinish(h, item, rc, &st, out, found))
+        {
+            item->resolved = 1;
+            resolved++;
+        } /* if */
+        else if (h->lookupFilter)
+        {
+            countLookupFilterEvent(&lookupFilterFalsePositives);
+        } /* else if */
+
+        arcdir[arclen] = '\0';
+    } /* for */
+
+    return resolved;
+} /* statManyGroup */
+
+
+int PHYSFS_statMany(const char **paths, PHYSFS_Stat *out, int *found,
+                    PHYSFS_uint32 n)
+{
+    StatManyItem *items = NULL;
+    char *names = NULL;
+    char *scratch = NULL;
+    char *ptr;
+    size_t namelen = 0;
+    size_t maxlen = 0;
+    size_t total = 0;
+    size_t pending;
+    size_t i;
+    DirHandle *h;
+    int shared;
+
+    BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
+    BAIL_IF(!paths && n, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!found && n, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    for (i = 0; i < n; i++)
     {
-        if (*fname == '\0')
+        size_t len;
+        BAIL_IF(!paths[i], PHYSFS_ERR_INVALID_ARGUMENT, 0);
+        len = strlen(paths[i]) + 1;
+        namelen += len;
+        if (len > maxlen)
+            maxlen = len;
+
+        found[i] = 0;
+        if (out)
         {
-            stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-            stat->readonly = !writeDir; /* Writeable if we have a writeDir */
-            retval = 1;
+            PHYSFS_Stat *st = &out[i];
+            st->filesize = -1;
+            st->modtime = -1;
+            st->createtime = -1;
+            st->accesstime = -1;
+            st->filetype = PHYSFS_FILETYPE_OTHER;
+            st->readonly = 1;
         } /* if */
-        else
+    } /* for */
+
+    if (n == 0)
+        return 1;
+
+    items = (StatManyItem *) allocator.Malloc(n * sizeof (StatManyItem));
+    names = (char *) allocator.Malloc(namelen);
+    GOTO_IF(!items || !names, PHYSFS_ERR_OUT_OF_MEMORY, statMany_failed);
+
+    /* sanitize everything up front, so each archive just gets clean paths. */
+    ptr = names;
+    for (i = 0; i < n; i++)
+    {
+        StatManyItem *item = &items[total];
+        char *slash;
+
+        if (!sanitizePlatformIndependentPath(paths[i], ptr))
+            continue;  /* bad path, so it's just not found. */
+        else if (*ptr == '\0')  /* the root of the tree is always there. */
         {
-            DirHandle *i;
-            int exists = 0;
-            for (i = searchPath; ((i != NULL) && (!exists)); i = i->next)
-            {
-                char *arcfname = fname;
-                exists = partOfMountPoint(i, arcfname);
-                if (exists)
-                {
-                    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-                    stat->readonly = 1;
-                    retval = 1;
-                } /* if */
-                else if (verifyPath(i, &arcfname, 0))
-                {
-                    retval = i->funcs->stat(i->opaque, arcfname, stat);
-                    if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
-                        exists = 1;
-                } /* else if */
-            } /* for */
-        } /* else */
+            found[i] = 1;
+            if (out)
+                out[i].filetype = PHYSFS_FILETYPE_DIRECTORY;
+            continue;  /* readonly gets filled in once we have the lock. */
+        } /* else if */
+
+        slash = strrchr(ptr, '/');
+        item->path = ptr;
+        item->dirlen = slash ? (size_t) (slash - ptr) : 0;
+        item->hash = __PHYSFS_hashString(ptr);
+        item->index = i;
+        item->resolved = 0;
+        ptr += strlen(ptr) + 1;
+        total++;
+    } /* for */
+
+    __PHYSFS_sort(items, total, statManySortCmp, statManySortSwap);
+
+    shared = grabSearchPathRead();
+
+    if (out)
+    {
+        for (i = 0; i < n; i++)
+        {
+            if ((found[i]) && (out[i].filetype == PHYSFS_FILETYPE_DIRECTORY))
+                out[i].readonly = !writeDir; /* Writeable if we have a writeDir */
+        } /* for */
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    __PHYSFS_smallFree(allocated_fname);
-    return retval;
-} /* PHYSFS_stat */
+    /* room for verifyPath() to put a root in front of any of these. */
+    scratch = (char *) allocator.Malloc(longest_root + 1 + maxlen + 1);
+    if (!scratch)
+    {
+        releaseSearchPathRead(shared);
+        GOTO(PHYSFS_ERR_OUT_OF_MEMORY, statMany_failed);
+    } /* if */
+
+    pending = total;
+    for (h = searchPath; (h != NULL) && (pending > 0); h = h->next)
+    {
+        size_t start = 0;
+        while (start < total)
+        {
+            size_t end = start + 1;
+            while ((end < total) && (statManySameDir(&items[start], &items[end])))
+                end++;
+            pending -= statManyGroup(h, &items[start], end - start,
+                                     scratch + longest_root + 1, out, found);
+            start = end;
+        } /* while */
+    } /* for */
+
+    releaseSearchPathRead(shared);
+
+    allocator.Free(scratch);
+    allocator.Free(names);
+    allocator.Free(items);
+    return 1;
+
+statMany_failed:
+    allocator.Free(scratch);
+    allocator.Free(names);
+    allocator.Free(items);
+    return 0;
+} /* PHYSFS_statMany */
 
 
 int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t _len)
@@ -3214,6 +6086,27 @@ int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t _len)
 } /* __PHYSFS_readAll */
 
 
+int __PHYSFS_readAllAt(PHYSFS_Io *io, void *buf, const size_t _len,
+                       const PHYSFS_uint64 offset)
+{
+    const PHYSFS_uint64 len = (PHYSFS_uint64) _len;
+    PHYSFS_sint64 amount_read;
+
+    if (!__PHYSFS_ioHas(io, readAt))
+    {
+        BAIL_IF_ERRPASS(!io->seek(io, offset), 0);
+        return __PHYSFS_readAll(io, buf, _len);
+    } /* if */
+
+    amount_read = io->readAt(io, buf, len, offset);
+    if (amount_read < 0)
+    {
+        return 0;
+    }
+    return ((PHYSFS_uint64)amount_read == len);
+} /* __PHYSFS_readAllAt */
+
+
 void *__PHYSFS_initSmallAlloc(void *ptr, const size_t len)
 {
     void *useHeap = ((ptr == NULL) ? ((void *) 1) : ((void *) 0));
@@ -3303,9 +6196,98 @@ static void setDefaultAllocator(void)
 } /* setDefaultAllocator */
 
 
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii)
+/*
+ * Entries live in blocks of (1 << slotShift) slots, which never move once
+ *  they're allocated, so pointers to entries stay good as the tree grows.
+ *  Names are packed end to end into blocks of up to DIRTREE_NAMEBLOCK
+ *  bytes, and an entry's (name) is its block's number times
+ *  DIRTREE_NAMEBLOCK, plus where it starts in that block. The first name
+ *  in the first block is the root's, "".
+ */
+#define DIRTREE_NAMESHIFT 16
+#define DIRTREE_NAMEBLOCK (((size_t) 1) << DIRTREE_NAMESHIFT)
+#define DIRTREE_MAXNAMEBLOCKS (((size_t) 1) << (31 - DIRTREE_NAMESHIFT))
+#define DIRTREE_NONE 0xFFFFFFFF
+
+static __PHYSFS_DirTreeEntry *dirTreeEntry(const __PHYSFS_DirTree *dt,
+                                           const size_t idx)
+{
+    const size_t mask = (((size_t) 1) << dt->slotShift) - 1;
+    PHYSFS_uint8 *block = dt->slots[idx >> dt->slotShift];
+    return (__PHYSFS_DirTreeEntry *) (block + ((idx & mask) * dt->entrylen));
+} /* dirTreeEntry */
+
+
+/* Make room for entry number (idx), which is one past the last one. */
+static __PHYSFS_DirTreeEntry *dirTreeAllocEntry(__PHYSFS_DirTree *dt,
+                                                const size_t idx)
+{
+    const size_t block = idx >> dt->slotShift;
+    __PHYSFS_DirTreeEntry *retval;
+
+    if (block >= dt->slotBlocks)
+    {
+        const size_t len = (block + 1) * sizeof (PHYSFS_uint8 *);
+        PHYSFS_uint8 **ptr;
+        assert(block == dt->slotBlocks);
+        ptr = (PHYSFS_uint8 **) (dt->slots ? allocator.Realloc(dt->slots, len) : allocator.Malloc(len));
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        dt->slots = ptr;
+        ptr[block] = (PHYSFS_uint8 *) allocator.Malloc(dt->entrylen << dt->slotShift);
+        BAIL_IF(!ptr[block], PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        dt->slotBlocks++;
+    } /* if */
+
+    retval = dirTreeEntry(dt, idx);
+    memset(retval, '\0', dt->entrylen);
+    return retval;
+} /* dirTreeAllocEntry */
+
+
+/* Copy (name) into the pool, and point (entry) at it. */
+static int dirTreeAddName(__PHYSFS_DirTree *dt, __PHYSFS_DirTreeEntry *entry,
+                          const char *name)
+{
+    const size_t len = strlen(name) + 1;
+    char *block;
+
+    BAIL_IF(len > DIRTREE_NAMEBLOCK, PHYSFS_ERR_BAD_FILENAME, 0);
+
+    if ((dt->nameBlocks == 0) || ((dt->nameAvail - dt->nameUsed) < len))
+    {
+        /* each block is twice the last, up to a limit. */
+        const size_t ptrlen = (dt->nameBlocks + 1) * sizeof (char *);
+        size_t avail = dt->nameBlocks ? dt->nameAvail * 2 : dt->nameAvail;
+        char **ptr;
+
+        BAIL_IF(dt->nameBlocks >= DIRTREE_MAXNAMEBLOCKS, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        if (avail > DIRTREE_NAMEBLOCK)
+            avail = DIRTREE_NAMEBLOCK;
+        if (avail < len)
+            avail = len;
+
+        ptr = (char **) (dt->names ? allocator.Realloc(dt->names, ptrlen) : allocator.Malloc(ptrlen));
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        dt->names = ptr;
+        ptr[dt->nameBlocks] = (char *) allocator.Malloc(avail);
+        BAIL_IF(!ptr[dt->nameBlocks], PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        dt->nameBlocks++;
+        dt->nameUsed = 0;
+        dt->nameAvail = avail;
+    } /* if */
+
+    block = dt->names[dt->nameBlocks - 1];
+    memcpy(block + dt->nameUsed, name, len);
+    entry->name = (PHYSFS_uint32) (((dt->nameBlocks - 1) << DIRTREE_NAMESHIFT) | dt->nameUsed);
+    dt->nameUsed += len;
+    return 1;
+} /* dirTreeAddName */
+
+
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen,
+                         const int case_sensitive, const int only_usascii,
+                         const PHYSFS_uint64 entrycount)
 {
-    static char rootpath[2] = { '/', '\0' };
     size_t alloclen;
 
     assert(entrylen >= sizeof (__PHYSFS_DirTreeEntry));
@@ -3313,53 +6295,162 @@ int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int
     memset(dt, '\0', sizeof (*dt));
     dt->case_sensitive = case_sensitive;
     dt->only_usascii = only_usascii;
+    dt->entrylen = entrylen;
 
-    dt->root = (__PHYSFS_DirTreeEntry *) allocator.Malloc(entrylen);
-    BAIL_IF(!dt->root, PHYSFS_ERR_OUT_OF_MEMORY, 0);
-    memset(dt->root, '\0', entrylen);
-    dt->root->name = rootpath;
-    dt->root->isdir = 1;
+    /* Size for the caller's guess up front; the hash grows past it if needed.
+       Don't trust a huge guess, it might come from a corrupt archive. */
     dt->hashBuckets = 64;
-    if (!dt->hashBuckets)
-        dt->hashBuckets = 1;
-    dt->entrylen = entrylen;
+    while ((dt->hashBuckets < entrycount) && (dt->hashBuckets < (1 << 20)))
+        dt->hashBuckets *= 2;
 
-    alloclen = dt->hashBuckets * sizeof (__PHYSFS_DirTreeEntry *);
-    dt->hash = (__PHYSFS_DirTreeEntry **) allocator.Malloc(alloclen);
+    /* Blocks of entries fit the guess, within reason, so small trees don't
+       waste much; without a guess, they're middling. */
+    dt->slotShift = entrycount ? 4 : 8;
+    while ((dt->slotShift < 12) && ((((PHYSFS_uint64) 1) << dt->slotShift) <= entrycount))
+        dt->slotShift++;
+
+    dt->nameAvail = 256;
+    while ((dt->nameAvail < DIRTREE_NAMEBLOCK) && ((dt->nameAvail / 16) < entrycount))
+        dt->nameAvail *= 2;
+
+    alloclen = dt->hashBuckets * sizeof (PHYSFS_uint32);
+    dt->hash = (PHYSFS_uint32 *) allocator.Malloc(alloclen);
     BAIL_IF(!dt->hash, PHYSFS_ERR_OUT_OF_MEMORY, 0);
     memset(dt->hash, '\0', alloclen);
 
+    dt->root = dirTreeAllocEntry(dt, 0);
+    BAIL_IF_ERRPASS(!dt->root, 0);
+    BAIL_IF_ERRPASS(!dirTreeAddName(dt, dt->root, ""), 0);
+    dt->root->isdir = 1;
+
     return 1;
 } /* __PHYSFS_DirTreeInit */
 
 
-static PHYSFS_uint32 hashPathName(__PHYSFS_DirTree *dt, const char *name)
+static PHYSFS_uint32 hashPathName(const __PHYSFS_DirTree *dt, const char *name)
 {
-    const PHYSFS_uint32 hashval = dt->case_sensitive ? __PHYSFS_hashString(name) : dt->only_usascii ? __PHYSFS_hashStringCaseFoldUSAscii(name) : __PHYSFS_hashStringCaseFold(name);
-    return hashval % dt->hashBuckets;
+    return dt->case_sensitive ? __PHYSFS_hashString(name) : dt->only_usascii ? __PHYSFS_hashStringCaseFoldUSAscii(name) : __PHYSFS_hashStringCaseFold(name);
 } /* hashPathName */
 
 
-/* Fill in missing parent directories. */
-static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
+/* Double the hash buckets. hashBuckets is always a power of two. */
+static void growDirTreeHash(__PHYSFS_DirTree *dt)
+{
+    const size_t newBuckets = dt->hashBuckets * 2;
+    const size_t alloclen = newBuckets * sizeof (PHYSFS_uint32);
+    PHYSFS_uint32 *newHash;
+    size_t i;
+
+    newHash = (PHYSFS_uint32 *) allocator.Malloc(alloclen);
+    if (!newHash)
+        return;  /* not fatal, the chains just get longer. */
+    memset(newHash, '\0', alloclen);
+
+    /* oldest first, so each chain still runs from newest to oldest. */
+    for (i = 1; i <= dt->entries; i++)
+    {
+        __PHYSFS_DirTreeEntry *entry = dirTreeEntry(dt, i);
+        const size_t bucket = entry->hash & (newBuckets - 1);
+        entry->hashnext = newHash[bucket];
+        newHash[bucket] = (PHYSFS_uint32) i;
+    } /* for */
+
+    allocator.Free(dt->hash);
+    dt->hash = newHash;
+    dt->hashBuckets = newBuckets;
+} /* growDirTreeHash */
+
+
+/* The number of the entry at (path), or DIRTREE_NONE. */
+static PHYSFS_uint32 dirTreeFindIndex(const __PHYSFS_DirTree *dt,
+                                      const char *path)
+{
+    PHYSFS_uint32 hashval;
+    size_t limit = dt->entries + 1;
+    size_t idx;
+
+    if (*path == '\0')
+        return 0;
+
+    /* the chains are short, and lookups don't write to the tree, so there's
+       no move-to-front here. Check the full hash before comparing strings.
+       Chains only go to older entries, so (limit) keeps them finite. */
+    hashval = hashPathName(dt, path);
+    idx = dt->hash[hashval & (PHYSFS_uint32) (dt->hashBuckets - 1)];
+    while ((idx != 0) && (idx < limit))
+    {
+        const __PHYSFS_DirTreeEntry *entry = dirTreeEntry(dt, idx);
+        if ((entry->hash == hashval) && (__PHYSFS_DirTreeIsPath(dt, entry, path)))
+            return (PHYSFS_uint32) idx;
+        limit = idx;
+        idx = entry->hashnext;
+    } /* while */
+
+    return DIRTREE_NONE;
+} /* dirTreeFindIndex */
+
+
+/*
+ * Hook a new entry up as number (dt->entries + 1) under entry number
+ *  (parent), with its own copy of (name).
+ */
+static __PHYSFS_DirTreeEntry *dirTreeNewEntry(__PHYSFS_DirTree *dt,
+                                              const char *name,
+                                              const PHYSFS_uint32 hash,
+                                              const PHYSFS_uint32 parent,
+                                              const int isdir)
+{
+    const size_t idx = dt->entries + 1;
+    __PHYSFS_DirTreeEntry *parentry = dirTreeEntry(dt, parent);
+    __PHYSFS_DirTreeEntry *retval;
+    PHYSFS_uint32 bucket;
+
+    BAIL_IF(dt->image, PHYSFS_ERR_READ_ONLY, NULL);
+    BAIL_IF(!parentry->isdir, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(idx >= DIRTREE_NONE, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    retval = dirTreeAllocEntry(dt, idx);
+    BAIL_IF_ERRPASS(!retval, NULL);
+    BAIL_IF_ERRPASS(!dirTreeAddName(dt, retval, name), NULL);
+    retval->hash = hash;
+    retval->isdir = isdir ? 1 : 0;
+
+    if (dt->entries >= dt->hashBuckets)
+        growDirTreeHash(dt);
+    bucket = hash & (PHYSFS_uint32) (dt->hashBuckets - 1);
+    retval->hashnext = dt->hash[bucket];
+    dt->hash[bucket] = (PHYSFS_uint32) idx;
+
+    retval->parent = parent;
+    retval->sibling = parentry->children;
+    parentry->children = (PHYSFS_uint32) idx;
+    dt->entries = idx;
+    return retval;
+} /* dirTreeNewEntry */
+
+
+/* Fill in missing parent directories. Returns the parent's number, or
+   DIRTREE_NONE on failure. */
+static PHYSFS_uint32 addAncestors(__PHYSFS_DirTree *dt, char *name)
 {
-    __PHYSFS_DirTreeEntry *retval = dt->root;
+    PHYSFS_uint32 retval = 0;
     char *sep = strrchr(name, '/');
 
     if (sep)
     {
         *sep = '\0';  /* chop off last piece. */
-        retval = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(dt, name);
+        retval = dirTreeFindIndex(dt, name);
 
-        if (retval != NULL)
+        if (retval != DIRTREE_NONE)
         {
             *sep = '/';
-            BAIL_IF(!retval->isdir, PHYSFS_ERR_CORRUPT, NULL);
+            BAIL_IF(!dirTreeEntry(dt, retval)->isdir, PHYSFS_ERR_CORRUPT, DIRTREE_NONE);
             return retval;  /* already hashed. */
         } /* if */
 
         /* okay, this is a new dir. Build and hash us. */
-        retval = (__PHYSFS_DirTreeEntry*)__PHYSFS_DirTreeAdd(dt, name, 1);
+        if (__PHYSFS_DirTreeAdd(dt, name, 1) != NULL)
+            retval = (PHYSFS_uint32) dt->entries;
         *sep = '/';
     } /* if */
 
@@ -3369,62 +6460,190 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
 
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir)
 {
-    __PHYSFS_DirTreeEntry *retval = __PHYSFS_DirTreeFind(dt, name);
-    if (!retval)
+    const PHYSFS_uint32 idx = dirTreeFindIndex(dt, name);
+    if (idx == DIRTREE_NONE)
     {
-        const size_t alloclen = strlen(name) + 1 + dt->entrylen;
-        PHYSFS_uint32 hashval;
-        __PHYSFS_DirTreeEntry *parent = addAncestors(dt, name);
-        BAIL_IF_ERRPASS(!parent, NULL);
-        assert(dt->entrylen >= sizeof (__PHYSFS_DirTreeEntry));
-        retval = (__PHYSFS_DirTreeEntry *) allocator.Malloc(alloclen);
-        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-        memset(retval, '\0', dt->entrylen);
-        retval->name = ((char *) retval) + dt->entrylen;
-        strcpy(retval->name, name);
-        hashval = hashPathName(dt, name);
-        retval->hashnext = dt->hash[hashval];
-        dt->hash[hashval] = retval;
-        retval->sibling = parent->children;
-        retval->isdir = isdir;
-        parent->children = retval;
+        /* only the last path element is stored; the parents have the rest. */
+        const char *sep = strrchr(name, '/');
+        const char *leaf = sep ? sep + 1 : name;
+        const PHYSFS_uint32 parent = addAncestors(dt, name);
+        BAIL_IF_ERRPASS(parent == DIRTREE_NONE, NULL);
+        return dirTreeNewEntry(dt, leaf, hashPathName(dt, name), parent, isdir);
     } /* if */
 
-    return retval;
+    return dirTreeEntry(dt, idx);
 } /* __PHYSFS_DirTreeAdd */
 
 
-/* Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation. */
-void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
+void *__PHYSFS_DirTreeAddUnique(__PHYSFS_DirTree *dt, const char *name,
+                                const PHYSFS_uint32 hash,
+                                const PHYSFS_uint32 parent, const int isdir)
 {
-    const int cs = dt->case_sensitive;
-    PHYSFS_uint32 hashval;
-    __PHYSFS_DirTreeEntry *prev = NULL;
-    __PHYSFS_DirTreeEntry *retval;
+    BAIL_IF(parent > dt->entries, PHYSFS_ERR_CORRUPT, NULL);
+    return dirTreeNewEntry(dt, name, hash, parent, isdir);
+} /* __PHYSFS_DirTreeAddUnique */
 
-    if (*path == '\0')
+
+void *__PHYSFS_DirTreeEntryAt(const __PHYSFS_DirTree *dt,
+                              const PHYSFS_uint32 idx)
+{
+    return (idx > dt->entries) ? NULL : dirTreeEntry(dt, idx);
+} /* __PHYSFS_DirTreeEntryAt */
+
+
+const char *__PHYSFS_DirTreeName(const __PHYSFS_DirTree *dt,
+                                 const void *entry)
+{
+    const PHYSFS_uint32 name = ((const __PHYSFS_DirTreeEntry *) entry)->name;
+    const size_t block = (size_t) (name >> DIRTREE_NAMESHIFT);
+    if (block >= dt->nameBlocks)
+        return "";  /* can't happen, unless the tree is damaged. */
+    else if (dt->namePool)
+        return dt->namePool + name;  /* blocks are end to end here. */
+    return dt->names[block] + (name & (DIRTREE_NAMEBLOCK - 1));
+} /* __PHYSFS_DirTreeName */
+
+
+/*
+ * (entry)'s parent; (entry) mustn't be the root. Parents always have
+ *  smaller numbers than their kids, so (*limit) drops with each step up,
+ *  and a damaged tree just looks like it reaches the root early.
+ */
+static const __PHYSFS_DirTreeEntry *dirTreeParent(const __PHYSFS_DirTree *dt,
+                                            const __PHYSFS_DirTreeEntry *entry,
+                                            size_t *limit)
+{
+    const PHYSFS_uint32 parent = entry->parent;
+    if (parent >= *limit)
         return dt->root;
+    *limit = parent;
+    return dirTreeEntry(dt, parent);
+} /* dirTreeParent */
 
-    hashval = hashPathName(dt, path);
-    for (retval = dt->hash[hashval]; retval; retval = retval->hashnext)
+
+/* Does (name) match the (len) bytes at (elem), ignoring case? */
+static int dirTreeElementMatchesCaseFold(const char *name, const char *elem,
+                                         const size_t len)
+{
+    const char *end = elem + len;
+    PHYSFS_uint32 folded1[3], folded2[3];
+    int head1 = 0, tail1 = 0, head2 = 0, tail2 = 0;
+
+    /* this is PHYSFS_utf8stricmp(), but (elem) isn't null-terminated. */
+    while (1)
     {
-        const int cmp = cs ? strcmp(retval->name, path) : PHYSFS_utf8stricmp(retval->name, path);
-        if (cmp == 0)
+        PHYSFS_uint32 cp1, cp2;
+
+        if (head1 != tail1)
+            cp1 = folded1[tail1++];
+        else
         {
-            if (prev != NULL)  /* move this to the front of the list */
-            {
-                prev->hashnext = retval->hashnext;
-                retval->hashnext = dt->hash[hashval];
-                dt->hash[hashval] = retval;
-            } /* if */
+            head1 = PHYSFS_caseFold(__PHYSFS_utf8codepoint(&name), folded1);
+            cp1 = folded1[0];
+            tail1 = 1;
+        } /* else */
 
-            return retval;
+        if (head2 != tail2)
+            cp2 = folded2[tail2++];
+        else if (elem >= end)
+        {
+            head2 = tail2 = 0;
+            cp2 = 0;
+        } /* else if */
+        else
+        {
+            head2 = PHYSFS_caseFold(__PHYSFS_utf8codepoint(&elem), folded2);
+            cp2 = folded2[0];
+            tail2 = 1;
+        } /* else */
+
+        if (cp1 != cp2)
+            return 0;
+        else if (cp1 == 0)
+            return 1;
+    } /* while */
+} /* dirTreeElementMatchesCaseFold */
+
+
+/* Entries only keep their last element, so walk up through the parents,
+   matching (path) from the end. */
+int __PHYSFS_DirTreeIsPath(const __PHYSFS_DirTree *dt, const void *_entry,
+                           const char *path)
+{
+    const __PHYSFS_DirTreeEntry *entry = (const __PHYSFS_DirTreeEntry *) _entry;
+    const char *end = path + strlen(path);
+    size_t limit = dt->entries + 1;
+
+    while (entry != dt->root)
+    {
+        const char *name = __PHYSFS_DirTreeName(dt, entry);
+        const char *elem = end;
+        size_t len;
+
+        while ((elem > path) && (elem[-1] != '/'))
+            elem--;
+        len = (size_t) (end - elem);
+
+        if (dt->case_sensitive)
+        {
+            if ((strncmp(name, elem, len) != 0) || (name[len]))
+                return 0;
         } /* if */
+        else if (!dirTreeElementMatchesCaseFold(name, elem, len))
+            return 0;
+
+        entry = dirTreeParent(dt, entry, &limit);
+        if (elem == path)
+            return (entry == dt->root);
+        end = elem - 1;
+    } /* while */
+
+    return 0;  /* (path) goes deeper than (entry) does. */
+} /* __PHYSFS_DirTreeIsPath */
+
+
+size_t __PHYSFS_DirTreePath(const __PHYSFS_DirTree *dt, const void *entry,
+                            char *buf, const size_t buflen)
+{
+    const __PHYSFS_DirTreeEntry *i;
+    const __PHYSFS_DirTreeEntry *parent;
+    size_t limit = dt->entries + 1;
+    size_t len = 0;
+    char *ptr;
 
-        prev = retval;
+    for (i = (const __PHYSFS_DirTreeEntry *) entry; i != dt->root; i = parent)
+    {
+        parent = dirTreeParent(dt, i, &limit);
+        len += strlen(__PHYSFS_DirTreeName(dt, i)) + ((parent != dt->root) ? 1 : 0);
     } /* for */
 
-    BAIL(PHYSFS_ERR_NOT_FOUND, NULL);
+    if (len < buflen)
+    {
+        limit = dt->entries + 1;
+        ptr = buf + len;
+        *ptr = '\0';
+        for (i = (const __PHYSFS_DirTreeEntry *) entry; i != dt->root; i = parent)
+        {
+            const char *name = __PHYSFS_DirTreeName(dt, i);
+            const size_t elemlen = strlen(name);
+            parent = dirTreeParent(dt, i, &limit);
+            ptr -= elemlen;
+            memcpy(ptr, name, elemlen);
+            if (parent != dt->root)
+                *(--ptr) = '/';
+        } /* for */
+    } /* if */
+
+    return len;
+} /* __PHYSFS_DirTreePath */
+
+
+/* Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation. */
+void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
+{
+    const PHYSFS_uint32 idx = dirTreeFindIndex(dt, path);
+    BAIL_IF(idx == DIRTREE_NONE, PHYSFS_ERR_NOT_FOUND, NULL);
+    return dirTreeEntry(dt, idx);
 } /* __PHYSFS_DirTreeFind */
 
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
@@ -3434,51 +6653,199 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
     __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) opaque;
     const __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
-    BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
+    size_t limit = tree->entries + 1;
+    size_t idx;
 
-    entry = entry->children;
+    BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
 
-    while (entry && (retval == PHYSFS_ENUM_OK))
+    /* siblings only go to older entries, so (limit) keeps this finite. */
+    idx = entry->children;
+    while ((idx != 0) && (idx < limit) && (retval == PHYSFS_ENUM_OK))
     {
-        const char *name = entry->name;
-        const char *ptr = strrchr(name, '/');
-        retval = cb(callbackdata, origdir, ptr ? ptr + 1 : name);
+        entry = dirTreeEntry(tree, idx);
+        retval = cb(callbackdata, origdir, __PHYSFS_DirTreeName(tree, entry));
         BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
-        entry = entry->sibling;
+        limit = idx;
+        idx = entry->sibling;
     } /* while */
 
     return retval;
 } /* __PHYSFS_DirTreeEnumerate */
 
 
+/*
+ * A tree's image is this header, then every entry from the root on, then
+ *  the hash buckets, then (nameBlocks) blocks of DIRTREE_NAMEBLOCK bytes of
+ *  names, each part padded out to 8 bytes. Names are packed again so none
+ *  crosses a block, and entries' (name) are fixed up to match, so a mapped
+ *  tree can find a name with one addition. Blocks are zero-padded, so the
+ *  image always ends with a null terminator, whatever else is damaged.
+ */
+typedef struct
+{
+    PHYSFS_uint32 entrylen;
+    PHYSFS_uint32 entries;
+    PHYSFS_uint32 hashBuckets;
+    PHYSFS_uint32 nameBlocks;
+    PHYSFS_uint32 flags;  /* DIRTREE_IMAGE_* */
+    PHYSFS_uint32 unused;
+} DirTreeImageHeader;
+
+#define DIRTREE_IMAGE_CASE_SENSITIVE (1 << 0)
+#define DIRTREE_IMAGE_ONLY_USASCII   (1 << 1)
+#define DIRTREE_IMAGE_HAS_SYMLINKS   (1 << 2)
+#define DIRTREE_IMAGE_PAD(x) ((((PHYSFS_uint64) (x)) + 7) & ~((PHYSFS_uint64) 7))
+
+/* Where (name), (len) bytes with its null, goes when packing an image. */
+static PHYSFS_uint32 dirTreeImageName(size_t *block, size_t *used,
+                                      const size_t len)
+{
+    if ((DIRTREE_NAMEBLOCK - *used) < len)
+    {
+        (*block)++;
+        *used = 0;
+    } /* if */
+    *used += len;
+    return (PHYSFS_uint32) ((*block << DIRTREE_NAMESHIFT) | (*used - len));
+} /* dirTreeImageName */
+
+
+void *__PHYSFS_DirTreeImage(const __PHYSFS_DirTree *dt, PHYSFS_uint64 *_len)
+{
+    const PHYSFS_uint64 entrieslen = DIRTREE_IMAGE_PAD((dt->entries + 1) * dt->entrylen);
+    const PHYSFS_uint64 hashlen = DIRTREE_IMAGE_PAD(dt->hashBuckets * sizeof (PHYSFS_uint32));
+    DirTreeImageHeader *hdr;
+    PHYSFS_uint8 *retval;
+    PHYSFS_uint8 *ptr;
+    PHYSFS_uint64 len;
+    size_t block = 0;
+    size_t used = 0;
+    size_t i;
+
+    for (i = 0; i <= dt->entries; i++)
+        dirTreeImageName(&block, &used, strlen(__PHYSFS_DirTreeName(dt, dirTreeEntry(dt, i))) + 1);
+
+    BAIL_IF(block >= DIRTREE_MAXNAMEBLOCKS, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    len = sizeof (*hdr) + entrieslen + hashlen + ((block + 1) * DIRTREE_NAMEBLOCK);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len), PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    retval = (PHYSFS_uint8 *) allocator.Malloc((size_t) len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(retval, '\0', (size_t) len);
+
+    hdr = (DirTreeImageHeader *) retval;
+    hdr->entrylen = (PHYSFS_uint32) dt->entrylen;
+    hdr->entries = (PHYSFS_uint32) dt->entries;
+    hdr->hashBuckets = (PHYSFS_uint32) dt->hashBuckets;
+    hdr->nameBlocks = (PHYSFS_uint32) (block + 1);
+    hdr->flags = (dt->case_sensitive ? DIRTREE_IMAGE_CASE_SENSITIVE : 0) |
+                 (dt->only_usascii ? DIRTREE_IMAGE_ONLY_USASCII : 0) |
+                 (dt->has_symlinks ? DIRTREE_IMAGE_HAS_SYMLINKS : 0);
+
+    /* same packing as the first pass, so it fits the same way. */
+    ptr = retval + sizeof (*hdr);
+    block = used = 0;
+    for (i = 0; i <= dt->entries; i++)
+    {
+        const __PHYSFS_DirTreeEntry *entry = dirTreeEntry(dt, i);
+        __PHYSFS_DirTreeEntry *copy = (__PHYSFS_DirTreeEntry *) (ptr + (i * dt->entrylen));
+        const char *name = __PHYSFS_DirTreeName(dt, entry);
+        const size_t namelen = strlen(name) + 1;
+        memcpy(copy, entry, dt->entrylen);
+        copy->name = dirTreeImageName(&block, &used, namelen);
+        memcpy(ptr + entrieslen + hashlen + copy->name, name, namelen);
+    } /* for */
+
+    memcpy(ptr + entrieslen, dt->hash, dt->hashBuckets * sizeof (PHYSFS_uint32));
+
+    *_len = len;
+    return retval;
+} /* __PHYSFS_DirTreeImage */
+
+
+int __PHYSFS_DirTreeMap(__PHYSFS_DirTree *dt, void *image,
+                        const PHYSFS_uint64 len, const size_t entrylen,
+                        const int case_sensitive, const int only_usascii)
+{
+    const DirTreeImageHeader *hdr = (const DirTreeImageHeader *) image;
+    const PHYSFS_uint32 flags = (case_sensitive ? DIRTREE_IMAGE_CASE_SENSITIVE : 0) |
+                                (only_usascii ? DIRTREE_IMAGE_ONLY_USASCII : 0);
+    PHYSFS_uint8 *ptr = ((PHYSFS_uint8 *) image) + sizeof (*hdr);
+    PHYSFS_uint64 entrieslen, hashlen;
+
+    memset(dt, '\0', sizeof (*dt));
+
+    /* entries are one block, so (slotShift) has to cover them all. */
+    if ((len < sizeof (*hdr)) || (hdr->entrylen != entrylen))
+        return 0;
+    else if (hdr->entries >= 0x7FFFFFFF)
+        return 0;
+    else if ((hdr->flags & ~DIRTREE_IMAGE_HAS_SYMLINKS) != flags)
+        return 0;
+    /* Init never makes fewer than 64 buckets, so something reading a little
+       past the last entry of a damaged image still stays inside it. */
+    else if ((hdr->hashBuckets < 64) || (hdr->hashBuckets & (hdr->hashBuckets - 1)))
+        return 0;
+    else if ((hdr->nameBlocks == 0) || (hdr->nameBlocks > DIRTREE_MAXNAMEBLOCKS))
+        return 0;
+
+    entrieslen = DIRTREE_IMAGE_PAD((((PHYSFS_uint64) hdr->entries) + 1) * entrylen);
+    hashlen = DIRTREE_IMAGE_PAD(((PHYSFS_uint64) hdr->hashBuckets) * sizeof (PHYSFS_uint32));
+    if (len != (sizeof (*hdr) + entrieslen + hashlen + (((PHYSFS_uint64) hdr->nameBlocks) * DIRTREE_NAMEBLOCK)))
+        return 0;
+    else if (((const char *) image)[len - 1] != '\0')
+        return 0;
+
+    dt->slots = (PHYSFS_uint8 **) allocator.Malloc(sizeof (PHYSFS_uint8 *));
+    BAIL_IF(!dt->slots, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    dt->slots[0] = ptr;
+    dt->slotBlocks = 1;
+    dt->slotShift = 31;
+    dt->hash = (PHYSFS_uint32 *) (ptr + entrieslen);
+    dt->hashBuckets = hdr->hashBuckets;
+    dt->entries = hdr->entries;
+    dt->namePool = (const char *) (ptr + entrieslen + hashlen);
+    dt->nameBlocks = hdr->nameBlocks;
+    dt->entrylen = entrylen;
+    dt->case_sensitive = case_sensitive;
+    dt->only_usascii = only_usascii;
+    dt->has_symlinks = ((hdr->flags & DIRTREE_IMAGE_HAS_SYMLINKS) != 0);
+    dt->image = image;
+    dt->root = (__PHYSFS_DirTreeEntry *) ptr;
+    return 1;
+} /* __PHYSFS_DirTreeMap */
+
+
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
 {
+    size_t i;
+
     if (!dt)
         return;
 
     if (dt->root)
     {
-        assert(dt->root->sibling == NULL);
-        assert(dt->hash || (dt->root->children == NULL));
-        allocator.Free(dt->root);
+        assert(dt->root->sibling == 0);
+        assert(dt->hash || (dt->root->children == 0));
     } /* if */
 
-    if (dt->hash)
+    if (dt->image)  /* everything but (slots) is in there. */
     {
-        size_t i;
-        for (i = 0; i < dt->hashBuckets; i++)
-        {
-            __PHYSFS_DirTreeEntry *entry;
-            __PHYSFS_DirTreeEntry *next;
-            for (entry = dt->hash[i]; entry; entry = next)
-            {
-                next = entry->hashnext;
-                allocator.Free(entry);
-            } /* for */
-        } /* for */
-        allocator.Free(dt->hash);
+        allocator.Free(dt->slots);
+        return;
     } /* if */
+
+    if (dt->hash)
+        allocator.Free(dt->hash);
+
+    for (i = 0; i < dt->slotBlocks; i++)
+        allocator.Free(dt->slots[i]);
+    if (dt->slots)
+        allocator.Free(dt->slots);
+
+    for (i = 0; i < dt->nameBlocks; i++)
+        allocator.Free(dt->names[i]);
+    if (dt->names)
+        allocator.Free(dt->names);
 } /* __PHYSFS_DirTreeDeinit */
 
 /* end of physfs.c ... */
-
@@ -3484,6 +3484,25 @@ extern PHYSFS_DECL PHYSFS_sint64 PHYSFS_CALL PHYSFS_readBytes(PHYSFS_File *handl
 extern PHYSFS_DECL PHYSFS_sint64 PHYSFS_CALL PHYSFS_writeBytes(PHYSFS_File *handle, const void *buffer, PHYSFS_uint64 len);
 
 
+/**
+ * \enum PHYSFS_IoHint
+ * \brief How a PHYSFS_Io is about to be read.
+ *
+ * These are passed to the hint() method of a PHYSFS_Io. They're only
+ *  advice, and an implementation is free to ignore them.
+ *
+ * \since This enum is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_Io
+ */
+typedef enum PHYSFS_IoHint
+{
+    PHYSFS_IOHINT_NORMAL,     /**< No particular pattern; the default. */
+    PHYSFS_IOHINT_SEQUENTIAL, /**< Mostly front to back; read ahead more. */
+    PHYSFS_IOHINT_RANDOM      /**< Jumping around; don't read ahead. */
+} PHYSFS_IoHint;
+
+
 /**
  * An abstract i/o interface.
  *
@@ -3521,7 +3540,8 @@ extern PHYSFS_DECL PHYSFS_sint64 PHYSFS_CALL PHYSFS_writeBytes(PHYSFS_File *hand
  *               the library provides its own locks. If you plan to use them
  *               directly from separate threads, you should either use mutexes
  *               to protect them, or don't use the same PHYSFS_Io from two
- *               threads at the same time.
+ *               threads at the same time. The exception is readAt(), which
+ *               must be safe to call from any thread at any time.
  *
  * \since This struct is available since PhysicsFS 2.1.0.
  *
@@ -3532,9 +3552,12 @@ typedef struct PHYSFS_Io
     /**
      * Binary compatibility information.
      *
-     * This must be set to zero at this time. Future versions of this
-     * struct will increment this field, so we know what a given
-     * implementation supports. We'll presumably keep supporting older
+     * This must be set to zero or one at this time. Version 1 adds the
+     * optional readAt(), map() and hint() methods at the end of the struct;
+     * a version 0 implementation doesn't have those fields at all, so it
+     * can keep using the smaller struct it was compiled against. Future
+     * versions of this struct will increment this field, so we know what a
+     * given implementation supports. We'll presumably keep supporting older
      * versions as we offer new features, though.
      */
     PHYSFS_uint32 version;
@@ -3687,6 +3710,67 @@ typedef struct PHYSFS_Io
      * \param io The i/o instance to destroy.
      */
     void (PHYSFS_CALL *destroy)(struct PHYSFS_Io *io);
+
+    /**
+     * Read data from a given offset, without moving the i/o position.
+     *
+     * Read `len` bytes starting at byte `offset` and store them in `buf`.
+     * Unlike read(), this doesn't use or change the current i/o position,
+     * so it must be safe to call from several threads at once on the same
+     * instance, and at the same time as any other method but destroy().
+     * Archivers use it to read members of an archive straight from the
+     * archive's i/o instead of duplicating it for every open file.
+     *
+     * This field only exists if `version` is at least 1. You don't have to
+     * implement this; set it to NULL if not implemented, and PhysicsFS will
+     * use duplicate(), seek() and read() instead.
+     *
+     * \param io The i/o instance to read from.
+     * \param buf The buffer to store data into. It must be at least
+     *            `len` bytes long and can't be NULL.
+     * \param len The number of bytes to read from the interface.
+     * \param offset The byte offset to start reading at.
+     * \returns number of bytes read, which is only less than `len` at
+     *          the end of the data, or -1 on complete failure.
+     */
+    PHYSFS_sint64 (PHYSFS_CALL *readAt)(struct PHYSFS_Io *io, void *buf,
+                                        PHYSFS_uint64 len,
+                                        PHYSFS_uint64 offset);
+
+    /**
+     * Get a pointer to the data at a given offset, without copying it.
+     *
+     * If the `len` bytes starting at `offset` are already in memory, return
+     * a read-only pointer to them. The pointer must stay valid until this
+     * instance is destroyed. Return NULL if that range isn't in memory or
+     * is past the end of the data; that isn't an error, the caller will
+     * read it instead.
+     *
+     * This field only exists if `version` is at least 1. You don't have to
+     * implement this; set it to NULL if not implemented.
+     *
+     * \param io The i/o instance to map.
+     * \param offset The byte offset of the first byte wanted.
+     * \param len The number of bytes wanted.
+     * \returns A pointer to the data, or NULL if it can't be mapped.
+     */
+    const void *(PHYSFS_CALL *map)(struct PHYSFS_Io *io, PHYSFS_uint64 offset,
+                                   PHYSFS_uint64 len);
+
+    /**
+     * Say how this i/o instance is about to be read.
+     *
+     * This is advice only: an implementation might use it to turn its
+     * readahead up or down, or pass it on to the OS. It can't fail, and
+     * ignoring it must not change the results of any read.
+     *
+     * This field only exists if `version` is at least 1. You don't have to
+     * implement this; set it to NULL if not implemented.
+     *
+     * \param io The i/o instance to advise.
+     * \param hint How the data will be read.
+     */
+    void (PHYSFS_CALL *hint)(struct PHYSFS_Io *io, PHYSFS_IoHint hint);
 } PHYSFS_Io;
 
 
@@ -4449,6 +4533,737 @@ extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_setRoot(const char *archive, const cha
 /* Everything above this line is part of the PhysicsFS 3.1 API. */
 
 
+/**
+ * Enable or disable the search path index.
+ *
+ * Normally, looking up a file in the search path asks each mounted archive,
+ * in order, if it has that file. With hundreds of archives mounted, most of
+ * those questions are answered "no," and that adds up.
+ *
+ * With the index enabled, PhysicsFS keeps a single table of every path in
+ * the interpolated tree that is provided by archives whose contents are
+ * known up front (ZIP, 7z, GRP, WAD, and most other archive types, but not
+ * directories on the physical filesystem). PHYSFS_openRead(), PHYSFS_stat(),
+ * PHYSFS_exists() and PHYSFS_getRealDir() then only ask the archives that
+ * actually have the requested path, plus any archives that couldn't be
+ * indexed (physical directories, case-insensitive archives, archives with
+ * symlinks or a root set by PHYSFS_setRoot()).
+ *
+ * The results of these functions are the same either way; this only
+ * changes how much work they do. The index costs memory proportional to the
+ * number of files in indexed archives, and is updated as archives are
+ * mounted and unmounted. It is built the first time it's needed after
+ * being enabled.
+ *
+ * The index is disabled by default, and is disabled again by PHYSFS_deinit().
+ *
+ * \param enable nonzero to use the index, zero to free it and stop using it.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_searchPathIndexed
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_indexSearchPath(int enable);
+
+
+/**
+ * Determine if the search path index is enabled.
+ *
+ * This reports the setting from the last call to PHYSFS_indexSearchPath().
+ * If PHYSFS_indexSearchPath() hasn't been called since the library was last
+ * initialized, the index is disabled.
+ *
+ * \returns non-zero if the search path index is enabled, zero if not.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_indexSearchPath
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_searchPathIndexed(void);
+
+
+/**
+ * Let threads that only read the search path run at the same time.
+ *
+ * PhysicsFS protects its state with a single lock, so if several threads
+ * call PHYSFS_openRead(), PHYSFS_stat(), PHYSFS_enumerate() or
+ * PHYSFS_close() at the same time, they take turns, even though none of
+ * them change anything. Reading from and writing to already-open files
+ * doesn't take that lock, so this only matters for the lookups.
+ *
+ * With concurrent reads enabled, those functions (and the ones built on
+ * them, like PHYSFS_exists() and PHYSFS_getRealDir()) only share the search
+ * path with each other. Changing the search path (PHYSFS_mount() and
+ * friends, PHYSFS_unmount(), PHYSFS_setRoot(), PHYSFS_setWriteDir(),
+ * PHYSFS_indexSearchPath()) waits for the readers to finish, and readers
+ * wait for the change to finish, but a mount doesn't lock out readers while
+ * it opens the archive, just while it adds it to the search path.
+ *
+ * A few things behave differently in this mode:
+ *
+ * - PHYSFS_enumerate() callbacks run without the lock held, so other threads
+ *   can change the search path while your callback runs. You'll still get
+ *   each archive's results from that archive, but the search path might not
+ *   look the same from one callback to the next. PHYSFS_unmount() fails with
+ *   PHYSFS_ERR_FILES_STILL_OPEN for an archive that's being enumerated,
+ *   even by another thread (without concurrent reads, only an unmount from
+ *   the callback itself can see that).
+ * - PHYSFS_close() closes files opened for reading without the lock held.
+ *   Until it returns, PHYSFS_unmount() fails with
+ *   PHYSFS_ERR_FILES_STILL_OPEN for the file's archive, just as if the
+ *   file were still open. If you unmount while other threads might be
+ *   closing files or enumerating, be ready to try again.
+ * - Archivers you register with PHYSFS_registerArchiver() have their
+ *   openRead, stat and enumerate methods called from several threads at
+ *   once, so they need to be able to handle that. The built-in archivers
+ *   can.
+ * - If the search path index is enabled (see PHYSFS_indexSearchPath()),
+ *   it's rebuilt when the search path changes, instead of the next time
+ *   it's needed.
+ *
+ * Concurrent reads are disabled by default, and are disabled again by
+ * PHYSFS_deinit(). They aren't available on all platforms; this fails with
+ * PHYSFS_ERR_UNSUPPORTED if you try to enable them where they aren't.
+ * Disabling them always succeeds.
+ *
+ * \param allow nonzero to let readers run concurrently, zero to serialize
+ *              them again.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_concurrentReadsAllowed
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_allowConcurrentReads(int allow);
+
+
+/**
+ * Determine if concurrent reads are enabled.
+ *
+ * This reports the setting from the last successful call to
+ * PHYSFS_allowConcurrentReads(). If it hasn't been called since the library
+ * was last initialized, concurrent reads are disabled.
+ *
+ * \returns non-zero if concurrent reads are enabled, zero if not.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_allowConcurrentReads
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_concurrentReadsAllowed(void);
+
+
+/**
+ * See how well lookups are skipping archives that don't have a file.
+ *
+ * When an archive whose contents are known up front (ZIP, 7z, GRP, WAD, and
+ * most other archive types, but not directories on the physical filesystem)
+ * is mounted, PhysicsFS builds a small filter from every path it provides.
+ * PHYSFS_openRead(), PHYSFS_stat(), PHYSFS_exists() and PHYSFS_getRealDir()
+ * check it before asking the archive about a path, and skip the archive if
+ * the filter says it definitely doesn't have it. Case-insensitive archives
+ * aren't filtered, and archives that the search path index already covers
+ * (see PHYSFS_indexSearchPath()) don't need it.
+ *
+ * The filter can be wrong in one direction: sometimes it lets a lookup
+ * through to an archive that turns out not to have the path. This reports
+ * how often each thing happened since the library was initialized, so you
+ * can tell if it's earning its keep. With the default sizing, false
+ * positives should be well under one percent of the lookups that reach
+ * filtered archives and miss.
+ *
+ * A lookup that reaches an archive that does have the path, but fails
+ * anyhow (opening a directory for reading, for example), counts as a false
+ * positive too. The counters wrap around when they overflow.
+ *
+ * \param rejected If not NULL, receives the number of times a filter let
+ *                 a lookup skip an archive.
+ * \param falsePositives If not NULL, receives the number of times a filter
+ *                       let a lookup through to an archive that didn't
+ *                       satisfy it.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_indexSearchPath
+ */
+extern PHYSFS_DECL void PHYSFS_CALL PHYSFS_getLookupFilterStats(PHYSFS_uint32 *rejected, PHYSFS_uint32 *falsePositives);
+
+
+/**
+ * Get information about a lot of files at once.
+ *
+ * This gives the same results as calling PHYSFS_stat() on each path in
+ * (paths), but is much faster for large batches, like checking that
+ * everything in an asset manifest is actually there. The search path is
+ * locked once for the whole batch, and each mounted archive is asked about
+ * each directory once, so paths that share a directory share most of the
+ * work.
+ *
+ * For each path, (found) gets non-zero if it exists and zero if it doesn't
+ * (or if it's not a valid path, or an archive reported an error looking for
+ * it). If (out) isn't NULL, it gets the same information PHYSFS_stat()
+ * would have filled in for each path that was found; the rest get the same
+ * "unknown" values PHYSFS_stat() uses. Element N of (found) and (out)
+ * matches element N of (paths).
+ *
+ * Like PHYSFS_stat(), this doesn't follow symbolic links unless you've
+ * permitted them with PHYSFS_permitSymbolicLinks(), and symlinks that are
+ * permitted are reported as symlinks.
+ *
+ * Failing on one path doesn't fail the whole batch; this only fails if it
+ * couldn't do the job at all (out of memory, bad arguments, etc), and in
+ * that case the contents of (found) and (out) are undefined.
+ *
+ * \param paths an array of (n) filenames to check, in platform-independent
+ *              notation.
+ * \param out an array of (n) PHYSFS_Stat structs to fill in, or NULL if you
+ *            just want to know what exists.
+ * \param found an array of (n) ints to fill in.
+ * \param n number of elements in (paths), (out) and (found).
+ * \returns non-zero on success, zero on failure. On failure, use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_stat
+ * \sa PHYSFS_exists
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_statMany(const char **paths, PHYSFS_Stat *out, int *found, PHYSFS_uint32 n);
+
+
+/**
+ * Map archives into memory instead of reading them.
+ *
+ * Normally, reading a file out of an archive on the physical filesystem
+ * means reading from the archive file, a piece at a time. With this
+ * enabled, archives mounted afterwards by PHYSFS_mount() are mapped into
+ * memory whole (with mmap() or similar), and read by copying from the
+ * mapping, with no system calls. Files that aren't compressed (stored files
+ * in a .zip, and everything in GRP, WAD, HOG, QPAK, POD and the other
+ * simple formats) become pieces of that mapping, and
+ * PHYSFS_getFileMemory() can hand you a pointer straight to their contents.
+ *
+ * Archives that are already mounted, directories, archives mounted with
+ * PHYSFS_mountIo() or PHYSFS_mountHandle(), and the write directory aren't
+ * affected. If an archive can't be mapped (it's empty, or too large for the
+ * address space), it's read normally.
+ *
+ * A mapped archive uses address space for its whole size, and the
+ * operating system pages it in as it's read. If something else truncates
+ * the archive file while it's mapped, touching the missing part can crash
+ * your program (with SIGBUS on Unix), so only enable this for archives that
+ * won't change while they're mounted.
+ *
+ * Mapping is disabled by default, and is disabled again by PHYSFS_deinit().
+ * It isn't available on all platforms; this fails with
+ * PHYSFS_ERR_UNSUPPORTED if you try to enable it where it isn't. Disabling
+ * it always succeeds.
+ *
+ * \param enable nonzero to map archives mounted from now on, zero to read
+ *               them normally.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_archivesMapped
+ * \sa PHYSFS_getFileMemory
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_mapArchives(int enable);
+
+
+/**
+ * Determine if archives are being mapped into memory.
+ *
+ * This reports the setting from the last successful call to
+ * PHYSFS_mapArchives(). If it hasn't been called since the library was
+ * last initialized, archives aren't mapped.
+ *
+ * \returns non-zero if archives are mapped, zero if not.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_mapArchives
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_archivesMapped(void);
+
+
+/**
+ * Get a pointer to an open file's contents, if they're in memory.
+ *
+ * Some files are read straight out of memory: uncompressed files in an
+ * archive mounted with PHYSFS_mountMemory(), in one mapped into memory
+ * (see PHYSFS_mapArchives()), or in one mounted with PHYSFS_mountIo() from
+ * a PHYSFS_Io whose map() method hands them over. For those, this returns
+ * a pointer to the whole file, so you can use the bytes where they are
+ * instead of copying them out with PHYSFS_readBytes().
+ *
+ * The pointer is to the start of the file, no matter where the file
+ * position is, and this doesn't move the file position. The memory is
+ * read-only, and stays valid until (handle) is closed.
+ *
+ * For any other file, this fails with PHYSFS_ERR_UNSUPPORTED, and you
+ * should read it like you usually would.
+ *
+ * \param handle a file handle opened for reading.
+ * \param len If not NULL, receives the size of the file, in bytes.
+ * \returns a pointer to the file's contents, or NULL if they aren't in
+ *          memory or there was an error. Use PHYSFS_getLastErrorCode() to
+ *          obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread, but the
+ *               usual rules about using one file handle from several threads
+ *               apply.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_mapArchives
+ * \sa PHYSFS_mountMemory
+ */
+extern PHYSFS_DECL const void * PHYSFS_CALL PHYSFS_getFileMemory(PHYSFS_File *handle, PHYSFS_uint64 *len);
+
+
+/**
+ * Keep the decompressed contents of small files around for reopening.
+ *
+ * Opening a compressed file in an archive means decompressing it, and
+ * reading it from the start again means decompressing it again. If your
+ * app opens the same small files over and over (a shared shader include, a
+ * config file, the same sound effect), this lets PhysicsFS hold onto the
+ * decompressed bytes, so the next PHYSFS_openRead() of that file reads
+ * them straight out of memory. All open handles to a cached file share one
+ * copy of it.
+ *
+ * The cache is shared by everything mounted, and holds no more than
+ * (capacity) bytes. When it's full, the files that were opened least
+ * recently are dropped to make room. Only files of (maxFileSize) bytes or
+ * less are cached, so one big file can't push everything else out;
+ * PhysicsFS may use a smaller limit than you ask for. Files read directly
+ * from disk, and files that don't need decompressing, are never cached,
+ * since there's nothing to gain.
+ *
+ * The cache is off by default. Set (capacity) to zero to turn it off and
+ * release the memory it holds. Calling this again with smaller numbers
+ * drops files until the cache fits. Files that are dropped from the cache
+ * while open stay readable until they're closed. A file is dropped from
+ * the cache when its archive is unmounted.
+ *
+ * Cached files are served from memory, so PHYSFS_getFileMemory() works on
+ * their handles.
+ *
+ * \param capacity The most bytes to keep in the cache. Zero turns it off.
+ * \param maxFileSize The biggest file, in bytes, to put in the cache.
+ * \returns nonzero on success, zero on error. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread, even
+ *               while other threads are opening files.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_getFileCacheStats
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_setFileCache(PHYSFS_uint64 capacity, PHYSFS_uint64 maxFileSize);
+
+
+/**
+ * Find out how well the file cache is working.
+ *
+ * This reports how many times, since PHYSFS_init(), opening a file found
+ * it in the cache (a hit), had to decompress it because it wasn't there (a
+ * miss), and how many files were dropped from the cache to make room (an
+ * eviction). Only files small enough to be cached count as hits or misses.
+ *
+ * If you get lots of evictions and few hits, the cache is too small for
+ * how your app uses files; see PHYSFS_setFileCache().
+ *
+ * Any of the pointers can be NULL if you don't want that number.
+ *
+ * \param hits Receives the number of cache hits.
+ * \param misses Receives the number of cache misses.
+ * \param evictions Receives the number of files dropped from the cache.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_setFileCache
+ */
+extern PHYSFS_DECL void PHYSFS_CALL PHYSFS_getFileCacheStats(PHYSFS_uint32 *hits, PHYSFS_uint32 *misses, PHYSFS_uint32 *evictions);
+
+
+/**
+ * Check files from archives against their stored checksums as they're read.
+ *
+ * Archives like .zip files store a CRC-32 for each file, but normally
+ * PhysicsFS doesn't look at it, so a damaged or truncated download just
+ * hands your program bad data. With this enabled, reading a file from an
+ * archive that has checksums keeps a running CRC, and the read that
+ * reaches the end of the file fails with PHYSFS_ERR_CORRUPT if it doesn't
+ * match.
+ *
+ * Only data read in order from the start of the file is checked; if you
+ * seek past data you haven't read, the rest of that file isn't checked.
+ * Files that are encrypted, or empty, aren't checked either. This applies
+ * to files opened after the call; files already open keep the setting they
+ * were opened with. Stored (uncompressed) files in archives that are in
+ * memory (see PHYSFS_mapArchives()) are copied out instead of being handed
+ * out as pieces of the archive, so PHYSFS_getFileMemory() won't work on
+ * them while this is enabled.
+ *
+ * Checking costs a little CPU time on every read. It's off by default, and
+ * is turned off again by PHYSFS_deinit(). Currently only .zip archives
+ * are checked.
+ *
+ * \param enable nonzero to check files opened from now on, zero to not.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_checksumsVerified
+ * \sa PHYSFS_verifyArchive
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_verifyChecksums(int enable);
+
+
+/**
+ * Determine if files are being checked against their stored checksums.
+ *
+ * This reports the setting from the last successful call to
+ * PHYSFS_verifyChecksums(). If it hasn't been called since the library was
+ * last initialized, files aren't checked.
+ *
+ * \returns non-zero if checksums are verified, zero if not.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_verifyChecksums
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_checksumsVerified(void);
+
+
+/**
+ * Check every file in a mounted archive against its stored checksum.
+ *
+ * This reads all of the archive's files, start to finish, and compares
+ * each against the CRC-32 the archive stored for it, whether or not
+ * PHYSFS_verifyChecksums() is enabled. It's a good thing to run once after
+ * downloading or patching an archive. It reads the whole archive, so it
+ * can take a while on a big one; where the platform has threads, it reads
+ * several files at once, on one thread per CPU core.
+ *
+ * (archive) is the name that was passed to PHYSFS_mount() (the same thing
+ * PHYSFS_getSearchPath() reports). Encrypted files are skipped. Currently
+ * only .zip archives can be checked; others fail with
+ * PHYSFS_ERR_UNSUPPORTED.
+ *
+ * \param archive the archive to check, in platform-dependent notation.
+ * \returns nonzero if every file checked out, zero if one didn't (the
+ *          error is PHYSFS_ERR_CORRUPT), or on any other error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread. The
+ *               archive can't be unmounted while this runs.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_verifyChecksums
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_verifyArchive(const char *archive);
+
+
+/**
+ * Save what's learned about big archives, so mounting them is faster later.
+ *
+ * Mounting a .zip file means reading and sorting out its whole table of
+ * contents, which takes a while when an archive has hundreds of thousands
+ * of files. With an index directory set, each .zip mounted from the
+ * physical filesystem gets a small index file written for it the first
+ * time, and later mounts (by this process or the next one) use that
+ * instead, mapping it into memory where the platform allows, so they take
+ * about the same time however many files there are.
+ *
+ * An index remembers the archive's size and modification time, and a
+ * checksum of its table of contents. If any of those changed, the index is
+ * ignored and written again. Index files are
+ * named after the archive, with ".physfsidx" on the end. If one can't be
+ * written (the directory is read-only, say), the archive mounts normally
+ * anyhow.
+ *
+ * (dir) is in platform-dependent notation; PHYSFS_getPrefDir() is a good
+ * choice. An empty string ("") puts each index next to its archive instead.
+ * NULL turns indexes off, which is the default; PHYSFS_deinit() turns them
+ * off again. Archives mounted with PHYSFS_mountIo(), PHYSFS_mountMemory()
+ * or PHYSFS_mountHandle() aren't indexed, unless the name you gave names
+ * the same file on the physical filesystem. This affects archives mounted
+ * after the call.
+ *
+ * \param dir where to keep index files, "" for next to each archive, or
+ *            NULL to not use them.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_getArchiveIndexDir
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_setArchiveIndexDir(const char *dir);
+
+
+/**
+ * Get where archive index files are kept.
+ *
+ * This reports the directory from the last successful call to
+ * PHYSFS_setArchiveIndexDir(). The string belongs to PhysicsFS; don't
+ * change or free it, and don't use it after the next call to
+ * PHYSFS_setArchiveIndexDir() or PHYSFS_deinit().
+ *
+ * \returns the index directory, "" if indexes go next to each archive, or
+ *          NULL if they aren't used.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_setArchiveIndexDir
+ */
+extern PHYSFS_DECL const char * PHYSFS_CALL PHYSFS_getArchiveIndexDir(void);
+
+
+/**
+ * \enum PHYSFS_ResolveMode
+ * \brief When archives look up where each file's data starts.
+ *
+ * \sa PHYSFS_setResolveMode
+ */
+typedef enum PHYSFS_ResolveMode
+{
+    PHYSFS_RESOLVE_ON_OPEN,       /**< The first time each file is opened. */
+    PHYSFS_RESOLVE_ON_MOUNT,      /**< All at once, while mounting. */
+    PHYSFS_RESOLVE_IN_BACKGROUND  /**< All at once, on another thread. */
+} PHYSFS_ResolveMode;
+
+
+/**
+ * Decide when archives find where each file's data starts.
+ *
+ * A .zip file has a small header in front of every file, and the only way
+ * to know where that file's data really starts is to read it. Normally
+ * PhysicsFS does this the first time each file is opened, so mounting is
+ * quick, but the first open of every file costs an extra seek and read.
+ * On hard drives, optical discs and network storage, that can be a
+ * noticeable hitch.
+ *
+ * With PHYSFS_RESOLVE_ON_MOUNT, mounting reads all of those headers in one
+ * pass, in the order they sit in the archive, with large reads. Mounting
+ * takes longer, but opening files never has to go find them.
+ * PHYSFS_RESOLVE_IN_BACKGROUND does the same pass on another thread after
+ * PHYSFS_mount() returns. Files opened before it gets to them are handled
+ * the usual way. Unmounting the archive stops the pass. This mode isn't
+ * available on all platforms; trying to set it where it isn't fails with
+ * PHYSFS_ERR_UNSUPPORTED.
+ *
+ * This affects archives mounted after the call. It's
+ * PHYSFS_RESOLVE_ON_OPEN by default, and PHYSFS_deinit() puts it back.
+ * Currently only .zip archives need this.
+ *
+ * \param mode when to find where files' data starts.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_getResolveMode
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_setResolveMode(PHYSFS_ResolveMode mode);
+
+
+/**
+ * Determine when archives find where each file's data starts.
+ *
+ * This reports the setting from the last successful call to
+ * PHYSFS_setResolveMode(). If it hasn't been called since the library was
+ * last initialized, this is PHYSFS_RESOLVE_ON_OPEN.
+ *
+ * \returns the current mode.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_setResolveMode
+ */
+extern PHYSFS_DECL PHYSFS_ResolveMode PHYSFS_CALL PHYSFS_getResolveMode(void);
+
+
+/**
+ * Decompress whole archives into memory when they're mounted.
+ *
+ * For archives that get read completely anyhow, like a level pack loaded
+ * all at once, it's faster to decompress everything up front, on every
+ * core, than one file at a time as they're opened. With this enabled,
+ * archives mounted afterwards have every file decompressed into one block
+ * of memory by PHYSFS_mount(), using (threads) threads: one file at a time
+ * per thread for .zip archives, and one solid block at a time for .7z
+ * archives. After that, opening one of those files just hands out a piece
+ * of that memory, and reading it never touches the archive again.
+ *
+ * This costs memory for the decompressed size of the whole archive, for as
+ * long as it's mounted. If that much memory isn't available, the archive
+ * is mounted the normal way. Files that fail to decompress (corrupt data,
+ * or a bad checksum if PHYSFS_verifyChecksums() is enabled) and encrypted
+ * files are left to fail or succeed when they're opened, like they always
+ * did. PHYSFS_getPreloadStats() reports how long this took, so you can
+ * decide if it's worth the memory.
+ *
+ * Only .zip and .7z archives do this; other archives, directories, and
+ * archives that are already mounted aren't affected. On platforms without
+ * threads, everything is decompressed on the thread that mounts the
+ * archive, whatever (threads) is.
+ *
+ * This is disabled by default, and PHYSFS_deinit() disables it again.
+ *
+ * \param threads zero to disable, a positive number of threads to use, or
+ *                a negative number for one thread per CPU core.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_archivesPreloaded
+ * \sa PHYSFS_getPreloadStats
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_preloadArchives(int threads);
+
+
+/**
+ * Determine if archives are decompressed into memory when mounted.
+ *
+ * This reports the setting from the last successful call to
+ * PHYSFS_preloadArchives(). If it hasn't been called since the library was
+ * last initialized, this is zero.
+ *
+ * \returns zero if archives aren't preloaded, or the number of threads
+ *          that was asked for (negative for one per CPU core).
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_preloadArchives
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_archivesPreloaded(void);
+
+
+/**
+ * Find out how fast archives are being preloaded.
+ *
+ * This reports totals for every archive preloaded since PHYSFS_init() (see
+ * PHYSFS_preloadArchives()): how many bytes of compressed data were read,
+ * how many bytes they decompressed to, and how many milliseconds of wall
+ * clock time it took. Dividing the decompressed bytes by the time gives
+ * the throughput. The time is zero on platforms that can't measure it.
+ *
+ * To measure one mount, call this before and after it and subtract.
+ *
+ * Any of the pointers can be NULL if you don't want that number.
+ *
+ * \param compressed Receives the number of compressed bytes read.
+ * \param decompressed Receives the number of bytes they decompressed to.
+ * \param milliseconds Receives the time spent, in milliseconds.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_preloadArchives
+ */
+extern PHYSFS_DECL void PHYSFS_CALL PHYSFS_getPreloadStats(PHYSFS_uint64 *compressed, PHYSFS_uint64 *decompressed, PHYSFS_uint64 *milliseconds);
+
+
+/**
+ * Decompress big blocks of data on several threads, where the format
+ *  allows it.
+ *
+ * Some compressed data comes in pieces that can be decompressed without
+ * each other. When PhysicsFS has to decompress a lot of data like that at
+ * once, it can give each of (threads) threads a share of the pieces,
+ * which is about that many times faster on a machine with enough cores.
+ *
+ * Right now, this applies to .7z archives compressed with LZMA2 by a
+ * multithreaded compressor (like 7-Zip's, which starts a new piece every
+ * few megabytes), when a whole solid block is decompressed at once: when
+ * it's cached for opening files, or preloaded (see
+ * PHYSFS_preloadArchives()). Data that isn't split into pieces is
+ * decompressed on one thread, like it always was. On platforms without
+ * threads, this does nothing.
+ *
+ * This is disabled by default, and PHYSFS_deinit() disables it again.
+ *
+ * \param threads zero to disable, a positive number of threads to use, or
+ *                a negative number for one thread per CPU core.
+ * \returns nonzero on success, zero on failure. Use PHYSFS_getLastErrorCode()
+ *          to obtain the specific error.
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_getDecoderThreads
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_setDecoderThreads(int threads);
+
+
+/**
+ * Find out how many threads decompress big blocks of data.
+ *
+ * This reports the setting from the last successful call to
+ * PHYSFS_setDecoderThreads(). If it hasn't been called since the library
+ * was last initialized, this is zero.
+ *
+ * \returns zero if everything is decompressed on one thread, or the
+ *          number of threads that was asked for (negative for one per CPU
+ *          core).
+ *
+ * \threadsafety It is safe to call this function from any thread.
+ *
+ * \since This function is available since PhysicsFS 3.3.0.
+ *
+ * \sa PHYSFS_setDecoderThreads
+ */
+extern PHYSFS_DECL int PHYSFS_CALL PHYSFS_getDecoderThreads(void);
+
+
 #ifdef __cplusplus
 }
 #endif
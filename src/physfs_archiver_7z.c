@@ -27,14 +27,41 @@ typedef struct
     PHYSFS_uint32 dbidx;          /* index into lzma sdk database   */
 } SZIPentry;
 
+/*
+ * Most 7zip archives are "solid": lots of files compressed together in one
+ *  folder, which the lzma sdk can only decompress from the start. Rather
+ *  than do that again for every file opened, we keep the last few folders
+ *  we decompressed, up to PHYSFS_7Z_BLOCK_CACHE bytes of them per archive,
+ *  and hand out files as slices of them. Bigger folders aren't cached.
+ */
+#ifndef PHYSFS_7Z_BLOCK_CACHE
+#define PHYSFS_7Z_BLOCK_CACHE (64 * 1024 * 1024)
+#endif
+
+typedef struct SZIPblock
+{
+    UInt32 folder;            /* which folder this is.                  */
+    PHYSFS_Io *io;            /* memory Io of it; we hold a reference.  */
+    PHYSFS_uint64 len;        /* its decompressed size.                 */
+    struct SZIPblock *next;   /* next in the cache; most recent first.  */
+} SZIPblock;
+
 /* One SZIPinfo is kept for each open 7zip archive. */
 typedef struct
 {
     __PHYSFS_DirTree tree;    /* manages directory tree.           */
     PHYSFS_Io *io;            /* physfs i/o interface for this archive. */
     CSzArEx db;               /* lzma sdk archive database object. */
+    PHYSFS_Io *preload;       /* NULL or memory Io of preloaded folders. */
+    PHYSFS_uint64 *preloaded; /* each folder's offset in (preload).    */
+    void *lock;               /* protects (blocks) and (blocksused).   */
+    SZIPblock *blocks;        /* cached folders, most recent first.    */
+    PHYSFS_uint64 blocksused; /* total len of (blocks).                */
 } SZIPinfo;
 
+/* a folder in (preloaded) that didn't make it. */
+#define SZIP_NOT_PRELOADED (~((PHYSFS_uint64) 0))
+
 
 static PHYSFS_ErrorCode szipErrorCode(const SRes rc)
 {
@@ -183,11 +210,11 @@ static int szipLoadEntry(SZIPinfo *info, const PHYSFS_uint32 idx)
 
 static int szipLoadEntries(SZIPinfo *info)
 {
+    const PHYSFS_uint32 count = info->db.NumFiles;
     int retval = 0;
 
-    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry), 1, 0))
+    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry), 1, 0, count))
     {
-        const PHYSFS_uint32 count = info->db.NumFiles;
         PHYSFS_uint32 i;
         for (i = 0; i < count; i++)
             BAIL_IF_ERRPASS(!szipLoadEntry(info, i), 0);
@@ -205,6 +232,20 @@ static void SZIP_closeArchive(void *opaque)
     {
         if (info->io)
             info->io->destroy(info->io);
+        if (info->preload)
+            info->preload->destroy(info->preload);
+        if (info->preloaded)
+            allocator.Free(info->preloaded);
+        while (info->blocks != NULL)
+        {
+            SZIPblock *next = info->blocks->next;
+            info->blocks->io->destroy(info->blocks->io);
+            allocator.Free(info->blocks);
+            info->blocks = next;
+        } /* while */
+        if (info->lock)
+            __PHYSFS_platformDestroyMutex(info->lock);
+        __PHYSFS_fileCacheForget(info);
         SzArEx_Free(&info->db, &SZIP_SzAlloc);
         __PHYSFS_DirTreeDeinit(&info->tree);
         allocator.Free(info);
@@ -212,6 +253,399 @@ static void SZIP_closeArchive(void *opaque)
 } /* SZIP_closeArchive */
 
 
+/*
+ * If (folder) has a single LZMA, LZMA2 or stored coder, and nothing else,
+ *  fill in that coder and return non-zero. We can stream those, and split
+ *  up some LZMA2 ones.
+ */
+static int szipCanStream(const SZIPinfo *info, const UInt32 folder,
+                         CSzCoderInfo *coder)
+{
+    const CSzAr *ar = &info->db.db;
+    CSzFolder f;
+    CSzData sd;
+
+    sd.Data = ar->CodersData + ar->FoCodersOffsets[folder];
+    sd.Size = ar->FoCodersOffsets[folder + 1] - ar->FoCodersOffsets[folder];
+    if (SzGetNextFolderItem(&f, &sd) != SZ_OK)
+        return 0;
+    else if ((f.NumCoders != 1) || (f.NumPackStreams != 1) || (f.NumBonds != 0))
+        return 0;
+    else if (f.Coders[0].NumStreams != 1)
+        return 0;
+
+    switch (f.Coders[0].MethodID)
+    {
+        case k_Copy: break;
+        case k_LZMA: break;
+        case k_LZMA2: break;
+        default: return 0;
+    } /* switch */
+
+    memcpy(coder, &f.Coders[0], sizeof (*coder));
+    return 1;
+} /* szipCanStream */
+
+
+/*
+ * LZMA2 data is a run of chunks, and a chunk that resets the dictionary
+ *  doesn't need anything that came before it. Multithreaded compressors
+ *  start a new dictionary every few megabytes, so a folder like that can be
+ *  decompressed as separate pieces, one task each, on the threads that
+ *  PHYSFS_setDecoderThreads() asked for.
+ */
+typedef struct
+{
+    PHYSFS_uint64 inpos;      /* where it starts in the packed data.     */
+    PHYSFS_uint64 inlen;      /* how much packed data it is.             */
+    PHYSFS_uint64 outpos;     /* where its output goes in the folder.    */
+    PHYSFS_uint64 outlen;     /* how much output it makes.               */
+    SRes rc;                  /* how decompressing it went.              */
+} SZIPlzma2Piece;
+
+/* what szipDecodeLzma2() shares with its tasks. */
+typedef struct
+{
+    SZIPinfo *info;
+    Byte prop;                /* the coder's LZMA2 property byte.        */
+    PHYSFS_uint64 packpos;    /* where the folder's packed data starts.  */
+    Byte *out;                /* the folder's output buffer.             */
+    SZIPlzma2Piece *pieces;
+} SZIPlzma2Job;
+
+
+/*
+ * Find the chunks in (folder)'s LZMA2 data that reset the dictionary, by
+ *  reading just the chunk headers. Returns NULL if there's only one piece
+ *  or something's wrong; then the folder is decompressed the usual way,
+ *  which reports any real problem.
+ */
+static SZIPlzma2Piece *szipScanLzma2(SZIPinfo *info, const UInt32 folder,
+                                     const PHYSFS_uint64 packpos,
+                                     UInt32 *_count)
+{
+    const CSzAr *ar = &info->db.db;
+    const UInt32 pack = ar->FoStartPackStreamIndex[folder];
+    const PHYSFS_uint64 packsize = ar->PackPositions[pack + 1] - ar->PackPositions[pack];
+    SZIPlzma2Piece *pieces = NULL;
+    SZIPlzma2Piece *piece = NULL;
+    PHYSFS_uint64 inpos = 0;
+    PHYSFS_uint64 outpos = 0;
+    UInt32 count = 0;
+    UInt32 alloced = 0;
+    PHYSFS_Io *io;
+
+    io = info->io->duplicate(info->io);
+    if (io == NULL)
+        return NULL;
+
+    while (inpos < packsize)
+    {
+        PHYSFS_uint8 hdr[6];
+        PHYSFS_uint64 inlen;
+        PHYSFS_uint64 outlen;
+        const PHYSFS_uint64 avail = packsize - inpos;
+        const size_t hdrlen = (avail < sizeof (hdr)) ? (size_t) avail : sizeof (hdr);
+
+        if (!io->seek(io, packpos + inpos) || !__PHYSFS_readAll(io, hdr, hdrlen))
+            goto scan_failed;
+        else if (hdr[0] == 0)  /* end of the data. */
+            break;
+        else if ((hdr[0] > 2) && (hdr[0] < 0x80))
+            goto scan_failed;  /* not LZMA2. */
+        else if (hdr[0] < 0x80)  /* stored chunk. */
+        {
+            if (hdrlen < 3)
+                goto scan_failed;
+            outlen = (((PHYSFS_uint64) hdr[1]) << 8) + hdr[2] + 1;
+            inlen = 3 + outlen;
+        } /* else if */
+        else  /* LZMA chunk. */
+        {
+            if (hdrlen < ((hdr[0] >= 0xC0) ? 6 : 5))
+                goto scan_failed;
+            outlen = (((PHYSFS_uint64) (hdr[0] & 0x1F)) << 16) + (((PHYSFS_uint64) hdr[1]) << 8) + hdr[2] + 1;
+            inlen = ((hdr[0] >= 0xC0) ? 6 : 5) + (((PHYSFS_uint64) hdr[3]) << 8) + hdr[4] + 1;
+        } /* else */
+
+        if ((hdr[0] == 1) || (hdr[0] >= 0xE0))  /* new dictionary? */
+        {
+            if (count == alloced)
+            {
+                void *ptr;
+                alloced = alloced ? (alloced * 2) : 16;
+                ptr = allocator.Realloc(pieces, alloced * sizeof (SZIPlzma2Piece));
+                if (ptr == NULL)
+                    goto scan_failed;
+                pieces = (SZIPlzma2Piece *) ptr;
+            } /* if */
+            piece = &pieces[count++];
+            piece->inpos = inpos;
+            piece->inlen = 0;
+            piece->outpos = outpos;
+            piece->outlen = 0;
+            piece->rc = SZ_OK;
+        } /* if */
+        else if (piece == NULL)
+            goto scan_failed;  /* the data has to start with one. */
+
+        piece->inlen += inlen;
+        piece->outlen += outlen;
+        inpos += inlen;
+        outpos += outlen;
+    } /* while */
+
+    if ((count < 2) || (outpos != SzAr_GetFolderUnpackSize(ar, folder)))
+        goto scan_failed;
+
+    io->destroy(io);
+    *_count = count;
+    return pieces;
+
+scan_failed:
+    io->destroy(io);
+    if (pieces)
+        allocator.Free(pieces);
+    return NULL;
+} /* szipScanLzma2 */
+
+
+static void szipDecodeLzma2Piece(void *data, int task)
+{
+    SZIPlzma2Job *job = (SZIPlzma2Job *) data;
+    SZIPlzma2Piece *piece = &job->pieces[task];
+    SizeT inlen = (SizeT) piece->inlen;
+    PHYSFS_Io *io = NULL;
+    Byte *in;
+
+    piece->rc = SZ_ERROR_MEM;
+    in = (Byte *) allocator.Malloc(inlen ? inlen : 1);
+    if (in == NULL)
+        return;
+
+    piece->rc = SZ_ERROR_READ;
+    io = job->info->io->duplicate(job->info->io);
+    if ((io != NULL) && (io->seek(io, job->packpos + piece->inpos)) &&
+        (__PHYSFS_readAll(io, in, piece->inlen)))
+    {
+        CLzma2Dec dec;
+        ELzmaStatus status;
+
+        Lzma2Dec_Construct(&dec);
+        piece->rc = Lzma2Dec_AllocateProbs(&dec, job->prop, &SZIP_SzAlloc);
+        if (piece->rc == SZ_OK)
+        {
+            dec.decoder.dic = job->out + piece->outpos;
+            dec.decoder.dicBufSize = (SizeT) piece->outlen;
+            Lzma2Dec_Init(&dec);
+            piece->rc = Lzma2Dec_DecodeToDic(&dec, (SizeT) piece->outlen, in,
+                                             &inlen, LZMA_FINISH_ANY, &status);
+            if ((piece->rc == SZ_OK) && (dec.decoder.dicPos != piece->outlen))
+                piece->rc = SZ_ERROR_DATA;
+            Lzma2Dec_FreeProbs(&dec, &SZIP_SzAlloc);
+        } /* if */
+    } /* if */
+
+    if (io != NULL)
+        io->destroy(io);
+    allocator.Free(in);
+} /* szipDecodeLzma2Piece */
+
+
+/*
+ * Decompress (folder) in pieces, on (threads) threads. Returns
+ *  SZ_ERROR_UNSUPPORTED if it can't be split up (or a piece failed: then
+ *  it's decompressed again the usual way, to get a trustworthy answer).
+ */
+static SRes szipDecodeLzma2(SZIPinfo *info, const UInt32 folder,
+                            const CSzCoderInfo *coder, Byte *buf,
+                            const int threads)
+{
+    const CSzAr *ar = &info->db.db;
+    SZIPlzma2Job job;
+    UInt32 count = 0;
+    UInt32 i;
+    SRes rc = SZ_OK;
+
+    if ((threads == 0) || (threads == 1))
+        return SZ_ERROR_UNSUPPORTED;
+    else if ((coder->MethodID != k_LZMA2) || (coder->PropsSize != 1))
+        return SZ_ERROR_UNSUPPORTED;
+
+    job.info = info;
+    job.prop = ar->CodersData[ar->FoCodersOffsets[folder] + coder->PropsOffset];
+    job.packpos = info->db.dataPos + ar->PackPositions[ar->FoStartPackStreamIndex[folder]];
+    job.out = buf;
+    job.pieces = szipScanLzma2(info, folder, job.packpos, &count);
+    if ((job.pieces == NULL) || (count > 0x7FFFFFFF))
+    {
+        if (job.pieces)
+            allocator.Free(job.pieces);
+        return SZ_ERROR_UNSUPPORTED;
+    } /* if */
+
+    __PHYSFS_runTasks(threads, &job, (int) count, szipDecodeLzma2Piece);
+
+    for (i = 0; (rc == SZ_OK) && (i < count); i++)
+        rc = job.pieces[i].rc;
+    allocator.Free(job.pieces);
+
+    if (rc != SZ_OK)
+        return SZ_ERROR_UNSUPPORTED;
+
+    /* SzAr_DecodeFolder() checks this, so we do too. */
+    if (SzBitWithVals_Check(&ar->FolderCRCs, folder))
+    {
+        if (CrcCalc(buf, (size_t) SzAr_GetFolderUnpackSize(ar, folder)) != ar->FolderCRCs.Vals[folder])
+            return SZ_ERROR_CRC;
+    } /* if */
+
+    return SZ_OK;
+} /* szipDecodeLzma2 */
+
+
+/*
+ * Decompress (folder) into (buf), which must hold all of it, and check the
+ *  CRC of each file in it, like SzArEx_Extract() would. This reads from a
+ *  duplicate of the archive's Io, so it's safe to run on several folders at
+ *  once.
+ */
+static SRes szipDecodeFolder(SZIPinfo *info, const UInt32 folder, Byte *buf,
+                             const int threads)
+{
+    const CSzArEx *db = &info->db;
+    const size_t len = (size_t) SzAr_GetFolderUnpackSize(&db->db, folder);
+    const PHYSFS_uint64 start = db->UnpackPositions[db->FolderToFile[folder]];
+    SZIPLookToRead stream;
+    CSzCoderInfo coder;
+    PHYSFS_Io *io;
+    UInt32 i;
+    SRes rc = SZ_ERROR_UNSUPPORTED;
+
+    if (szipCanStream(info, folder, &coder))
+        rc = szipDecodeLzma2(info, folder, &coder, buf, threads);
+
+    if (rc == SZ_ERROR_UNSUPPORTED)
+    {
+        io = info->io->duplicate(info->io);
+        if (io == NULL)
+            return SZ_ERROR_READ;
+
+        szipInitStream(&stream, io);
+        rc = SzAr_DecodeFolder(&db->db, folder, &stream.lookStream.s,
+                               db->dataPos, buf, len, &SZIP_SzAlloc);
+        io->destroy(io);
+    } /* if */
+
+    for (i = db->FolderToFile[folder]; (rc == SZ_OK) && (i < db->FolderToFile[folder + 1]); i++)
+    {
+        const PHYSFS_uint64 pos = db->UnpackPositions[i] - start;
+        if (db->FileToFolder[i] != folder)
+            continue;
+        else if (!SzBitWithVals_Check(&db->CRCs, i))
+            continue;
+        else if (CrcCalc(buf + pos, (size_t) SzArEx_GetFileSize(db, i)) != db->CRCs.Vals[i])
+            rc = SZ_ERROR_CRC;
+    } /* for */
+
+    return rc;
+} /* szipDecodeFolder */
+
+
+/* what szipPreload() shares with its tasks. */
+typedef struct
+{
+    SZIPinfo *info;
+    PHYSFS_uint8 *buf;
+    int threads;  /* each folder's decoder threads. */
+} SZIPpreload;
+
+static void szipPreloadFolder(void *data, int task)
+{
+    SZIPpreload *preload = (SZIPpreload *) data;
+    SZIPinfo *info = preload->info;
+    const UInt32 folder = (UInt32) task;
+    Byte *buf = preload->buf + info->preloaded[folder];
+
+    if (szipDecodeFolder(info, folder, buf, preload->threads) != SZ_OK)
+        info->preloaded[folder] = SZIP_NOT_PRELOADED;
+} /* szipPreloadFolder */
+
+
+/*
+ * Decompress every folder (solid block) into one buffer, one folder per
+ *  task on PHYSFS_preloadArchives()'s threads. If there isn't memory for
+ *  that, files are decompressed when they're opened, like always, and so
+ *  are files in folders that fail here. Only one set of threads runs at a
+ *  time: the folders get spread out over them, or if there's just one
+ *  folder (or one thread to spread them over), its pieces do, on
+ *  PHYSFS_setDecoderThreads()'s.
+ */
+static void szipPreload(SZIPinfo *info)
+{
+    const UInt32 count = info->db.db.NumFolders;
+    SZIPpreload preload;
+    PHYSFS_uint64 total = 0;
+    PHYSFS_uint64 compressed = 0;
+    PHYSFS_uint64 decompressed = 0;
+    PHYSFS_uint64 ms;
+    UInt32 i;
+
+    if ((count == 0) || (count > 0x7FFFFFFF))
+        return;
+
+    info->preloaded = (PHYSFS_uint64 *) allocator.Malloc(count * sizeof (PHYSFS_uint64));
+    if (!info->preloaded)
+        return;
+
+    for (i = 0; i < count; i++)
+    {
+        const PHYSFS_uint64 len = SzAr_GetFolderUnpackSize(&info->db.db, i);
+        info->preloaded[i] = total;
+        total += len;
+        if (total < len)
+            goto szipPreload_failed;
+    } /* for */
+
+    if (!__PHYSFS_ui64FitsAddressSpace(total))
+        goto szipPreload_failed;
+    preload.info = info;
+    preload.threads = 1;
+    if ((count == 1) || (PHYSFS_archivesPreloaded() == 1))
+        preload.threads = PHYSFS_getDecoderThreads();
+    preload.buf = (PHYSFS_uint8 *) allocator.Malloc(total ? (size_t) total : 1);
+    if (!preload.buf)
+        goto szipPreload_failed;
+
+    ms = __PHYSFS_runTasks(PHYSFS_archivesPreloaded(), &preload, (int) count, szipPreloadFolder);
+
+    info->preload = __PHYSFS_createMemoryIo(preload.buf, total, allocator.Free);
+    if (!info->preload)
+    {
+        allocator.Free(preload.buf);
+        goto szipPreload_failed;
+    } /* if */
+
+    for (i = 0; i < count; i++)
+    {
+        if (info->preloaded[i] != SZIP_NOT_PRELOADED)
+        {
+            const CSzAr *ar = &info->db.db;
+            const UInt64 *pack = ar->PackPositions;
+            compressed += pack[ar->FoStartPackStreamIndex[i + 1]] - pack[ar->FoStartPackStreamIndex[i]];
+            decompressed += SzAr_GetFolderUnpackSize(ar, i);
+        } /* if */
+    } /* for */
+
+    __PHYSFS_addPreloadStats(compressed, decompressed, ms);
+    return;
+
+szipPreload_failed:
+    allocator.Free(info->preloaded);
+    info->preloaded = NULL;
+} /* szipPreload */
+
+
 static void *SZIP_openArchive(PHYSFS_Io *io, const char *name,
                               int forWriting, int *claimed)
 {
@@ -236,6 +670,9 @@ static void *SZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     SzArEx_Init(&info->db);
 
+    info->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF_ERRPASS(!info->lock, failed);
+
     info->io = io;
 
     szipInitStream(&stream, io);
@@ -244,6 +681,14 @@ static void *SZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     GOTO_IF_ERRPASS(!szipLoadEntries(info), failed);
 
+    if (PHYSFS_archivesPreloaded())
+    {
+        /* this reads the whole archive, mostly front to back. */
+        __PHYSFS_ioHint(info->io, PHYSFS_IOHINT_SEQUENTIAL);
+        szipPreload(info);
+        __PHYSFS_ioHint(info->io, PHYSFS_IOHINT_NORMAL);
+    } /* if */
+
     return info;
 
 failed:
@@ -253,12 +698,448 @@ failed:
 } /* SZIP_openArchive */
 
 
-static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
+/* (info->lock) must be held. Returns a new reference to a cached folder. */
+static PHYSFS_Io *szipFindBlock(SZIPinfo *info, const UInt32 folder)
+{
+    SZIPblock *prev = NULL;
+    SZIPblock *block;
+
+    for (block = info->blocks; block != NULL; block = block->next)
+    {
+        if (block->folder == folder)
+        {
+            if (prev != NULL)  /* move to front. */
+            {
+                prev->next = block->next;
+                block->next = info->blocks;
+                info->blocks = block;
+            } /* if */
+            return block->io->duplicate(block->io);
+        } /* if */
+        prev = block;
+    } /* for */
+
+    return NULL;
+} /* szipFindBlock */
+
+
+/*
+ * Get a memory Io of all of (folder), from the cache or by decompressing
+ *  it and adding it to the cache. The caller owns the returned reference.
+ *  The lock isn't held while decompressing, so two threads might both
+ *  decompress the same folder; the first one to finish gets cached.
+ */
+static PHYSFS_Io *szipGetBlock(SZIPinfo *info, const UInt32 folder,
+                               const PHYSFS_uint64 len)
+{
+    PHYSFS_Io *retval;
+    SZIPblock *block;
+    Byte *buf;
+    SRes rc;
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    retval = szipFindBlock(info, folder);
+    __PHYSFS_platformReleaseMutex(info->lock);
+    if (retval != NULL)
+        return retval;
+
+    buf = (Byte *) allocator.Malloc(len ? (size_t) len : 1);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    rc = szipDecodeFolder(info, folder, buf, PHYSFS_getDecoderThreads());
+    if (rc != SZ_OK)
+    {
+        allocator.Free(buf);
+        BAIL(szipErrorCode(rc), NULL);
+    } /* if */
+
+    retval = __PHYSFS_createMemoryIo(buf, len, allocator.Free);
+    if (!retval)
+    {
+        allocator.Free(buf);
+        return NULL;
+    } /* if */
+
+    block = (SZIPblock *) allocator.Malloc(sizeof (SZIPblock));
+    if (block == NULL)
+        return retval;  /* not caching it isn't an error. */
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    block->io = szipFindBlock(info, folder);
+    if (block->io != NULL)  /* someone else beat us to it; use theirs. */
+    {
+        __PHYSFS_platformReleaseMutex(info->lock);
+        retval->destroy(retval);
+        retval = block->io;
+        allocator.Free(block);
+        return retval;
+    } /* if */
+
+    block->io = retval->duplicate(retval);
+    if (block->io == NULL)
+        allocator.Free(block);
+    else
+    {
+        /* drop the least recently used folders until this one fits. */
+        info->blocksused += len;
+        while ((info->blocks != NULL) && (info->blocksused > PHYSFS_7Z_BLOCK_CACHE))
+        {
+            SZIPblock **last = &info->blocks;
+            SZIPblock *victim;
+            while ((*last)->next != NULL)
+                last = &(*last)->next;
+            victim = *last;
+            *last = NULL;
+            info->blocksused -= victim->len;
+            victim->io->destroy(victim->io);  /* open files keep the buffer. */
+            allocator.Free(victim);
+        } /* while */
+
+        block->folder = folder;
+        block->len = len;
+        block->next = info->blocks;
+        info->blocks = block;
+    } /* else */
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    return retval;
+} /* szipGetBlock */
+
+
+/*
+ * Folders too big for the block cache are streamed instead: a file is
+ *  decompressed as it's read, through a window the size of the folder's
+ *  dictionary, so opening a huge file doesn't mean decompressing all of it
+ *  into memory first. Seeking forward decompresses and throws away what's
+ *  in between. Seeking back into the window is free; seeking back further
+ *  than that starts over from the beginning of the folder. Only folders
+ *  with a single LZMA, LZMA2 or stored coder can be streamed; ones with
+ *  filters (BCJ, etc) are still decompressed whole.
+ */
+#define SZIP_STREAM_BUFSIZE (64 * 1024)
+
+typedef struct
+{
+    SZIPinfo *info;           /* the archive, for duplicate().           */
+    PHYSFS_Io *io;            /* our own duplicate of the archive's Io.  */
+    UInt32 dbidx;             /* the file, in the lzma sdk database.     */
+    CSzCoderInfo coder;       /* the folder's only coder.                */
+    UInt32 method;            /* k_Copy, k_LZMA or k_LZMA2.              */
+    PHYSFS_uint64 packpos;    /* where the folder's packed data starts.  */
+    PHYSFS_uint64 packsize;   /* how much packed data there is.          */
+    PHYSFS_uint64 packused;   /* how much of it we've read.              */
+    PHYSFS_uint64 start;      /* the file's offset in the folder.        */
+    PHYSFS_uint64 size;       /* the file's size.                        */
+    PHYSFS_uint64 decoded;    /* how much of the folder we've decoded.   */
+    PHYSFS_uint64 pos;        /* the app's position in the file.         */
+    UInt32 crc;               /* running CRC of the file, as decoded.    */
+    int checkcrc;             /* non-zero if the file has a CRC.         */
+    int corrupt;              /* non-zero once the CRC didn't match.     */
+    CLzmaDec lzma;            /* decoder state, for k_LZMA.              */
+    CLzma2Dec lzma2;          /* decoder state, for k_LZMA2.             */
+    Byte *window;             /* the last (windowsize) bytes decoded.    */
+    SizeT windowsize;
+    SizeT windowpos;          /* where the next decoded byte goes.       */
+    size_t inpos;             /* next unused byte in (inbuf).            */
+    size_t inlen;             /* bytes in (inbuf).                       */
+    Byte inbuf[SZIP_STREAM_BUFSIZE];
+} SZIPstream;
+
+
+static int szipStreamRestart(SZIPstream *s)
+{
+    BAIL_IF_ERRPASS(!s->io->seek(s->io, s->packpos), 0);
+    s->packused = 0;
+    s->inpos = s->inlen = 0;
+    s->decoded = 0;
+    s->windowpos = 0;
+    s->crc = CRC_INIT_VAL;
+    if (s->method == k_LZMA)
+        LzmaDec_Init(&s->lzma);
+    else if (s->method == k_LZMA2)
+        Lzma2Dec_Init(&s->lzma2);
+    return 1;
+} /* szipStreamRestart */
+
+
+/* Decode up to (want) more bytes of the folder into the window. */
+static int szipStreamDecode(SZIPstream *s, const PHYSFS_uint64 want)
+{
+    const PHYSFS_uint64 end = s->start + s->size;
+    SizeT before;
+    SizeT outlen;
+    SizeT inlen;
+    SRes rc = SZ_OK;
+
+    if (s->windowpos == s->windowsize)
+        s->windowpos = 0;
+
+    outlen = s->windowsize - s->windowpos;
+    if (outlen > want)
+        outlen = (SizeT) want;
+
+    if (s->inpos == s->inlen)
+    {
+        PHYSFS_uint64 avail = s->packsize - s->packused;
+        PHYSFS_sint64 br = 0;
+        if (avail > sizeof (s->inbuf))
+            avail = sizeof (s->inbuf);
+        if (avail > 0)
+            br = s->io->read(s->io, s->inbuf, avail);
+        BAIL_IF_ERRPASS(br < 0, 0);
+        s->packused += (PHYSFS_uint64) br;
+        s->inpos = 0;
+        s->inlen = (size_t) br;
+    } /* if */
+
+    before = s->windowpos;
+    inlen = s->inlen - s->inpos;
+    if (s->method == k_Copy)
+    {
+        if (outlen > inlen)
+            outlen = inlen;
+        memcpy(s->window + s->windowpos, s->inbuf + s->inpos, outlen);
+        inlen = outlen;
+        s->windowpos += outlen;
+    } /* if */
+    else
+    {
+        CLzmaDec *dec = (s->method == k_LZMA) ? &s->lzma : &s->lzma2.decoder;
+        ELzmaStatus status;
+        dec->dicPos = s->windowpos;
+        if (s->method == k_LZMA)
+            rc = LzmaDec_DecodeToDic(dec, s->windowpos + outlen, s->inbuf + s->inpos, &inlen, LZMA_FINISH_ANY, &status);
+        else
+            rc = Lzma2Dec_DecodeToDic(&s->lzma2, s->windowpos + outlen, s->inbuf + s->inpos, &inlen, LZMA_FINISH_ANY, &status);
+        s->windowpos = dec->dicPos;
+    } /* else */
+
+    s->inpos += inlen;
+    BAIL_IF(rc != SZ_OK, szipErrorCode(rc), 0);
+    outlen = s->windowpos - before;
+    BAIL_IF((outlen == 0) && (inlen == 0), PHYSFS_ERR_CORRUPT, 0);  /* stuck. */
+
+    /* the CRC covers the file's bytes, so check it as they go past. */
+    if ((s->checkcrc) && (s->decoded < end) && ((s->decoded + outlen) > s->start))
+    {
+        const PHYSFS_uint64 from = (s->decoded > s->start) ? s->decoded : s->start;
+        const PHYSFS_uint64 to = ((s->decoded + outlen) < end) ? (s->decoded + outlen) : end;
+        s->crc = g_CrcUpdate(s->crc, s->window + before + (from - s->decoded),
+                             (size_t) (to - from), g_CrcTable);
+        if (to == end)
+            s->corrupt = (CRC_GET_DIGEST(s->crc) != s->info->db.CRCs.Vals[s->dbidx]);
+    } /* if */
+
+    s->decoded += outlen;
+    BAIL_IF(s->corrupt, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* szipStreamDecode */
+
+
+static PHYSFS_sint64 SZIP_stream_read(PHYSFS_Io *io, void *_buf, PHYSFS_uint64 len)
 {
-    /* !!! FIXME: the current lzma sdk C API only allows you to decompress
-       !!! FIXME:  the entire file at once, which isn't ideal. Fix this in the
-       !!! FIXME:  SDK and then convert this all to a streaming interface. */
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    Byte *buf = (Byte *) _buf;
+    PHYSFS_uint64 total = 0;
+
+    BAIL_IF(s->corrupt, PHYSFS_ERR_CORRUPT, -1);
+
+    if (len > (s->size - s->pos))
+        len = s->size - s->pos;
 
+    while (total < len)
+    {
+        const PHYSFS_uint64 at = s->start + s->pos;
+        if (at >= s->decoded)  /* not there yet; decode some more. */
+        {
+            if (!szipStreamDecode(s, (at + (len - total)) - s->decoded))
+                return (total > 0) ? (PHYSFS_sint64) total : -1;
+        } /* if */
+        else if ((s->decoded - at) > s->windowsize)  /* already gone. */
+        {
+            if (!szipStreamRestart(s))
+                return (total > 0) ? (PHYSFS_sint64) total : -1;
+        } /* else if */
+        else  /* still in the window. */
+        {
+            const PHYSFS_uint64 back = s->decoded - at;
+            const SizeT idx = (SizeT) ((s->windowpos + s->windowsize - back) % s->windowsize);
+            PHYSFS_uint64 cpy = len - total;
+            if (cpy > back)
+                cpy = back;
+            if (cpy > (s->windowsize - idx))
+                cpy = s->windowsize - idx;
+            memcpy(buf + total, s->window + idx, (size_t) cpy);
+            total += cpy;
+            s->pos += cpy;
+        } /* else */
+    } /* while */
+
+    return (PHYSFS_sint64) total;
+} /* SZIP_stream_read */
+
+
+static PHYSFS_sint64 SZIP_stream_write(PHYSFS_Io *io, const void *b, PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, -1);
+} /* SZIP_stream_write */
+
+
+static int SZIP_stream_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    BAIL_IF(offset > s->size, PHYSFS_ERR_PAST_EOF, 0);
+    s->pos = offset;  /* the next read catches up. */
+    return 1;
+} /* SZIP_stream_seek */
+
+
+static PHYSFS_sint64 SZIP_stream_tell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPstream *) io->opaque)->pos;
+} /* SZIP_stream_tell */
+
+
+static PHYSFS_sint64 SZIP_stream_length(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPstream *) io->opaque)->size;
+} /* SZIP_stream_length */
+
+
+static PHYSFS_Io *szipOpenStream(SZIPinfo *info, const UInt32 dbidx,
+                                 const CSzCoderInfo *coder);
+
+static PHYSFS_Io *SZIP_stream_duplicate(PHYSFS_Io *io)
+{
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    return szipOpenStream(s->info, s->dbidx, &s->coder);
+} /* SZIP_stream_duplicate */
+
+
+static int SZIP_stream_flush(PHYSFS_Io *io) { return 1;  /* no write support. */ }
+
+
+static void SZIP_stream_destroy(PHYSFS_Io *io)
+{
+    SZIPstream *s = (SZIPstream *) io->opaque;
+    if (s->method == k_LZMA)
+        LzmaDec_FreeProbs(&s->lzma, &SZIP_SzAlloc);
+    else if (s->method == k_LZMA2)
+        Lzma2Dec_FreeProbs(&s->lzma2, &SZIP_SzAlloc);
+    if (s->window)
+        allocator.Free(s->window);
+    if (s->io)
+        s->io->destroy(s->io);
+    allocator.Free(s);
+    allocator.Free(io);
+} /* SZIP_stream_destroy */
+
+
+static const PHYSFS_Io SZIP_stream_Io =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    SZIP_stream_read,
+    SZIP_stream_write,
+    SZIP_stream_seek,
+    SZIP_stream_tell,
+    SZIP_stream_length,
+    SZIP_stream_duplicate,
+    SZIP_stream_flush,
+    SZIP_stream_destroy,
+    NULL,
+    NULL,
+    NULL
+};
+
+
+static PHYSFS_Io *szipOpenStream(SZIPinfo *info, const UInt32 dbidx,
+                                 const CSzCoderInfo *coder)
+{
+    const CSzAr *ar = &info->db.db;
+    const UInt32 folder = info->db.FileToFolder[dbidx];
+    const UInt32 pack = ar->FoStartPackStreamIndex[folder];
+    const Byte *props = ar->CodersData + ar->FoCodersOffsets[folder] + coder->PropsOffset;
+    PHYSFS_uint64 windowsize = SZIP_STREAM_BUFSIZE;
+    PHYSFS_Io *retval = NULL;
+    SZIPstream *s = NULL;
+    SRes rc = SZ_OK;
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+    s = (SZIPstream *) allocator.Malloc(sizeof (SZIPstream));
+    GOTO_IF(!s, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+    memset(s, '\0', sizeof (*s));
+    LzmaDec_Construct(&s->lzma);
+    Lzma2Dec_Construct(&s->lzma2);
+
+    s->info = info;
+    s->dbidx = dbidx;
+    memcpy(&s->coder, coder, sizeof (*coder));
+    s->method = (UInt32) coder->MethodID;
+    s->packpos = info->db.dataPos + ar->PackPositions[pack];
+    s->packsize = ar->PackPositions[pack + 1] - ar->PackPositions[pack];
+    s->start = info->db.UnpackPositions[dbidx] - info->db.UnpackPositions[info->db.FolderToFile[folder]];
+    s->size = SzArEx_GetFileSize(&info->db, dbidx);
+    s->checkcrc = SzBitWithVals_Check(&info->db.CRCs, dbidx);
+
+    if (s->method == k_LZMA)
+    {
+        rc = LzmaDec_AllocateProbs(&s->lzma, props, coder->PropsSize, &SZIP_SzAlloc);
+        if (rc == SZ_OK)
+            windowsize = s->lzma.prop.dicSize;
+    } /* if */
+    else if (s->method == k_LZMA2)
+    {
+        if (coder->PropsSize != 1)
+            rc = SZ_ERROR_UNSUPPORTED;
+        else
+            rc = Lzma2Dec_AllocateProbs(&s->lzma2, props[0], &SZIP_SzAlloc);
+        if (rc == SZ_OK)
+            windowsize = s->lzma2.decoder.prop.dicSize;
+    } /* else if */
+    GOTO_IF(rc != SZ_OK, szipErrorCode(rc), failed);
+
+    /* the window never needs to be bigger than the folder. */
+    if (windowsize > SzAr_GetFolderUnpackSize(ar, folder))
+        windowsize = SzAr_GetFolderUnpackSize(ar, folder);
+    if (windowsize == 0)
+        windowsize = 1;
+    GOTO_IF(!__PHYSFS_ui64FitsAddressSpace(windowsize), PHYSFS_ERR_OUT_OF_MEMORY, failed);
+    s->windowsize = (SizeT) windowsize;
+    s->window = (Byte *) allocator.Malloc(s->windowsize);
+    GOTO_IF(!s->window, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+    s->lzma.dic = s->lzma2.decoder.dic = s->window;
+    s->lzma.dicBufSize = s->lzma2.decoder.dicBufSize = s->windowsize;
+
+    s->io = info->io->duplicate(info->io);
+    GOTO_IF_ERRPASS(!s->io, failed);
+    GOTO_IF_ERRPASS(!szipStreamRestart(s), failed);
+
+    memcpy(retval, &SZIP_stream_Io, sizeof (PHYSFS_Io));
+    retval->opaque = s;
+    return retval;
+
+failed:
+    if (s != NULL)
+    {
+        LzmaDec_FreeProbs(&s->lzma, &SZIP_SzAlloc);
+        Lzma2Dec_FreeProbs(&s->lzma2, &SZIP_SzAlloc);
+        if (s->window)
+            allocator.Free(s->window);
+        if (s->io)
+            s->io->destroy(s->io);
+        allocator.Free(s);
+    } /* if */
+
+    if (retval != NULL)
+        allocator.Free(retval);
+
+    return NULL;
+} /* szipOpenStream */
+
+
+static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
+{
     SZIPinfo *info = (SZIPinfo *) opaque;
     SZIPentry *entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
     ISzAlloc *alloc = &SZIP_SzAlloc;
@@ -266,6 +1147,7 @@ static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
     PHYSFS_Io *retval = NULL;
     PHYSFS_Io *io = NULL;
     UInt32 blockIndex = 0xFFFFFFFF;
+    UInt32 folder;
     Byte *outBuffer = NULL;
     size_t outBufferSize = 0;
     size_t offset = 0;
@@ -276,6 +1158,54 @@ static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
     BAIL_IF_ERRPASS(!entry, NULL);
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
+    folder = info->db.FileToFolder[entry->dbidx];
+    if (info->preloaded != NULL)
+    {
+        if ((folder != (UInt32) -1) && (info->preloaded[folder] != SZIP_NOT_PRELOADED))
+        {
+            const UInt64 *pos = info->db.UnpackPositions;
+            const PHYSFS_uint64 start = pos[info->db.FolderToFile[folder]];
+            retval = __PHYSFS_createMemoryIoSlice(info->preload,
+                        info->preloaded[folder] + (pos[entry->dbidx] - start),
+                        SzArEx_GetFileSize(&info->db, entry->dbidx));
+            if (retval != NULL)
+                return retval;
+        } /* if */
+    } /* if */
+
+    if (folder != (UInt32) -1)
+    {
+        const PHYSFS_uint64 len = SzAr_GetFolderUnpackSize(&info->db.db, folder);
+        if ((len <= PHYSFS_7Z_BLOCK_CACHE) && (__PHYSFS_ui64FitsAddressSpace(len)))
+        {
+            const UInt64 *pos = info->db.UnpackPositions;
+            const PHYSFS_uint64 start = pos[info->db.FolderToFile[folder]];
+            io = szipGetBlock(info, folder, len);
+            BAIL_IF_ERRPASS(!io, NULL);
+            retval = __PHYSFS_createMemoryIoSlice(io, pos[entry->dbidx] - start,
+                                    SzArEx_GetFileSize(&info->db, entry->dbidx));
+            io->destroy(io);  /* (retval) keeps the buffer, if it worked. */
+            BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+            return retval;
+        } /* if */
+    } /* if */
+
+    /* bigger folders get decompressed every time, so any hit is a big win. */
+    if (__PHYSFS_fileCacheWants(SzArEx_GetFileSize(&info->db, entry->dbidx)))
+    {
+        retval = __PHYSFS_fileCacheFind(info, entry);
+        if (retval != NULL)
+            return retval;
+    } /* if */
+
+    /* if it's not going in the file cache, don't decompress it all now. */
+    else if (folder != (UInt32) -1)
+    {
+        CSzCoderInfo coder;
+        if (szipCanStream(info, folder, &coder))
+            return szipOpenStream(info, entry->dbidx, &coder);
+    } /* else if */
+
     io = info->io->duplicate(info->io);
     GOTO_IF_ERRPASS(!io, SZIP_openRead_failed);
 
@@ -302,6 +1232,7 @@ static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
     retval = __PHYSFS_createMemoryIo(buf, outSizeProcessed, allocator.Free);
     GOTO_IF_ERRPASS(!retval, SZIP_openRead_failed);
 
+    __PHYSFS_fileCacheAdd(info, entry, retval);  /* ignores big files. */
     return retval;
 
 SZIP_openRead_failed:
@@ -56,9 +56,6 @@ static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
     void *entry;
     int i;
 
-    if (fnamelen == 1 && ((fname[0] == 0) || (fname[0] == 1)))
-        return 1;  /* Magic that represents "." and "..", ignore */
-
     BAIL_IF(fnamelen == 0, PHYSFS_ERR_CORRUPT, 0);
     assert(fnamelen > 0);
     assert(fnamelen <= 255);
@@ -133,27 +130,23 @@ static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
 
     while (1)
     {
+        PHYSFS_uint8 record[255];
         PHYSFS_uint8 recordlen;
         PHYSFS_uint8 extattrlen;
         PHYSFS_uint32 extent;
         PHYSFS_uint32 datalen;
-        PHYSFS_uint8 ignore[4];
-        PHYSFS_uint8 year, month, day, hour, minute, second, offset;
+        PHYSFS_uint8 year, month, day, hour, minute, second;
         PHYSFS_uint8 flags;
         PHYSFS_uint8 fnamelen;
-        PHYSFS_uint8 fname[256];
+        PHYSFS_uint16 fname[129];  /* 256 bytes + null, aligned for Joliet. */
         PHYSFS_sint64 timestamp;
         struct tm t;
         int isdir;
         int multiextent;
 
-        BAIL_IF_ERRPASS(!io->seek(io, readpos), 0);
-
         /* recordlen = 0 -> no more entries or fill entry */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &recordlen, 1), 0);
-        if (recordlen > 0)
-            readpos += recordlen;  /* ready to seek to next record. */
-        else
+        BAIL_IF_ERRPASS(!__PHYSFS_readAllAt(io, &recordlen, 1, readpos), 0);
+        if (recordlen == 0)
         {
             PHYSFS_uint64 nextpos;
 
@@ -169,34 +162,37 @@ static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
 
             readpos = nextpos;
             continue;  /* start back at upper loop. */
-        } /* else */
+        } /* if */
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extattrlen, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extent, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* extent be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &datalen, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* datalen be */
+        /* grab the whole record at once instead of a field at a time. */
+        BAIL_IF(recordlen < 33, PHYSFS_ERR_CORRUPT, 0);
+        BAIL_IF_ERRPASS(!__PHYSFS_readAllAt(io, record, recordlen, readpos), 0);
+        readpos += recordlen;  /* ready to read the next record. */
 
-        /* record timestamp */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &year, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &month, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &day, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &hour, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &minute, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &second, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &offset, 1), 0);
+        extattrlen = record[1];
+        memcpy(&extent, &record[2], 4);  /* le; record[6] is be. */
+        memcpy(&datalen, &record[10], 4);  /* le; record[14] is be. */
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &flags, 1), 0);
+        /* record timestamp */
+        year = record[18];
+        month = record[19];
+        day = record[20];
+        hour = record[21];
+        minute = record[22];
+        second = record[23];
+        /* record[24] is the gmt offset, which we ignore. */
+
+        flags = record[25];
         isdir = (flags & (1 << 1)) != 0;
         multiextent = (flags & (1 << 7)) != 0;
         BAIL_IF(multiextent, PHYSFS_ERR_UNSUPPORTED, 0);  /* !!! FIXME */
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* unit size */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* interleave gap */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* seqnum le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* seqnum be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &fnamelen, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, fname, fnamelen), 0);
+        /* record[26..31] are unit size, interleave gap and seqnum le/be. */
+        fnamelen = record[32];
+        BAIL_IF(33 + fnamelen > recordlen, PHYSFS_ERR_CORRUPT, 0);
+        if ((fnamelen == 1) && ((record[33] == 0) || (record[33] == 1)))
+            continue;  /* Magic that represents "." and "..", ignore */
+        memcpy(fname, &record[33], fnamelen);
 
         t.tm_sec = second;
         t.tm_min = minute;
@@ -214,8 +210,9 @@ static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
         /* infinite loop, corrupt file? */
         BAIL_IF((extent * 2048) == dirstart, PHYSFS_ERR_CORRUPT, 0);
 
-        if (!iso9660AddEntry(io, joliet, isdir, base, fname, fnamelen,
-                             timestamp, extent * 2048, datalen, unpkarc))
+        if (!iso9660AddEntry(io, joliet, isdir, base, (PHYSFS_uint8 *) fname,
+                             fnamelen, timestamp, extent * 2048, datalen,
+                             unpkarc))
         {
             return 0;
         } /* if */
@@ -501,7 +501,10 @@ static const PHYSFS_Io ROFS_Io =
 	ROFS_length,
 	ROFS_duplicate,
 	ROFS_flush,
-	ROFS_destroy
+	ROFS_destroy,
+	NULL,
+	NULL,
+	NULL
 };
 
 
@@ -698,13 +701,13 @@ static void *ROFS_openArchive(PHYSFS_Io *io, const char *name, int forWriting, i
 
 	info->io = io;
 
-	if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ROFSentry), 1, 1))
+	if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ROFSentry), 1, 1, 0))
         goto ROFS_openarchive_failed;
 
 	if (!rofs_load_entries(info))
 		goto ROFS_openarchive_failed;
 
-	assert(info->tree.root->sibling == NULL);
+	assert(info->tree.root->sibling == 0);
 
 	return info;
 
@@ -161,7 +161,10 @@ static const PHYSFS_Io UNPK_Io =
     UNPK_length,
     UNPK_duplicate,
     UNPK_flush,
-    UNPK_destroy
+    UNPK_destroy,
+    NULL,
+    NULL,
+    NULL
 };
 
 
@@ -181,6 +184,16 @@ PHYSFS_Io *UNPK_openRead(void *opaque, const char *name)
     BAIL_IF_ERRPASS(!entry, NULL);
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
+    /* if the archive is in memory, the file can just be a piece of it. */
+    retval = __PHYSFS_createMemoryIoSlice(info->io, entry->startPos, entry->size);
+    if (retval != NULL)
+        return retval;
+
+    /* if not, it can still be a piece of it if we can read that in place. */
+    retval = __PHYSFS_createIoView(info->io, entry->startPos, entry->size);
+    if (retval != NULL)
+        return retval;
+
     retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
     GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_openRead_failed);
 
@@ -290,7 +303,7 @@ void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive, const int only_u
     UNPKinfo *info = (UNPKinfo *) allocator.Malloc(sizeof (UNPKinfo));
     BAIL_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
 
-    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry), case_sensitive, only_usascii))
+    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry), case_sensitive, only_usascii, 0))
     {
         allocator.Free(info);
         return NULL;
@@ -13,6 +13,7 @@
 #if PHYSFS_SUPPORTS_ZIP
 
 #include <errno.h>
+#include <stddef.h>
 
 #if (PHYSFS_BYTEORDER == PHYSFS_LIL_ENDIAN)
 #define MINIZ_LITTLE_ENDIAN 1
@@ -21,6 +22,10 @@
 #endif
 #include "physfs_miniz.h"
 
+#if PHYSFS_SUPPORTS_ZIP_ZSTD
+#include "physfs_zstd.h"
+#endif
+
 /*
  * A buffer of ZIP_READBUFSIZE is allocated for each compressed file opened,
  *  and is freed when you close the file; compressed data is read into
@@ -35,6 +40,41 @@
  */
 #define ZIP_READBUFSIZE   (16 * 1024)
 
+/*
+ * The central directory is read into a buffer of ZIP_CDIRBUFSIZE bytes (or
+ *  a smaller one, if the whole thing fits) and entries are parsed out of
+ *  memory, instead of making a separate i/o call for every field. This
+ *  buffer only exists while the archive is being opened. It must be large
+ *  enough to hold the biggest possible central directory record, which is
+ *  46 bytes plus three 16-bit lengths' worth of variable-sized data.
+ */
+#define ZIP_CDIRBUFSIZE   (256 * 1024)
+
+/*
+ * While a deflated entry is being decoded, we save a copy of the decoder's
+ *  state (including its 32k window) every ZIP_CHECKPOINT_SPACING bytes of
+ *  output, so seeking can restart from the nearest one instead of decoding
+ *  from the start of the entry. Each checkpoint costs about 43k of memory,
+ *  and is kept until the archive is closed; the checkpoints for an entry
+ *  are shared by every open handle to it. Define this to zero to turn
+ *  checkpoints off.
+ */
+#ifndef ZIP_CHECKPOINT_SPACING
+#define ZIP_CHECKPOINT_SPACING  (1024 * 1024)
+#endif
+
+
+/*
+ * With PHYSFS_setResolveMode() set to resolve everything up front, local
+ *  headers are read in offset order, ZIP_RESOLVE_WINDOW bytes at a time at
+ *  most, so headers close together come in with one read. Each read goes
+ *  ZIP_RESOLVE_SLACK bytes past the last header it's for, to catch its
+ *  name and extra field; if that's not enough, that header just starts
+ *  the next read.
+ */
+#define ZIP_RESOLVE_WINDOW  (1024 * 1024)
+#define ZIP_RESOLVE_SLACK   1024
+
 
 /*
  * Entries are "unresolved" until they are first opened. At that time,
@@ -46,10 +86,13 @@
  */
 typedef enum
 {
+    ZIP_UNLOADED,  /* DirTree made it; no central directory record yet. */
     ZIP_UNRESOLVED_FILE,
     ZIP_UNRESOLVED_SYMLINK,
     ZIP_RESOLVING,
     ZIP_RESOLVED,
+    ZIP_RESOLVED_SYMLINK,
+    ZIP_PRELOADED,  /* resolved, and decompressed into ZIPinfo's preload. */
     ZIP_DIRECTORY,
     ZIP_BROKEN_FILE,
     ZIP_BROKEN_SYMLINK
@@ -57,25 +100,59 @@ typedef enum
 
 
 /*
- * One ZIPentry is kept for each file in an open ZIP archive.
+ * One ZIPentry is kept for each file in an open ZIP archive, so archives
+ *  with millions of files have millions of these: keep them small. Only
+ *  the host system byte of "version made by" is ever used, the version
+ *  needed to extract isn't, and the mod time is only converted from DOS
+ *  format when something asks for it. Offsets and sizes are 32 bits; in
+ *  archives that need more (4 gigs or bigger, or with a file that big in
+ *  them), a ZIPentryWide follows each ZIPentry, and a field that's
+ *  ZIP_WIDE means the real value is over there, like Zip64 does it.
+ *  Use zip_entry_offset() and friends instead of reading those directly.
  */
+#define ZIP_WIDE 0xFFFFFFFF
+
+struct _ZIPcheckpoints;
+
 typedef struct _ZIPentry
 {
     __PHYSFS_DirTreeEntry tree;         /* manages directory tree         */
-    struct _ZIPentry *symlink;          /* NULL or file we symlink to     */
-    ZipResolveType resolved;            /* Have we resolved file/symlink? */
-    PHYSFS_uint64 offset;               /* offset of data in archive      */
-    PHYSFS_uint16 version;              /* version made by                */
-    PHYSFS_uint16 version_needed;       /* version needed to extract      */
-    PHYSFS_uint16 general_bits;         /* general purpose bits           */
-    PHYSFS_uint16 compression_method;   /* compression method             */
+    PHYSFS_uint32 offset;               /* offset of data in archive      */
+    PHYSFS_uint32 compressed_size;      /* compressed size                */
+    PHYSFS_uint32 uncompressed_size;    /* uncompressed size              */
     PHYSFS_uint32 crc;                  /* crc-32                         */
-    PHYSFS_uint64 compressed_size;      /* compressed size                */
-    PHYSFS_uint64 uncompressed_size;    /* uncompressed size              */
-    PHYSFS_sint64 last_mod_time;        /* last file mod time             */
     PHYSFS_uint32 dos_mod_time;         /* original MS-DOS style mod time */
+    PHYSFS_uint16 general_bits;         /* general purpose bits           */
+    PHYSFS_uint16 compression_method;   /* compression method             */
+    PHYSFS_uint8 resolved;              /* a ZipResolveType.              */
+    PHYSFS_uint8 hosttype;              /* high byte of "version made by" */
 } ZIPentry;
 
+/* low word, then high word; these don't need 64-bit alignment this way. */
+typedef struct
+{
+    PHYSFS_uint32 offset[2];
+    PHYSFS_uint32 compressed_size[2];
+    PHYSFS_uint32 uncompressed_size[2];
+} ZIPentryWide;
+
+/*
+ * The few entries that need a pointer of their own keep it here instead
+ *  of in every ZIPentry. A symlink never has checkpoints of its own (its
+ *  target does), and preloaded files never get any, so one will do.
+ */
+typedef struct _ZIPextra
+{
+    const struct _ZIPentry *entry;
+    union
+    {
+        struct _ZIPentry *symlink;      /* file we link to, once resolved */
+        struct _ZIPcheckpoints *checkpoints; /* seek checkpoints          */
+        PHYSFS_uint64 preloaded;        /* where it is, if ZIP_PRELOADED  */
+    } u;
+    struct _ZIPextra *next;             /* next in the same bucket.       */
+} ZIPextra;
+
 /*
  * One ZIPinfo is kept for each open ZIP archive.
  */
@@ -83,10 +160,50 @@ typedef struct
 {
     __PHYSFS_DirTree tree;    /* manages directory tree.                */
     PHYSFS_Io *io;            /* the i/o interface for this archive.    */
+    void *lock;               /* serializes entry resolution on (io).   */
     int zip64;                /* non-zero if this is a Zip64 archive.   */
+    int wide;                 /* non-zero if entries have a ZIPentryWide. */
+    int too_narrow;           /* non-zero if an entry needed (wide).    */
     int has_crypto;           /* non-zero if any entry uses encryption. */
+    struct _ZIPcheckpoints *checkpoints;  /* every entry's, to free later. */
+    ZIPextra **extras;        /* hashed by entry; only touch with (lock). */
+    size_t extra_buckets;     /* number of buckets in (extras).         */
+    size_t extra_count;       /* number of items in (extras).           */
+    void *resolver;           /* NULL or thread resolving entries.      */
+    PHYSFS_Io *resolver_io;   /* (resolver)'s own duplicate of (io).    */
+    volatile int stop_resolving;  /* tells (resolver) to give up.       */
+    PHYSFS_Io *preload;       /* NULL or memory Io of preloaded files.  */
+    int preloading;           /* non-zero while filling (preload).      */
+    void *index;              /* NULL or sidecar index (tree) uses.     */
+    PHYSFS_uint64 indexlen;   /* size of (index) in bytes.              */
+    int index_mapped;         /* non-zero if (index) is mapped.         */
 } ZIPinfo;
 
+/*
+ * A saved decoder state inside a deflated entry. Restoring it means seeking
+ *  to (compressed_position) and handing the decoder this state again.
+ */
+typedef struct
+{
+    PHYSFS_uint32 compressed_position;    /* compressed bytes consumed.  */
+    PHYSFS_uint32 uncompressed_position;  /* tell() at this point.       */
+    inflate_state state;                  /* decoder state and window.   */
+} ZIPcheckpoint;
+
+/*
+ * Checkpoint (i) is the first one taken at or past
+ *  (i * ZIP_CHECKPOINT_SPACING) bytes of output. Slot 0 is never used;
+ *  that's just the start of the entry. These are shared between handles,
+ *  so slots are only touched while holding (lock), which is the archive's.
+ */
+typedef struct _ZIPcheckpoints
+{
+    void *lock;                           /* ZIPinfo::lock.              */
+    ZIPcheckpoint **items;                /* NULL until decoded that far */
+    PHYSFS_uint32 count;                  /* number of slots in (items). */
+    struct _ZIPcheckpoints *next;         /* next in ZIPinfo's list.     */
+} ZIPcheckpoints;
+
 /*
  * One ZIPfileinfo is kept for each open file in a ZIP archive.
  */
@@ -96,13 +213,52 @@ typedef struct
     PHYSFS_Io *io;                        /* physical file handle.      */
     PHYSFS_uint32 compressed_position;    /* offset in compressed data. */
     PHYSFS_uint32 uncompressed_position;  /* tell() position.           */
+    PHYSFS_uint32 next_checkpoint;        /* save state once past this. */
+    PHYSFS_uint32 crc;                    /* CRC-32 of data read so far.*/
+    PHYSFS_uint32 crc_position;           /* (crc) covers up to here.   */
+    int verify;                           /* non-zero to check (crc).   */
+    int corrupt;                          /* non-zero once (crc) failed.*/
+    ZIPcheckpoints *checkpoints;          /* NULL or entry's checkpoints*/
     PHYSFS_uint8 *buffer;                 /* decompression buffer.      */
     PHYSFS_uint32 crypto_keys[3];         /* for "traditional" crypto.  */
     PHYSFS_uint32 initial_crypto_keys[3]; /* for "traditional" crypto.  */
     z_stream stream;                      /* zlib stream state.         */
+    struct ZSTDstream *zstd;              /* NULL or zstd stream state. */
 } ZIPfileinfo;
 
 
+/*
+ * A sidecar index (see PHYSFS_setArchiveIndexDir()) is this header, then
+ *  an image of the archive's tree (see __PHYSFS_DirTreeImage()), ZIPentries
+ *  and all, as it was before anything got resolved. Later mounts map it
+ *  copy-on-write and use it as the tree right where it is, so they don't
+ *  build a thing: only the entries that get used, and the pages they're
+ *  on, cost any time or memory. It's in native byte order and layout;
+ *  anything that doesn't match just means we parse the archive instead.
+ *  (magic) is written last, so a half-written index never looks valid.
+ */
+#define ZIP_INDEX_MAGIC "PhysIdx\x1A"
+#define ZIP_INDEX_VERSION 4
+#define ZIP_INDEX_BYTEORDER 0x01020304
+#define ZIP_INDEX_EXTENSION ".physfsidx"
+
+#define ZIP_INDEX_FLAG_CRYPTO  (1 << 0)
+#define ZIP_INDEX_FLAG_WIDE    (1 << 1)
+
+/* the tree image after this has to be 8-byte aligned; so does this. */
+typedef struct
+{
+    char magic[8];                   /* ZIP_INDEX_MAGIC                */
+    PHYSFS_uint32 version;           /* ZIP_INDEX_VERSION              */
+    PHYSFS_uint32 byteorder;         /* ZIP_INDEX_BYTEORDER, as we see it */
+    PHYSFS_uint64 archive_size;      /* these three are the key...     */
+    PHYSFS_sint64 archive_mtime;
+    PHYSFS_uint32 central_crc;       /* CRC-32 of the central directory. */
+    PHYSFS_uint32 flags;             /* ZIP_INDEX_FLAG_*               */
+    PHYSFS_uint64 total_len;         /* size of the whole index file.  */
+} ZIPindexHeader;
+
+
 /* Magic numbers... */
 #define ZIP_LOCAL_FILE_SIG                          0x04034b50
 #define ZIP_CENTRAL_DIR_SIG                         0x02014b50
@@ -113,6 +269,8 @@ typedef struct
 
 /* compression methods... */
 #define COMPMETH_NONE 0
+#define COMPMETH_DEFLATE 8
+#define COMPMETH_ZSTD 93
 /* ...and others... */
 
 
@@ -133,6 +291,142 @@ static int zip_entry_ignore_local_header(const ZIPentry *entry)
     return (entry->general_bits & ZIP_GENERAL_BITS_IGNORE_LOCAL_HEADER) != 0;
 } /* zip_entry_is_traditional_crypto */
 
+
+static PHYSFS_uint64 zip_entry_get(const ZIPentry *entry,
+                                   const PHYSFS_uint32 val,
+                                   const size_t wideofs)
+{
+    const PHYSFS_uint32 *wide;
+    if (val != ZIP_WIDE)
+        return val;
+    wide = (const PHYSFS_uint32 *) (((const PHYSFS_uint8 *) (entry + 1)) + wideofs);
+    return (((PHYSFS_uint64) wide[1]) << 32) | wide[0];
+} /* zip_entry_get */
+
+/*
+ * Store (val) in one of (entry)'s offsets or sizes. Returns zero if it
+ *  needs more than 32 bits and (info) doesn't have room for that.
+ */
+static int zip_entry_set(const ZIPinfo *info, ZIPentry *entry,
+                         PHYSFS_uint32 *field, const size_t wideofs,
+                         const PHYSFS_uint64 val)
+{
+    PHYSFS_uint32 *wide;
+
+    if (val < ZIP_WIDE)
+    {
+        *field = (PHYSFS_uint32) val;
+        return 1;
+    } /* if */
+
+    else if (!info->wide)
+        return 0;
+
+    wide = (PHYSFS_uint32 *) (((PHYSFS_uint8 *) (entry + 1)) + wideofs);
+    wide[0] = (PHYSFS_uint32) (val & 0xFFFFFFFF);
+    wide[1] = (PHYSFS_uint32) (val >> 32);
+    *field = ZIP_WIDE;
+    return 1;
+} /* zip_entry_set */
+
+#define zip_entry_offset(e) zip_entry_get(e, (e)->offset, offsetof(ZIPentryWide, offset))
+#define zip_entry_compressed_size(e) zip_entry_get(e, (e)->compressed_size, offsetof(ZIPentryWide, compressed_size))
+#define zip_entry_uncompressed_size(e) zip_entry_get(e, (e)->uncompressed_size, offsetof(ZIPentryWide, uncompressed_size))
+#define zip_entry_set_offset(i, e, v) zip_entry_set(i, e, &(e)->offset, offsetof(ZIPentryWide, offset), v)
+#define zip_entry_set_compressed_size(i, e, v) zip_entry_set(i, e, &(e)->compressed_size, offsetof(ZIPentryWide, compressed_size), v)
+#define zip_entry_set_uncompressed_size(i, e, v) zip_entry_set(i, e, &(e)->uncompressed_size, offsetof(ZIPentryWide, uncompressed_size), v)
+
+/* how much room each entry takes in the tree. */
+static size_t zip_entry_len(const ZIPinfo *info)
+{
+    return sizeof (ZIPentry) + (info->wide ? sizeof (ZIPentryWide) : 0);
+} /* zip_entry_len */
+
+
+/* (entry)'s ZIPextra, or NULL. Caller holds (info->lock). */
+static ZIPextra *zip_find_extra(const ZIPinfo *info, const ZIPentry *entry)
+{
+    ZIPextra *extra;
+
+    if (info->extra_buckets == 0)
+        return NULL;
+
+    extra = info->extras[entry->tree.hash & (info->extra_buckets - 1)];
+    while ((extra != NULL) && (extra->entry != entry))
+        extra = extra->next;
+    return extra;
+} /* zip_find_extra */
+
+
+/* (entry)'s ZIPextra, made empty if it didn't have one. Caller holds (info->lock). */
+static ZIPextra *zip_add_extra(ZIPinfo *info, const ZIPentry *entry)
+{
+    ZIPextra *retval = zip_find_extra(info, entry);
+    size_t bucket;
+
+    if (retval != NULL)
+        return retval;
+
+    if (info->extra_count >= info->extra_buckets)
+    {
+        /* double the buckets; they're always a power of two. */
+        const size_t newBuckets = info->extra_buckets ? info->extra_buckets * 2 : 16;
+        ZIPextra **newExtras = (ZIPextra **) allocator.Malloc(newBuckets * sizeof (ZIPextra *));
+        size_t i;
+
+        BAIL_IF(!newExtras, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        memset(newExtras, '\0', newBuckets * sizeof (ZIPextra *));
+        for (i = 0; i < info->extra_buckets; i++)
+        {
+            ZIPextra *extra = info->extras[i];
+            while (extra != NULL)
+            {
+                ZIPextra *next = extra->next;
+                bucket = extra->entry->tree.hash & (newBuckets - 1);
+                extra->next = newExtras[bucket];
+                newExtras[bucket] = extra;
+                extra = next;
+            } /* while */
+        } /* for */
+
+        if (info->extras)
+            allocator.Free(info->extras);
+        info->extras = newExtras;
+        info->extra_buckets = newBuckets;
+    } /* if */
+
+    retval = (ZIPextra *) allocator.Malloc(sizeof (ZIPextra));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(retval, '\0', sizeof (*retval));
+    retval->entry = entry;
+    bucket = entry->tree.hash & (info->extra_buckets - 1);
+    retval->next = info->extras[bucket];
+    info->extras[bucket] = retval;
+    info->extra_count++;
+    return retval;
+} /* zip_add_extra */
+
+
+static void zip_free_extras(ZIPinfo *info)
+{
+    size_t i;
+    for (i = 0; i < info->extra_buckets; i++)
+    {
+        ZIPextra *extra = info->extras[i];
+        while (extra != NULL)
+        {
+            ZIPextra *next = extra->next;
+            allocator.Free(extra);
+            extra = next;
+        } /* while */
+    } /* for */
+
+    if (info->extras)
+        allocator.Free(info->extras);
+    info->extras = NULL;
+    info->extra_buckets = info->extra_count = 0;
+} /* zip_free_extras */
+
 static PHYSFS_uint32 zip_crypto_crc32(const PHYSFS_uint32 crc, const PHYSFS_uint8 val)
 {
     int i;
@@ -268,6 +562,57 @@ static int zlib_err(const int rc)
     return rc;
 } /* zlib_err */
 
+
+/*
+ * Set up (finfo) to decompress its entry: the compressed data buffer, and
+ *  either a zstd stream or (finfo->stream) for inflate. Call
+ *  zip_free_decoder() when done, even if this fails.
+ */
+static int zip_init_decoder(ZIPfileinfo *finfo)
+{
+    finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+    BAIL_IF(!finfo->buffer, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    if (finfo->entry->compression_method == COMPMETH_ZSTD)
+    {
+        #if PHYSFS_SUPPORTS_ZIP_ZSTD
+        finfo->zstd = (ZSTDstream *) allocator.Malloc(sizeof (ZSTDstream));
+        BAIL_IF(!finfo->zstd, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        if (!zstd_init(finfo->zstd))
+        {
+            allocator.Free(finfo->zstd);
+            finfo->zstd = NULL;
+            BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        } /* if */
+        return 1;
+        #else
+        BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+        #endif
+    } /* if */
+
+    return (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) == Z_OK);
+} /* zip_init_decoder */
+
+
+static void zip_free_decoder(ZIPfileinfo *finfo)
+{
+    if (finfo->buffer != NULL)
+    {
+        allocator.Free(finfo->buffer);
+        inflateEnd(&finfo->stream);
+        finfo->buffer = NULL;
+    } /* if */
+
+    #if PHYSFS_SUPPORTS_ZIP_ZSTD
+    if (finfo->zstd != NULL)
+    {
+        zstd_end(finfo->zstd);
+        allocator.Free(finfo->zstd);
+        finfo->zstd = NULL;
+    } /* if */
+    #endif
+} /* zip_free_decoder */
+
 /*
  * Read an unsigned 64-bit int and swap to native byte order.
  */
@@ -303,15 +648,287 @@ static int readui16(PHYSFS_Io *io, PHYSFS_uint16 *val)
 } /* readui16 */
 
 
+/*
+ * Pull little-endian ints out of a memory buffer. These don't care about
+ *  alignment, which we can't promise inside the central directory.
+ */
+static inline PHYSFS_uint16 zip_getui16(const PHYSFS_uint8 *ptr)
+{
+    return (PHYSFS_uint16) (((PHYSFS_uint16) ptr[0]) |
+                            (((PHYSFS_uint16) ptr[1]) << 8));
+} /* zip_getui16 */
+
+static inline PHYSFS_uint32 zip_getui32(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint32) ptr[0]) | (((PHYSFS_uint32) ptr[1]) << 8) |
+           (((PHYSFS_uint32) ptr[2]) << 16) | (((PHYSFS_uint32) ptr[3]) << 24);
+} /* zip_getui32 */
+
+static inline PHYSFS_uint64 zip_getui64(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint64) zip_getui32(ptr)) |
+           (((PHYSFS_uint64) zip_getui32(ptr + 4)) << 32);
+} /* zip_getui64 */
+
+
+/*
+ * Get (entry)'s checkpoints, creating them if this is the first handle that
+ *  wants them. Returns NULL if the entry can't use them (too small, stored,
+ *  or encrypted, since we'd need the crypto keys at an arbitrary point in
+ *  the compressed stream) or if we're out of memory; either way, seeking
+ *  just decodes from the start like it always did.
+ */
+static ZIPcheckpoints *zip_get_checkpoints(ZIPinfo *info, ZIPentry *entry)
+{
+    ZIPcheckpoints *retval = NULL;
+    ZIPextra *extra;
+    PHYSFS_uint64 count;
+
+    if ((ZIP_CHECKPOINT_SPACING) <= 0)
+        return NULL;
+    else if (entry->compression_method != COMPMETH_DEFLATE)
+        return NULL;
+    else if (zip_entry_is_traditional_crypto(entry))
+        return NULL;
+    else if ((info->preloading) || (entry->resolved == ZIP_PRELOADED))
+        return NULL;  /* only ever read once, start to finish. */
+    else if (zip_entry_uncompressed_size(entry) <= ZIP_CHECKPOINT_SPACING)
+        return NULL;
+
+    /* positions are 32-bit in ZIPfileinfo, so don't go past that. */
+    count = zip_entry_uncompressed_size(entry);
+    if (count > 0xFFFFFFFF)
+        count = 0xFFFFFFFF;
+    count = (count / ZIP_CHECKPOINT_SPACING) + 1;
+
+    __PHYSFS_platformGrabMutex(info->lock);
+
+    extra = zip_add_extra(info, entry);
+    retval = extra ? extra->u.checkpoints : NULL;
+    if ((extra != NULL) && (retval == NULL))
+    {
+        const size_t len = ((size_t) count) * sizeof (ZIPcheckpoint *);
+        retval = (ZIPcheckpoints *) allocator.Malloc(sizeof (ZIPcheckpoints));
+        if (retval != NULL)
+        {
+            retval->items = (ZIPcheckpoint **) allocator.Malloc(len);
+            if (retval->items == NULL)
+            {
+                allocator.Free(retval);
+                retval = NULL;
+            } /* if */
+            else
+            {
+                memset(retval->items, '\0', len);
+                retval->lock = info->lock;
+                retval->count = (PHYSFS_uint32) count;
+                retval->next = info->checkpoints;
+                info->checkpoints = retval;
+                extra->u.checkpoints = retval;
+            } /* else */
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    return retval;
+} /* zip_get_checkpoints */
+
+
+static void zip_free_checkpoints(ZIPcheckpoints *cps)
+{
+    while (cps != NULL)
+    {
+        ZIPcheckpoints *next = cps->next;
+        PHYSFS_uint32 i;
+        for (i = 0; i < cps->count; i++)
+        {
+            if (cps->items[i] != NULL)
+                allocator.Free(cps->items[i]);
+        } /* for */
+        allocator.Free(cps->items);
+        allocator.Free(cps);
+        cps = next;
+    } /* while */
+} /* zip_free_checkpoints */
+
+
+/* The decoder is (pos) bytes into the entry; save its state if we want it. */
+static void zip_add_checkpoint(ZIPfileinfo *finfo, const PHYSFS_uint32 pos)
+{
+    ZIPcheckpoints *cps = finfo->checkpoints;
+    const PHYSFS_uint32 slot = pos / ZIP_CHECKPOINT_SPACING;
+
+    /* whether we save one or not, don't look again until the next slot. */
+    finfo->next_checkpoint = (slot + 1) * ZIP_CHECKPOINT_SPACING;
+    if (finfo->next_checkpoint < pos)  /* overflow? Stop checking. */
+        finfo->next_checkpoint = 0xFFFFFFFF;
+
+    if ((slot == 0) || (slot >= cps->count))
+        return;
+
+    __PHYSFS_platformGrabMutex(cps->lock);
+    if (cps->items[slot] == NULL)
+    {
+        ZIPcheckpoint *cp;
+        cp = (ZIPcheckpoint *) allocator.Malloc(sizeof (ZIPcheckpoint));
+        if (cp != NULL)  /* if we're out of memory, just do without. */
+        {
+            cp->compressed_position = finfo->compressed_position -
+                                      finfo->stream.avail_in;
+            cp->uncompressed_position = pos;
+            memcpy(&cp->state, finfo->stream.state, sizeof (inflate_state));
+            cps->items[slot] = cp;
+        } /* if */
+    } /* if */
+    __PHYSFS_platformReleaseMutex(cps->lock);
+} /* zip_add_checkpoint */
+
+
+/*
+ * Restart the decoder from the last checkpoint at or before (offset), if
+ *  there is one that's closer than where we are now (or we're seeking
+ *  backwards, where anything beats starting over). Returns -1 on i/o
+ *  error, 0 if there was no useful checkpoint, 1 if we restored one.
+ */
+static int zip_restore_checkpoint(ZIPfileinfo *finfo, const PHYSFS_uint64 offset)
+{
+    ZIPcheckpoints *cps = finfo->checkpoints;
+    const ZIPentry *entry = finfo->entry;
+    PHYSFS_uint64 slot;
+    int retval = 0;
+
+    if (cps == NULL)
+        return 0;
+
+    slot = offset / ZIP_CHECKPOINT_SPACING;
+    if (slot >= cps->count)
+        slot = cps->count - 1;
+
+    __PHYSFS_platformGrabMutex(cps->lock);
+    for (; slot > 0; slot--)
+    {
+        const ZIPcheckpoint *cp = cps->items[slot];
+        if ((cp == NULL) || (cp->uncompressed_position > offset))
+            continue;
+        else if ((offset >= finfo->uncompressed_position) &&
+                 (cp->uncompressed_position <= finfo->uncompressed_position))
+            break;  /* we're already closer than this; just keep decoding. */
+        else if (!finfo->io->seek(finfo->io, zip_entry_offset(entry) + cp->compressed_position))
+            retval = -1;
+        else
+        {
+            memcpy(finfo->stream.state, &cp->state, sizeof (inflate_state));
+            finfo->stream.next_in = finfo->buffer;
+            finfo->stream.avail_in = 0;
+            finfo->compressed_position = cp->compressed_position;
+            finfo->uncompressed_position = cp->uncompressed_position;
+            finfo->next_checkpoint = cp->uncompressed_position + 1;
+            retval = 1;
+        } /* else */
+        break;
+    } /* for */
+    __PHYSFS_platformReleaseMutex(cps->lock);
+
+    return retval;
+} /* zip_restore_checkpoint */
+
+
+#if PHYSFS_SUPPORTS_ZIP_ZSTD
+static PHYSFS_sint64 zip_read_zstd(ZIPfileinfo *finfo, void *buf,
+                                   const PHYSFS_sint64 maxread)
+{
+    const ZIPentry *entry = finfo->entry;
+    ZSTDstream *zstd = finfo->zstd;
+    PHYSFS_sint64 retval = 0;
+
+    zstd->next_out = (PHYSFS_uint8 *) buf;
+    zstd->avail_out = (size_t) maxread;
+
+    while (retval < maxread)
+    {
+        const size_t before = zstd->avail_out;
+        PHYSFS_ErrorCode rc;
+
+        if (zstd->avail_in == 0)
+        {
+            PHYSFS_sint64 br;
+
+            br = zip_entry_compressed_size(entry) - finfo->compressed_position;
+            if (br > 0)
+            {
+                if (br > ZIP_READBUFSIZE)
+                    br = ZIP_READBUFSIZE;
+
+                br = zip_read_decrypt(finfo, finfo->buffer, (PHYSFS_uint64) br);
+                if (br <= 0)
+                    break;
+
+                finfo->compressed_position += (PHYSFS_uint32) br;
+                zstd->next_in = finfo->buffer;
+                zstd->avail_in = (size_t) br;
+            } /* if */
+        } /* if */
+
+        rc = zstd_decompress(zstd);
+        retval += (PHYSFS_sint64) (before - zstd->avail_out);
+
+        if (rc != PHYSFS_ERR_OK)
+        {
+            PHYSFS_setErrorCode(rc);
+            break;
+        } /* if */
+
+        /* no progress and nothing left to feed it? It's truncated. */
+        else if ((zstd->avail_out == before) && (zstd->avail_in == 0) &&
+                 (finfo->compressed_position >= zip_entry_compressed_size(entry)))
+        {
+            PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+            break;
+        } /* else if */
+    } /* while */
+
+    return retval;
+} /* zip_read_zstd */
+#endif
+
+
+/*
+ * Fold (len) bytes just read at tell() into the running CRC. This only
+ *  follows the data while it's read in order from the start; once a seek
+ *  skips past what we've checked, we stop checking (reading from before
+ *  there again picks it back up). Fails when the last byte is in and the
+ *  CRC doesn't match the entry's, and for every read after that, too.
+ */
+static int zip_update_crc(ZIPfileinfo *finfo, const PHYSFS_uint8 *buf,
+                          const PHYSFS_uint32 len)
+{
+    const PHYSFS_uint32 pos = finfo->uncompressed_position;
+    if ((pos <= finfo->crc_position) && ((pos + len) > finfo->crc_position))
+    {
+        const PHYSFS_uint32 skip = finfo->crc_position - pos;
+        finfo->crc = __PHYSFS_crc32(finfo->crc, buf + skip, len - skip);
+        finfo->crc_position = pos + len;
+        if (finfo->crc_position == zip_entry_uncompressed_size(finfo->entry))
+            finfo->corrupt = (finfo->crc != finfo->entry->crc);
+    } /* if */
+
+    BAIL_IF(finfo->corrupt, PHYSFS_ERR_CORRUPT, 0);
+    return 1;
+} /* zip_update_crc */
+
+
 static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) _io->opaque;
     ZIPentry *entry = finfo->entry;
     PHYSFS_sint64 retval = 0;
     PHYSFS_sint64 maxread = (PHYSFS_sint64) len;
-    PHYSFS_sint64 avail = entry->uncompressed_size -
+    PHYSFS_sint64 avail = zip_entry_uncompressed_size(entry) -
                           finfo->uncompressed_position;
 
+    BAIL_IF(finfo->corrupt, PHYSFS_ERR_CORRUPT, -1);
+
     if (avail < maxread)
         maxread = avail;
 
@@ -319,6 +936,12 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 
     if (entry->compression_method == COMPMETH_NONE)
         retval = zip_read_decrypt(finfo, buf, maxread);
+
+    #if PHYSFS_SUPPORTS_ZIP_ZSTD
+    else if (finfo->zstd != NULL)
+        retval = zip_read_zstd(finfo, buf, maxread);
+    #endif
+
     else
     {
         finfo->stream.next_out = buf;
@@ -333,7 +956,7 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
             {
                 PHYSFS_sint64 br;
 
-                br = entry->compressed_size - finfo->compressed_position;
+                br = zip_entry_compressed_size(entry) - finfo->compressed_position;
                 if (br > 0)
                 {
                     if (br > ZIP_READBUFSIZE)
@@ -354,11 +977,25 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 
             if (rc != Z_OK)
                 break;
+
+            if ( (finfo->checkpoints) &&
+                 ((finfo->uncompressed_position + retval) >= finfo->next_checkpoint) )
+            {
+                zip_add_checkpoint(finfo, (PHYSFS_uint32)
+                                     (finfo->uncompressed_position + retval));
+            } /* if */
         } /* while */
     } /* else */
 
     if (retval > 0)
+    {
+        /* it was consumed either way, so tell() has to move past it. */
+        const int ok = (!finfo->verify) ||
+                       zip_update_crc(finfo, buf, (PHYSFS_uint32) retval);
         finfo->uncompressed_position += (PHYSFS_uint32) retval;
+        if (!ok)
+            retval = -1;
+    } /* if */
 
     return retval;
 } /* ZIP_read */
@@ -383,11 +1020,11 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
     PHYSFS_Io *io = finfo->io;
     const int encrypted = zip_entry_is_traditional_crypto(entry);
 
-    BAIL_IF(offset > entry->uncompressed_size, PHYSFS_ERR_PAST_EOF, 0);
+    BAIL_IF(offset > zip_entry_uncompressed_size(entry), PHYSFS_ERR_PAST_EOF, 0);
 
     if (!encrypted && (entry->compression_method == COMPMETH_NONE))
     {
-        PHYSFS_sint64 newpos = offset + entry->offset;
+        PHYSFS_sint64 newpos = offset + zip_entry_offset(entry);
         BAIL_IF_ERRPASS(!io->seek(io, newpos), 0);
         finfo->uncompressed_position = (PHYSFS_uint32) offset;
     } /* if */
@@ -396,24 +1033,41 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
     {
         /*
          * If seeking backwards, we need to redecode the file
-         *  from the start and throw away the compressed bits until we hit
-         *  the offset we need. If seeking forward, we still need to
-         *  decode, but we don't rewind first.
+         *  from the start (or the nearest checkpoint) and throw away the
+         *  compressed bits until we hit the offset we need. If seeking
+         *  forward, we still need to decode, but we don't rewind first,
+         *  unless there's a checkpoint closer than where we are.
          */
-        if (offset < finfo->uncompressed_position)
+        const int restored = zip_restore_checkpoint(finfo, offset);
+        if (restored < 0)
+            return 0;
+        else if ((!restored) && (offset < finfo->uncompressed_position))
         {
-            /* we do a copy so state is sane if inflateInit2() fails. */
-            z_stream str;
-            initializeZStream(&str);
-            if (zlib_err(inflateInit2(&str, -MAX_WBITS)) != Z_OK)
-                return 0;
+            #if PHYSFS_SUPPORTS_ZIP_ZSTD
+            if (finfo->zstd != NULL)
+            {
+                if (!io->seek(io, zip_entry_offset(entry) + (encrypted ? 12 : 0)))
+                    return 0;
+                zstd_reset(finfo->zstd);
+            } /* if */
+            else
+            #endif
+            {
+                /* we do a copy so state is sane if inflateInit2() fails. */
+                z_stream str;
+                initializeZStream(&str);
+                if (zlib_err(inflateInit2(&str, -MAX_WBITS)) != Z_OK)
+                    return 0;
 
-            if (!io->seek(io, entry->offset + (encrypted ? 12 : 0)))
-                return 0;
+                if (!io->seek(io, zip_entry_offset(entry) + (encrypted ? 12 : 0)))
+                    return 0;
+
+                inflateEnd(&finfo->stream);
+                memcpy(&finfo->stream, &str, sizeof (z_stream));
+            } /* else */
 
-            inflateEnd(&finfo->stream);
-            memcpy(&finfo->stream, &str, sizeof (z_stream));
             finfo->uncompressed_position = finfo->compressed_position = 0;
+            finfo->next_checkpoint = 0;
 
             if (encrypted)
                 memcpy(finfo->crypto_keys, finfo->initial_crypto_keys, 12);
@@ -440,7 +1094,7 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
 static PHYSFS_sint64 ZIP_length(PHYSFS_Io *io)
 {
     const ZIPfileinfo *finfo = (ZIPfileinfo *) io->opaque;
-    return (PHYSFS_sint64) finfo->entry->uncompressed_size;
+    return (PHYSFS_sint64) zip_entry_uncompressed_size(finfo->entry);
 } /* ZIP_length */
 
 
@@ -456,15 +1110,15 @@ static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
     memset(finfo, '\0', sizeof (*finfo));
 
     finfo->entry = origfinfo->entry;
+    finfo->checkpoints = origfinfo->checkpoints;
+    finfo->verify = origfinfo->verify;
     finfo->io = zip_get_io(origfinfo->io, NULL, finfo->entry);
     GOTO_IF_ERRPASS(!finfo->io, failed);
 
     initializeZStream(&finfo->stream);
     if (finfo->entry->compression_method != COMPMETH_NONE)
     {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        GOTO_IF(!finfo->buffer, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-        if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
+        if (!zip_init_decoder(finfo))
             goto failed;
     } /* if */
 
@@ -478,12 +1132,7 @@ failed:
         if (finfo->io != NULL)
             finfo->io->destroy(finfo->io);
 
-        if (finfo->buffer != NULL)
-        {
-            allocator.Free(finfo->buffer);
-            inflateEnd(&finfo->stream);
-        } /* if */
-
+        zip_free_decoder(finfo);
         allocator.Free(finfo);
     } /* if */
 
@@ -499,13 +1148,7 @@ static void ZIP_destroy(PHYSFS_Io *io)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) io->opaque;
     finfo->io->destroy(finfo->io);
-
-    if (finfo->entry->compression_method != COMPMETH_NONE)
-        inflateEnd(&finfo->stream);
-
-    if (finfo->buffer != NULL)
-        allocator.Free(finfo->buffer);
-
+    zip_free_decoder(finfo);
     allocator.Free(finfo);
     allocator.Free(io);
 } /* ZIP_destroy */
@@ -521,7 +1164,10 @@ static const PHYSFS_Io ZIP_Io =
     ZIP_length,
     ZIP_duplicate,
     ZIP_flush,
-    ZIP_destroy
+    ZIP_destroy,
+    NULL,
+    NULL,
+    NULL
 };
 
 
@@ -641,9 +1287,8 @@ static int isZip(PHYSFS_Io *io)
 
 
 /* Convert paths from old, buggy DOS zippers... */
-static void zip_convert_dos_path(const PHYSFS_uint16 entryversion, char *path)
+static void zip_convert_dos_path(const PHYSFS_uint8 hosttype, char *path)
 {
-    const PHYSFS_uint8 hosttype = (PHYSFS_uint8) ((entryversion >> 8) & 0xFF);
     if (hosttype == 0)  /* FS_FAT_ */
     {
         while (*path)
@@ -720,6 +1365,24 @@ static inline ZIPentry *zip_find_entry(ZIPinfo *info, const char *path)
     return (ZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
 } /* zip_find_entry */
 
+/* The file a resolved symlink points to, or (entry) if it isn't one. */
+static ZIPentry *zip_real_entry(ZIPinfo *info, ZIPentry *entry)
+{
+    ZIPentry *retval = entry;
+
+    if (entry->resolved == ZIP_RESOLVED_SYMLINK)
+    {
+        const ZIPextra *extra;
+        __PHYSFS_platformGrabMutex(info->lock);
+        extra = zip_find_extra(info, entry);
+        retval = extra ? extra->u.symlink : NULL;
+        __PHYSFS_platformReleaseMutex(info->lock);
+        BAIL_IF(!retval, PHYSFS_ERR_CORRUPT, NULL);
+    } /* if */
+
+    return retval;
+} /* zip_real_entry */
+
 /* (forward reference: zip_follow_symlink and zip_resolve call each other.) */
 static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry);
 
@@ -740,10 +1403,7 @@ static ZIPentry *zip_follow_symlink(PHYSFS_Io *io, ZIPinfo *info, char *path)
         if (!zip_resolve(io, info, entry))  /* recursive! */
             entry = NULL;
         else
-        {
-            if (entry->symlink != NULL)
-                entry = entry->symlink;
-        } /* else */
+            entry = zip_real_entry(info, entry);
     } /* if */
 
     return entry;
@@ -752,7 +1412,7 @@ static ZIPentry *zip_follow_symlink(PHYSFS_Io *io, ZIPinfo *info, char *path)
 
 static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 {
-    const size_t size = (size_t) entry->uncompressed_size;
+    const size_t size = (size_t) zip_entry_uncompressed_size(entry);
     char *path = NULL;
     int rc = 0;
 
@@ -762,7 +1422,7 @@ static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
      *  follow it.
      */
 
-    BAIL_IF_ERRPASS(!io->seek(io, entry->offset), 0);
+    BAIL_IF_ERRPASS(!io->seek(io, zip_entry_offset(entry)), 0);
 
     path = (char *) __PHYSFS_smallAlloc(size + 1);
     BAIL_IF(!path, PHYSFS_ERR_OUT_OF_MEMORY, 0);
@@ -770,10 +1430,23 @@ static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
     if (entry->compression_method == COMPMETH_NONE)
         rc = __PHYSFS_readAll(io, path, size);
 
+    #if PHYSFS_SUPPORTS_ZIP_ZSTD
+    else if (entry->compression_method == COMPMETH_ZSTD)
+    {
+        ZIPfileinfo finfo;
+        memset(&finfo, '\0', sizeof (finfo));
+        finfo.io = io;
+        finfo.entry = entry;
+        if (zip_init_decoder(&finfo))
+            rc = (zip_read_zstd(&finfo, path, size) == (PHYSFS_sint64) size);
+        zip_free_decoder(&finfo);
+    } /* else if */
+    #endif
+
     else  /* symlink target path is compressed... */
     {
         z_stream stream;
-        const size_t complen = (size_t) entry->compressed_size;
+        const size_t complen = (size_t) zip_entry_compressed_size(entry);
         PHYSFS_uint8 *compressed = (PHYSFS_uint8*) __PHYSFS_smallAlloc(complen);
         if (compressed != NULL)
         {
@@ -799,26 +1472,35 @@ static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 
     if (rc)
     {
-        path[entry->uncompressed_size] = '\0';    /* null-terminate it. */
-        zip_convert_dos_path(entry->version, path);
-        entry->symlink = zip_follow_symlink(io, info, path);
+        ZIPentry *target;
+        ZIPextra *extra = NULL;
+        path[size] = '\0';    /* null-terminate it. */
+        zip_convert_dos_path(entry->hosttype, path);
+        target = zip_follow_symlink(io, info, path);
+        if (target != NULL)
+            extra = zip_add_extra(info, entry);  /* we hold (info->lock). */
+        if (extra != NULL)
+            extra->u.symlink = target;
+        rc = (extra != NULL);
     } /* else */
 
     __PHYSFS_smallFree(path);
 
-    return (entry->symlink != NULL);
+    return rc;
 } /* zip_resolve_symlink */
 
 
+/* the fixed part of a local file header, before the name and extra field. */
+#define ZIP_LOCAL_HEADER_SIZE 30
+
 /*
- * Parse the local file header of an entry, and update entry->offset.
+ * Check the local file header at (ptr) against what the central directory
+ *  told us about (entry). Returns the header's full size, including the
+ *  name and extra field that follow it, or zero if it's bad.
  */
-static int zip_parse_local(PHYSFS_Io *io, ZIPentry *entry)
+static PHYSFS_uint32 zip_check_local(ZIPentry *entry, const PHYSFS_uint8 *ptr)
 {
     PHYSFS_uint32 ui32;
-    PHYSFS_uint16 ui16;
-    PHYSFS_uint16 fnamelen;
-    PHYSFS_uint16 extralen;
 
     /*
      * crc and (un)compressed_size are always zero if this is a "JAR"
@@ -833,38 +1515,46 @@ static int zip_parse_local(PHYSFS_Io *io, ZIPentry *entry)
        !!! FIXME:  which is probably true for Jar files, fwiw, but we don't
        !!! FIXME:  care about these values anyhow. */
 
-    BAIL_IF_ERRPASS(!io->seek(io, entry->offset), 0);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
-    BAIL_IF(ui32 != ZIP_LOCAL_FILE_SIG, PHYSFS_ERR_CORRUPT, 0);
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), 0);
-    /* Windows Explorer might rewrite the entire central directory, setting
-       this field to 2.0/MS-DOS for all files, so favor the local version,
-       which it leaves intact if it didn't alter that specific file. */
-    entry->version_needed = ui16;
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), 0);  /* general bits. */
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), 0);
-    BAIL_IF(ui16 != entry->compression_method, PHYSFS_ERR_CORRUPT, 0);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);  /* date/time */
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
+    BAIL_IF(zip_getui32(ptr) != ZIP_LOCAL_FILE_SIG, PHYSFS_ERR_CORRUPT, 0);
+    /* version needed to extract at ptr + 4; nothing uses it. */
+    /* general bits at ptr + 6. */
+    BAIL_IF(zip_getui16(ptr + 8) != entry->compression_method, PHYSFS_ERR_CORRUPT, 0);
+    /* date/time at ptr + 10. */
+    ui32 = zip_getui32(ptr + 14);
     BAIL_IF(ui32 && (ui32 != entry->crc), PHYSFS_ERR_CORRUPT, 0);
 
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
+    ui32 = zip_getui32(ptr + 18);
     BAIL_IF(ui32 && (ui32 != 0xFFFFFFFF) &&
-                  (ui32 != entry->compressed_size), PHYSFS_ERR_CORRUPT, 0);
+                  (ui32 != zip_entry_compressed_size(entry)), PHYSFS_ERR_CORRUPT, 0);
 
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
+    ui32 = zip_getui32(ptr + 22);
     BAIL_IF(ui32 && (ui32 != 0xFFFFFFFF) &&
-                 (ui32 != entry->uncompressed_size), PHYSFS_ERR_CORRUPT, 0);
+                 (ui32 != zip_entry_uncompressed_size(entry)), PHYSFS_ERR_CORRUPT, 0);
+
+    return ZIP_LOCAL_HEADER_SIZE + ((PHYSFS_uint32) zip_getui16(ptr + 26)) +
+           ((PHYSFS_uint32) zip_getui16(ptr + 28));
+} /* zip_check_local */
+
+
+/*
+ * Parse the local file header of an entry, and update entry->offset.
+ */
+static int zip_parse_local(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
+{
+    const PHYSFS_uint64 offset = zip_entry_offset(entry);
+    PHYSFS_uint8 buf[ZIP_LOCAL_HEADER_SIZE];
+    PHYSFS_uint32 len;
 
-    BAIL_IF_ERRPASS(!readui16(io, &fnamelen), 0);
-    BAIL_IF_ERRPASS(!readui16(io, &extralen), 0);
+    BAIL_IF_ERRPASS(!__PHYSFS_readAllAt(io, buf, sizeof (buf), offset), 0);
+    len = zip_check_local(entry, buf);
+    BAIL_IF_ERRPASS(!len, 0);
 
-    entry->offset += fnamelen + extralen + 30;
+    BAIL_IF(!zip_entry_set_offset(info, entry, offset + len), PHYSFS_ERR_CORRUPT, 0);
     return 1;
 } /* zip_parse_local */
 
 
-static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
+static int zip_resolve_entry(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 {
     int retval = 1;
     const ZipResolveType resolve_type = entry->resolved;
@@ -886,7 +1576,9 @@ static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
      *  need to check the local file header...not just for corruption,
      *  but since it stores offset info the central directory does not.
      */
-    if (resolve_type != ZIP_RESOLVED)
+    if ( (resolve_type != ZIP_RESOLVED) &&
+         (resolve_type != ZIP_RESOLVED_SYMLINK) &&
+         (resolve_type != ZIP_PRELOADED) )
     {
         if (entry->tree.isdir)  /* an ancestor dir that DirTree filled in? */
         {
@@ -894,7 +1586,7 @@ static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
             return 1;
         } /* if */
 
-        retval = zip_parse_local(io, entry);
+        retval = zip_parse_local(io, info, entry);
         if (retval)
         {
             /*
@@ -907,11 +1599,26 @@ static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
         } /* if */
 
         if (resolve_type == ZIP_UNRESOLVED_SYMLINK)
-            entry->resolved = ((retval) ? ZIP_RESOLVED : ZIP_BROKEN_SYMLINK);
+            entry->resolved = ((retval) ? ZIP_RESOLVED_SYMLINK : ZIP_BROKEN_SYMLINK);
         else if (resolve_type == ZIP_UNRESOLVED_FILE)
             entry->resolved = ((retval) ? ZIP_RESOLVED : ZIP_BROKEN_FILE);
     } /* if */
 
+    return retval;
+} /* zip_resolve_entry */
+
+
+/*
+ * Resolving updates (entry), and maybe others if it's a symlink, and seeks
+ *  around (io), which is usually the archive's shared one. Concurrent
+ *  PHYSFS_openRead() and PHYSFS_stat() calls can both land here.
+ */
+static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
+{
+    int retval;
+    __PHYSFS_platformGrabMutex(info->lock);  /* recursive for symlinks. */
+    retval = zip_resolve_entry(io, info, entry);
+    __PHYSFS_platformReleaseMutex(info->lock);
     return retval;
 } /* zip_resolve */
 
@@ -919,15 +1626,14 @@ static int zip_resolve(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 static int zip_entry_is_symlink(const ZIPentry *entry)
 {
     return ((entry->resolved == ZIP_UNRESOLVED_SYMLINK) ||
-            (entry->resolved == ZIP_BROKEN_SYMLINK) ||
-            (entry->symlink));
+            (entry->resolved == ZIP_RESOLVED_SYMLINK) ||
+            (entry->resolved == ZIP_BROKEN_SYMLINK));
 } /* zip_entry_is_symlink */
 
 
-static int zip_version_does_symlinks(PHYSFS_uint32 version)
+static int zip_host_does_symlinks(const PHYSFS_uint8 hosttype)
 {
     int retval = 0;
-    PHYSFS_uint8 hosttype = (PHYSFS_uint8) ((version >> 8) & 0xFF);
 
     switch (hosttype)
     {
@@ -953,15 +1659,15 @@ static int zip_version_does_symlinks(PHYSFS_uint32 version)
     } /* switch */
 
     return retval;
-} /* zip_version_does_symlinks */
+} /* zip_host_does_symlinks */
 
 
 static inline int zip_has_symlink_attr(const ZIPentry *entry,
                                        const PHYSFS_uint32 extern_attr)
 {
     PHYSFS_uint16 xattr = ((extern_attr >> 16) & 0xFFFF);
-    return ( (zip_version_does_symlinks(entry->version)) &&
-             (entry->uncompressed_size > 0) &&
+    return ( (zip_host_does_symlinks(entry->hosttype)) &&
+             (zip_entry_uncompressed_size(entry) > 0) &&
              ((xattr & UNIX_FILETYPE_MASK) == UNIX_FILETYPE_SYMLINK) );
 } /* zip_has_symlink_attr */
 
@@ -989,66 +1695,67 @@ static PHYSFS_sint64 zip_dos_time_to_physfs_time(PHYSFS_uint32 dostime)
 } /* zip_dos_time_to_physfs_time */
 
 
+/* size of a central directory record, before the variable-sized fields. */
+#define ZIP_CDIR_RECORD_SIZE 46
+
+
+/*
+ * (ptr) points to a complete central directory record: the fixed part,
+ *  filename, extra field and comment are all in memory.
+ */
 static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
-                                const PHYSFS_uint64 ofs_fixup)
+                                const PHYSFS_uint64 ofs_fixup,
+                                const PHYSFS_uint8 *ptr)
 {
-    PHYSFS_Io *io = info->io;
     ZIPentry entry;
     ZIPentry *retval = NULL;
-    PHYSFS_uint16 fnamelen, extralen, commentlen;
+    PHYSFS_uint16 fnamelen, extralen;
     PHYSFS_uint32 external_attr;
     PHYSFS_uint32 starting_disk;
     PHYSFS_uint64 offset;
-    PHYSFS_uint16 ui16;
-    PHYSFS_uint32 ui32;
-    PHYSFS_sint64 si64;
+    PHYSFS_uint64 compressed_size;
+    PHYSFS_uint64 uncompressed_size;
+    const PHYSFS_uint8 *extra;
     char *name = NULL;
     int isdir = 0;
 
     /* sanity check with central directory signature... */
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    BAIL_IF(ui32 != ZIP_CENTRAL_DIR_SIG, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(zip_getui32(ptr) != ZIP_CENTRAL_DIR_SIG, PHYSFS_ERR_CORRUPT, NULL);
 
     memset(&entry, '\0', sizeof (entry));
 
     /* Get the pertinent parts of the record... */
-    BAIL_IF_ERRPASS(!readui16(io, &entry.version), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &entry.version_needed), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &entry.general_bits), NULL);  /* general bits */
-    BAIL_IF_ERRPASS(!readui16(io, &entry.compression_method), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &entry.dos_mod_time), NULL);
-    entry.last_mod_time = zip_dos_time_to_physfs_time(entry.dos_mod_time);  /* !!! FIXME: there are extended fields that can get you off gross old DOS time format. */
-    BAIL_IF_ERRPASS(!readui32(io, &entry.crc), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    entry.compressed_size = (PHYSFS_uint64) ui32;
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    entry.uncompressed_size = (PHYSFS_uint64) ui32;
-    BAIL_IF_ERRPASS(!readui16(io, &fnamelen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &extralen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &commentlen), NULL);
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), NULL);
-    starting_disk = (PHYSFS_uint32) ui16;
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), NULL);  /* internal file attribs */
-    BAIL_IF_ERRPASS(!readui32(io, &external_attr), NULL);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), NULL);
-    offset = (PHYSFS_uint64) ui32;
+    entry.hosttype = (PHYSFS_uint8) ((zip_getui16(ptr + 4) >> 8) & 0xFF);
+    /* version needed to extract at ptr + 6. */
+    entry.general_bits = zip_getui16(ptr + 8);
+    entry.compression_method = zip_getui16(ptr + 10);
+    entry.dos_mod_time = zip_getui32(ptr + 12);
+    entry.crc = zip_getui32(ptr + 16);
+    compressed_size = (PHYSFS_uint64) zip_getui32(ptr + 20);
+    uncompressed_size = (PHYSFS_uint64) zip_getui32(ptr + 24);
+    fnamelen = zip_getui16(ptr + 28);
+    extralen = zip_getui16(ptr + 30);
+    /* comment length at ptr + 32; the caller skips the comment for us. */
+    starting_disk = (PHYSFS_uint32) zip_getui16(ptr + 34);
+    /* internal file attribs at ptr + 36. */
+    external_attr = zip_getui32(ptr + 38);
+    offset = (PHYSFS_uint64) zip_getui32(ptr + 42);
+
+    ptr += ZIP_CDIR_RECORD_SIZE;
+    extra = ptr + fnamelen;
 
     name = (char *) __PHYSFS_smallAlloc(fnamelen + 1);
     BAIL_IF(!name, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-    if (!__PHYSFS_readAll(io, name, fnamelen))
-    {
-        __PHYSFS_smallFree(name);
-        return NULL;
-    } /* if */
+    memcpy(name, ptr, fnamelen);
 
-    if (name[fnamelen - 1] == '/')
+    if ((fnamelen > 0) && (name[fnamelen - 1] == '/'))
     {
         name[fnamelen - 1] = '\0';
         isdir = 1;
     } /* if */
     name[fnamelen] = '\0';  /* null-terminate the filename. */
 
-    zip_convert_dos_path(entry.version, name);
+    zip_convert_dos_path(entry.hosttype, name);
 
     retval = (ZIPentry *) __PHYSFS_DirTreeAdd(&info->tree, name, isdir);
     __PHYSFS_smallFree(name);
@@ -1057,82 +1764,72 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
 
     /* It's okay to BAIL without freeing retval, because it's stored in the
        __PHYSFS_DirTree and will be freed later anyhow. */
-    BAIL_IF(retval->last_mod_time != 0, PHYSFS_ERR_CORRUPT, NULL); /* dupe? */
+    BAIL_IF(retval->resolved != ZIP_UNLOADED, PHYSFS_ERR_CORRUPT, NULL); /* dupe? */
 
     /* Move the data we already read into place in the official object. */
     memcpy(((PHYSFS_uint8 *) retval) + sizeof (__PHYSFS_DirTreeEntry),
            ((PHYSFS_uint8 *) &entry) + sizeof (__PHYSFS_DirTreeEntry),
            sizeof (*retval) - sizeof (__PHYSFS_DirTreeEntry));
 
-    retval->symlink = NULL;  /* will be resolved later, if necessary. */
-
-    if (isdir)
-        retval->resolved = ZIP_DIRECTORY;
-    else
-    {
-        retval->resolved = (zip_has_symlink_attr(retval, external_attr)) ?
-                                ZIP_UNRESOLVED_SYMLINK : ZIP_UNRESOLVED_FILE;
-    } /* else */
-
-    si64 = io->tell(io);
-    BAIL_IF_ERRPASS(si64 == -1, NULL);
-
     /* If the actual sizes didn't fit in 32-bits, look for the Zip64
         extended information extra field... */
     if ( (zip64) &&
          ((offset == 0xFFFFFFFF) ||
           (starting_disk == 0xFFFFFFFF) ||
-          (retval->compressed_size == 0xFFFFFFFF) ||
-          (retval->uncompressed_size == 0xFFFFFFFF)) )
+          (compressed_size == 0xFFFFFFFF) ||
+          (uncompressed_size == 0xFFFFFFFF)) )
     {
         int found = 0;
         PHYSFS_uint16 sig = 0;
         PHYSFS_uint16 len = 0;
         while (extralen > 4)
         {
-            BAIL_IF_ERRPASS(!readui16(io, &sig), NULL);
-            BAIL_IF_ERRPASS(!readui16(io, &len), NULL);
+            sig = zip_getui16(extra);
+            len = zip_getui16(extra + 2);
             BAIL_IF(extralen < (4 + len), PHYSFS_ERR_CORRUPT, NULL);
 
-            si64 += 4 + len;
+            extra += 4;
             extralen -= 4 + len;
-            if (sig != ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
+            if (sig == ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
             {
-                BAIL_IF_ERRPASS(!io->seek(io, si64), NULL);
-                continue;
+                found = 1;
+                break;
             } /* if */
 
-            found = 1;
-            break;
+            extra += len;
         } /* while */
 
         BAIL_IF(!found, PHYSFS_ERR_CORRUPT, NULL);
 
-        if (retval->uncompressed_size == 0xFFFFFFFF)
+        if (uncompressed_size == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &retval->uncompressed_size), NULL);
+            uncompressed_size = zip_getui64(extra);
+            extra += 8;
             len -= 8;
         } /* if */
 
-        if (retval->compressed_size == 0xFFFFFFFF)
+        if (compressed_size == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &retval->compressed_size), NULL);
+            compressed_size = zip_getui64(extra);
+            extra += 8;
             len -= 8;
         } /* if */
 
         if (offset == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui64(io, &offset), NULL);
+            offset = zip_getui64(extra);
+            extra += 8;
             len -= 8;
         } /* if */
 
         if (starting_disk == 0xFFFFFFFF)
         {
             BAIL_IF(len < 8, PHYSFS_ERR_CORRUPT, NULL);
-            BAIL_IF_ERRPASS(!readui32(io, &starting_disk), NULL);
+            starting_disk = zip_getui32(extra);
+            extra += 4;
             len -= 4;
         } /* if */
 
@@ -1141,15 +1838,65 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
 
     BAIL_IF(starting_disk != 0, PHYSFS_ERR_CORRUPT, NULL);
 
-    retval->offset = offset + ofs_fixup;
+    if ( (!zip_entry_set_offset(info, retval, offset + ofs_fixup)) ||
+         (!zip_entry_set_compressed_size(info, retval, compressed_size)) ||
+         (!zip_entry_set_uncompressed_size(info, retval, uncompressed_size)) )
+    {
+        info->too_narrow = 1;  /* the caller starts over with room for it. */
+        BAIL(PHYSFS_ERR_CORRUPT, NULL);
+    } /* if */
 
-    /* seek to the start of the next entry in the central directory... */
-    BAIL_IF_ERRPASS(!io->seek(io, si64 + extralen + commentlen), NULL);
+    if (isdir)
+        retval->resolved = ZIP_DIRECTORY;
+    else
+    {
+        retval->resolved = (zip_has_symlink_attr(retval, external_attr)) ?
+                                ZIP_UNRESOLVED_SYMLINK : ZIP_UNRESOLVED_FILE;
+        if (retval->resolved == ZIP_UNRESOLVED_SYMLINK)
+            info->tree.has_symlinks = 1;
+    } /* else */
 
     return retval;  /* success. */
 } /* zip_load_entry */
 
 
+/*
+ * Make sure at least (needed) bytes of the central directory are sitting
+ *  in (buf), starting at (*bufpos), reading more from (io) if necessary.
+ *  Whatever we haven't parsed yet gets moved to the front of the buffer
+ *  first. (*remaining) is how much of the file is left to read.
+ */
+static int zip_fill_cdir_buffer(PHYSFS_Io *io, PHYSFS_uint8 *buf,
+                                const size_t bufsize, size_t *bufpos,
+                                size_t *buflen, PHYSFS_uint64 *remaining,
+                                const size_t needed)
+{
+    size_t avail = *buflen - *bufpos;
+    size_t toread;
+
+    if (avail >= needed)
+        return 1;
+
+    BAIL_IF(((PHYSFS_uint64) (needed - avail)) > *remaining,
+            PHYSFS_ERR_CORRUPT, 0);
+    assert(needed <= bufsize);
+
+    if (avail > 0)
+        memmove(buf, buf + *bufpos, avail);
+    *bufpos = 0;
+    *buflen = avail;
+
+    toread = bufsize - avail;
+    if (((PHYSFS_uint64) toread) > *remaining)
+        toread = (size_t) *remaining;
+
+    BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, buf + avail, toread), 0);
+    *buflen += toread;
+    *remaining -= toread;
+    return 1;
+} /* zip_fill_cdir_buffer */
+
+
 /* This leaves things allocated on error; the caller will clean up the mess. */
 static int zip_load_entries(ZIPinfo *info,
                             const PHYSFS_uint64 data_ofs,
@@ -1158,19 +1905,61 @@ static int zip_load_entries(ZIPinfo *info,
 {
     PHYSFS_Io *io = info->io;
     const int zip64 = info->zip64;
+    const PHYSFS_sint64 filelen = io->length(io);
+    PHYSFS_uint64 remaining;
+    PHYSFS_uint8 *buf;
+    size_t bufsize = ZIP_CDIRBUFSIZE;
+    size_t bufpos = 0;
+    size_t buflen = 0;
     PHYSFS_uint64 i;
+    int retval = 0;
 
+    BAIL_IF_ERRPASS(filelen == -1, 0);
+    BAIL_IF(((PHYSFS_uint64) filelen) < central_ofs, PHYSFS_ERR_CORRUPT, 0);
     BAIL_IF_ERRPASS(!io->seek(io, central_ofs), 0);
 
+    /* Everything from here to EOF is the central directory and the records
+       that follow it, so there's no point in a bigger buffer than that. */
+    remaining = ((PHYSFS_uint64) filelen) - central_ofs;
+    if (((PHYSFS_uint64) bufsize) > remaining)
+        bufsize = (size_t) remaining;
+
+    buf = (PHYSFS_uint8 *) allocator.Malloc(bufsize ? bufsize : 1);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
     for (i = 0; i < entry_count; i++)
     {
-        ZIPentry *entry = zip_load_entry(info, zip64, data_ofs);
-        BAIL_IF_ERRPASS(!entry, 0);
-        if (zip_entry_is_traditional_crypto(entry))
+        const PHYSFS_uint8 *ptr;
+        ZIPentry *entry;
+        size_t reclen;
+
+        if (!zip_fill_cdir_buffer(io, buf, bufsize, &bufpos, &buflen,
+                                  &remaining, ZIP_CDIR_RECORD_SIZE))
+            goto zip_load_entries_done;
+
+        ptr = buf + bufpos;
+        reclen = ZIP_CDIR_RECORD_SIZE + ((size_t) zip_getui16(ptr + 28)) +
+                 ((size_t) zip_getui16(ptr + 30)) +
+                 ((size_t) zip_getui16(ptr + 32));
+
+        if (!zip_fill_cdir_buffer(io, buf, bufsize, &bufpos, &buflen,
+                                  &remaining, reclen))
+            goto zip_load_entries_done;
+
+        entry = zip_load_entry(info, zip64, data_ofs, buf + bufpos);
+        if (!entry)
+            goto zip_load_entries_done;
+        else if (zip_entry_is_traditional_crypto(entry))
             info->has_crypto = 1;
+
+        bufpos += reclen;
     } /* for */
 
-    return 1;
+    retval = 1;
+
+zip_load_entries_done:
+    allocator.Free(buf);
+    return retval;
 } /* zip_load_entries */
 
 
@@ -1447,6 +2236,616 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
 } /* zip_parse_end_of_central_dir */
 
 
+/*
+ * Where (name)'s index goes, in platform-dependent notation, or NULL if
+ *  indexes are off. Caller frees it with allocator.Free().
+ */
+static char *zip_index_path(const char *name)
+{
+    const char *dir = PHYSFS_getArchiveIndexDir();
+    const size_t extlen = strlen(ZIP_INDEX_EXTENSION);
+    const char *base;
+    PHYSFS_uint32 hash;
+    size_t dirlen;
+    char *retval;
+    int i;
+
+    if ((dir == NULL) || (name == NULL))
+        return NULL;
+
+    else if (*dir == '\0')  /* next to the archive. */
+    {
+        retval = (char *) allocator.Malloc(strlen(name) + extlen + 1);
+        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        strcpy(retval, name);
+        strcat(retval, ZIP_INDEX_EXTENSION);
+        return retval;
+    } /* else if */
+
+    /* archives with the same name in different places get different
+       indexes, thanks to the hash of the full path. */
+    hash = __PHYSFS_hashString(name);
+    base = strrchr(name, __PHYSFS_platformDirSeparator);
+    base = base ? base + 1 : name;
+    dirlen = strlen(dir);
+    retval = (char *) allocator.Malloc(dirlen + strlen(base) + extlen + 11);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    strcpy(retval, dir);
+    if ((dirlen == 0) || (dir[dirlen - 1] != __PHYSFS_platformDirSeparator))
+        retval[dirlen++] = __PHYSFS_platformDirSeparator;
+    strcpy(retval + dirlen, base);
+    dirlen += strlen(base);
+    retval[dirlen++] = '-';
+    for (i = 28; i >= 0; i -= 4)
+        retval[dirlen++] = "0123456789abcdef"[(hash >> i) & 0xF];
+    strcpy(retval + dirlen, ZIP_INDEX_EXTENSION);
+    return retval;
+} /* zip_index_path */
+
+
+/*
+ * Fill in the parts of (key) that identify this version of the archive.
+ *  Returns zero if (name) isn't a file we can see, or isn't the one (io)
+ *  reads, so there's nothing to key an index on. This reads everything
+ *  from (central_ofs) to the end, the central directory and the records
+ *  after it, but that's one quick pass: nothing gets parsed or kept.
+ */
+static int zip_index_key(ZIPinfo *info, const char *name,
+                         const PHYSFS_uint64 central_ofs, ZIPindexHeader *key)
+{
+    PHYSFS_Io *io = info->io;
+    const PHYSFS_sint64 len = io->length(io);
+    PHYSFS_uint64 remaining;
+    PHYSFS_uint32 crc = 0;
+    size_t bufsize = ZIP_CDIRBUFSIZE;
+    PHYSFS_uint8 *buf;
+    PHYSFS_Stat statbuf;
+
+    if (len <= 0)
+        return 0;
+    else if (((PHYSFS_uint64) len) < central_ofs)
+        return 0;
+    else if (!__PHYSFS_platformStat(name, &statbuf, 1))
+        return 0;
+    else if (statbuf.filetype != PHYSFS_FILETYPE_REGULAR)
+        return 0;
+    else if (statbuf.filesize != len)
+        return 0;
+
+    remaining = ((PHYSFS_uint64) len) - central_ofs;
+    if (((PHYSFS_uint64) bufsize) > remaining)
+        bufsize = (size_t) remaining;
+
+    buf = (PHYSFS_uint8 *) allocator.Malloc(bufsize ? bufsize : 1);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    if (!io->seek(io, central_ofs))
+        remaining = 1;  /* fails below. */
+
+    while (remaining > 0)
+    {
+        const size_t chunk = (remaining < bufsize) ? (size_t) remaining : bufsize;
+        if (!__PHYSFS_readAll(io, buf, chunk))
+            break;
+        crc = __PHYSFS_crc32(crc, buf, chunk);
+        remaining -= chunk;
+    } /* while */
+    allocator.Free(buf);
+
+    if (remaining > 0)
+        return 0;
+
+    memset(key, '\0', sizeof (*key));
+    memcpy(key->magic, ZIP_INDEX_MAGIC, sizeof (key->magic));
+    key->version = ZIP_INDEX_VERSION;
+    key->byteorder = ZIP_INDEX_BYTEORDER;
+    key->archive_size = (PHYSFS_uint64) len;
+    key->archive_mtime = statbuf.modtime;
+    key->central_crc = crc;
+    return 1;
+} /* zip_index_key */
+
+
+static void zip_free_index(void *index, const PHYSFS_uint64 len,
+                           const int mapped)
+{
+    #ifdef PHYSFS_HAVE_PLATFORM_MMAP
+    if (mapped)
+    {
+        __PHYSFS_platformUnmapFile(index, len);
+        return;
+    } /* if */
+    #endif
+    allocator.Free(index);
+} /* zip_free_index */
+
+
+/*
+ * Pull in (path) whole, mapping it if we can, privately, since resolving
+ *  entries writes to them. NULL if it isn't there.
+ */
+static void *zip_read_index(const char *path, PHYSFS_uint64 *_len,
+                            int *mapped)
+{
+    void *handle = __PHYSFS_platformOpenRead(path);
+    PHYSFS_sint64 len;
+    void *retval = NULL;
+
+    if (!handle)
+        return NULL;
+
+    #ifdef PHYSFS_HAVE_PLATFORM_MMAP
+    retval = __PHYSFS_platformMapFile(handle, _len, 1);
+    if (retval != NULL)
+    {
+        __PHYSFS_platformClose(handle);
+        *mapped = 1;
+        return retval;
+    } /* if */
+    #endif
+
+    len = __PHYSFS_platformFileLength(handle);
+    if ((len > 0) && (__PHYSFS_ui64FitsAddressSpace((PHYSFS_uint64) len)))
+    {
+        retval = allocator.Malloc((size_t) len);
+        if ((retval) && (__PHYSFS_platformRead(handle, retval, (PHYSFS_uint64) len) != len))
+        {
+            allocator.Free(retval);
+            retval = NULL;
+        } /* if */
+    } /* if */
+
+    __PHYSFS_platformClose(handle);
+    *_len = (PHYSFS_uint64) len;
+    *mapped = 0;
+    return retval;
+} /* zip_read_index */
+
+
+/*
+ * Use the index at (path) as the tree, if it matches (key). Returns non-zero
+ *  if it did; zero if the index isn't usable, which does no harm: we parse
+ *  the archive instead. Checking it doesn't read the entries, so a mount
+ *  takes the same time however many there are; DirTree makes sure even a
+ *  damaged index never sends us outside of it.
+ */
+static int zip_load_index(ZIPinfo *info, const char *path,
+                          const ZIPindexHeader *key)
+{
+    const ZIPindexHeader *hdr;
+    PHYSFS_uint64 len = 0;
+    int mapped = 0;
+    void *index;
+
+    index = zip_read_index(path, &len, &mapped);
+    if (!index)
+        return 0;
+
+    hdr = (const ZIPindexHeader *) index;
+    if ( (len >= sizeof (*hdr)) &&
+         (memcmp(hdr->magic, key->magic, sizeof (hdr->magic)) == 0) &&
+         (hdr->version == key->version) &&
+         (hdr->byteorder == key->byteorder) &&
+         (hdr->archive_size == key->archive_size) &&
+         (hdr->archive_mtime == key->archive_mtime) &&
+         (hdr->central_crc == key->central_crc) &&
+         (hdr->total_len == len) )
+    {
+        info->wide = ((hdr->flags & ZIP_INDEX_FLAG_WIDE) != 0);
+        info->has_crypto = ((hdr->flags & ZIP_INDEX_FLAG_CRYPTO) != 0);
+        if (__PHYSFS_DirTreeMap(&info->tree, (void *) (hdr + 1),
+                                len - sizeof (*hdr), zip_entry_len(info), 1, 0))
+        {
+            info->index = index;
+            info->indexlen = len;
+            info->index_mapped = mapped;
+            return 1;
+        } /* if */
+
+        /* (tree) is empty again, but don't leave these behind. */
+        info->wide = info->has_crypto = 0;
+    } /* if */
+
+    zip_free_index(index, len, mapped);
+    return 0;
+} /* zip_load_index */
+
+
+/*
+ * Save the freshly-parsed tree to (path). This is only an optimization for
+ *  next time, so failing is quiet: there's just no index then.
+ */
+static void zip_write_index(ZIPinfo *info, const char *path,
+                            const ZIPindexHeader *key)
+{
+    ZIPindexHeader hdr;
+    PHYSFS_uint64 len = 0;
+    void *handle = NULL;
+    void *image;
+    int okay = 0;
+
+    image = __PHYSFS_DirTreeImage(&info->tree, &len);
+    if (!image)
+        return;
+
+    memcpy(&hdr, key, sizeof (hdr));
+    memset(hdr.magic, '\0', sizeof (hdr.magic));  /* until we're done. */
+    hdr.flags = (info->wide ? ZIP_INDEX_FLAG_WIDE : 0) |
+                (info->has_crypto ? ZIP_INDEX_FLAG_CRYPTO : 0);
+    hdr.total_len = sizeof (hdr) + len;
+
+    /* delete first, so anyone with the old one mapped keeps their copy. */
+    __PHYSFS_platformDelete(path);
+    handle = __PHYSFS_platformOpenWrite(path);
+    if (handle)
+    {
+        okay = (__PHYSFS_platformWrite(handle, &hdr, sizeof (hdr)) == sizeof (hdr)) &&
+               (__PHYSFS_platformWrite(handle, image, len) == (PHYSFS_sint64) len) &&
+               (__PHYSFS_platformSeek(handle, 0)) &&
+               (__PHYSFS_platformWrite(handle, key->magic, sizeof (hdr.magic)) == sizeof (hdr.magic)) &&
+               (__PHYSFS_platformFlush(handle));
+        __PHYSFS_platformClose(handle);
+        if (!okay)
+            __PHYSFS_platformDelete(path);
+    } /* if */
+
+    allocator.Free(image);
+} /* zip_write_index */
+
+
+/* an unresolved entry, and where its local header was when we looked. */
+typedef struct
+{
+    ZIPentry *entry;
+    PHYSFS_uint64 offset;
+} ZIPresolveItem;
+
+static int zip_resolve_offset_cmp(void *_a, size_t one, size_t two)
+{
+    const ZIPresolveItem *a = (const ZIPresolveItem *) _a;
+    if (a[one].offset < a[two].offset)
+        return -1;
+    return (a[one].offset > a[two].offset) ? 1 : 0;
+} /* zip_resolve_offset_cmp */
+
+
+static void zip_resolve_offset_swap(void *_a, size_t one, size_t two)
+{
+    ZIPresolveItem *a = (ZIPresolveItem *) _a;
+    ZIPresolveItem tmp;
+    memcpy(&tmp, &a[one], sizeof (tmp));
+    memcpy(&a[one], &a[two], sizeof (tmp));
+    memcpy(&a[two], &tmp, sizeof (tmp));
+} /* zip_resolve_offset_swap */
+
+
+/*
+ * Resolve every entry nobody has opened yet, reading local headers through
+ *  (io) in the order they sit in the archive. This can run on another
+ *  thread while files are being opened, so entries are only touched while
+ *  holding (info->lock), and anything already resolved is left alone. If
+ *  this fails partway (or (*stop) gets set), whatever's left is resolved
+ *  on open, like always.
+ */
+static void zip_resolve_all(ZIPinfo *info, PHYSFS_Io *io,
+                            volatile int *stop)
+{
+    const PHYSFS_sint64 filelen = io->length(io);
+    ZIPresolveItem *items = NULL;
+    PHYSFS_uint8 *buf = NULL;
+    size_t total = 0;
+    size_t i;
+    int full = 0;
+
+    if (filelen <= 0)
+        return;
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    for (i = 1; i <= info->tree.entries; i++)
+    {
+        const ZIPentry *entry = (const ZIPentry *) __PHYSFS_DirTreeEntryAt(&info->tree, (PHYSFS_uint32) i);
+        total += ((!entry->tree.isdir) && (entry->resolved == ZIP_UNRESOLVED_FILE));
+    } /* for */
+
+    if (total > 0)
+    {
+        items = (ZIPresolveItem *) allocator.Malloc(total * sizeof (ZIPresolveItem));
+        buf = (PHYSFS_uint8 *) allocator.Malloc(ZIP_RESOLVE_WINDOW);
+    } /* if */
+
+    if ((items != NULL) && (buf != NULL))
+    {
+        size_t n = 0;
+        for (i = 1; i <= info->tree.entries; i++)
+        {
+            ZIPentry *entry = (ZIPentry *) __PHYSFS_DirTreeEntryAt(&info->tree, (PHYSFS_uint32) i);
+            if ((!entry->tree.isdir) && (entry->resolved == ZIP_UNRESOLVED_FILE))
+            {
+                items[n].entry = entry;
+                items[n].offset = zip_entry_offset(entry);
+                n++;
+            } /* if */
+        } /* for */
+        assert(n == total);
+    } /* if */
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    if ((items == NULL) || (buf == NULL))
+        goto zip_resolve_all_done;
+
+    __PHYSFS_sort(items, total, zip_resolve_offset_cmp, zip_resolve_offset_swap);
+
+    i = 0;
+    while ((i < total) && (!*stop))
+    {
+        const PHYSFS_uint64 start = items[i].offset;
+        PHYSFS_uint64 len = ZIP_RESOLVE_WINDOW;
+        const size_t first = i;
+
+        if (!full)  /* just read as far as the headers that fit. */
+        {
+            PHYSFS_uint64 end = start;
+            size_t j;
+            for (j = i; j < total; j++)
+            {
+                const PHYSFS_uint64 ofs = items[j].offset;
+                if ((ofs - start) + ZIP_LOCAL_HEADER_SIZE > ZIP_RESOLVE_WINDOW)
+                    break;
+                end = ofs + ZIP_LOCAL_HEADER_SIZE + ZIP_RESOLVE_SLACK;
+            } /* for */
+
+            if ((end - start) < len)
+                len = end - start;
+        } /* if */
+
+        if (start >= (PHYSFS_uint64) filelen)
+            len = 0;
+        else if (len > (((PHYSFS_uint64) filelen) - start))
+            len = ((PHYSFS_uint64) filelen) - start;
+
+        if ((len > 0) && ((!io->seek(io, start)) || (!__PHYSFS_readAll(io, buf, (size_t) len))))
+            break;
+
+        __PHYSFS_platformGrabMutex(info->lock);
+        for (; i < total; i++)
+        {
+            ZIPentry *entry = items[i].entry;
+            const PHYSFS_uint64 pos = items[i].offset - start;
+            PHYSFS_uint32 hdrlen;
+
+            /* if someone opened it while we weren't looking, its offset
+               moved, but we're done with it anyhow. */
+            if (entry->resolved != ZIP_UNRESOLVED_FILE)
+                continue;
+
+            if ((pos + ZIP_LOCAL_HEADER_SIZE) > len)
+                break;
+
+            hdrlen = ZIP_LOCAL_HEADER_SIZE +
+                     ((PHYSFS_uint32) zip_getui16(buf + pos + 26)) +
+                     ((PHYSFS_uint32) zip_getui16(buf + pos + 28));
+            if ((pos + hdrlen) > len)
+                break;
+
+            hdrlen = zip_check_local(entry, buf + pos);
+            if ((hdrlen) && (zip_entry_set_offset(info, entry, items[i].offset + hdrlen)))
+                entry->resolved = ZIP_RESOLVED;
+            else
+                entry->resolved = ZIP_BROKEN_FILE;
+        } /* for */
+
+        /* a header that didn't fit even at the start of a read gets one
+           full-sized read, and if it still doesn't fit, it's truncated. */
+        if ((i == first) && (i < total))
+        {
+            if (full)
+            {
+                items[i++].entry->resolved = ZIP_BROKEN_FILE;
+                full = 0;
+            } /* if */
+            else
+            {
+                full = 1;
+            } /* else */
+        } /* if */
+        else
+        {
+            full = 0;
+        } /* else */
+        __PHYSFS_platformReleaseMutex(info->lock);
+    } /* while */
+
+    /* symlinks have to read their targets, too; they're usually few. */
+    for (i = 1; (i <= info->tree.entries) && (!*stop); i++)
+    {
+        ZIPentry *entry = (ZIPentry *) __PHYSFS_DirTreeEntryAt(&info->tree, (PHYSFS_uint32) i);
+        if ((!entry->tree.isdir) && (entry->resolved == ZIP_UNRESOLVED_SYMLINK))
+            zip_resolve(io, info, entry);  /* failing just marks it broken. */
+    } /* for */
+
+zip_resolve_all_done:
+    if (buf) allocator.Free(buf);
+    if (items) allocator.Free(items);
+} /* zip_resolve_all */
+
+
+#ifdef PHYSFS_HAVE_PLATFORM_THREADS
+static void zip_resolve_thread(void *data)
+{
+    ZIPinfo *info = (ZIPinfo *) data;
+    zip_resolve_all(info, info->resolver_io, &info->stop_resolving);
+} /* zip_resolve_thread */
+#endif
+
+
+static void zip_start_resolving(ZIPinfo *info)
+{
+    const PHYSFS_ResolveMode mode = PHYSFS_getResolveMode();
+
+    if (mode == PHYSFS_RESOLVE_ON_MOUNT)
+        zip_resolve_all(info, info->io, &info->stop_resolving);
+
+    #ifdef PHYSFS_HAVE_PLATFORM_THREADS
+    else if (mode == PHYSFS_RESOLVE_IN_BACKGROUND)
+    {
+        /* if we can't start a thread, entries just get resolved on open. */
+        info->resolver_io = info->io->duplicate(info->io);
+        if (info->resolver_io != NULL)
+        {
+            info->resolver = __PHYSFS_platformCreateThread(zip_resolve_thread, info);
+            if (info->resolver == NULL)
+            {
+                info->resolver_io->destroy(info->resolver_io);
+                info->resolver_io = NULL;
+            } /* if */
+        } /* if */
+    } /* else if */
+    #endif
+} /* zip_start_resolving */
+
+
+static PHYSFS_Io *zip_open_entry(ZIPinfo *info, ZIPentry *entry,
+                                 const PHYSFS_uint8 *password,
+                                 const int verify);
+
+/* what zip_preload() shares with its tasks. */
+typedef struct
+{
+    ZIPinfo *info;
+    ZIPresolveItem *items;  /* (offset) is where each one goes in (buf). */
+    PHYSFS_uint8 *buf;
+    PHYSFS_uint8 *done;     /* non-zero for each item that made it.    */
+} ZIPpreload;
+
+static void zip_preload_entry(void *data, int task)
+{
+    ZIPpreload *preload = (ZIPpreload *) data;
+    const ZIPresolveItem *item = &preload->items[task];
+    PHYSFS_Io *io = zip_open_entry(preload->info, item->entry, NULL,
+                                   PHYSFS_checksumsVerified());
+    if (io != NULL)
+    {
+        preload->done[task] = (PHYSFS_uint8) __PHYSFS_readAll(io,
+                                preload->buf + item->offset,
+                                (size_t) zip_entry_uncompressed_size(item->entry));
+        io->destroy(io);
+    } /* if */
+} /* zip_preload_entry */
+
+
+/*
+ * Decompress every file into one buffer, on PHYSFS_preloadArchives()'s
+ *  threads, so opening one later just hands out a piece of it. If there
+ *  isn't memory for that, files are read from the archive like always, and
+ *  files that fail to decompress here are left to fail when they're opened.
+ */
+static void zip_preload(ZIPinfo *info)
+{
+    ZIPpreload preload;
+    PHYSFS_Io *slice;
+    PHYSFS_uint64 total = 0;
+    PHYSFS_uint64 compressed = 0;
+    PHYSFS_uint64 decompressed = 0;
+    PHYSFS_uint64 ms;
+    size_t count = 0;
+    size_t i;
+    int inmem;
+
+    memset(&preload, '\0', sizeof (preload));
+    preload.info = info;
+
+    zip_resolve_all(info, info->io, &info->stop_resolving);
+
+    /* stored files in an archive that's already in memory stay there. */
+    slice = __PHYSFS_createMemoryIoSlice(info->io, 0, 0);
+    inmem = (slice != NULL) && (!PHYSFS_checksumsVerified());
+    if (slice != NULL)
+        slice->destroy(slice);
+
+    for (i = 1; i <= info->tree.entries; i++)
+    {
+        const ZIPentry *entry = (const ZIPentry *) __PHYSFS_DirTreeEntryAt(&info->tree, (PHYSFS_uint32) i);
+        if ( (!entry->tree.isdir) && (entry->resolved == ZIP_RESOLVED) &&
+             (zip_entry_uncompressed_size(entry) > 0) &&
+             (!zip_entry_is_traditional_crypto(entry)) &&
+             ((!inmem) || (entry->compression_method != COMPMETH_NONE)) )
+            count++;
+    } /* for */
+
+    if ((count == 0) || (count > 0x7FFFFFFF))
+        return;
+
+    preload.items = (ZIPresolveItem *) allocator.Malloc(count * sizeof (ZIPresolveItem));
+    preload.done = (PHYSFS_uint8 *) allocator.Malloc(count);
+    if ((!preload.items) || (!preload.done))
+        goto zip_preload_done;
+    memset(preload.done, '\0', count);
+
+    count = 0;
+    for (i = 1; i <= info->tree.entries; i++)
+    {
+        ZIPentry *entry = (ZIPentry *) __PHYSFS_DirTreeEntryAt(&info->tree, (PHYSFS_uint32) i);
+        if ( (!entry->tree.isdir) && (entry->resolved == ZIP_RESOLVED) &&
+             (zip_entry_uncompressed_size(entry) > 0) &&
+             (!zip_entry_is_traditional_crypto(entry)) &&
+             ((!inmem) || (entry->compression_method != COMPMETH_NONE)) )
+        {
+            preload.items[count].entry = entry;
+            preload.items[count].offset = zip_entry_offset(entry);
+            count++;
+        } /* if */
+    } /* for */
+
+    /* hand them out in archive order, so the reads mostly go forward. */
+    __PHYSFS_sort(preload.items, count, zip_resolve_offset_cmp, zip_resolve_offset_swap);
+
+    for (i = 0; i < count; i++)
+    {
+        const PHYSFS_uint64 len = zip_entry_uncompressed_size(preload.items[i].entry);
+        preload.items[i].offset = total;
+        total += len;
+        if (total < len)
+            goto zip_preload_done;
+    } /* for */
+
+    if (!__PHYSFS_ui64FitsAddressSpace(total))
+        goto zip_preload_done;
+    preload.buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) total);
+    if (!preload.buf)
+        goto zip_preload_done;
+
+    info->preloading = 1;
+    ms = __PHYSFS_runTasks(PHYSFS_archivesPreloaded(), &preload, (int) count, zip_preload_entry);
+    info->preloading = 0;
+
+    info->preload = __PHYSFS_createMemoryIo(preload.buf, total, allocator.Free);
+    if (!info->preload)
+        goto zip_preload_done;
+    preload.buf = NULL;  /* (info->preload) owns it now. */
+
+    __PHYSFS_platformGrabMutex(info->lock);
+    for (i = 0; i < count; i++)
+    {
+        ZIPentry *entry = preload.items[i].entry;
+        ZIPextra *extra = preload.done[i] ? zip_add_extra(info, entry) : NULL;
+        if (extra != NULL)
+        {
+            extra->u.preloaded = preload.items[i].offset;
+            entry->resolved = ZIP_PRELOADED;
+            compressed += zip_entry_compressed_size(entry);
+            decompressed += zip_entry_uncompressed_size(entry);
+        } /* if */
+    } /* for */
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    __PHYSFS_addPreloadStats(compressed, decompressed, ms);
+
+zip_preload_done:
+    if (preload.buf) allocator.Free(preload.buf);
+    if (preload.done) allocator.Free(preload.done);
+    if (preload.items) allocator.Free(preload.items);
+} /* zip_preload */
+
+
 static void ZIP_closeArchive(void *opaque)
 {
     ZIPinfo *info = (ZIPinfo *) (opaque);
@@ -1454,23 +2853,64 @@ static void ZIP_closeArchive(void *opaque)
     if (!info)
         return;
 
+    #ifdef PHYSFS_HAVE_PLATFORM_THREADS
+    if (info->resolver)
+    {
+        info->stop_resolving = 1;
+        __PHYSFS_platformWaitThread(info->resolver);
+    } /* if */
+    #endif
+
+    if (info->resolver_io)
+        info->resolver_io->destroy(info->resolver_io);
+
     if (info->io)
         info->io->destroy(info->io);
 
+    if (info->preload)
+        info->preload->destroy(info->preload);
+
+    __PHYSFS_fileCacheForget(info);
     __PHYSFS_DirTreeDeinit(&info->tree);
+    zip_free_checkpoints(info->checkpoints);
+    zip_free_extras(info);
+
+    if (info->index)  /* after the tree, which might be using it. */
+        zip_free_index(info->index, info->indexlen, info->index_mapped);
+
+    if (info->lock)
+        __PHYSFS_platformDestroyMutex(info->lock);
 
     allocator.Free(info);
 } /* ZIP_closeArchive */
 
 
+/* This leaves things allocated on error; the caller will clean up the mess. */
+static int zip_load_tree(ZIPinfo *info, const PHYSFS_uint64 data_ofs,
+                         const PHYSFS_uint64 central_ofs,
+                         const PHYSFS_uint64 entry_count)
+{
+    ZIPentry *root;
+
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeInit(&info->tree, zip_entry_len(info), 1, 0, entry_count), 0);
+    root = (ZIPentry *) info->tree.root;
+    root->resolved = ZIP_DIRECTORY;
+
+    return zip_load_entries(info, data_ofs, central_ofs, entry_count);
+} /* zip_load_tree */
+
+
 static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
                              int forWriting, int *claimed)
 {
     ZIPinfo *info = NULL;
-    ZIPentry *root = NULL;
     PHYSFS_uint64 dstart = 0;  /* data start */
     PHYSFS_uint64 cdir_ofs;  /* central dir offset */
     PHYSFS_uint64 count;
+    ZIPindexHeader key;
+    char *indexpath = NULL;
+    int indexed = 0;
+    int keyed = 0;
 
     assert(io != NULL);  /* shouldn't ever happen. */
 
@@ -1485,21 +2925,61 @@ static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     info->io = io;
 
-    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &count))
+    info->lock = __PHYSFS_platformCreateMutex();
+    if (!info->lock)
         goto ZIP_openarchive_failed;
-    else if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry), 1, 0))
+
+    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &count))
         goto ZIP_openarchive_failed;
 
-    root = (ZIPentry *) info->tree.root;
-    root->resolved = ZIP_DIRECTORY;
+    indexpath = zip_index_path(name);
+    if ((indexpath) && (zip_index_key(info, name, cdir_ofs, &key)))
+    {
+        indexed = zip_load_index(info, indexpath, &key);
+        keyed = !indexed;
+    } /* if */
 
-    if (!zip_load_entries(info, dstart, cdir_ofs, count))
-        goto ZIP_openarchive_failed;
+    if (!indexed)
+    {
+        /* most archives never need more than 32 bits in an entry, even
+           Zip64 ones; if this one does after all, start over wide. */
+        const PHYSFS_sint64 len = io->length(io);
+        info->wide = (len < 0) || (((PHYSFS_uint64) len) >= ZIP_WIDE);
+        if (!zip_load_tree(info, dstart, cdir_ofs, count))
+        {
+            if ((info->wide) || (!info->too_narrow))
+                goto ZIP_openarchive_failed;
+            __PHYSFS_DirTreeDeinit(&info->tree);
+            info->has_crypto = 0;
+            info->wide = 1;
+            if (!zip_load_tree(info, dstart, cdir_ofs, count))
+                goto ZIP_openarchive_failed;
+        } /* if */
+
+        /* (this has to see the tree before anything gets resolved.) */
+        if (keyed)
+            zip_write_index(info, indexpath, &key);
+    } /* if */
+
+    if (indexpath)
+        allocator.Free(indexpath);
 
-    assert(info->tree.root->sibling == NULL);
+    if (PHYSFS_archivesPreloaded())
+    {
+        /* this reads the whole archive, mostly front to back. */
+        __PHYSFS_ioHint(info->io, PHYSFS_IOHINT_SEQUENTIAL);
+        zip_preload(info);
+        __PHYSFS_ioHint(info->io, PHYSFS_IOHINT_NORMAL);
+    } /* if */
+    else
+        zip_start_resolving(info);
+
+    assert(info->tree.root->sibling == 0);
     return info;
 
 ZIP_openarchive_failed:
+    if (indexpath)
+        allocator.Free(indexpath);
     info->io = NULL;  /* don't let ZIP_closeArchive destroy (io). */
     ZIP_closeArchive(info);
     return NULL;
@@ -1509,18 +2989,33 @@ ZIP_openarchive_failed:
 static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry)
 {
     int success;
-    PHYSFS_Io *retval = io->duplicate(io);
+    PHYSFS_Io *retval = NULL;
+
+    /* a view of the archive doesn't need its own file handle. */
+    if (__PHYSFS_ioHas(io, readAt))
+    {
+        const PHYSFS_sint64 len = io->length(io);
+        if (len >= 0)
+            retval = __PHYSFS_createIoView(io, 0, (PHYSFS_uint64) len);
+    } /* if */
+
+    if (retval == NULL)
+        retval = io->duplicate(io);
     BAIL_IF_ERRPASS(!retval, NULL);
 
     assert(!entry->tree.isdir); /* should have been checked before calling. */
 
-    /* (inf) can be NULL if we already resolved. */
+    /* (inf) can be NULL if we already resolved, and (entry) is the real one. */
     success = (inf == NULL) || zip_resolve(retval, inf, entry);
+    if ((success) && (inf != NULL))
+    {
+        entry = zip_real_entry(inf, entry);
+        success = (entry != NULL);
+    } /* if */
+
     if (success)
     {
-        PHYSFS_sint64 offset;
-        offset = ((entry->symlink) ? entry->symlink->offset : entry->offset);
-        success = retval->seek(retval, offset);
+        success = retval->seek(retval, zip_entry_offset(entry));
     } /* if */
 
     if (!success)
@@ -1533,13 +3028,118 @@ static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry)
 } /* zip_get_io */
 
 
+/* (entry) must already be resolved. */
+static PHYSFS_Io *zip_open_entry(ZIPinfo *info, ZIPentry *entry,
+                                 const PHYSFS_uint8 *password,
+                                 const int verify)
+{
+    PHYSFS_Io *retval = NULL;
+    ZIPfileinfo *finfo = NULL;
+    PHYSFS_Io *io = NULL;
+
+    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, zip_open_entry_failed);
+
+    finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
+    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, zip_open_entry_failed);
+    memset(finfo, '\0', sizeof (ZIPfileinfo));
+
+    io = zip_get_io(info->io, info, entry);
+    GOTO_IF_ERRPASS(!io, zip_open_entry_failed);
+    finfo->io = io;
+    finfo->entry = zip_real_entry(info, entry);
+    GOTO_IF_ERRPASS(!finfo->entry, zip_open_entry_failed);
+    finfo->verify = verify;
+    initializeZStream(&finfo->stream);
+
+    if (finfo->entry->compression_method != COMPMETH_NONE)
+    {
+        if (!zip_init_decoder(finfo))
+            goto zip_open_entry_failed;
+        finfo->checkpoints = zip_get_checkpoints(info, finfo->entry);
+    } /* if */
+
+    if (!zip_entry_is_traditional_crypto(entry))
+        GOTO_IF(password != NULL, PHYSFS_ERR_BAD_PASSWORD, zip_open_entry_failed);
+    else
+    {
+        PHYSFS_uint8 crypto_header[12];
+        GOTO_IF(password == NULL, PHYSFS_ERR_BAD_PASSWORD, zip_open_entry_failed);
+        if (io->read(io, crypto_header, 12) != 12)
+            goto zip_open_entry_failed;
+        else if (!zip_prep_crypto_keys(finfo, crypto_header, password))
+            goto zip_open_entry_failed;
+    } /* if */
+
+    memcpy(retval, &ZIP_Io, sizeof (PHYSFS_Io));
+    retval->opaque = finfo;
+
+    return retval;
+
+zip_open_entry_failed:
+    if (finfo != NULL)
+    {
+        if (finfo->io != NULL)
+            finfo->io->destroy(finfo->io);
+
+        zip_free_decoder(finfo);
+        allocator.Free(finfo);
+    } /* if */
+
+    if (retval != NULL)
+        allocator.Free(retval);
+
+    return NULL;
+} /* zip_open_entry */
+
+
+/*
+ * Get a compressed, unencrypted entry from the file cache, or decompress
+ *  the whole thing into memory and put it there. (entry) must already be
+ *  resolved.
+ */
+static PHYSFS_Io *zip_open_cached(ZIPinfo *info, ZIPentry *entry)
+{
+    const ZIPentry *real = zip_real_entry(info, entry);
+    PHYSFS_Io *retval;
+    PHYSFS_Io *io;
+    size_t len;
+    void *buf;
+
+    BAIL_IF_ERRPASS(!real, NULL);
+    len = (size_t) zip_entry_uncompressed_size(real);
+    retval = __PHYSFS_fileCacheFind(info, real);
+    if (retval != NULL)
+        return retval;
+
+    buf = allocator.Malloc(len ? len : 1);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    io = zip_open_entry(info, entry, NULL, PHYSFS_checksumsVerified());
+    GOTO_IF_ERRPASS(!io, zip_open_cached_failed);
+    if (!__PHYSFS_readAll(io, buf, len))
+    {
+        io->destroy(io);
+        goto zip_open_cached_failed;
+    } /* if */
+    io->destroy(io);
+
+    retval = __PHYSFS_createMemoryIo(buf, len, allocator.Free);
+    GOTO_IF_ERRPASS(!retval, zip_open_cached_failed);
+    __PHYSFS_fileCacheAdd(info, real, retval);
+    return retval;
+
+zip_open_cached_failed:
+    allocator.Free(buf);
+    return NULL;
+} /* zip_open_cached */
+
+
 static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
 {
     PHYSFS_Io *retval = NULL;
     ZIPinfo *info = (ZIPinfo *) opaque;
     ZIPentry *entry = zip_find_entry(info, filename);
-    ZIPfileinfo *finfo = NULL;
-    PHYSFS_Io *io = NULL;
     PHYSFS_uint8 *password = NULL;
 
     /* if not found, see if maybe "$PASSWORD" is appended. */
@@ -1565,65 +3165,164 @@ static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
 
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
-    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
+    if ((password == NULL) && (!zip_entry_is_traditional_crypto(entry)))
+    {
+        const ZIPentry *real = zip_real_entry(info, entry);
+        BAIL_IF_ERRPASS(!real, NULL);
 
-    finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-    memset(finfo, '\0', sizeof (ZIPfileinfo));
+        if (real->resolved == ZIP_PRELOADED)
+        {
+            const ZIPextra *extra;
+            __PHYSFS_platformGrabMutex(info->lock);
+            extra = zip_find_extra(info, real);
+            __PHYSFS_platformReleaseMutex(info->lock);
+            if ((extra != NULL) && (info->preload != NULL))
+            {
+                retval = __PHYSFS_createMemoryIoSlice(info->preload,
+                                                      extra->u.preloaded,
+                                                      zip_entry_uncompressed_size(real));
+                if (retval != NULL)
+                    return retval;
+            } /* if */
+        } /* if */
 
-    io = zip_get_io(info->io, info, entry);
-    GOTO_IF_ERRPASS(!io, ZIP_openRead_failed);
-    finfo->io = io;
-    finfo->entry = ((entry->symlink != NULL) ? entry->symlink : entry);
-    initializeZStream(&finfo->stream);
+        /* a stored file can just be a piece of the archive (in memory, or
+           read with readAt())...unless it needs checking, which means
+           reading it through our own Io anyhow. */
+        else if (real->compression_method == COMPMETH_NONE)
+        {
+            if (PHYSFS_checksumsVerified())
+                return zip_open_entry(info, entry, NULL, 1);
+
+            retval = __PHYSFS_createMemoryIoSlice(info->io, zip_entry_offset(real),
+                                                  zip_entry_uncompressed_size(real));
+            if (retval != NULL)
+                return retval;
+
+            retval = __PHYSFS_createIoView(info->io, zip_entry_offset(real),
+                                           zip_entry_uncompressed_size(real));
+            if (retval != NULL)
+                return retval;
+        } /* if */
 
-    if (finfo->entry->compression_method != COMPMETH_NONE)
-    {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        if (!finfo->buffer)
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-        else if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
-            goto ZIP_openRead_failed;
+        /* small compressed files might be worth keeping decompressed. */
+        else if (__PHYSFS_fileCacheWants(zip_entry_uncompressed_size(real)))
+        {
+            return zip_open_cached(info, entry);
+        } /* else if */
     } /* if */
 
-    if (!zip_entry_is_traditional_crypto(entry))
-        GOTO_IF(password != NULL, PHYSFS_ERR_BAD_PASSWORD, ZIP_openRead_failed);
-    else
-    {
-        PHYSFS_uint8 crypto_header[12];
-        GOTO_IF(password == NULL, PHYSFS_ERR_BAD_PASSWORD, ZIP_openRead_failed);
-        if (io->read(io, crypto_header, 12) != 12)
-            goto ZIP_openRead_failed;
-        else if (!zip_prep_crypto_keys(finfo, crypto_header, password))
-            goto ZIP_openRead_failed;
-    } /* if */
+    return zip_open_entry(info, entry, password, PHYSFS_checksumsVerified());
+} /* ZIP_openRead */
 
-    memcpy(retval, &ZIP_Io, sizeof (PHYSFS_Io));
-    retval->opaque = finfo;
 
-    return retval;
+/* what __PHYSFS_zipVerify() shares with its tasks. */
+typedef struct
+{
+    ZIPinfo *info;
+    ZIPresolveItem *items;
+    PHYSFS_ErrorCode *errors;  /* how each item went; error codes are per-thread. */
+} ZIPverify;
 
-ZIP_openRead_failed:
-    if (finfo != NULL)
+static void zip_verify_entry(void *data, int task)
+{
+    ZIPverify *verify = (ZIPverify *) data;
+    ZIPentry *entry = verify->items[task].entry;
+    PHYSFS_uint64 remaining = zip_entry_uncompressed_size(entry);
+    PHYSFS_ErrorCode err = PHYSFS_ERR_OK;
+    PHYSFS_uint8 *buf;
+    PHYSFS_Io *io = NULL;
+
+    buf = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+    if (!buf)
+        err = PHYSFS_ERR_OUT_OF_MEMORY;
+    else if ((io = zip_open_entry(verify->info, entry, NULL, 1)) == NULL)
+        err = PHYSFS_getLastErrorCode();
+
+    while ((err == PHYSFS_ERR_OK) && (remaining > 0))
     {
-        if (finfo->io != NULL)
-            finfo->io->destroy(finfo->io);
+        const PHYSFS_uint64 len = (remaining < ZIP_READBUFSIZE) ? remaining : ZIP_READBUFSIZE;
+        const PHYSFS_sint64 br = io->read(io, buf, len);
+        if (br == 0)  /* ended early? It's truncated. */
+            err = PHYSFS_ERR_CORRUPT;
+        else if (br < 0)
+            err = PHYSFS_getLastErrorCode();
+        else
+            remaining -= (PHYSFS_uint64) br;
+    } /* while */
+
+    if (io != NULL)
+        io->destroy(io);
+    if (buf != NULL)
+        allocator.Free(buf);
+    verify->errors[task] = err;
+} /* zip_verify_entry */
 
-        if (finfo->buffer != NULL)
+
+int __PHYSFS_zipVerify(void *opaque)
+{
+    ZIPinfo *info = (ZIPinfo *) opaque;
+    ZIPverify verify;
+    size_t count = 0;
+    size_t i;
+    int pass;
+    int retval = 0;
+
+    memset(&verify, '\0', sizeof (verify));
+    verify.info = info;
+
+    /* resolve everything here, then count it once and collect it once. */
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
         {
-            allocator.Free(finfo->buffer);
-            inflateEnd(&finfo->stream);
+            BAIL_IF(count > 0x7FFFFFFF, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+            if (count == 0)
+                return 1;
+            verify.items = (ZIPresolveItem *) allocator.Malloc(count * sizeof (ZIPresolveItem));
+            verify.errors = (PHYSFS_ErrorCode *) allocator.Malloc(count * sizeof (PHYSFS_ErrorCode));
+            GOTO_IF((!verify.items) || (!verify.errors), PHYSFS_ERR_OUT_OF_MEMORY, zipverify_done);
+            count = 0;
         } /* if */
 
-        allocator.Free(finfo);
-    } /* if */
+        for (i = 1; i <= info->tree.entries; i++)
+        {
+            ZIPentry *entry = (ZIPentry *) __PHYSFS_DirTreeEntryAt(&info->tree, (PHYSFS_uint32) i);
 
-    if (retval != NULL)
-        allocator.Free(retval);
+            if (entry->tree.isdir)
+                continue;
+            else if ((pass == 0) && (!zip_resolve(info->io, info, entry)))
+                goto zipverify_done;
+            /* symlinks get checked as their targets; no password, no check. */
+            else if ((entry->resolved == ZIP_RESOLVED_SYMLINK) || (entry->resolved == ZIP_DIRECTORY))
+                continue;
+            else if (zip_entry_is_traditional_crypto(entry))
+                continue;
 
-    return NULL;
-} /* ZIP_openRead */
+            if (pass == 1)
+            {
+                verify.items[count].entry = entry;
+                verify.items[count].offset = zip_entry_offset(entry);
+            } /* if */
+            count++;
+        } /* for */
+    } /* for */
+
+    /* each thread reads its entries front to back, in archive order. */
+    __PHYSFS_sort(verify.items, count, zip_resolve_offset_cmp, zip_resolve_offset_swap);
+    __PHYSFS_runTasks(-1, &verify, (int) count, zip_verify_entry);
+
+    for (i = 0; i < count; i++)
+    {
+        GOTO_IF(verify.errors[i] != PHYSFS_ERR_OK, verify.errors[i], zipverify_done);
+    } /* for */
+    retval = 1;
+
+zipverify_done:
+    if (verify.errors) allocator.Free(verify.errors);
+    if (verify.items) allocator.Free(verify.items);
+    return retval;
+} /* __PHYSFS_zipVerify */
 
 
 static PHYSFS_Io *ZIP_openWrite(void *opaque, const char *filename)
@@ -1675,11 +3374,12 @@ static int ZIP_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
 
     else
     {
-        stat->filesize = (PHYSFS_sint64) entry->uncompressed_size;
+        stat->filesize = (PHYSFS_sint64) zip_entry_uncompressed_size(entry);
         stat->filetype = PHYSFS_FILETYPE_REGULAR;
     } /* else */
 
-    stat->modtime = ((entry) ? entry->last_mod_time : 0);
+    /* !!! FIXME: there are extended fields that can get you off gross old DOS time format. */
+    stat->modtime = (entry->dos_mod_time) ? zip_dos_time_to_physfs_time(entry->dos_mod_time) : 0;
     stat->createtime = stat->modtime;
     stat->accesstime = -1;
     stat->readonly = 1; /* .zip files are always read only */
@@ -144,6 +144,20 @@ int __PHYSFS_ATOMIC_INCR(int *ptrval);
 int __PHYSFS_ATOMIC_DECR(int *ptrval);
 #endif
 
+/* thread-local storage. If this isn't defined, code that wants it has to
+   fall back to something slower (a locked list keyed on thread ID, etc).
+   Build with PHYSFS_NO_THREAD_LOCAL if your toolchain claims support but
+   doesn't actually deliver (some old MSVC DLLs loaded with LoadLibrary()). */
+#if defined(PHYSFS_NO_THREAD_LOCAL) || defined(PHYSFS_PLATFORM_PLAYDATE) || defined(PHYSFS_PLATFORM_DOS)
+/* no TLS for you. */
+#elif defined(_MSC_VER) && (_MSC_VER >= 1300)
+#define __PHYSFS_THREAD_LOCAL __declspec(thread)
+#elif defined(__clang__) || (defined(__GNUC__) && (((__GNUC__ * 10000) + (__GNUC_MINOR__ * 100)) >= 30300))
+#define __PHYSFS_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#define __PHYSFS_THREAD_LOCAL _Thread_local
+#endif
+
 
 /*
  * Interface for small allocations. If you need a little scratch space for
@@ -196,6 +210,9 @@ void __PHYSFS_smallFree(void *ptr);
 #ifndef PHYSFS_SUPPORTS_ZIP
 #define PHYSFS_SUPPORTS_ZIP PHYSFS_SUPPORTS_DEFAULT
 #endif
+#ifndef PHYSFS_SUPPORTS_ZIP_ZSTD
+#define PHYSFS_SUPPORTS_ZIP_ZSTD PHYSFS_SUPPORTS_ZIP
+#endif
 #ifndef PHYSFS_SUPPORTS_7Z
 #define PHYSFS_SUPPORTS_7Z PHYSFS_SUPPORTS_DEFAULT
 #endif
@@ -243,7 +260,7 @@ extern void SZIP_global_init(void);
 #endif
 
 /* The latest supported PHYSFS_Io::version value. */
-#define CURRENT_PHYSFS_IO_API_VERSION 0
+#define CURRENT_PHYSFS_IO_API_VERSION 1
 
 /* The latest supported PHYSFS_Archiver::version value. */
 #define CURRENT_PHYSFS_ARCHIVER_API_VERSION 0
@@ -400,6 +417,115 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode);
 PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
                                    void (*destruct)(void *));
 
+/*
+ * Create a READ-ONLY PHYSFS_Io for a file in the physical filesystem (in
+ *  platform-dependent notation) by mapping the whole thing into memory. It
+ *  behaves like a memory Io (so __PHYSFS_createMemoryIoSlice() works on it),
+ *  and the mapping goes away when the last duplicate is destroyed. Returns
+ *  NULL if the platform can't map files or this one can't be mapped; use
+ *  __PHYSFS_createNativeIo() instead then.
+ */
+PHYSFS_Io *__PHYSFS_createMappedIo(const char *path);
+
+/*
+ * If (io) reads from memory (it came from __PHYSFS_createMemoryIo() or
+ *  __PHYSFS_createMappedIo(), or is a duplicate or slice of one), make a new
+ *  PHYSFS_Io for the (len) bytes at (pos) in it. The new Io shares the
+ *  buffer, so this doesn't copy anything, and keeps it alive after (io) is
+ *  destroyed. Returns NULL if (io) isn't a memory Io, the range is out of
+ *  bounds, or we're out of memory; archivers should read (io) the usual way
+ *  then.
+ */
+PHYSFS_Io *__PHYSFS_createMemoryIoSlice(PHYSFS_Io *io, PHYSFS_uint64 pos,
+                                        PHYSFS_uint64 len);
+
+/*
+ * PHYSFS_Io version 1 added the optional readAt(), map() and hint()
+ *  methods. Applications can still hand us version 0 Ios, which don't even
+ *  have those fields, so check with this before touching them.
+ */
+#define __PHYSFS_ioHas(io, method) \
+    (((io)->version >= 1) && ((io)->method != NULL))
+
+/*
+ * Wrappers for the optional map() and hint() methods, safe to call on any
+ *  Io. __PHYSFS_ioMap() returns NULL if the range isn't in memory, and
+ *  __PHYSFS_ioHint() does nothing if (io) doesn't care.
+ */
+const void *__PHYSFS_ioMap(PHYSFS_Io *io, PHYSFS_uint64 offset,
+                           PHYSFS_uint64 len);
+void __PHYSFS_ioHint(PHYSFS_Io *io, PHYSFS_IoHint hint);
+
+/*
+ * If (io) has readAt(), make a new PHYSFS_Io for the (len) bytes at (pos)
+ *  in it, which reads them with (io)'s readAt(). This is how archivers
+ *  should open their members instead of calling (io)'s duplicate(): the new
+ *  Io has its own position but doesn't need its own file handle, and any
+ *  number of them can read at once. The view doesn't own (io), so (io) must
+ *  outlive it; that's always true for an archive's Io and its open files.
+ *  If (io) can map() the range, you get a memory Io of it instead.
+ *  Returns NULL if (io) has no readAt(), the range is out of bounds, or
+ *  we're out of memory; archivers should duplicate (io) then.
+ */
+PHYSFS_Io *__PHYSFS_createIoView(PHYSFS_Io *io, PHYSFS_uint64 pos,
+                                 PHYSFS_uint64 len);
+
+/*
+ * The file cache (see PHYSFS_setFileCache()) keeps the decompressed
+ *  contents of small files that archivers would otherwise decompress every
+ *  time they're opened. (archive) and (entry) are whatever pointers
+ *  identify the file to the archiver; usually its opaque archive handle
+ *  and its DirTree entry.
+ *
+ * __PHYSFS_fileCacheWants() says if a file of (len) bytes is worth caching
+ *  (it's zero if the cache is off). __PHYSFS_fileCacheFind() returns a new
+ *  memory Io for a cached file, or NULL if it isn't cached. After
+ *  decompressing a file into a memory Io (from __PHYSFS_createMemoryIo()),
+ *  hand it to __PHYSFS_fileCacheAdd(), which takes its own reference to the
+ *  buffer (or doesn't, if it can't; that's not an error). Archivers that
+ *  use the cache must call __PHYSFS_fileCacheForget() when they close.
+ */
+int __PHYSFS_fileCacheWants(const PHYSFS_uint64 len);
+PHYSFS_Io *__PHYSFS_fileCacheFind(const void *archive, const void *entry);
+void __PHYSFS_fileCacheAdd(const void *archive, const void *entry,
+                           PHYSFS_Io *io);
+void __PHYSFS_fileCacheForget(const void *archive);
+
+
+/*
+ * For archivers that preload (see PHYSFS_preloadArchives()) or decode in
+ *  parallel (see PHYSFS_setDecoderThreads()). Call fn(data, task) once for
+ *  each task from 0 to (count - 1), spread over (threads) threads (zero or
+ *  one for just the caller, negative for one per CPU), and wait for them
+ *  all to finish. Tasks are started in order, so put the expensive ones
+ *  first if you can. Returns how many milliseconds that took, or zero if
+ *  the platform can't tell. Preloaders report what was done, when it's
+ *  done, with __PHYSFS_addPreloadStats().
+ */
+#ifndef PHYSFS_MAX_PRELOAD_THREADS
+#define PHYSFS_MAX_PRELOAD_THREADS 64
+#endif
+PHYSFS_uint64 __PHYSFS_runTasks(const int threads, void *data,
+                                const int count,
+                                void (*fn)(void *data, int task));
+void __PHYSFS_addPreloadStats(const PHYSFS_uint64 compressed,
+                              const PHYSFS_uint64 decompressed,
+                              const PHYSFS_uint64 ms);
+
+
+/*
+ * Update a CRC-32 (the zlib/.zip kind) with (len) more bytes. Start with
+ *  a (crc) of zero; the result is the finished value, ready to compare.
+ */
+PHYSFS_uint32 __PHYSFS_crc32(PHYSFS_uint32 crc, const void *buf, size_t len);
+
+/*
+ * Read every file in a mounted .zip (the archiver's opaque handle) and
+ *  check it against its stored CRC. Returns zero if any are bad, with
+ *  PHYSFS_ERR_CORRUPT set, or on i/o errors.
+ */
+int __PHYSFS_zipVerify(void *opaque);
+
 
 /*
  * Read (len) bytes from (io) into (buf). Returns non-zero on success,
@@ -407,6 +533,14 @@ PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
  */
 int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t len);
 
+/*
+ * Read (len) bytes at (offset) in (io) into (buf), with readAt() if (io) has
+ *  it, otherwise by seeking and reading. Either way, don't count on (io)'s
+ *  position afterwards. Returns non-zero on success, zero on i/o error.
+ */
+int __PHYSFS_readAllAt(PHYSFS_Io *io, void *buf, const size_t len,
+                       const PHYSFS_uint64 offset);
+
 
 /* These are shared between some archivers. */
 
@@ -430,33 +564,70 @@ int UNPK_stat(void *opaque, const char *fn, PHYSFS_Stat *st);
 /* Optional API many archivers use this to manage their directory tree. */
 /* !!! FIXME: document this better. */
 
+/*
+ * Entries refer to each other by number instead of by pointer, and keep
+ *  their names in the tree's string pool, so archives with millions of
+ *  files don't pay for five pointers a file. The root is entry 0, and the
+ *  rest are numbered from 1 in the order they were added; 0 in a link means
+ *  "none" (nothing links back to the root but (parent)). Since a parent is
+ *  always added before its kids, (parent), (sibling) and (hashnext) always
+ *  point to smaller numbers, and (children) to a bigger one.
+ */
 typedef struct __PHYSFS_DirTreeEntry
 {
-    char *name;                              /* Full path in archive.        */
-    struct __PHYSFS_DirTreeEntry *hashnext;  /* next item in hash bucket.    */
-    struct __PHYSFS_DirTreeEntry *children;  /* linked list of kids, if dir. */
-    struct __PHYSFS_DirTreeEntry *sibling;   /* next item in same dir.       */
-    int isdir;
+    PHYSFS_uint32 hashnext;  /* next item in hash bucket.    */
+    PHYSFS_uint32 children;  /* newest of the kids, if dir.  */
+    PHYSFS_uint32 sibling;   /* next (older) item in same dir. */
+    PHYSFS_uint32 parent;    /* containing dir; root's is 0, too. */
+    PHYSFS_uint32 hash;      /* hash of the full path.       */
+    PHYSFS_uint32 name : 31; /* Last path element only; see __PHYSFS_DirTreeName(). */
+    PHYSFS_uint32 isdir : 1;
 } __PHYSFS_DirTreeEntry;
 
 typedef struct __PHYSFS_DirTree
 {
-    __PHYSFS_DirTreeEntry *root;    /* root of directory tree.             */
-    __PHYSFS_DirTreeEntry **hash;  /* all entries hashed for fast lookup. */
-    size_t hashBuckets;            /* number of buckets in hash.          */
+    __PHYSFS_DirTreeEntry *root;    /* root of directory tree (entry 0). */
+    PHYSFS_uint32 *hash;  /* newest entry in each bucket, for fast lookup. */
+    size_t hashBuckets;   /* number of buckets in hash (power of 2). */
+    size_t entries;       /* number of entries in hash; the highest number. */
+    PHYSFS_uint8 **slots; /* blocks of (1 << slotShift) entries each.     */
+    size_t slotBlocks;    /* number of blocks in (slots).                 */
+    unsigned int slotShift;
+    char **names;         /* blocks of names; see __PHYSFS_DirTreeName(). */
+    const char *namePool; /* a mapped tree's names, blocks end to end.    */
+    size_t nameBlocks;    /* number of blocks in (names).                 */
+    size_t nameUsed;      /* bytes used in the last one.                  */
+    size_t nameAvail;     /* size of the last one.                        */
     size_t entrylen;    /* size in bytes of entries (including subclass). */
     int case_sensitive;  /* non-zero to treat entries as case-sensitive in DirTreeFind */
     int only_usascii;  /* non-zero to treat paths as US ASCII only (one byte per char, only 'A' through 'Z' are considered for case folding). */
+    int has_symlinks;  /* non-zero if the archiver put any symlinks in the tree. */
+    void *image;  /* what __PHYSFS_DirTreeMap() used, or NULL. */
 } __PHYSFS_DirTree;
 
 
 /* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here. */
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii);
+/* (entrycount) is a guess at how many entries will be added, to size things up front. Zero if you don't know. */
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii, const PHYSFS_uint64 entrycount);
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir);
+/* For rebuilding a tree you saved: add (name), the last element of a path that must not be in the tree yet, under entry number (parent), which must be a dir. (hash) is what the tree would have computed for the full path. */
+void *__PHYSFS_DirTreeAddUnique(__PHYSFS_DirTree *dt, const char *name, const PHYSFS_uint32 hash, const PHYSFS_uint32 parent, const int isdir);
 void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path);
+/* Entry number (idx), or NULL if there isn't one. 0 is the root. */
+void *__PHYSFS_DirTreeEntryAt(const __PHYSFS_DirTree *dt, const PHYSFS_uint32 idx);
+/* The last element of (entry)'s path; "" for the root. */
+const char *__PHYSFS_DirTreeName(const __PHYSFS_DirTree *dt, const void *entry);
+/* Non-zero if (entry) is the one at (path), by the tree's case rules. */
+int __PHYSFS_DirTreeIsPath(const __PHYSFS_DirTree *dt, const void *entry, const char *path);
+/* Write (entry)'s full path into (buf), if it fits in (buflen) bytes with its null terminator. Returns the path's length either way. */
+size_t __PHYSFS_DirTreePath(const __PHYSFS_DirTree *dt, const void *entry, char *buf, const size_t buflen);
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
                               const char *dname, PHYSFS_EnumerateCallback cb,
                               const char *origdir, void *callbackdata);
+/* A copy of (dt) with no pointers in it, for saving; put its length in (*len). Free it with allocator.Free(). */
+void *__PHYSFS_DirTreeImage(const __PHYSFS_DirTree *dt, PHYSFS_uint64 *len);
+/* Use (len) bytes of (image), from __PHYSFS_DirTreeImage(), as (dt) without copying it. (image) must be 8-byte aligned, writable if you'll change entries, and outlive (dt), which can't have entries added. Returns zero if it isn't an image of a tree like this one. That's only checked as far as it can be without reading every entry; a damaged image gives wrong answers, but never sends the tree outside of (image). */
+int __PHYSFS_DirTreeMap(__PHYSFS_DirTree *dt, void *image, const PHYSFS_uint64 len, const size_t entrylen, const int case_sensitive, const int only_usascii);
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt);
 
 
@@ -652,6 +823,77 @@ int __PHYSFS_platformFlush(void *opaque);
  */
 void __PHYSFS_platformClose(void *opaque);
 
+/*
+ * Make a new handle for a file opened with __PHYSFS_platformOpenRead(),
+ *  positioned at the start of the file, without opening the file again.
+ *  The new handle has its own file position and can be used from another
+ *  thread at the same time as (opaque), and either one can be closed
+ *  first; on Unix, they share one file descriptor and read with pread().
+ *  This keeps archives from using a descriptor per open member.
+ *
+ * Platforms that don't define PHYSFS_HAVE_PLATFORM_DUPLICATE don't need to
+ *  implement this; their handles are duplicated by opening the file again.
+ *  That's also what happens if this fails, so it's fine to refuse handles
+ *  that can't be shared, like pipes or other files that can't seek.
+ *
+ * Call PHYSFS_setErrorCode() and return (NULL) on failure.
+ */
+#if defined(PHYSFS_PLATFORM_POSIX) && !defined(PHYSFS_PLATFORM_DOS)
+#define PHYSFS_HAVE_PLATFORM_DUPLICATE 1
+#endif
+
+#ifdef PHYSFS_HAVE_PLATFORM_DUPLICATE
+void *__PHYSFS_platformDuplicate(void *opaque);
+#endif
+
+/*
+ * Read up to (len) bytes at byte (offset) of a file opened with
+ *  __PHYSFS_platformOpenRead() into (buf), without using or changing the
+ *  handle's file position or readahead. This must be safe to call from
+ *  several threads at once on the same handle (and its duplicates); it's
+ *  what the native PHYSFS_Io's readAt() method uses. Keep reading until
+ *  (len) bytes or EOF, so a short count always means EOF. Call
+ *  PHYSFS_setErrorCode() and return -1 if nothing could be read.
+ *
+ * __PHYSFS_platformHint() passes a PHYSFS_Io hint() on to the OS, if it
+ *  takes such advice. It can't fail.
+ *
+ * Platforms that don't define PHYSFS_HAVE_PLATFORM_READAT don't need to
+ *  implement these; their native Ios just don't offer readAt() or hint().
+ */
+#if defined(PHYSFS_PLATFORM_POSIX) && !defined(PHYSFS_PLATFORM_DOS)
+#define PHYSFS_HAVE_PLATFORM_READAT 1
+#endif
+
+#ifdef PHYSFS_HAVE_PLATFORM_READAT
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset);
+void __PHYSFS_platformHint(void *opaque, PHYSFS_IoHint hint);
+#endif
+
+/*
+ * Map the entire contents of a file opened with __PHYSFS_platformOpenRead()
+ *  into memory and put its size in (*len). The mapping is read-only, unless
+ *  (writable) is non-zero: then it's private, so writes to it only change
+ *  our copy, never the file. The mapping stays valid after (opaque) is
+ *  closed, until __PHYSFS_platformUnmapFile() is called with the same
+ *  pointer and length.
+ *
+ * Platforms that don't define PHYSFS_HAVE_PLATFORM_MMAP don't need to
+ *  implement these; archives are read through normal file i/o there.
+ *
+ * Call PHYSFS_setErrorCode() and return (NULL) if the file can't be mapped
+ *  (including if it's empty).
+ */
+#if defined(PHYSFS_PLATFORM_POSIX) && !defined(PHYSFS_PLATFORM_DOS) && !defined(PHYSFS_PLATFORM_EMSCRIPTEN)
+#define PHYSFS_HAVE_PLATFORM_MMAP 1
+#endif
+
+#ifdef PHYSFS_HAVE_PLATFORM_MMAP
+void *__PHYSFS_platformMapFile(void *opaque, PHYSFS_uint64 *len, const int writable);
+void __PHYSFS_platformUnmapFile(void *ptr, PHYSFS_uint64 len);
+#endif
+
 /*
  * Platform implementation of PHYSFS_getCdRomDirsCallback()...
  *  CD directories are discovered and reported to the callback one at a time.
@@ -784,6 +1026,56 @@ int __PHYSFS_platformGrabMutex(void *mutex);
 void __PHYSFS_platformReleaseMutex(void *mutex);
 
 
+/*
+ * Platforms that can let several threads hold a lock at once define
+ *  PHYSFS_HAVE_PLATFORM_RWLOCK and implement the functions below. Everyone
+ *  else doesn't have to, and PHYSFS_allowConcurrentReads() will just report
+ *  PHYSFS_ERR_UNSUPPORTED there.
+ *
+ * Unlike mutexes, these do NOT have to be recursive, and the higher level
+ *  never asks for a read lock while it holds the write lock or vice versa.
+ *  They should not let a steady stream of readers starve out a writer.
+ *  CreateRWLock returns NULL on failure (and sets the error code); the
+ *  Grab functions return zero on a major system error, like GrabMutex.
+ *  Same rules about calling PHYSFS_setErrorCode() apply as for mutexes.
+ */
+#if defined(PHYSFS_PLATFORM_POSIX) && !defined(PHYSFS_PLATFORM_DOS)
+#define PHYSFS_HAVE_PLATFORM_RWLOCK 1
+#endif
+
+#ifdef PHYSFS_HAVE_PLATFORM_RWLOCK
+void *__PHYSFS_platformCreateRWLock(void);
+void __PHYSFS_platformDestroyRWLock(void *rwlock);
+int __PHYSFS_platformGrabReadLock(void *rwlock);
+int __PHYSFS_platformGrabWriteLock(void *rwlock);
+void __PHYSFS_platformReleaseRWLock(void *rwlock);
+#endif
+
+
+/*
+ * Platforms that can run work on other threads define
+ *  PHYSFS_HAVE_PLATFORM_THREADS and implement the functions below; anything
+ *  that wants a thread has to do without it elsewhere.
+ *
+ * CreateThread runs fn(data) on a new thread and returns a handle for it,
+ *  or NULL (and sets the error code) if it can't. WaitThread blocks until
+ *  that fn returns, then frees the handle. Every thread that's created must
+ *  be waited on exactly once.
+ */
+#if defined(PHYSFS_PLATFORM_POSIX) && !defined(PHYSFS_PLATFORM_DOS)
+#define PHYSFS_HAVE_PLATFORM_THREADS 1
+#endif
+
+#ifdef PHYSFS_HAVE_PLATFORM_THREADS
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data);
+void __PHYSFS_platformWaitThread(void *thread);
+/* How many CPU cores there are; at least 1, even if we can't tell. */
+int __PHYSFS_platformCPUCount(void);
+/* Milliseconds from some arbitrary point; never goes backwards. */
+PHYSFS_uint64 __PHYSFS_platformTicks(void);
+#endif
+
+
 /* !!! FIXME: move to public API? */
 PHYSFS_uint32 __PHYSFS_utf8codepoint(const char **_str);
 
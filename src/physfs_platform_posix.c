@@ -19,9 +19,11 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 
 #ifndef PHYSFS_PLATFORM_DOS
 #include <pthread.h>
+#include <sys/mman.h>
 #endif
 
 #include "physfs_internal.h"
@@ -172,17 +174,63 @@ static inline void set_CLOEXEC(int fildes)
 }
 #endif
 
+/*
+ * Read-only handles to seekable files and their duplicates share one of
+ *  these, so opening a member of an archive doesn't cost an open() and a
+ *  file descriptor. Each of those handles keeps its own offset and reads
+ *  with pread(), so nothing touches the descriptor's file position. Other
+ *  handles (writers, pipes, ttys, sockets...) don't get one; they read()
+ *  and let the descriptor track the position, like they always did.
+ */
+typedef struct SharedFd
+{
+    int fd;
+    int refcount;
+} SharedFd;
+
+/*
+ * Reads go through a readahead buffer that starts at PHYSFS_READAHEAD_MIN
+ *  bytes and doubles every time it's refilled right where the last fill
+ *  ended, up to PHYSFS_READAHEAD_MAX. Seeking out of the buffer halves it
+ *  again. Reads at least as big as the current window skip the buffer and
+ *  go straight into the caller's memory.
+ */
+#ifndef PHYSFS_READAHEAD_MIN
+#define PHYSFS_READAHEAD_MIN (4 * 1024)
+#endif
+
+#ifndef PHYSFS_READAHEAD_MAX
+#define PHYSFS_READAHEAD_MAX (256 * 1024)
+#endif
+
 typedef struct File
 {
     int fd;
+    SharedFd *shared;  /* NULL unless read-only. */
     PHYSFS_uint64 offset;
-    PHYSFS_uint8 readahead[4 * 1024];
+    PHYSFS_uint8 *readahead;  /* allocated on first use. */
+    size_t readahead_alloc;  /* bytes allocated at (readahead). */
+    size_t readahead_window;  /* bytes to read on the next fill. */
+    size_t readahead_max;  /* the window won't grow past this. */
+    PHYSFS_uint64 readahead_next;  /* where a sequential fill would start. */
     size_t readahead_pos;
     size_t readahead_len;
     int readonly;
 } File;
 
 
+static void initReadahead(File *f)
+{
+    f->readahead = NULL;
+    f->readahead_alloc = 0;
+    f->readahead_window = PHYSFS_READAHEAD_MIN;
+    f->readahead_max = PHYSFS_READAHEAD_MAX;
+    f->readahead_next = (PHYSFS_uint64) -1;  /* first fill isn't a streak. */
+    f->readahead_pos = 0;
+    f->readahead_len = 0;
+} /* initReadahead */
+
+
 static File *doOpen(const char *filename, int mode)
 {
     const int appending = (mode & O_APPEND);
@@ -235,6 +283,7 @@ static File *doOpen(const char *filename, int mode)
 
     retval->fd = fd;
     retval->offset = (PHYSFS_uint64) offset;
+    initReadahead(retval);
 
     return retval;
 } /* doOpen */
@@ -245,11 +294,46 @@ void *__PHYSFS_platformOpenRead(const char *filename)
     File *f = doOpen(filename, O_RDONLY);
     if (f) {
         f->readonly = 1;
+#ifdef PHYSFS_HAVE_PLATFORM_DUPLICATE
+        /* pread() fails with ESPIPE on things we can't seek in. */
+        if (lseek(f->fd, 0, SEEK_CUR) == -1)
+            return f;
+
+        f->shared = (SharedFd *) allocator.Malloc(sizeof (SharedFd));
+        if (!f->shared) {
+            __PHYSFS_platformClose(f);
+            BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        }
+        f->shared->fd = f->fd;
+        f->shared->refcount = 1;
+#endif
     }
     return f;
 } /* __PHYSFS_platformOpenRead */
 
 
+#ifdef PHYSFS_HAVE_PLATFORM_DUPLICATE
+void *__PHYSFS_platformDuplicate(void *opaque)
+{
+    File *f = (File *) opaque;
+    File *retval;
+
+    /* writers and unseekable files have to be opened again instead. */
+    BAIL_IF(f->shared == NULL, PHYSFS_ERR_UNSUPPORTED, NULL);
+
+    retval = (File *) allocator.Malloc(sizeof (File));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(retval, '\0', sizeof (*retval));
+    retval->fd = f->fd;
+    retval->shared = f->shared;
+    retval->readonly = 1;
+    initReadahead(retval);
+    __PHYSFS_ATOMIC_INCR(&f->shared->refcount);
+    return retval;
+} /* __PHYSFS_platformDuplicate */
+#endif
+
+
 void *__PHYSFS_platformOpenWrite(const char *filename)
 {
     return doOpen(filename, O_WRONLY | O_CREAT | O_TRUNC);
@@ -262,6 +346,84 @@ void *__PHYSFS_platformOpenAppend(const char *filename)
 } /* __PHYSFS_platformOpenAppend */
 
 
+#ifdef PHYSFS_HAVE_PLATFORM_MMAP
+void *__PHYSFS_platformMapFile(void *opaque, PHYSFS_uint64 *len,
+                               const int writable)
+{
+    const int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+    const int flags = writable ? MAP_PRIVATE : MAP_SHARED;
+    File *f = (File *) opaque;
+    struct stat statbuf;
+    void *retval;
+
+    BAIL_IF(fstat(f->fd, &statbuf) == -1, errcodeFromErrno(), NULL);
+    BAIL_IF(statbuf.st_size <= 0, PHYSFS_ERR_UNSUPPORTED, NULL);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace((PHYSFS_uint64) statbuf.st_size), PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    retval = mmap(NULL, (size_t) statbuf.st_size, prot, flags, f->fd, 0);
+    BAIL_IF(retval == MAP_FAILED, errcodeFromErrno(), NULL);
+
+    *len = (PHYSFS_uint64) statbuf.st_size;
+    return retval;
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(void *ptr, PHYSFS_uint64 len)
+{
+    munmap(ptr, (size_t) len);
+} /* __PHYSFS_platformUnmapFile */
+#endif
+
+
+/* one read() (or pread()) at our current offset; doesn't touch (f)'s buffer. */
+static ssize_t readFd(File *f, void *buffer, const size_t len)
+{
+    ssize_t rc;
+    do {
+#ifdef PHYSFS_HAVE_PLATFORM_DUPLICATE
+        /* a shared fd's file position means nothing to us. */
+        if (f->shared)
+            rc = pread(f->fd, buffer, len, (off_t) f->offset);
+        else
+#endif
+        rc = read(f->fd, buffer, len);
+    } while ((rc < 0) && (errno == EINTR));
+    return rc;
+} /* readFd */
+
+
+/* get the buffer ready for a fill at f->offset, and say how much to read. */
+static size_t prepareReadahead(File *f)
+{
+    if (f->offset == f->readahead_next)  /* sequential: read more next time. */
+    {
+        if (f->readahead_window <= (f->readahead_max / 2))
+            f->readahead_window *= 2;
+        else
+            f->readahead_window = f->readahead_max;
+    } /* if */
+
+    if (f->readahead_alloc < f->readahead_window)
+    {
+        /* the buffer is empty, so there's nothing in it to keep. */
+        void *ptr = allocator.Malloc(f->readahead_window);
+        if (ptr != NULL)
+        {
+            if (f->readahead != NULL)
+                allocator.Free(f->readahead);
+            f->readahead = (PHYSFS_uint8 *) ptr;
+            f->readahead_alloc = f->readahead_window;
+        } /* if */
+        else  /* make do with what we have. */
+        {
+            f->readahead_window = f->readahead_alloc;
+        } /* else */
+    } /* if */
+
+    return f->readahead_window;  /* might be smaller than the buffer. */
+} /* prepareReadahead */
+
+
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
                                     PHYSFS_uint64 len)
 {
@@ -274,13 +436,34 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
         size_t cpy = f->readahead_len;
         if (cpy == 0)
         {
-            const ssize_t rc = read(f->fd, f->readahead, sizeof (f->readahead));
-            if ((rc < 0) && (errno == EINTR)) {
-                continue; /* just try again. */
-            }
+            ssize_t rc;
+            size_t avail = 0;
+
+            /* big reads (or no buffer at all) skip the buffer entirely. */
+            if (((size_t) len) < f->readahead_window)
+                avail = prepareReadahead(f);
+
+            if (((size_t) len) >= avail)
+            {
+                /* the loop gets the rest if this is too big for one call. */
+                const size_t maxread = ((size_t) 1) << 30;
+                rc = readFd(f, buffer, (len > maxread) ? maxread : (size_t) len);
+                BAIL_IF(rc < 0, errcodeFromErrno(), (br > 0) ? (PHYSFS_sint64) br : -1);
+                if (rc == 0)  /* out of data. */
+                    return (PHYSFS_sint64) br;
+                f->offset += (size_t) rc;
+                f->readahead_next = f->offset;
+                len -= (size_t) rc;
+                br += (size_t) rc;
+                buffer = ((PHYSFS_uint8 *) buffer) + rc;
+                continue;
+            } /* if */
+
+            rc = readFd(f, f->readahead, avail);
             BAIL_IF(rc < 0, errcodeFromErrno(), (br > 0) ? (PHYSFS_sint64) br : -1);
             f->readahead_len = (size_t) rc;
             f->readahead_pos = 0;
+            f->readahead_next = f->offset + (size_t) rc;
             cpy = f->readahead_len;
             if (!cpy)  /* out of data. */
                 return (PHYSFS_sint64) br;
@@ -302,6 +485,56 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
 } /* __PHYSFS_platformRead */
 
 
+#ifdef PHYSFS_HAVE_PLATFORM_READAT
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len), PHYSFS_ERR_INVALID_ARGUMENT, -1);
+    File *f = (File *) opaque;
+    size_t br = 0;
+
+    while (br < (size_t) len)
+    {
+        PHYSFS_uint8 *ptr = ((PHYSFS_uint8 *) buffer) + br;
+        const ssize_t rc = pread(f->fd, ptr, ((size_t) len) - br, (off_t) (offset + br));
+        if ((rc < 0) && (errno == EINTR)) {
+            continue; /* just try again. */
+        }
+        BAIL_IF(rc < 0, errcodeFromErrno(), (br > 0) ? (PHYSFS_sint64) br : -1);
+        if (rc == 0)  /* out of data. */
+            break;
+        br += (size_t) rc;
+    } /* while */
+
+    return (PHYSFS_sint64) br;
+} /* __PHYSFS_platformReadAt */
+
+
+void __PHYSFS_platformHint(void *opaque, PHYSFS_IoHint hint)
+{
+    File *f = (File *) opaque;
+
+    /* random access gets the smallest window; sequential starts big. */
+    f->readahead_max = PHYSFS_READAHEAD_MAX;
+    if (hint == PHYSFS_IOHINT_RANDOM)
+        f->readahead_window = f->readahead_max = PHYSFS_READAHEAD_MIN;
+    else if (hint == PHYSFS_IOHINT_SEQUENTIAL)
+        f->readahead_window = PHYSFS_READAHEAD_MAX;
+
+#ifdef POSIX_FADV_NORMAL
+    {
+        int advice = POSIX_FADV_NORMAL;
+        if (hint == PHYSFS_IOHINT_SEQUENTIAL)
+            advice = POSIX_FADV_SEQUENTIAL;
+        else if (hint == PHYSFS_IOHINT_RANDOM)
+            advice = POSIX_FADV_RANDOM;
+        (void) posix_fadvise(f->fd, 0, 0, advice);  /* just advice; ignore errors. */
+    }
+#endif
+} /* __PHYSFS_platformHint */
+#endif
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -322,6 +555,16 @@ PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
 } /* __PHYSFS_platformWrite */
 
 
+/* we seeked out of the buffer, so reads probably aren't sequential now. */
+static void dumpReadahead(File *f)
+{
+    f->readahead_len = 0;
+    f->readahead_pos = 0;
+    if (f->readahead_window >= (PHYSFS_READAHEAD_MIN * 2))
+        f->readahead_window /= 2;
+} /* dumpReadahead */
+
+
 int __PHYSFS_platformSeek(void *opaque, PHYSFS_uint64 pos)
 {
     File *f = (File *) opaque;
@@ -331,6 +574,19 @@ int __PHYSFS_platformSeek(void *opaque, PHYSFS_uint64 pos)
         return 1;  /* already there, nothing to do. */
     }
 
+#ifdef PHYSFS_HAVE_PLATFORM_DUPLICATE
+    if (f->shared) {  /* we pread() from f->offset, no lseek() needed. */
+        f->offset = pos;
+        if ((pos > start) && ((pos - start) < f->readahead_len)) {
+            f->readahead_len -= (size_t) (pos - start);
+            f->readahead_pos += (size_t) (pos - start);
+        } else {
+            dumpReadahead(f);
+        }
+        return 1;
+    }
+#endif
+
     const off_t rc = lseek(f->fd, (off_t) pos, SEEK_SET);
     BAIL_IF(rc == -1, errcodeFromErrno(), 0);
 
@@ -352,8 +608,7 @@ int __PHYSFS_platformSeek(void *opaque, PHYSFS_uint64 pos)
             } /* if */
         } /* else if */
 
-        f->readahead_len = 0;  /* dump the readahead cache. */
-        f->readahead_pos = 0;
+        dumpReadahead(f);
     }
 
     return 1;
@@ -394,6 +649,18 @@ void __PHYSFS_platformClose(void *opaque)
 {
     File *f = (File *) opaque;
     int rc = -1;
+
+    if (f->readahead != NULL)
+        allocator.Free(f->readahead);
+
+    if (f->shared) {
+        if (__PHYSFS_ATOMIC_DECR(&f->shared->refcount) > 0) {
+            allocator.Free(opaque);  /* someone else still has the fd. */
+            return;
+        }
+        allocator.Free(f->shared);
+    }
+
     do {
         rc = close(f->fd);  /* we don't check this. You should have used flush! */
     } while ((rc == -1) && (errno == EINTR));
@@ -523,6 +790,119 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
         } /* if */
     } /* if */
 } /* __PHYSFS_platformReleaseMutex */
+
+
+void *__PHYSFS_platformCreateRWLock(void)
+{
+    pthread_rwlockattr_t attr;
+    pthread_rwlock_t *rwlock;
+    int rc;
+
+    rwlock = (pthread_rwlock_t *) allocator.Malloc(sizeof (pthread_rwlock_t));
+    BAIL_IF(!rwlock, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    pthread_rwlockattr_init(&attr);
+    #if defined(__GLIBC__)
+    /* glibc favors readers by default, which can starve a mount forever. */
+    pthread_rwlockattr_setkind_np(&attr,
+                            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    #endif
+    rc = pthread_rwlock_init(rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    if (rc != 0)
+    {
+        allocator.Free(rwlock);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    return ((void *) rwlock);
+} /* __PHYSFS_platformCreateRWLock */
+
+
+void __PHYSFS_platformDestroyRWLock(void *rwlock)
+{
+    pthread_rwlock_destroy((pthread_rwlock_t *) rwlock);
+    allocator.Free(rwlock);
+} /* __PHYSFS_platformDestroyRWLock */
+
+
+int __PHYSFS_platformGrabReadLock(void *rwlock)
+{
+    return (pthread_rwlock_rdlock((pthread_rwlock_t *) rwlock) == 0);
+} /* __PHYSFS_platformGrabReadLock */
+
+
+int __PHYSFS_platformGrabWriteLock(void *rwlock)
+{
+    return (pthread_rwlock_wrlock((pthread_rwlock_t *) rwlock) == 0);
+} /* __PHYSFS_platformGrabWriteLock */
+
+
+void __PHYSFS_platformReleaseRWLock(void *rwlock)
+{
+    pthread_rwlock_unlock((pthread_rwlock_t *) rwlock);
+} /* __PHYSFS_platformReleaseRWLock */
+
+
+typedef struct
+{
+    pthread_t thread;
+    void (*fn)(void *);
+    void *data;
+} PthreadThread;
+
+static void *pthreadThreadEntry(void *arg)
+{
+    PthreadThread *t = (PthreadThread *) arg;
+    t->fn(t->data);
+    return NULL;
+} /* pthreadThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    int rc;
+    PthreadThread *t = (PthreadThread *) allocator.Malloc(sizeof (PthreadThread));
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    rc = pthread_create(&t->thread, NULL, pthreadThreadEntry, t);
+    if (rc != 0)
+    {
+        allocator.Free(t);
+        BAIL(errcodeFromErrnoError(rc), NULL);
+    } /* if */
+    return t;
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    PthreadThread *t = (PthreadThread *) thread;
+    pthread_join(t->thread, NULL);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+int __PHYSFS_platformCPUCount(void)
+{
+    #ifdef _SC_NPROCESSORS_ONLN
+    const long rc = sysconf(_SC_NPROCESSORS_ONLN);
+    if (rc > 0)
+        return (rc > 0x7FFF) ? 0x7FFF : (int) rc;
+    #endif
+    return 1;
+} /* __PHYSFS_platformCPUCount */
+
+
+PHYSFS_uint64 __PHYSFS_platformTicks(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+    return (((PHYSFS_uint64) ts.tv_sec) * 1000) +
+           (((PHYSFS_uint64) ts.tv_nsec) / 1000000);
+} /* __PHYSFS_platformTicks */
 #endif  /* !PHYSFS_PLATFORM_DOS */
 
 #endif  /* PHYSFS_PLATFORM_POSIX */
@@ -0,0 +1,1382 @@
+/*
+ * Zstandard decompression for PhysicsFS.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ * This is a small, decode-only, streaming implementation of the Zstandard
+ *  format, as described in RFC 8878, for ZIP entries that use compression
+ *  method 93. It doesn't support dictionaries (ZIP has no way to supply
+ *  one), and it skips the optional content checksum, since ZIP entries
+ *  have their own CRC.
+ *
+ * You feed it with next_in/avail_in and drain it with next_out/avail_out,
+ *  like a z_stream. Input is gathered until there's a complete block, the
+ *  block is decoded into a window buffer that holds the history that later
+ *  blocks can copy from, and then that block's output is handed back.
+ *  Concatenated frames decode as one stream, and skippable frames are
+ *  skipped.
+ *
+ * Memory use is the frame's window (or its content size, if that's
+ *  smaller) twice over, plus about 270k of fixed buffers and tables.
+ */
+
+#ifndef _INCLUDE_PHYSFS_ZSTD_H_
+#define _INCLUDE_PHYSFS_ZSTD_H_
+
+/*
+ * Frames that need a bigger window than this are rejected. The reference
+ *  decoder's default limit is the same 128 megabytes; archives made with
+ *  zstd's --long option for bigger windows need this raised.
+ */
+#ifndef ZSTD_WINDOWLOG_MAX
+#define ZSTD_WINDOWLOG_MAX 27
+#endif
+
+#define ZSTD_MAGIC 0xFD2FB528
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A50  /* low 4 bits can be anything. */
+#define ZSTD_BLOCKSIZE_MAX (128 * 1024)
+#define ZSTD_SLACK 32  /* spare bytes after buffers, for 16-byte copies. */
+#define ZSTD_HUF_LOG_MAX 11
+#define ZSTD_LL_LOG_MAX 9
+#define ZSTD_ML_LOG_MAX 9
+#define ZSTD_OF_LOG_MAX 8
+#define ZSTD_LL_SYMBOL_MAX 35
+#define ZSTD_ML_SYMBOL_MAX 52
+#define ZSTD_OF_SYMBOL_MAX 31
+
+typedef enum
+{
+    ZSTD_STATE_MAGIC,
+    ZSTD_STATE_FRAME_HEADER,
+    ZSTD_STATE_FRAME_HEADER_REST,
+    ZSTD_STATE_SKIP_SIZE,
+    ZSTD_STATE_SKIP,
+    ZSTD_STATE_BLOCK_HEADER,
+    ZSTD_STATE_BLOCK,
+    ZSTD_STATE_FLUSH,
+    ZSTD_STATE_CHECKSUM
+} ZSTDstate;
+
+/* One FSE decoding table cell. */
+typedef struct
+{
+    PHYSFS_uint16 base;    /* next state, before adding the read bits. */
+    PHYSFS_uint8 symbol;
+    PHYSFS_uint8 nbits;    /* bits to read for the next state. */
+} ZSTDfse;
+
+/* One Huffman decoding table cell. */
+typedef struct
+{
+    PHYSFS_uint8 symbol;
+    PHYSFS_uint8 nbits;
+} ZSTDhuf;
+
+typedef struct ZSTDstream
+{
+    const PHYSFS_uint8 *next_in;
+    size_t avail_in;
+    PHYSFS_uint8 *next_out;
+    size_t avail_out;
+
+    /* everything below here is private. */
+    ZSTDstate state;
+    size_t need;               /* bytes we want for the current state.  */
+    size_t have;               /* bytes of (need) gathered so far.      */
+    PHYSFS_uint64 skip;        /* bytes left in a skippable frame.      */
+    PHYSFS_uint8 header[18];   /* the current frame or block header.    */
+    int checksum;              /* non-zero if the frame has a checksum. */
+    int last_block;            /* non-zero if this is the frame's last. */
+    int block_type;            /* 0 raw, 1 RLE, 2 compressed.           */
+    size_t block_size;         /* size of the block's data in the frame.*/
+    size_t block_max;          /* most a block can decode to.           */
+    PHYSFS_uint64 window_size; /* how far back matches can reach.       */
+    PHYSFS_uint8 *window;      /* recent output; matches copy from it.  */
+    size_t window_alloc;       /* bytes allocated for (window).         */
+    size_t capacity;           /* bytes of (window) this frame can use. */
+    size_t pos;                /* end of decoded data in (window).      */
+    size_t flushed;            /* (window) bytes already handed out.    */
+    PHYSFS_uint8 *block;       /* block data, if it came in pieces.     */
+    PHYSFS_uint8 *literals;    /* a block's decoded literals.           */
+    PHYSFS_uint32 rep[3];      /* repeat offsets.                       */
+    int huf_valid;             /* can a block reuse (huf)?              */
+    unsigned int huf_log;
+    ZSTDhuf huf[1 << ZSTD_HUF_LOG_MAX];
+    int ll_valid, ml_valid, of_valid;  /* can a block reuse these?      */
+    unsigned int ll_log, ml_log, of_log;
+    ZSTDfse ll[1 << ZSTD_LL_LOG_MAX];
+    ZSTDfse ml[1 << ZSTD_ML_LOG_MAX];
+    ZSTDfse of[1 << ZSTD_OF_LOG_MAX];
+} ZSTDstream;
+
+
+static const PHYSFS_uint32 zstd_ll_base[ZSTD_LL_SYMBOL_MAX + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+};
+
+static const PHYSFS_uint8 zstd_ll_bits[ZSTD_LL_SYMBOL_MAX + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+};
+
+static const PHYSFS_uint32 zstd_ml_base[ZSTD_ML_SYMBOL_MAX + 1] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+};
+
+static const PHYSFS_uint8 zstd_ml_bits[ZSTD_ML_SYMBOL_MAX + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+
+/* the "predefined" distributions, for blocks that don't send their own. */
+static const PHYSFS_sint16 zstd_ll_default[ZSTD_LL_SYMBOL_MAX + 1] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+
+static const PHYSFS_sint16 zstd_ml_default[ZSTD_ML_SYMBOL_MAX + 1] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+
+static const PHYSFS_sint16 zstd_of_default[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+
+static inline unsigned int zstd_highbit(PHYSFS_uint32 val)  /* val != 0 */
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 31 - (unsigned int) __builtin_clz(val);
+#else
+    unsigned int retval = 0;
+    while (val >>= 1)
+        retval++;
+    return retval;
+#endif
+} /* zstd_highbit */
+
+static inline PHYSFS_uint32 zstd_le16(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint32) ptr[0]) | (((PHYSFS_uint32) ptr[1]) << 8);
+} /* zstd_le16 */
+
+static inline PHYSFS_uint32 zstd_le24(const PHYSFS_uint8 *ptr)
+{
+    return zstd_le16(ptr) | (((PHYSFS_uint32) ptr[2]) << 16);
+} /* zstd_le24 */
+
+static inline PHYSFS_uint32 zstd_le32(const PHYSFS_uint8 *ptr)
+{
+    return zstd_le24(ptr) | (((PHYSFS_uint32) ptr[3]) << 24);
+} /* zstd_le32 */
+
+static inline PHYSFS_uint64 zstd_le64(const PHYSFS_uint8 *ptr)
+{
+#if PHYSFS_BYTEORDER == PHYSFS_LIL_ENDIAN
+    PHYSFS_uint64 retval;
+    memcpy(&retval, ptr, sizeof (retval));  /* this is the bit reader's hot path. */
+    return retval;
+#else
+    return ((PHYSFS_uint64) zstd_le32(ptr)) |
+           (((PHYSFS_uint64) zstd_le32(ptr + 4)) << 32);
+#endif
+} /* zstd_le64 */
+
+
+/*
+ * Huffman and FSE data is read backwards, starting from the last byte,
+ *  whose highest set bit marks where the data starts. (bits) holds the 64
+ *  bits starting at (ptr), with the next bit to read at the top once
+ *  (consumed) bits are skipped. Reading past the start of the stream gives
+ *  zeros and pushes (consumed) past 64, which callers check for.
+ */
+typedef struct
+{
+    PHYSFS_uint64 bits;
+    unsigned int consumed;
+    const PHYSFS_uint8 *ptr;
+    const PHYSFS_uint8 *start;
+} ZSTDbits;
+
+static int zstd_bits_init(ZSTDbits *br, const PHYSFS_uint8 *src, size_t len)
+{
+    if ((len == 0) || (src[len - 1] == 0))
+        return 0;  /* no end marker. */
+
+    br->start = src;
+    if (len >= 8)
+    {
+        br->ptr = src + len - 8;
+        br->bits = zstd_le64(br->ptr);
+        br->consumed = 0;
+    } /* if */
+    else
+    {
+        size_t i;
+        br->ptr = src;
+        br->bits = 0;
+        for (i = 0; i < len; i++)
+            br->bits |= ((PHYSFS_uint64) src[i]) << (i * 8);
+        br->consumed = (unsigned int) ((8 - len) * 8);
+    } /* else */
+
+    br->consumed += 8 - zstd_highbit(src[len - 1]);
+    return 1;
+} /* zstd_bits_init */
+
+/* after a reload, at least 57 bits can be read before the next one. */
+static inline void zstd_bits_reload(ZSTDbits *br)
+{
+    if (br->consumed > 64)
+        return;  /* overflowed; callers will notice. */
+    else if (br->ptr >= br->start + 8)
+    {
+        br->ptr -= br->consumed >> 3;
+        br->consumed &= 7;
+    } /* else if */
+    else if (br->ptr == br->start)
+        return;  /* nothing left to load. */
+    else
+    {
+        size_t nbytes = br->consumed >> 3;
+        if (nbytes > (size_t) (br->ptr - br->start))
+            nbytes = (size_t) (br->ptr - br->start);
+        br->ptr -= nbytes;
+        br->consumed -= (unsigned int) (nbytes * 8);
+    } /* else */
+    br->bits = zstd_le64(br->ptr);
+} /* zstd_bits_reload */
+
+static inline PHYSFS_uint32 zstd_bits_peek(const ZSTDbits *br, const unsigned int n)
+{
+    /* the masking keeps the shifts defined if we've overflowed. */
+    return (PHYSFS_uint32) (((br->bits << (br->consumed & 63)) >> 1) >> ((63 - n) & 63));
+} /* zstd_bits_peek */
+
+static inline PHYSFS_uint32 zstd_bits_read(ZSTDbits *br, const unsigned int n)
+{
+    const PHYSFS_uint32 retval = zstd_bits_peek(br, n);
+    br->consumed += n;
+    return retval;
+} /* zstd_bits_read */
+
+static inline int zstd_bits_overflowed(const ZSTDbits *br)
+{
+    return (br->consumed > 64);
+} /* zstd_bits_overflowed */
+
+/* non-zero if every bit was read, no more and no less. */
+static inline int zstd_bits_finished(const ZSTDbits *br)
+{
+    return ((br->ptr == br->start) && (br->consumed == 64));
+} /* zstd_bits_finished */
+
+
+/* forward reading, for table descriptions. Bits past (len) read as zero. */
+static PHYSFS_uint32 zstd_fwd_bits(const PHYSFS_uint8 *src, const size_t len,
+                                   const size_t bitpos, const unsigned int n)
+{
+    const size_t bytepos = bitpos >> 3;
+    PHYSFS_uint32 val = 0;
+    size_t i;
+    for (i = 0; (i < 4) && (bytepos + i < len); i++)
+        val |= ((PHYSFS_uint32) src[bytepos + i]) << (i * 8);
+    return (val >> (bitpos & 7)) & ((((PHYSFS_uint32) 1) << n) - 1);
+} /* zstd_fwd_bits */
+
+
+/*
+ * Read an FSE table description into (norm). (*maxsym) is the biggest
+ *  symbol allowed on input, and the biggest one that's used on output.
+ *  Returns bytes used, or zero if it's corrupt.
+ */
+static size_t zstd_read_ncount(PHYSFS_sint16 *norm, unsigned int *maxsym,
+                               unsigned int *log, const unsigned int maxlog,
+                               const PHYSFS_uint8 *src, const size_t len)
+{
+    size_t bitpos = 4;
+    unsigned int sym = 0;
+    int remaining, threshold, nbits;
+    int previous0 = 0;
+
+    if (len < 1)
+        return 0;
+
+    *log = (src[0] & 0xF) + 5;
+    if (*log > maxlog)
+        return 0;
+
+    remaining = (1 << *log) + 1;
+    threshold = 1 << *log;
+    nbits = (int) *log + 1;
+
+    while ((remaining > 1) && (sym <= *maxsym))
+    {
+        int max, count;
+        PHYSFS_uint32 val;
+
+        if (previous0)  /* a zero is followed by a count of more zeros. */
+        {
+            PHYSFS_uint32 repeat;
+            do
+            {
+                PHYSFS_uint32 j;
+                repeat = zstd_fwd_bits(src, len, bitpos, 2);
+                bitpos += 2;
+                for (j = 0; j < repeat; j++)
+                {
+                    if (sym > *maxsym)
+                        return 0;
+                    norm[sym++] = 0;
+                } /* for */
+            } while (repeat == 3);
+
+            if (sym > *maxsym)
+                return 0;
+        } /* if */
+
+        max = (2 * threshold - 1) - remaining;
+        val = zstd_fwd_bits(src, len, bitpos, (unsigned int) nbits);
+        if ((int) (val & (threshold - 1)) < max)
+        {
+            count = (int) (val & (threshold - 1));
+            bitpos += nbits - 1;
+        } /* if */
+        else
+        {
+            count = (int) val;
+            if (count >= threshold)
+                count -= max;
+            bitpos += nbits;
+        } /* else */
+
+        count--;  /* stored as probability plus one; -1 is "less than 1". */
+        remaining -= (count < 0) ? -count : count;
+        norm[sym++] = (PHYSFS_sint16) count;
+        previous0 = (count == 0);
+
+        if (remaining < 1)
+            return 0;
+
+        while (remaining < threshold)
+        {
+            nbits--;
+            threshold >>= 1;
+        } /* while */
+    } /* while */
+
+    if ((remaining != 1) || (bitpos > len * 8))
+        return 0;
+
+    *maxsym = sym - 1;
+    return (bitpos + 7) >> 3;
+} /* zstd_read_ncount */
+
+
+static int zstd_build_fse(ZSTDfse *table, const PHYSFS_sint16 *norm,
+                          const unsigned int maxsym, const unsigned int log)
+{
+    const PHYSFS_uint32 size = ((PHYSFS_uint32) 1) << log;
+    const PHYSFS_uint32 mask = size - 1;
+    const PHYSFS_uint32 step = (size >> 1) + (size >> 3) + 3;
+    PHYSFS_uint32 high = size - 1;
+    PHYSFS_uint32 pos = 0;
+    PHYSFS_uint16 next[ZSTD_ML_SYMBOL_MAX + 1];
+    unsigned int s;
+    PHYSFS_uint32 i;
+
+    /* "less than 1" symbols go at the end, the rest are spread around. */
+    for (s = 0; s <= maxsym; s++)
+    {
+        if (norm[s] == -1)
+        {
+            table[high--].symbol = (PHYSFS_uint8) s;
+            next[s] = 1;
+        } /* if */
+        else
+        {
+            next[s] = (PHYSFS_uint16) norm[s];
+        } /* else */
+    } /* for */
+
+    for (s = 0; s <= maxsym; s++)
+    {
+        int j;
+        for (j = 0; j < norm[s]; j++)
+        {
+            table[pos].symbol = (PHYSFS_uint8) s;
+            do
+            {
+                pos = (pos + step) & mask;
+            } while (pos > high);
+        } /* for */
+    } /* for */
+
+    if (pos != 0)
+        return 0;  /* the counts didn't add up. */
+
+    for (i = 0; i < size; i++)
+    {
+        const PHYSFS_uint32 n = next[table[i].symbol]++;
+        const unsigned int nbits = log - zstd_highbit(n);
+        table[i].nbits = (PHYSFS_uint8) nbits;
+        table[i].base = (PHYSFS_uint16) ((n << nbits) - size);
+    } /* for */
+
+    return 1;
+} /* zstd_build_fse */
+
+
+/* Build (z)'s Huffman table from (count) weights, plus the implied last. */
+static int zstd_build_huf(ZSTDstream *z, PHYSFS_uint8 *weights, size_t count)
+{
+    PHYSFS_uint32 ranks[ZSTD_HUF_LOG_MAX + 2];
+    PHYSFS_uint32 total = 0;
+    PHYSFS_uint32 rest;
+    unsigned int maxbits;
+    size_t i;
+
+    memset(ranks, '\0', sizeof (ranks));
+    for (i = 0; i < count; i++)
+    {
+        if (weights[i] > ZSTD_HUF_LOG_MAX)
+            return 0;
+        ranks[weights[i]]++;
+        total += (((PHYSFS_uint32) 1) << weights[i]) >> 1;
+    } /* for */
+
+    if (total == 0)
+        return 0;
+
+    maxbits = zstd_highbit(total) + 1;
+    if (maxbits > ZSTD_HUF_LOG_MAX)
+        return 0;
+
+    rest = (((PHYSFS_uint32) 1) << maxbits) - total;
+    if (rest & (rest - 1))
+        return 0;  /* the last weight has to make it a power of two. */
+    weights[count] = (PHYSFS_uint8) (zstd_highbit(rest) + 1);
+    ranks[weights[count]]++;
+    count++;
+
+    /* longest codes first; each weight's cells start where the last's end. */
+    total = 0;
+    for (i = 1; i <= maxbits; i++)
+    {
+        const PHYSFS_uint32 start = total;
+        total += ranks[i] << (i - 1);
+        ranks[i] = start;
+    } /* for */
+
+    for (i = 0; i < count; i++)
+    {
+        const PHYSFS_uint8 w = weights[i];
+        if (w > 0)
+        {
+            const PHYSFS_uint32 len = (((PHYSFS_uint32) 1) << w) >> 1;
+            ZSTDhuf cell;
+            PHYSFS_uint32 j;
+            cell.symbol = (PHYSFS_uint8) i;
+            cell.nbits = (PHYSFS_uint8) (maxbits + 1 - w);
+            for (j = 0; j < len; j++)
+                z->huf[ranks[w] + j] = cell;
+            ranks[w] += len;
+        } /* if */
+    } /* for */
+
+    z->huf_log = maxbits;
+    return 1;
+} /* zstd_build_huf */
+
+
+/* Huffman weights can be FSE compressed; two states take turns. */
+static size_t zstd_read_fse_weights(PHYSFS_uint8 *weights,
+                                    const PHYSFS_uint8 *src, const size_t len)
+{
+    PHYSFS_sint16 norm[ZSTD_HUF_LOG_MAX + 2];
+    ZSTDfse table[1 << 6];
+    unsigned int maxsym = ZSTD_HUF_LOG_MAX + 1;
+    unsigned int log;
+    PHYSFS_uint32 s1, s2;
+    ZSTDbits br;
+    size_t count = 0;
+    size_t used;
+
+    used = zstd_read_ncount(norm, &maxsym, &log, 6, src, len);
+    if ((used == 0) || (used > len))
+        return 0;
+    else if (!zstd_build_fse(table, norm, maxsym, log))
+        return 0;
+    else if (!zstd_bits_init(&br, src + used, len - used))
+        return 0;
+
+    zstd_bits_reload(&br);
+    s1 = zstd_bits_read(&br, log);
+    s2 = zstd_bits_read(&br, log);
+
+    while (count < 254)
+    {
+        weights[count++] = table[s1].symbol;
+        zstd_bits_reload(&br);
+        s1 = table[s1].base + zstd_bits_read(&br, table[s1].nbits);
+        if (zstd_bits_overflowed(&br))
+        {
+            weights[count++] = table[s2].symbol;
+            return count;
+        } /* if */
+
+        weights[count++] = table[s2].symbol;
+        zstd_bits_reload(&br);
+        s2 = table[s2].base + zstd_bits_read(&br, table[s2].nbits);
+        if (zstd_bits_overflowed(&br))
+        {
+            weights[count++] = table[s1].symbol;
+            return count;
+        } /* if */
+    } /* while */
+
+    return 0;  /* too many weights. */
+} /* zstd_read_fse_weights */
+
+
+/* Read a Huffman tree description. Returns bytes used, or zero if corrupt. */
+static size_t zstd_read_huf(ZSTDstream *z, const PHYSFS_uint8 *src,
+                            const size_t len)
+{
+    PHYSFS_uint8 weights[256];
+    size_t count, used;
+
+    if (len < 1)
+        return 0;
+    else if (src[0] >= 128)  /* stored as 4-bit numbers. */
+    {
+        size_t i;
+        count = src[0] - 127;
+        used = 1 + ((count + 1) / 2);
+        if (used > len)
+            return 0;
+        for (i = 0; i < count; i++)
+        {
+            const PHYSFS_uint8 byte = src[1 + (i / 2)];
+            weights[i] = (i & 1) ? (byte & 0xF) : (byte >> 4);
+        } /* for */
+    } /* else if */
+    else
+    {
+        used = 1 + src[0];
+        if (used > len)
+            return 0;
+        count = zstd_read_fse_weights(weights, src + 1, src[0]);
+        if (count == 0)
+            return 0;
+    } /* else */
+
+    return zstd_build_huf(z, weights, count) ? used : 0;
+} /* zstd_read_huf */
+
+
+static int zstd_decode_huf_stream(const ZSTDstream *z, PHYSFS_uint8 *dst,
+                                  size_t count, const PHYSFS_uint8 *src,
+                                  const size_t len)
+{
+    const ZSTDhuf *table = z->huf;
+    const unsigned int log = z->huf_log;
+    ZSTDbits br;
+
+    if (!zstd_bits_init(&br, src, len))
+        return 0;
+
+    /* codes are at most 11 bits, so we can do four between reloads. */
+    while (count >= 4)
+    {
+        ZSTDhuf cell;
+        zstd_bits_reload(&br);
+        cell = table[zstd_bits_peek(&br, log)]; br.consumed += cell.nbits; *(dst++) = cell.symbol;
+        cell = table[zstd_bits_peek(&br, log)]; br.consumed += cell.nbits; *(dst++) = cell.symbol;
+        cell = table[zstd_bits_peek(&br, log)]; br.consumed += cell.nbits; *(dst++) = cell.symbol;
+        cell = table[zstd_bits_peek(&br, log)]; br.consumed += cell.nbits; *(dst++) = cell.symbol;
+        count -= 4;
+    } /* while */
+
+    zstd_bits_reload(&br);
+    while (count--)
+    {
+        const ZSTDhuf cell = table[zstd_bits_peek(&br, log)];
+        br.consumed += cell.nbits;
+        *(dst++) = cell.symbol;
+    } /* while */
+
+    zstd_bits_reload(&br);
+    return zstd_bits_finished(&br);
+} /* zstd_decode_huf_stream */
+
+
+/*
+ * Decode a block's literals section. (*lits) ends up pointing to them,
+ *  which is either (z->literals) or the raw bytes in (src). Returns bytes
+ *  used, or zero if it's corrupt.
+ */
+static size_t zstd_decode_literals(ZSTDstream *z, const PHYSFS_uint8 *src,
+                                   const size_t len, const PHYSFS_uint8 **lits,
+                                   size_t *litcount)
+{
+    const int type = src[0] & 3;
+    const int format = (src[0] >> 2) & 3;
+    size_t hdrlen, regen;
+
+    if (type < 2)  /* raw or RLE. */
+    {
+        if ((format & 1) == 0)
+        {
+            hdrlen = 1;
+            regen = src[0] >> 3;
+        } /* if */
+        else if (format == 1)
+        {
+            hdrlen = 2;
+            if (len < hdrlen)
+                return 0;
+            regen = zstd_le16(src) >> 4;
+        } /* else if */
+        else
+        {
+            hdrlen = 3;
+            if (len < hdrlen)
+                return 0;
+            regen = zstd_le24(src) >> 4;
+        } /* else */
+
+        if (regen > z->block_max)
+            return 0;
+
+        *litcount = regen;
+        if (type == 0)
+        {
+            if (len - hdrlen < regen)
+                return 0;
+            *lits = src + hdrlen;
+            return hdrlen + regen;
+        } /* if */
+
+        if (len - hdrlen < 1)
+            return 0;
+        memset(z->literals, src[hdrlen], regen);
+        *lits = z->literals;
+        return hdrlen + 1;
+    } /* if */
+
+    else  /* Huffman compressed, with a new table or the last block's. */
+    {
+        const int streams = (format == 0) ? 1 : 4;
+        const PHYSFS_uint8 *ptr;
+        size_t complen;
+
+        hdrlen = (format < 2) ? 3 : (size_t) format + 2;
+        if (len < hdrlen)
+            return 0;
+        else if (hdrlen == 3)
+        {
+            const PHYSFS_uint32 val = zstd_le24(src);
+            regen = (val >> 4) & 0x3FF;
+            complen = (val >> 14) & 0x3FF;
+        } /* else if */
+        else if (hdrlen == 4)
+        {
+            const PHYSFS_uint32 val = zstd_le32(src);
+            regen = (val >> 4) & 0x3FFF;
+            complen = val >> 18;
+        } /* else if */
+        else
+        {
+            const PHYSFS_uint32 val = zstd_le32(src);
+            regen = (val >> 4) & 0x3FFFF;
+            complen = (val >> 22) | (((size_t) src[4]) << 10);
+        } /* else */
+
+        if ((regen > z->block_max) || (len - hdrlen < complen))
+            return 0;
+
+        ptr = src + hdrlen;
+        if (type == 2)
+        {
+            const size_t used = zstd_read_huf(z, ptr, complen);
+            z->huf_valid = (used != 0);
+            if (!used)
+                return 0;
+            ptr += used;
+            complen -= used;
+        } /* if */
+        else if (!z->huf_valid)
+        {
+            return 0;
+        } /* else if */
+
+        if (streams == 1)
+        {
+            if (!zstd_decode_huf_stream(z, z->literals, regen, ptr, complen))
+                return 0;
+        } /* if */
+        else
+        {
+            const size_t seg = (regen + 3) / 4;
+            size_t sizes[4];
+            PHYSFS_uint8 *dst = z->literals;
+            int i;
+
+            if ((complen < 6) || (seg * 3 > regen))
+                return 0;
+            sizes[0] = zstd_le16(ptr);
+            sizes[1] = zstd_le16(ptr + 2);
+            sizes[2] = zstd_le16(ptr + 4);
+            ptr += 6;
+            complen -= 6;
+            if (sizes[0] + sizes[1] + sizes[2] > complen)
+                return 0;
+            sizes[3] = complen - (sizes[0] + sizes[1] + sizes[2]);
+
+            for (i = 0; i < 4; i++)
+            {
+                const size_t count = (i < 3) ? seg : (regen - (seg * 3));
+                if (!zstd_decode_huf_stream(z, dst, count, ptr, sizes[i]))
+                    return 0;
+                dst += count;
+                ptr += sizes[i];
+            } /* for */
+        } /* else */
+
+        *lits = z->literals;
+        *litcount = regen;
+        return (size_t) (ptr - src) + ((streams == 1) ? complen : 0);
+    } /* else */
+} /* zstd_decode_literals */
+
+
+/*
+ * Set up one of the sequence decoding tables, based on its mode from the
+ *  sequences section header. Returns bytes used, or -1 if it's corrupt.
+ */
+static int zstd_read_seq_table(ZSTDfse *table, unsigned int *log, int *valid,
+                               const int mode, const PHYSFS_sint16 *defnorm,
+                               const unsigned int defmaxsym,
+                               const unsigned int deflog,
+                               const unsigned int maxsym,
+                               const unsigned int maxlog,
+                               const PHYSFS_uint8 *src, const size_t len)
+{
+    if (mode == 0)  /* predefined. */
+    {
+        *valid = zstd_build_fse(table, defnorm, defmaxsym, deflog);
+        *log = deflog;
+        return *valid ? 0 : -1;
+    } /* if */
+
+    else if (mode == 1)  /* one symbol, repeated. */
+    {
+        if ((len < 1) || (src[0] > maxsym))
+            return -1;
+        table[0].symbol = src[0];
+        table[0].nbits = 0;
+        table[0].base = 0;
+        *log = 0;
+        *valid = 1;
+        return 1;
+    } /* else if */
+
+    else if (mode == 2)  /* FSE compressed. */
+    {
+        PHYSFS_sint16 norm[ZSTD_ML_SYMBOL_MAX + 1];
+        unsigned int lastsym = maxsym;
+        const size_t used = zstd_read_ncount(norm, &lastsym, log, maxlog, src, len);
+        *valid = (used != 0) && (used <= len) &&
+                 zstd_build_fse(table, norm, lastsym, *log);
+        return *valid ? (int) used : -1;
+    } /* else if */
+
+    return *valid ? 0 : -1;  /* repeat the last block's table. */
+} /* zstd_read_seq_table */
+
+
+/* Copy 16 bytes at a time; this can write up to 15 bytes past (dst + len). */
+static inline void zstd_wildcopy(PHYSFS_uint8 *dst, const PHYSFS_uint8 *src,
+                                 const size_t len)
+{
+    PHYSFS_uint8 *end = dst + len;
+    do
+    {
+        memcpy(dst, src, 16);
+        dst += 16;
+        src += 16;
+    } while (dst < end);
+} /* zstd_wildcopy */
+
+
+/* (op) must have ZSTD_SLACK bytes to spare after (op + len). */
+static inline void zstd_copy_match(PHYSFS_uint8 *op, const size_t offset,
+                                   size_t len)
+{
+    const PHYSFS_uint8 *src = op - offset;
+    if (offset >= 16)  /* each 16 bytes only reads what's already written. */
+        zstd_wildcopy(op, src, len);
+    else if (offset >= len)
+        memcpy(op, src, len);
+    else  /* overlapping; each copy doubles the repeating part. */
+    {
+        while (len > 0)
+        {
+            size_t chunk = (size_t) (op - src);
+            if (chunk > len)
+                chunk = len;
+            memcpy(op, src, chunk);
+            op += chunk;
+            len -= chunk;
+        } /* while */
+    } /* else */
+} /* zstd_copy_match */
+
+
+/*
+ * Decode a block's sequences section and run the sequences, writing the
+ *  block's output at (z->window + z->pos), without going past (oend).
+ */
+static int zstd_decode_sequences(ZSTDstream *z, const PHYSFS_uint8 *src,
+                                 size_t len, const PHYSFS_uint8 *lits,
+                                 size_t litcount, PHYSFS_uint8 *oend)
+{
+    PHYSFS_uint8 *op = z->window + z->pos;
+    const PHYSFS_uint8 *litend = lits + litcount;
+    const int lits_slack = (lits == z->literals);  /* safe to overread? */
+    PHYSFS_uint32 nseq, i;
+    PHYSFS_uint32 llstate, mlstate, ofstate;
+    ZSTDbits br;
+    int used;
+
+    if (len < 1)
+        return 0;
+
+    nseq = src[0];
+    if (nseq == 0)
+    {
+        if (len != 1)
+            return 0;
+    } /* if */
+    else
+    {
+        if (nseq < 128)
+        {
+            src++;
+            len--;
+        } /* if */
+        else if (nseq < 255)
+        {
+            if (len < 2)
+                return 0;
+            nseq = ((nseq - 128) << 8) + src[1];
+            src += 2;
+            len -= 2;
+        } /* else if */
+        else
+        {
+            if (len < 3)
+                return 0;
+            nseq = zstd_le16(src + 1) + 0x7F00;
+            src += 3;
+            len -= 3;
+        } /* else */
+
+        if ((len < 1) || (src[0] & 3))
+            return 0;
+        else
+        {
+            const int modes = src[0];
+            src++;
+            len--;
+
+            used = zstd_read_seq_table(z->ll, &z->ll_log, &z->ll_valid,
+                                       (modes >> 6) & 3, zstd_ll_default,
+                                       ZSTD_LL_SYMBOL_MAX, 6,
+                                       ZSTD_LL_SYMBOL_MAX, ZSTD_LL_LOG_MAX,
+                                       src, len);
+            if (used < 0)
+                return 0;
+            src += used;
+            len -= (size_t) used;
+
+            used = zstd_read_seq_table(z->of, &z->of_log, &z->of_valid,
+                                       (modes >> 4) & 3, zstd_of_default,
+                                       28, 5,
+                                       ZSTD_OF_SYMBOL_MAX, ZSTD_OF_LOG_MAX,
+                                       src, len);
+            if (used < 0)
+                return 0;
+            src += used;
+            len -= (size_t) used;
+
+            used = zstd_read_seq_table(z->ml, &z->ml_log, &z->ml_valid,
+                                       (modes >> 2) & 3, zstd_ml_default,
+                                       ZSTD_ML_SYMBOL_MAX, 6,
+                                       ZSTD_ML_SYMBOL_MAX, ZSTD_ML_LOG_MAX,
+                                       src, len);
+            if (used < 0)
+                return 0;
+            src += used;
+            len -= (size_t) used;
+        } /* else */
+
+        if (!zstd_bits_init(&br, src, len))
+            return 0;
+
+        zstd_bits_reload(&br);
+        llstate = zstd_bits_read(&br, z->ll_log);
+        ofstate = zstd_bits_read(&br, z->of_log);
+        mlstate = zstd_bits_read(&br, z->ml_log);
+
+        for (i = 0; i < nseq; i++)
+        {
+            const ZSTDfse *llcell = &z->ll[llstate];
+            const ZSTDfse *mlcell = &z->ml[mlstate];
+            const ZSTDfse *ofcell = &z->of[ofstate];
+            const unsigned int llcode = llcell->symbol;
+            const unsigned int mlcode = mlcell->symbol;
+            const unsigned int ofcode = ofcell->symbol;
+            PHYSFS_uint32 offset, ll, ml;
+
+            /* offset, match length, literal length, in that order. */
+            zstd_bits_reload(&br);
+            offset = (((PHYSFS_uint32) 1) << ofcode) + zstd_bits_read(&br, ofcode);
+            if (ofcode > 24)  /* up to 32 more bits might not fit. */
+                zstd_bits_reload(&br);
+            ml = zstd_ml_base[mlcode] + zstd_bits_read(&br, zstd_ml_bits[mlcode]);
+            ll = zstd_ll_base[llcode] + zstd_bits_read(&br, zstd_ll_bits[llcode]);
+
+            if (offset > 3)
+            {
+                offset -= 3;
+                z->rep[2] = z->rep[1];
+                z->rep[1] = z->rep[0];
+                z->rep[0] = offset;
+            } /* if */
+            else
+            {
+                /* repeat offsets; a zero literal length shifts them by one. */
+                const PHYSFS_uint32 idx = offset - 1 + (ll == 0);
+                if (idx == 0)
+                    offset = z->rep[0];
+                else
+                {
+                    offset = (idx == 3) ? z->rep[0] - 1 : z->rep[idx];
+                    if (offset == 0)
+                        return 0;
+                    if (idx > 1)
+                        z->rep[2] = z->rep[1];
+                    z->rep[1] = z->rep[0];
+                    z->rep[0] = offset;
+                } /* else */
+            } /* else */
+
+            if (i + 1 < nseq)  /* the last sequence doesn't update them. */
+            {
+                zstd_bits_reload(&br);
+                llstate = llcell->base + zstd_bits_read(&br, llcell->nbits);
+                mlstate = mlcell->base + zstd_bits_read(&br, mlcell->nbits);
+                ofstate = ofcell->base + zstd_bits_read(&br, ofcell->nbits);
+            } /* if */
+
+            if ((ll > (size_t) (litend - lits)) ||
+                (((size_t) ll) + ((size_t) ml) > (size_t) (oend - op)) ||
+                (offset > (size_t) (op - z->window) + ll))
+                return 0;
+
+            if (lits_slack)
+                zstd_wildcopy(op, lits, ll);
+            else
+                memcpy(op, lits, ll);
+            op += ll;
+            lits += ll;
+            zstd_copy_match(op, offset, ml);
+            op += ml;
+        } /* for */
+
+        zstd_bits_reload(&br);
+        if (!zstd_bits_finished(&br))
+            return 0;
+    } /* else */
+
+    /* whatever literals are left go at the end. */
+    litcount = (size_t) (litend - lits);
+    if (litcount > (size_t) (oend - op))
+        return 0;
+    memcpy(op, lits, litcount);
+    op += litcount;
+
+    z->pos = (size_t) (op - z->window);
+    return 1;
+} /* zstd_decode_sequences */
+
+
+static int zstd_decode_block(ZSTDstream *z, const PHYSFS_uint8 *src,
+                             const size_t len, PHYSFS_uint8 *oend)
+{
+    const PHYSFS_uint8 *lits = NULL;
+    size_t litcount = 0;
+    size_t used;
+
+    if (len < 1)
+        return 0;
+
+    used = zstd_decode_literals(z, src, len, &lits, &litcount);
+    if (used == 0)
+        return 0;
+
+    return zstd_decode_sequences(z, src + used, len - used, lits, litcount, oend);
+} /* zstd_decode_block */
+
+
+/* Set up for a new frame, once its header is all here. */
+static PHYSFS_ErrorCode zstd_start_frame(ZSTDstream *z)
+{
+    const PHYSFS_uint8 fhd = z->header[0];
+    const int single_segment = (fhd >> 5) & 1;
+    const int fcs_flag = fhd >> 6;
+    static const size_t did_sizes[4] = { 0, 1, 2, 4 };
+    const PHYSFS_uint8 *ptr = z->header + 1;
+    PHYSFS_uint64 fcs = 0;
+    int have_fcs = 1;
+    size_t capacity;
+
+    if (fhd & 0x08)
+        return PHYSFS_ERR_CORRUPT;  /* reserved bit. */
+
+    if (!single_segment)
+    {
+        const unsigned int windowlog = 10 + (*ptr >> 3);
+        const PHYSFS_uint64 base = ((PHYSFS_uint64) 1) << windowlog;
+        z->window_size = base + ((base / 8) * (*ptr & 7));
+        ptr++;
+    } /* if */
+
+    /* a dictionary ID means we need a dictionary, which we can't have. */
+    if (fhd & 3)
+    {
+        size_t i;
+        PHYSFS_uint32 did = 0;
+        for (i = 0; i < did_sizes[fhd & 3]; i++)
+            did |= ((PHYSFS_uint32) ptr[i]) << (i * 8);
+        if (did != 0)
+            return PHYSFS_ERR_UNSUPPORTED;
+        ptr += did_sizes[fhd & 3];
+    } /* if */
+
+    switch (fcs_flag)
+    {
+        case 0:
+            if (single_segment)
+                fcs = *ptr;
+            else
+                have_fcs = 0;
+            break;
+        case 1: fcs = zstd_le16(ptr) + 256; break;
+        case 2: fcs = zstd_le32(ptr); break;
+        case 3: fcs = zstd_le64(ptr); break;
+    } /* switch */
+
+    if (single_segment)
+        z->window_size = fcs;
+
+    if (z->window_size > (((PHYSFS_uint64) 1) << ZSTD_WINDOWLOG_MAX))
+        return PHYSFS_ERR_UNSUPPORTED;
+
+    z->block_max = ZSTD_BLOCKSIZE_MAX;
+    if (z->window_size < z->block_max)
+        z->block_max = (size_t) z->window_size;
+
+    /* twice the window, so we only slide it down once per window's worth.
+       If the whole frame fits in that, we never slide at all. */
+    capacity = (((size_t) z->window_size) * 2) + z->block_max;
+    if ((have_fcs) && (fcs < (PHYSFS_uint64) capacity))
+        capacity = (size_t) fcs;
+
+    if ((z->window == NULL) || (z->window_alloc < capacity))
+    {
+        void *buf = allocator.Malloc(capacity + ZSTD_SLACK);
+        if (!buf)
+            return PHYSFS_ERR_OUT_OF_MEMORY;
+        allocator.Free(z->window);
+        z->window = (PHYSFS_uint8 *) buf;
+        z->window_alloc = capacity;
+    } /* if */
+
+    z->capacity = capacity;
+    z->pos = z->flushed = 0;
+    z->checksum = (fhd >> 2) & 1;
+    z->rep[0] = 1;
+    z->rep[1] = 4;
+    z->rep[2] = 8;
+    z->huf_valid = z->ll_valid = z->ml_valid = z->of_valid = 0;
+    return PHYSFS_ERR_OK;
+} /* zstd_start_frame */
+
+
+static void zstd_want(ZSTDstream *z, const ZSTDstate state, const size_t need)
+{
+    z->state = state;
+    z->need = need;
+    z->have = 0;
+} /* zstd_want */
+
+
+/* Gather input until we (need) bytes at (dst). Non-zero if we have them. */
+static int zstd_gather(ZSTDstream *z, PHYSFS_uint8 *dst)
+{
+    size_t cpy = z->need - z->have;
+    if (cpy > z->avail_in)
+        cpy = z->avail_in;
+    memcpy(dst + z->have, z->next_in, cpy);
+    z->have += cpy;
+    z->next_in += cpy;
+    z->avail_in -= cpy;
+    return (z->have == z->need);
+} /* zstd_gather */
+
+
+static void zstd_reset(ZSTDstream *z)
+{
+    zstd_want(z, ZSTD_STATE_MAGIC, 4);
+    z->next_in = NULL;
+    z->avail_in = 0;
+    z->pos = z->flushed = 0;
+} /* zstd_reset */
+
+
+static int zstd_init(ZSTDstream *z)
+{
+    memset(z, '\0', sizeof (*z));
+    z->block = (PHYSFS_uint8 *) allocator.Malloc(ZSTD_BLOCKSIZE_MAX);
+    z->literals = (PHYSFS_uint8 *) allocator.Malloc(ZSTD_BLOCKSIZE_MAX + ZSTD_SLACK);
+    if (!z->block || !z->literals)
+    {
+        allocator.Free(z->block);
+        allocator.Free(z->literals);
+        return 0;
+    } /* if */
+
+    zstd_reset(z);
+    return 1;
+} /* zstd_init */
+
+
+static void zstd_end(ZSTDstream *z)
+{
+    allocator.Free(z->window);
+    allocator.Free(z->block);
+    allocator.Free(z->literals);
+    z->window = z->block = z->literals = NULL;
+} /* zstd_end */
+
+
+/*
+ * Decompress as much as we can. Returns PHYSFS_ERR_OK if we stopped because
+ *  we're out of input or output space, or an error code if the data is bad
+ *  or we ran out of memory.
+ */
+static PHYSFS_ErrorCode zstd_decompress(ZSTDstream *z)
+{
+    while (1)
+    {
+        switch (z->state)
+        {
+            case ZSTD_STATE_MAGIC:
+            {
+                PHYSFS_uint32 magic;
+                if (!zstd_gather(z, z->header))
+                    return PHYSFS_ERR_OK;
+                magic = zstd_le32(z->header);
+                if (magic == ZSTD_MAGIC)
+                    zstd_want(z, ZSTD_STATE_FRAME_HEADER, 1);
+                else if ((magic & 0xFFFFFFF0) == ZSTD_SKIPPABLE_MAGIC)
+                    zstd_want(z, ZSTD_STATE_SKIP_SIZE, 4);
+                else
+                    return PHYSFS_ERR_CORRUPT;
+                break;
+            } /* case */
+
+            case ZSTD_STATE_FRAME_HEADER:
+            {
+                static const size_t did_sizes[4] = { 0, 1, 2, 4 };
+                static const size_t fcs_sizes[4] = { 0, 2, 4, 8 };
+                PHYSFS_uint8 fhd;
+                size_t len;
+                if (!zstd_gather(z, z->header))
+                    return PHYSFS_ERR_OK;
+                fhd = z->header[0];
+                len = did_sizes[fhd & 3] + fcs_sizes[fhd >> 6];
+                if (fhd & 0x20)  /* single segment: no window descriptor. */
+                    len += ((fhd >> 6) == 0) ? 1 : 0;
+                else
+                    len++;
+                zstd_want(z, ZSTD_STATE_FRAME_HEADER_REST, len);
+                z->have = 1;  /* keep the descriptor in header[0]. */
+                z->need++;
+                break;
+            } /* case */
+
+            case ZSTD_STATE_FRAME_HEADER_REST:
+            {
+                PHYSFS_ErrorCode rc;
+                if (!zstd_gather(z, z->header))
+                    return PHYSFS_ERR_OK;
+                rc = zstd_start_frame(z);
+                if (rc != PHYSFS_ERR_OK)
+                    return rc;
+                zstd_want(z, ZSTD_STATE_BLOCK_HEADER, 3);
+                break;
+            } /* case */
+
+            case ZSTD_STATE_SKIP_SIZE:
+                if (!zstd_gather(z, z->header))
+                    return PHYSFS_ERR_OK;
+                z->skip = zstd_le32(z->header);
+                zstd_want(z, ZSTD_STATE_SKIP, 0);
+                break;
+
+            case ZSTD_STATE_SKIP:
+            {
+                size_t len = z->avail_in;
+                if (((PHYSFS_uint64) len) > z->skip)
+                    len = (size_t) z->skip;
+                z->next_in += len;
+                z->avail_in -= len;
+                z->skip -= len;
+                if (z->skip > 0)
+                    return PHYSFS_ERR_OK;
+                zstd_want(z, ZSTD_STATE_MAGIC, 4);
+                break;
+            } /* case */
+
+            case ZSTD_STATE_BLOCK_HEADER:
+            {
+                PHYSFS_uint32 val;
+                if (!zstd_gather(z, z->header))
+                    return PHYSFS_ERR_OK;
+
+                val = zstd_le24(z->header);
+                z->last_block = val & 1;
+                z->block_type = (int) ((val >> 1) & 3);
+                z->block_size = (size_t) (val >> 3);
+                if ((z->block_type == 3) || (z->block_size > z->block_max))
+                    return PHYSFS_ERR_CORRUPT;
+
+                /* everything's been handed out; make room for this block. */
+                if ( (z->capacity - z->pos < z->block_max) &&
+                     (((PHYSFS_uint64) z->pos) > z->window_size) )
+                {
+                    const size_t keep = (size_t) z->window_size;
+                    memmove(z->window, z->window + z->pos - keep, keep);
+                    z->pos = z->flushed = keep;
+                } /* if */
+
+                if (z->block_type == 0)  /* raw; read it right into place. */
+                {
+                    if (z->block_size > z->capacity - z->pos)
+                        return PHYSFS_ERR_CORRUPT;
+                    zstd_want(z, ZSTD_STATE_BLOCK, z->block_size);
+                } /* if */
+                else
+                {
+                    zstd_want(z, ZSTD_STATE_BLOCK, (z->block_type == 1) ? 1 : z->block_size);
+                } /* else */
+                break;
+            } /* case */
+
+            case ZSTD_STATE_BLOCK:
+            {
+                size_t room = z->capacity - z->pos;
+                if (room > z->block_max)
+                    room = z->block_max;
+
+                if (z->block_type == 0)
+                {
+                    if (!zstd_gather(z, z->window + z->pos))
+                        return PHYSFS_ERR_OK;
+                    z->pos += z->block_size;
+                } /* if */
+                else if (z->block_type == 1)
+                {
+                    if (!zstd_gather(z, z->block))
+                        return PHYSFS_ERR_OK;
+                    else if (z->block_size > room)
+                        return PHYSFS_ERR_CORRUPT;
+                    memset(z->window + z->pos, z->block[0], z->block_size);
+                    z->pos += z->block_size;
+                } /* else if */
+                else
+                {
+                    const PHYSFS_uint8 *src = z->block;
+                    PHYSFS_uint8 *oend = z->window + z->pos + room;
+
+                    /* decode straight from the input if it's all there. */
+                    if ((z->have == 0) && (z->avail_in >= z->need))
+                    {
+                        src = z->next_in;
+                        z->next_in += z->need;
+                        z->avail_in -= z->need;
+                    } /* if */
+                    else if (!zstd_gather(z, z->block))
+                    {
+                        return PHYSFS_ERR_OK;
+                    } /* else if */
+
+                    if (!zstd_decode_block(z, src, z->block_size, oend))
+                        return PHYSFS_ERR_CORRUPT;
+                } /* else */
+
+                z->state = ZSTD_STATE_FLUSH;
+                break;
+            } /* case */
+
+            case ZSTD_STATE_FLUSH:
+            {
+                size_t len = z->pos - z->flushed;
+                if (len > z->avail_out)
+                    len = z->avail_out;
+                memcpy(z->next_out, z->window + z->flushed, len);
+                z->next_out += len;
+                z->avail_out -= len;
+                z->flushed += len;
+                if (z->flushed < z->pos)
+                    return PHYSFS_ERR_OK;  /* no more room for output. */
+                else if (!z->last_block)
+                    zstd_want(z, ZSTD_STATE_BLOCK_HEADER, 3);
+                else if (z->checksum)
+                    zstd_want(z, ZSTD_STATE_CHECKSUM, 4);
+                else
+                    zstd_want(z, ZSTD_STATE_MAGIC, 4);
+                break;
+            } /* case */
+
+            case ZSTD_STATE_CHECKSUM:
+                if (!zstd_gather(z, z->header))
+                    return PHYSFS_ERR_OK;
+                zstd_want(z, ZSTD_STATE_MAGIC, 4);  /* maybe another frame. */
+                break;
+        } /* switch */
+    } /* while */
+
+    return PHYSFS_ERR_OK;  /* shouldn't hit this. */
+} /* zstd_decompress */
+
+#endif  /* _INCLUDE_PHYSFS_ZSTD_H_ */
+
+/* end of physfs_zstd.h ... */
@@ -0,0 +1,344 @@
+#!/usr/bin/env python3
+#
+# Regenerates the archives test_regress reads. You only need this if you
+#  change them; the output is checked in. Needs the zstd command line tool.
+#
+# Please see the file LICENSE.txt in the source's root directory.
+
+import lzma
+import os
+import random
+import struct
+import subprocess
+import tempfile
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+def zip_archive(members):
+    """members is a list of (name, data, method, packed) tuples. Add a
+       fifth item to store that as the CRC instead of the real one."""
+    local = b''
+    central = b''
+    for member in members:
+        name, data, method, packed = member[:4]
+        name = name.encode('ascii')
+        crc = member[4] if len(member) > 4 else zlib.crc32(data)
+        fields = struct.pack('<HHHHHIII', 63, 0, method, 0, 0x21, crc,
+                             len(packed), len(data))
+        central += b'PK\x01\x02' + struct.pack('<H', 63) + fields
+        central += struct.pack('<HHHHHII', len(name), 0, 0, 0, 0, 0, len(local))
+        central += name
+        local += b'PK\x03\x04' + fields + struct.pack('<HH', len(name), 0)
+        local += name + packed
+    eocd = b'PK\x05\x06' + struct.pack('<HHHHIIH', 0, 0, len(members),
+                                       len(members), len(central),
+                                       len(local), 0)
+    return local + central + eocd
+
+
+def sevenzip_number(v):
+    for i in range(8):
+        if v < (1 << (7 * (i + 1))):
+            if i == 0:
+                return bytes([v])
+            first = ((0xFF << (8 - i)) & 0xFF) | (v >> (8 * i))
+            return bytes([first]) + (v & ((1 << (8 * i)) - 1)).to_bytes(i, 'little')
+    return b'\xff' + v.to_bytes(8, 'little')
+
+
+def sevenzip_archive(folders, piece):
+    """folders is a list of (name, data) lists, each one solid LZMA2 folder.
+       Every (piece) bytes starts a new dictionary, the way multithreaded
+       compressors split things up."""
+    num = sevenzip_number
+    filt = [{'id': lzma.FILTER_LZMA2, 'dict_size': 1 << 20, 'preset': 1}]
+    packs = []
+    for members in folders:
+        data = b''.join(d for _, d in members)
+        packed = b''
+        pieces = [data[i:i + piece] for i in range(0, len(data), piece)]
+        for n, chunk in enumerate(pieces):
+            c = lzma.compress(chunk, format=lzma.FORMAT_RAW, filters=filt)
+            assert c[-1] == 0  # end marker; only the last piece keeps it.
+            packed += c if n == len(pieces) - 1 else c[:-1]
+        packs.append(packed)
+    members = [m for f in folders for m in f]
+
+    h = bytearray()
+    h += b'\x01\x04'  # Header, MainStreamsInfo
+    h += b'\x06' + num(0) + num(len(packs))
+    h += b'\x09' + b''.join(num(len(p)) for p in packs) + b'\x00'
+    h += b'\x07\x0b' + num(len(folders)) + b'\x00'  # UnpackInfo, Folder, not external
+    for _ in folders:
+        h += num(1) + bytes([0x21, 0x21]) + num(1) + bytes([16])  # LZMA2, 1 meg
+    h += b'\x0c' + b''.join(num(sum(len(d) for _, d in f)) for f in folders)
+    h += b'\x00'
+    h += b'\x08\x0d' + b''.join(num(len(f)) for f in folders)  # SubStreamsInfo
+    h += b'\x09' + b''.join(num(len(d)) for f in folders for _, d in f[:-1])
+    h += b'\x0a\x01' + b''.join(struct.pack('<I', zlib.crc32(d))
+                                for _, d in members)
+    h += b'\x00\x00'
+    names = b''.join(n.encode('utf-16-le') + b'\x00\x00' for n, _ in members)
+    h += b'\x05' + num(len(members)) + b'\x11' + num(len(names) + 1)
+    h += b'\x00' + names + b'\x00'
+    h += b'\x00'
+    h = bytes(h)
+
+    packed = b''.join(packs)
+    start = struct.pack('<QQI', len(packed), len(h), zlib.crc32(h))
+    sig = b'7z\xbc\xaf\x27\x1c\x00\x04' + struct.pack('<I', zlib.crc32(start))
+    return sig + start + packed + h
+
+
+def iso_both(fmt, v):
+    """ISO9660 stores most numbers twice: little endian, then big."""
+    return struct.pack('<' + fmt, v) + struct.pack('>' + fmt, v)
+
+
+def iso_record(name, sector, size, isdir):
+    """A directory record. The name is raw bytes; no padding if it's odd."""
+    rec = struct.pack('<BB', 0, 0) + iso_both('I', sector) + iso_both('I', size)
+    rec += bytes([100, 1, 2, 3, 4, 5, 0])  # 2000-01-02 03:04:05 GMT
+    rec += bytes([2 if isdir else 0, 0, 0]) + iso_both('H', 1)
+    rec += bytes([len(name)]) + name
+    assert len(rec) <= 255
+    return bytes([len(rec)]) + rec[1:]
+
+
+def iso_dir(sector, parent, entries):
+    """One sector of directory: ".", "..", then (name, sector, size, isdir)."""
+    out = iso_record(b'\x00', sector, 2048, True)
+    out += iso_record(b'\x01', parent, 2048, True)
+    for entry in entries:
+        out += iso_record(*entry)
+    assert len(out) <= 2048
+    return out + bytes(2048 - len(out))
+
+
+def iso_volume(kind, root, escapes):
+    v = bytes([kind]) + b'CD001\x01\x00' + bytes(64) + bytes(8)
+    v += iso_both('I', 64) + escapes.ljust(32, b'\x00')
+    v += iso_both('H', 1) + iso_both('H', 1) + iso_both('H', 2048)
+    v += bytes(8 + 16)  # path tables, which we don't use.
+    v += iso_record(b'\x00', root, 2048, True)
+    return v + bytes(2048 - len(v))
+
+
+def write(name, data):
+    with open(os.path.join(HERE, name), 'wb') as f:
+        f.write(data)
+
+
+def zstd(data, *args):
+    """Compress from a file, so the frame records the content size."""
+    with tempfile.NamedTemporaryFile() as f:
+        f.write(data)
+        f.flush()
+        return subprocess.run(['zstd', '-q', '-c'] + list(args) + [f.name],
+                              stdout=subprocess.PIPE, check=True).stdout
+
+
+def zstd_stream(data, *args):
+    """Compress from a pipe, so the frame doesn't know the content size."""
+    return subprocess.run(['zstd', '-q', '-c'] + list(args), input=data,
+                          stdout=subprocess.PIPE, check=True).stdout
+
+
+def zstd_header_len(frame, pos):
+    fhd = frame[pos + 4]
+    retval = 5 + [0, 1, 2, 4][fhd & 3] + [0, 2, 4, 8][fhd >> 6]
+    if (fhd & 0x20) == 0:
+        retval += 1  # window descriptor
+    elif (fhd >> 6) == 0:
+        retval += 1  # single segment with a one-byte content size
+    return retval
+
+
+def zstd_block_types(frames):
+    """Walk zstd frames and list the type of every block in them."""
+    types = []
+    pos = 0
+    while pos < len(frames):
+        magic, = struct.unpack_from('<I', frames, pos)
+        if (magic & 0xFFFFFFF0) == 0x184D2A50:  # skippable
+            pos += 8 + struct.unpack_from('<I', frames, pos + 4)[0]
+            continue
+        assert magic == 0xFD2FB528
+        fhd = frames[pos + 4]
+        pos += zstd_header_len(frames, pos)
+        while True:
+            hdr = int.from_bytes(frames[pos:pos + 3], 'little')
+            types.append((hdr >> 1) & 3)
+            pos += 3 + (1 if ((hdr >> 1) & 3) == 1 else (hdr >> 3))
+            if hdr & 1:
+                break
+        if fhd & 4:
+            pos += 4  # content checksum
+    return types
+
+
+def deflate(data):
+    c = zlib.compressobj(9, zlib.DEFLATED, -15)
+    return c.compress(data) + c.flush()
+
+
+def text(lines):
+    out = []
+    for i in range(lines):
+        out.append('entry %05d: the quick brown fox jumps over %d lazy dogs, '
+                   'slot=%d\n' % (i, i % 17, (i * 7) % 31))
+    return ''.join(out).encode('ascii')
+
+
+def make_zstd():
+    rng = random.Random(93)
+    small = text(200)
+    noise = bytes(rng.getrandbits(8) for _ in range(2048))
+    zeros = bytes(300 * 1024)
+    lines = text(4000)
+
+    # one entry, several frames: a raw block, RLE blocks, compressed blocks
+    #  (full of repeat offsets), and a skippable frame in the middle.
+    frames = zstd(noise, '-1') + zstd(zeros, '-1')
+    frames += struct.pack('<II', 0x184D2A53, 5) + b'skip!'
+    frames += zstd(lines, '-19', '--check')
+    types = zstd_block_types(frames)
+    assert 0 in types and 1 in types and 2 in types, types
+    multi = noise + zeros + lines
+
+    # no content size in the frame header, so we can't size the window by it.
+    nosize = zstd_stream(lines, '-3')
+    assert (nosize[4] >> 6) == 0 and not (nosize[4] & 0x20)
+
+    packed_small = zstd(small, '-3')
+    write('zstd.zip', zip_archive([
+        ('small.txt', small, 93, packed_small),
+        ('frames.bin', multi, 93, frames),
+        ('nosize.txt', lines, 93, nosize),
+    ]))
+
+    # the same entry with its last few bytes gone (sizes fixed to match).
+    write('zstd-truncated.zip', zip_archive([
+        ('frames.bin', multi, 93, frames[:-1000]),
+    ]))
+
+    # a block header with the reserved block type.
+    bad = bytearray(packed_small)
+    bad[zstd_header_len(bad, 0)] |= 0x06
+    write('zstd-badblock.zip', zip_archive([
+        ('small.txt', small, 93, bytes(bad)),
+    ]))
+
+
+def make_cache():
+    members = [('a.txt', text(40)), ('b.txt', text(60)),
+               ('big.txt', text(2000)), ('empty.txt', b'')]
+    write('cache.zip', zip_archive([(name, data, 8, deflate(data))
+                                    for name, data in members]))
+
+
+def make_crc():
+    good = text(50)
+    bad = text(70)
+    wrong = zlib.crc32(bad) ^ 0x10
+    write('crc.zip', zip_archive([
+        ('good.txt', good, 8, deflate(good)),
+        ('bad-stored.txt', bad, 0, bad, wrong),
+        ('bad-deflated.txt', bad, 8, deflate(bad), wrong),
+    ]))
+
+
+def make_7z():
+    rng = random.Random(7)
+    small = [('a.txt', text(300)), ('b.txt', text(500)),
+             ('c.bin', bytes(rng.getrandbits(8) for _ in range(8000)))]
+    good = sevenzip_archive([small], 16 * 1024)
+    write('solid.7z', good)
+
+    # a byte flipped halfway through the packed data.
+    bad = bytearray(good)
+    bad[32 + (len(good) - 32) // 3] ^= 0x20
+    write('solid-bad.7z', bytes(bad))
+
+    # the same files, in two folders of several pieces each.
+    write('folders.7z', sevenzip_archive([small[:2], small[2:] + [
+        ('d.txt', text(400))]], 16 * 1024))
+
+    # too big for the folder cache, so it's streamed. A mark every meg.
+    huge = bytearray(65 * 1024 * 1024 + 1000)
+    for i in range(0, len(huge), 1024 * 1024):
+        huge[i:i + 12] = b'MARK%08d' % (i // (1024 * 1024))
+    big = [('head.txt', text(100)), ('huge.bin', bytes(huge)),
+           ('tail.txt', text(100))]
+    good = sevenzip_archive([big], 4 * 1024 * 1024)
+    write('stream.7z', good)
+
+    bad = bytearray(good)
+    bad[32 + (len(good) - 32) // 2] ^= 0x20
+    write('stream-bad.7z', bytes(bad))
+
+
+def make_nested():
+    def stored(name, data):
+        return (name, data, 0, data)
+
+    def deflated(name, data):
+        return (name, data, 8, deflate(data))
+
+    deep = zip_archive([stored('hello.txt', b'hello from the bottom\n')])
+    inner = zip_archive([stored('deep.zip', deep),
+                         deflated('inner.txt', text(50))])
+    write('nested.zip', zip_archive([stored('plain.txt', text(30)),
+                                     deflated('packed.txt', text(80)),
+                                     stored('inner.zip', inner)]))
+
+
+def make_tree():
+    # directories in a case-sensitive archive, for PHYSFS_setRoot() tests.
+    write('tree.zip', zip_archive([
+        (name, data, 8, deflate(data)) for name, data in [
+            ('data/x.txt', text(10)), ('data/deeper/y.txt', text(20)),
+            ('other/z.txt', text(30)), ('top.txt', text(5))]]))
+
+
+def make_iso():
+    def joliet(name):
+        return name.encode('utf-16-be')
+
+    hello = b'hello from joliet\n'
+    sub = text(40)
+    # 111 UCS-2 characters: a 222 byte name in a 255 byte record, the
+    #  biggest a record can hold.
+    longname = 'L' * 107 + '.txt'
+    sectors = [
+        # primary volume: 8.3 names only, which we shouldn't see.
+        iso_dir(19, 19, [(b'HELLO.TXT;1', 22, len(hello), False)]),
+        iso_dir(20, 20, [(joliet('hello.txt'), 22, len(hello), False),
+                         (joliet(longname), 22, len(hello), False),
+                         (joliet('sub dir'), 21, 2048, True)]),
+        iso_dir(21, 20, [(joliet('h\u00e9llo w\u00f6rld.txt'), 23,
+                          len(sub), False)]),
+        hello.ljust(2048, b'\x00'),
+        sub.ljust(4096, b'\x00'),
+    ]
+    assert len(iso_record(joliet(longname), 0, 0, False)) == 255
+
+    iso = bytes(16 * 2048)
+    iso += iso_volume(1, 19, b'')
+    iso += iso_volume(2, 20, b'%/E')
+    iso += b'\xffCD001\x01'.ljust(2048, b'\x00')
+    iso += b''.join(sectors)
+    assert len(iso) == 23 * 2048 + 4096
+    write('joliet.iso', iso)
+
+
+if __name__ == '__main__':
+    make_zstd()
+    make_cache()
+    make_crc()
+    make_7z()
+    make_nested()
+    make_tree()
+    make_iso()
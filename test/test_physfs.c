@@ -585,6 +585,25 @@ static int cmd_permitsyms(char *args)
 } /* cmd_permitsyms */
 
 
+static int cmd_indexsearchpath(char *args)
+{
+    int num;
+
+    if (*args == '\"')
+    {
+        args++;
+        args[strlen(args) - 1] = '\0';
+    } /* if */
+
+    num = atoi(args);
+    if (!PHYSFS_indexSearchPath(num))
+        printf("Failure. reason: %s.\n", PHYSFS_getLastError());
+    else
+        printf("Search path index is now %s.\n", num ? "enabled" : "disabled");
+    return 1;
+} /* cmd_indexsearchpath */
+
+
 static int cmd_setbuffer(char *args)
 {
     if (*args == '\"')
@@ -1460,6 +1479,7 @@ static const command_info commands[] =
     { "getwritedir",    cmd_getwritedir,    0, NULL                         },
     { "setwritedir",    cmd_setwritedir,    1, "<newWriteDir>"              },
     { "permitsymlinks", cmd_permitsyms,     1, "<1or0>"                     },
+    { "indexsearchpath", cmd_indexsearchpath, 1, "<1or0>"                   },
     { "setsaneconfig",  cmd_setsaneconfig,  5, "<org> <appName> <arcExt> <includeCdRoms> <archivesFirst>" },
     { "mkdir",          cmd_mkdir,          1, "<dirToMk>"                  },
     { "delete",         cmd_delete,         1, "<dirToDelete>"              },
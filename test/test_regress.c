@@ -0,0 +1,1993 @@
+/**
+ * Regression checks for PhysicsFS, run by CTest.
+ *
+ * Unlike test_physfs, this isn't interactive: it runs a named group of
+ *  checks against the archives in test/data and exits non-zero if any of
+ *  them failed. Run it like this:
+ *
+ *   ./test_regress /path/to/test/data [group]
+ *
+ * Leave out the group to run all of them. The archives come from
+ *  test/data/make_fixtures.py.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#if TEST_REGRESS_HAVE_PTHREAD
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "physfs.h"
+
+static const char *datadir = NULL;
+static int failures = 0;
+
+#define CHECK(x) check((x) != 0, #x, __FILE__, __LINE__)
+
+static int check(const int ok, const char *what, const char *fname,
+                 const int line)
+{
+    if (!ok)
+    {
+        const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+        printf("%s:%d: FAILED: %s (last error: %s)\n", fname, line, what,
+               (err == PHYSFS_ERR_OK) ? "none" : PHYSFS_getErrorByCode(err));
+        failures++;
+    } /* if */
+    return ok;
+} /* check */
+
+
+static const char *fixture(const char *fname)
+{
+    static char path[1024];
+    snprintf(path, sizeof (path), "%s/%s", datadir, fname);
+    return path;
+} /* fixture */
+
+
+/* Load a file into a malloc()'d buffer. */
+static void *loadFile(const char *fname, PHYSFS_uint64 *len)
+{
+    FILE *io = fopen(fname, "rb");
+    void *retval = NULL;
+    long size;
+
+    *len = 0;
+    if (!CHECK(io != NULL))
+        return NULL;
+
+    if ((fseek(io, 0, SEEK_END) == 0) && ((size = ftell(io)) > 0))
+    {
+        retval = malloc((size_t) size);
+        rewind(io);
+        if ((retval != NULL) && (fread(retval, size, 1, io) == 1))
+            *len = (PHYSFS_uint64) size;
+        else
+        {
+            free(retval);
+            retval = NULL;
+        } /* else */
+    } /* if */
+
+    fclose(io);
+    CHECK(retval != NULL);
+    return retval;
+} /* loadFile */
+
+
+static void *loadFixture(const char *fname, PHYSFS_uint64 *len)
+{
+    return loadFile(fixture(fname), len);
+} /* loadFixture */
+
+
+static int saveFile(const char *fname, const void *buf, const PHYSFS_uint64 len)
+{
+    FILE *io = fopen(fname, "wb");
+    int retval;
+    if (io == NULL)
+        return 0;
+    retval = (len == 0) || (fwrite(buf, (size_t) len, 1, io) == 1);
+    return (fclose(io) == 0) && retval;
+} /* saveFile */
+
+
+static int fileExists(const char *fname)
+{
+    FILE *io = fopen(fname, "rb");
+    if (io != NULL)
+        fclose(io);
+    return (io != NULL);
+} /* fileExists */
+
+
+/*
+ * Read all of (fname) into a malloc()'d buffer. Returns NULL and leaves
+ *  the error code alone if anything fails, so callers can check why.
+ */
+static PHYSFS_uint8 *slurp(const char *fname, PHYSFS_uint64 *len)
+{
+    PHYSFS_File *f = PHYSFS_openRead(fname);
+    PHYSFS_uint8 *retval = NULL;
+    PHYSFS_sint64 flen;
+
+    *len = 0;
+    if (f == NULL)
+        return NULL;
+
+    flen = PHYSFS_fileLength(f);
+    if (flen >= 0)
+        retval = (PHYSFS_uint8 *) malloc((size_t) flen + 1);
+
+    if ((retval == NULL) || (PHYSFS_readBytes(f, retval, flen) != flen))
+    {
+        free(retval);
+        retval = NULL;
+    } /* if */
+    else
+    {
+        *len = (PHYSFS_uint64) flen;
+    } /* else */
+
+    PHYSFS_close(f);
+    return retval;
+} /* slurp */
+
+
+/* Read (fname), check its length and how it starts. */
+static int readText(const char *fname, const PHYSFS_uint64 len,
+                    const char *start)
+{
+    PHYSFS_uint64 buflen;
+    PHYSFS_uint8 *buf = slurp(fname, &buflen);
+    const int retval = (buf != NULL) && (buflen == len) &&
+                       (memcmp(buf, start, strlen(start)) == 0);
+    free(buf);
+    return retval;
+} /* readText */
+
+
+/* Seek (f) to (pos) and check the next (len) bytes match (expect + pos). */
+static int readAt(PHYSFS_File *f, const PHYSFS_uint8 *expect,
+                  const PHYSFS_uint64 pos, const PHYSFS_uint64 len)
+{
+    PHYSFS_uint8 buf[4096];
+    if ((len > sizeof (buf)) || !PHYSFS_seek(f, pos))
+        return 0;
+    else if (PHYSFS_tell(f) != (PHYSFS_sint64) pos)
+        return 0;
+    else if (PHYSFS_readBytes(f, buf, len) != (PHYSFS_sint64) len)
+        return 0;
+    return (memcmp(buf, expect + pos, (size_t) len) == 0);
+} /* readAt */
+
+
+/* Reading (fname) must fail, and say the data is corrupt. */
+static int readFailsCorrupt(const char *fname)
+{
+    PHYSFS_uint64 len;
+    PHYSFS_uint8 *buf;
+
+    PHYSFS_setErrorCode(PHYSFS_ERR_OK);
+    buf = slurp(fname, &len);
+    if (buf != NULL)
+    {
+        free(buf);
+        return 0;
+    } /* if */
+
+    return (PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+} /* readFailsCorrupt */
+
+
+static void test_zstd(void)
+{
+    /* backwards, forwards, across frame boundaries, and back to the start. */
+    static const PHYSFS_uint64 seeks[] = {
+        300000, 2040, 310000, 310000, 1000, 2048 + 307200 - 10, 0, 560000
+    };
+    PHYSFS_uint8 *frames;
+    PHYSFS_uint8 *buf;
+    PHYSFS_uint8 *data;
+    PHYSFS_uint64 framesLen, len, datalen, i;
+    PHYSFS_File *f;
+    size_t j;
+
+    if (!CHECK(PHYSFS_mount(fixture("zstd.zip"), NULL, 1)))
+        return;
+
+    /* CRC checks catch anything that decodes to the wrong bytes. */
+    PHYSFS_verifyChecksums(1);
+    buf = slurp("small.txt", &len);
+    CHECK(buf != NULL);
+    CHECK(len == 13015);
+    free(buf);
+
+    /* several frames with raw, RLE and compressed blocks, and a skip. */
+    frames = slurp("frames.bin", &framesLen);
+    CHECK(frames != NULL);
+    CHECK(framesLen == 2048 + 307200 + 260354);
+
+    /* no content size in the frame header. */
+    buf = slurp("nosize.txt", &len);
+    CHECK(buf != NULL);
+    CHECK(len == 260354);
+    CHECK((buf != NULL) && (frames != NULL) &&
+          (memcmp(buf, frames + framesLen - len, (size_t) len) == 0));
+    free(buf);
+    PHYSFS_verifyChecksums(0);
+
+    /* going backwards has to start the decoder over from the top. */
+    f = PHYSFS_openRead("frames.bin");
+    if (CHECK(f != NULL) && (frames != NULL))
+    {
+        for (j = 0; j < sizeof (seeks) / sizeof (seeks[0]); j++)
+            CHECK(readAt(f, frames, seeks[j], 4096));
+        CHECK(readAt(f, frames, framesLen - 100, 100));
+        CHECK(PHYSFS_eof(f));
+        CHECK(!PHYSFS_seek(f, framesLen + 1));
+        PHYSFS_close(f);
+    } /* if */
+
+    CHECK(PHYSFS_unmount(fixture("zstd.zip")));
+
+    /* broken streams fail with PHYSFS_ERR_CORRUPT. */
+    if (CHECK(PHYSFS_mount(fixture("zstd-truncated.zip"), NULL, 1)))
+    {
+        CHECK(readFailsCorrupt("frames.bin"));
+        CHECK(PHYSFS_unmount(fixture("zstd-truncated.zip")));
+    } /* if */
+
+    if (CHECK(PHYSFS_mount(fixture("zstd-badblock.zip"), NULL, 1)))
+    {
+        CHECK(readFailsCorrupt("small.txt"));
+        CHECK(PHYSFS_unmount(fixture("zstd-badblock.zip")));
+    } /* if */
+
+    /*
+     * Flip each byte of small.txt's stream in turn. With CRCs on, every
+     *  one of them has to either decode correctly (it hit something the
+     *  decoder doesn't need, like the frame checksum) or fail as corrupt.
+     */
+    data = (PHYSFS_uint8 *) loadFixture("zstd.zip", &datalen);
+    if (data != NULL)
+    {
+        const PHYSFS_uint64 start = 30 + 9;  /* local header, "small.txt" */
+        const PHYSFS_uint64 end = start + (data[18] | (data[19] << 8));  /* < 64k */
+        int wrong = 0;
+
+        PHYSFS_verifyChecksums(1);
+        for (i = start; i < end; i++)
+        {
+            data[i] ^= 0x5A;
+            if (!PHYSFS_mountMemory(data, datalen, NULL, "flip.zip", NULL, 1))
+                wrong++;
+            else
+            {
+                buf = slurp("small.txt", &len);
+                if ((buf == NULL) && (PHYSFS_getLastErrorCode() != PHYSFS_ERR_CORRUPT))
+                    wrong++;
+                free(buf);
+                PHYSFS_unmount("flip.zip");
+            } /* else */
+            data[i] ^= 0x5A;
+        } /* for */
+        PHYSFS_verifyChecksums(0);
+
+        CHECK(wrong == 0);
+        free(data);
+    } /* if */
+
+    free(frames);
+} /* test_zstd */
+
+
+/* Open (fname), check it's (len) bytes, and see how the file cache did. */
+static int openCounted(const char *fname, const PHYSFS_uint64 len,
+                       PHYSFS_uint32 *hits, PHYSFS_uint32 *misses)
+{
+    PHYSFS_uint32 h0, m0, h1, m1;
+    PHYSFS_uint64 buflen;
+    PHYSFS_uint8 *buf;
+
+    PHYSFS_getFileCacheStats(&h0, &m0, NULL);
+    buf = slurp(fname, &buflen);
+    PHYSFS_getFileCacheStats(&h1, &m1, NULL);
+    *hits = h1 - h0;
+    *misses = m1 - m0;
+    free(buf);
+    return ((buf != NULL) && (buflen == len));
+} /* openCounted */
+
+
+static void test_filecache(void)
+{
+    PHYSFS_uint32 hits, misses, evictions, e0;
+    PHYSFS_File *f;
+    PHYSFS_File *g;
+
+    if (!CHECK(PHYSFS_mount(fixture("cache.zip"), NULL, 1)))
+        return;
+
+    /* off by default, and nothing counts while it's off. */
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+    CHECK(openCounted("empty.txt", 0, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+
+    CHECK(PHYSFS_setFileCache(1024 * 1024, 8 * 1024));
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 0) && (misses == 1));
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 1) && (misses == 0));
+    CHECK(openCounted("b.txt", 3901, &hits, &misses));
+    CHECK((hits == 0) && (misses == 1));
+
+    /* too big for it: not cached, and not counted either. */
+    CHECK(openCounted("big.txt", 130174, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+    CHECK(openCounted("big.txt", 130174, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+
+    /* open handles share the cached copy, straight out of memory. */
+    f = PHYSFS_openRead("b.txt");
+    g = PHYSFS_openRead("b.txt");
+    if (CHECK((f != NULL) && (g != NULL)))
+    {
+        PHYSFS_uint64 flen = 0, glen = 0;
+        const void *fmem = PHYSFS_getFileMemory(f, &flen);
+        CHECK((fmem != NULL) && (flen == 3901));
+        CHECK(fmem == PHYSFS_getFileMemory(g, &glen));
+    } /* if */
+
+    /* shrinking it below every file drops them all; open ones still work. */
+    PHYSFS_getFileCacheStats(NULL, NULL, &e0);
+    CHECK(PHYSFS_setFileCache(8 * 1024, 1024));
+    PHYSFS_getFileCacheStats(NULL, NULL, &evictions);
+    CHECK(evictions - e0 == 2);
+    if ((f != NULL) && (g != NULL))
+    {
+        char buf[16];
+        CHECK(PHYSFS_seek(f, 0) && (PHYSFS_readBytes(f, buf, 6) == 6));
+        CHECK(memcmp(buf, "entry ", 6) == 0);
+    } /* if */
+    PHYSFS_close(f);
+    PHYSFS_close(g);
+
+    /* the per-file limit can't be more than a slice of the capacity. */
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+    CHECK(PHYSFS_setFileCache(8 * 3000, 64 * 1024));  /* 3000 bytes a shard */
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 0) && (misses == 1));
+    CHECK(openCounted("b.txt", 3901, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+
+    /* unmounting forgets its files. */
+    CHECK(PHYSFS_unmount(fixture("cache.zip")));
+    CHECK(PHYSFS_mount(fixture("cache.zip"), NULL, 1));
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 0) && (misses == 1));
+
+    /* turning it off again stops the counting, even for empty files. */
+    CHECK(PHYSFS_setFileCache(0, 0));
+    CHECK(openCounted("a.txt", 2601, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+    CHECK(openCounted("empty.txt", 0, &hits, &misses));
+    CHECK((hits == 0) && (misses == 0));
+
+    CHECK(PHYSFS_unmount(fixture("cache.zip")));
+} /* test_filecache */
+
+
+/* Read all of (f) twice: both have to fail as corrupt, not stop at EOF. */
+static int readStaysCorrupt(PHYSFS_File *f, const PHYSFS_sint64 len)
+{
+    PHYSFS_uint8 buf[8192];
+    int i;
+
+    if ((f == NULL) || (len > (PHYSFS_sint64) sizeof (buf)))
+        return 0;
+
+    for (i = 0; i < 2; i++)
+    {
+        PHYSFS_setErrorCode(PHYSFS_ERR_OK);
+        if (PHYSFS_readBytes(f, buf, len) != -1)
+            return 0;
+        else if (PHYSFS_getLastErrorCode() != PHYSFS_ERR_CORRUPT)
+            return 0;
+    } /* for */
+    return 1;
+} /* readStaysCorrupt */
+
+
+static void test_crc(void)
+{
+    static const char *bad[] = { "bad-stored.txt", "bad-deflated.txt" };
+    PHYSFS_File *f;
+    size_t i;
+
+    if (!CHECK(PHYSFS_mount(fixture("crc.zip"), NULL, 1)))
+        return;
+
+    /* off by default, so nobody notices. */
+    CHECK(!PHYSFS_checksumsVerified());
+    CHECK(readText("bad-deflated.txt", 4555, "entry 00000"));
+
+    CHECK(PHYSFS_verifyChecksums(1));
+    CHECK(readText("good.txt", 3253, "entry 00000"));
+    for (i = 0; i < sizeof (bad) / sizeof (bad[0]); i++)
+    {
+        CHECK(readFailsCorrupt(bad[i]));
+
+        /* trying again, or going back for more, doesn't help. */
+        f = PHYSFS_openRead(bad[i]);
+        CHECK(readStaysCorrupt(f, 4555));
+        CHECK((f != NULL) && (PHYSFS_tell(f) == 4555));
+        if (f != NULL)
+        {
+            /* deflated files decode up to a seek, so that fails instead. */
+            if (PHYSFS_seek(f, 100))
+                CHECK(readStaysCorrupt(f, 100));
+            else
+                CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+            PHYSFS_close(f);
+        } /* if */
+    } /* for */
+    CHECK(PHYSFS_verifyChecksums(0));
+
+    /* checking a whole archive works with the setting off, too. */
+    PHYSFS_setErrorCode(PHYSFS_ERR_OK);
+    CHECK(!PHYSFS_verifyArchive(fixture("crc.zip")));
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+
+    if (CHECK(PHYSFS_mount(fixture("zstd.zip"), NULL, 1)))
+    {
+        CHECK(PHYSFS_verifyArchive(fixture("zstd.zip")));
+        CHECK(PHYSFS_unmount(fixture("zstd.zip")));
+    } /* if */
+
+    if (CHECK(PHYSFS_mount(fixture("solid.7z"), NULL, 1)))
+    {
+        CHECK(!PHYSFS_verifyArchive(fixture("solid.7z")));
+        CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_UNSUPPORTED);
+        CHECK(PHYSFS_unmount(fixture("solid.7z")));
+    } /* if */
+
+    CHECK(!PHYSFS_verifyArchive(fixture("cache.zip")));
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_NOT_MOUNTED);
+
+    CHECK(PHYSFS_unmount(fixture("crc.zip")));
+} /* test_crc */
+
+
+/*
+ * A PHYSFS_Io over a buffer that counts how it's used, so we can see which
+ *  of the optional version 1 methods PhysicsFS calls.
+ */
+typedef struct
+{
+    const PHYSFS_uint8 *buf;
+    PHYSFS_uint64 len;
+    int reads;          /* read() calls, from any instance.    */
+    int duplicates;     /* duplicate() calls.                  */
+    int readAts;        /* readAt() calls.                     */
+    int maps;           /* map() calls that handed out memory. */
+    int sequential;     /* hint(PHYSFS_IOHINT_SEQUENTIAL) calls. */
+    PHYSFS_IoHint lastHint;
+    int failReadAt;     /* make readAt() fail.                 */
+    int live;           /* instances not destroyed yet.        */
+} TestIoState;
+
+typedef struct
+{
+    TestIoState *state;
+    PHYSFS_uint64 pos;
+} TestIoInfo;
+
+/* Decoder threads duplicate and read Ios, too, so count carefully. */
+#if TEST_REGRESS_HAVE_PTHREAD
+static pthread_mutex_t testIoLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void bump(int *counter, const int by)
+{
+#if TEST_REGRESS_HAVE_PTHREAD
+    pthread_mutex_lock(&testIoLock);
+#endif
+    *counter += by;
+#if TEST_REGRESS_HAVE_PTHREAD
+    pthread_mutex_unlock(&testIoLock);
+#endif
+} /* bump */
+
+static PHYSFS_Io *createTestIo(TestIoState *state, const PHYSFS_uint32 version,
+                               const int canMap);
+
+static PHYSFS_sint64 testIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    TestIoInfo *info = (TestIoInfo *) io->opaque;
+    const PHYSFS_uint64 avail = info->state->len - info->pos;
+    if (len > avail)
+        len = avail;
+    memcpy(buf, info->state->buf + info->pos, (size_t) len);
+    info->pos += len;
+    bump(&info->state->reads, 1);
+    return (PHYSFS_sint64) len;
+} /* testIo_read */
+
+static PHYSFS_sint64 testIo_write(PHYSFS_Io *io, const void *b,
+                                  PHYSFS_uint64 len)
+{
+    PHYSFS_setErrorCode(PHYSFS_ERR_READ_ONLY);
+    return -1;
+} /* testIo_write */
+
+static int testIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    TestIoInfo *info = (TestIoInfo *) io->opaque;
+    if (offset > info->state->len)
+    {
+        PHYSFS_setErrorCode(PHYSFS_ERR_PAST_EOF);
+        return 0;
+    } /* if */
+    info->pos = offset;
+    return 1;
+} /* testIo_seek */
+
+static PHYSFS_sint64 testIo_tell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((TestIoInfo *) io->opaque)->pos;
+} /* testIo_tell */
+
+static PHYSFS_sint64 testIo_length(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((TestIoInfo *) io->opaque)->state->len;
+} /* testIo_length */
+
+static PHYSFS_Io *testIo_duplicate(PHYSFS_Io *io)
+{
+    TestIoInfo *info = (TestIoInfo *) io->opaque;
+    const int canMap = (io->version >= 1) && (io->map != NULL);
+    bump(&info->state->duplicates, 1);
+    return createTestIo(info->state, io->version, canMap);
+} /* testIo_duplicate */
+
+static int testIo_flush(PHYSFS_Io *io) { return 1; }
+
+static void testIo_destroy(PHYSFS_Io *io)
+{
+    TestIoInfo *info = (TestIoInfo *) io->opaque;
+    bump(&info->state->live, -1);
+    free(info);
+    free(io);
+} /* testIo_destroy */
+
+static PHYSFS_sint64 testIo_readAt(PHYSFS_Io *io, void *buf,
+                                   PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    TestIoState *state = ((TestIoInfo *) io->opaque)->state;
+    bump(&state->readAts, 1);
+    if (state->failReadAt)
+    {
+        PHYSFS_setErrorCode(PHYSFS_ERR_IO);
+        return -1;
+    } /* if */
+    else if (offset >= state->len)
+        return 0;
+    else if (len > (state->len - offset))
+        len = state->len - offset;
+    memcpy(buf, state->buf + offset, (size_t) len);
+    return (PHYSFS_sint64) len;
+} /* testIo_readAt */
+
+static const void *testIo_map(PHYSFS_Io *io, PHYSFS_uint64 offset,
+                              PHYSFS_uint64 len)
+{
+    TestIoState *state = ((TestIoInfo *) io->opaque)->state;
+    if ((offset > state->len) || (len > (state->len - offset)))
+        return NULL;
+    bump(&state->maps, 1);
+    return state->buf + offset;
+} /* testIo_map */
+
+static void testIo_hint(PHYSFS_Io *io, PHYSFS_IoHint hint)
+{
+    TestIoState *state = ((TestIoInfo *) io->opaque)->state;
+    if (hint == PHYSFS_IOHINT_SEQUENTIAL)
+        bump(&state->sequential, 1);
+    state->lastHint = hint;
+} /* testIo_hint */
+
+/* A version 0 Io is allocated without the version 1 fields at all. */
+static PHYSFS_Io *createTestIo(TestIoState *state, const PHYSFS_uint32 version,
+                               const int canMap)
+{
+    const size_t len = version ? sizeof (PHYSFS_Io) : offsetof(PHYSFS_Io, readAt);
+    PHYSFS_Io *io = (PHYSFS_Io *) malloc(len);
+    TestIoInfo *info = (TestIoInfo *) malloc(sizeof (TestIoInfo));
+    if (!io || !info)
+    {
+        free(io);
+        free(info);
+        return NULL;
+    } /* if */
+
+    info->state = state;
+    info->pos = 0;
+    memset(io, '\0', len);
+    io->version = version;
+    io->opaque = info;
+    io->read = testIo_read;
+    io->write = testIo_write;
+    io->seek = testIo_seek;
+    io->tell = testIo_tell;
+    io->length = testIo_length;
+    io->duplicate = testIo_duplicate;
+    io->flush = testIo_flush;
+    io->destroy = testIo_destroy;
+    if (version >= 1)
+    {
+        io->readAt = testIo_readAt;
+        io->map = canMap ? testIo_map : NULL;
+        io->hint = testIo_hint;
+    } /* if */
+    bump(&state->live, 1);
+    return io;
+} /* createTestIo */
+
+
+/* Check the mark make_fixtures.py left at each meg of huge.bin. */
+static int readMark(PHYSFS_File *f, const PHYSFS_uint64 meg)
+{
+    char expect[16];
+    char buf[12];
+    snprintf(expect, sizeof (expect), "MARK%08u", (unsigned int) meg);
+    if (!PHYSFS_seek(f, meg * 1024 * 1024))
+        return 0;
+    else if (PHYSFS_readBytes(f, buf, sizeof (buf)) != sizeof (buf))
+        return 0;
+    return (memcmp(buf, expect, sizeof (buf)) == 0);
+} /* readMark */
+
+
+/*
+ * Mount the 7z (fname) with these decoder and preload threads, through an
+ *  Io that counts its duplicates, and read every file in it, in order.
+ *  Every LZMA2 piece decoded on its own reads through a duplicate, so the
+ *  count shows how the folders were decoded.
+ */
+static PHYSFS_uint8 *decodeCounted(const char *fname, const int decoders,
+                                   const int preloaders, PHYSFS_uint64 *len,
+                                   int *dups)
+{
+    static const char *members[] = { "a.txt", "b.txt", "c.bin", "d.txt" };
+    PHYSFS_uint8 *retval = NULL;
+    TestIoState state;
+    PHYSFS_Io *io;
+    size_t i;
+
+    *len = 0;
+    *dups = 0;
+    memset(&state, '\0', sizeof (state));
+    state.buf = (const PHYSFS_uint8 *) loadFixture(fname, &state.len);
+    if (state.buf == NULL)
+        return NULL;
+
+    CHECK(PHYSFS_setDecoderThreads(decoders));
+    CHECK(PHYSFS_preloadArchives(preloaders));
+    io = createTestIo(&state, 0, 0);
+    if (CHECK(io != NULL) && CHECK(PHYSFS_mountIo(io, fname, NULL, 1)))
+    {
+        for (i = 0; i < sizeof (members) / sizeof (members[0]); i++)
+        {
+            PHYSFS_uint64 flen;
+            PHYSFS_uint8 *buf;
+            void *ptr;
+
+            if (!PHYSFS_exists(members[i]))
+                continue;
+            buf = slurp(members[i], &flen);
+            ptr = CHECK(buf != NULL) ? realloc(retval, *len + flen) : NULL;
+            if (ptr != NULL)
+            {
+                retval = (PHYSFS_uint8 *) ptr;
+                memcpy(retval + *len, buf, (size_t) flen);
+                *len += flen;
+            } /* if */
+            free(buf);
+        } /* for */
+        CHECK(PHYSFS_unmount(fname));
+    } /* if */
+
+    CHECK(PHYSFS_setDecoderThreads(0));
+    CHECK(PHYSFS_preloadArchives(0));
+    CHECK(state.live == 0);
+    free((void *) state.buf);
+    *dups = state.duplicates;
+    return retval;
+} /* decodeCounted */
+
+
+/* Does (buf) match (ref)? Frees (buf) either way. */
+static int sameBytes(PHYSFS_uint8 *buf, const PHYSFS_uint64 len,
+                     const PHYSFS_uint8 *ref, const PHYSFS_uint64 reflen)
+{
+    const int retval = (buf != NULL) && (ref != NULL) && (len == reflen) &&
+                       (memcmp(buf, ref, (size_t) len) == 0);
+    free(buf);
+    return retval;
+} /* sameBytes */
+
+
+static void test_7z(void)
+{
+    const void *amem;
+    const void *bmem;
+    PHYSFS_uint64 alen, blen, len;
+    PHYSFS_uint32 hits, misses;
+    PHYSFS_uint8 *buf;
+    PHYSFS_File *a;
+    PHYSFS_File *b;
+    PHYSFS_uint8 *ref;
+    int threads;
+    int dups;
+
+    /*
+     * A solid folder is decompressed once and kept; its files are slices
+     *  of it. Do it once on this thread and once split across several.
+     */
+    for (threads = 1; threads <= 4; threads += 3)
+    {
+        CHECK(PHYSFS_setDecoderThreads(threads));
+        if (!CHECK(PHYSFS_mount(fixture("solid.7z"), NULL, 1)))
+            return;
+
+        a = PHYSFS_openRead("a.txt");
+        b = PHYSFS_openRead("b.txt");
+        if (CHECK((a != NULL) && (b != NULL)))
+        {
+            amem = PHYSFS_getFileMemory(a, &alen);
+            bmem = PHYSFS_getFileMemory(b, &blen);
+            CHECK((amem != NULL) && (alen == 19522));
+            CHECK((bmem != NULL) && (blen == 32541));
+            CHECK((const char *) bmem == ((const char *) amem) + alen);
+            CHECK((amem != NULL) && (memcmp(amem, "entry 00000", 11) == 0));
+        } /* if */
+        PHYSFS_close(a);
+        PHYSFS_close(b);
+
+        buf = slurp("c.bin", &len);
+        CHECK((buf != NULL) && (len == 8000));
+        free(buf);
+
+        CHECK(PHYSFS_unmount(fixture("solid.7z")));
+    } /* for */
+    CHECK(PHYSFS_setDecoderThreads(0));
+
+    /*
+     * solid.7z's one folder is in several LZMA2 pieces, which can be
+     *  decoded on several threads. folders.7z has two folders like that:
+     *  preloading spreads the folders over its threads, and only when
+     *  there's one thread to spread them over, their pieces.
+     */
+    ref = decodeCounted("solid.7z", 1, 0, &len, &dups);
+    CHECK((ref != NULL) && (len == 19522 + 32541 + 8000) && (dups == 1));
+    buf = decodeCounted("solid.7z", 4, 0, &alen, &dups);
+    CHECK(sameBytes(buf, alen, ref, len) && (dups > 1));
+    buf = decodeCounted("solid.7z", 4, 4, &alen, &dups);
+    CHECK(sameBytes(buf, alen, ref, len) && (dups > 1));
+    free(ref);
+
+    ref = decodeCounted("folders.7z", 1, 0, &len, &dups);
+    CHECK((ref != NULL) && (len == 19522 + 32541 + 8000 + 26031) && (dups == 2));
+    buf = decodeCounted("folders.7z", 4, 4, &alen, &dups);
+    CHECK(sameBytes(buf, alen, ref, len) && (dups == 2));
+    buf = decodeCounted("folders.7z", 4, 1, &alen, &dups);
+    CHECK(sameBytes(buf, alen, ref, len) && (dups > 2));
+    free(ref);
+
+    /* a bad folder fails its CRC check every time, and isn't kept. */
+    if (CHECK(PHYSFS_mount(fixture("solid-bad.7z"), NULL, 1)))
+    {
+        CHECK(readFailsCorrupt("a.txt"));
+        CHECK(readFailsCorrupt("a.txt"));
+        CHECK(readFailsCorrupt("c.bin"));
+        CHECK(PHYSFS_unmount(fixture("solid-bad.7z")));
+    } /* if */
+
+    /*
+     * This folder is too big to keep around, so files in it are
+     *  decompressed as they're read instead of all at once.
+     */
+    if (!CHECK(PHYSFS_mount(fixture("stream.7z"), NULL, 1)))
+        return;
+
+    a = PHYSFS_openRead("huge.bin");
+    if (CHECK(a != NULL))
+    {
+        CHECK(PHYSFS_fileLength(a) == (65 * 1024 * 1024) + 1000);
+        CHECK(PHYSFS_getFileMemory(a, &alen) == NULL);
+        CHECK(readMark(a, 0));
+        CHECK(readMark(a, 10));
+        CHECK(readMark(a, 10));  /* still in the window. */
+        CHECK(readMark(a, 3));  /* starts over. */
+        CHECK(readMark(a, 4));
+        CHECK(readMark(a, 65));
+        CHECK(!PHYSFS_seek(a, (65 * 1024 * 1024) + 1001));
+        PHYSFS_close(a);
+    } /* if */
+
+    buf = slurp("tail.txt", &len);
+    CHECK((buf != NULL) && (len == 6507));
+    CHECK((buf != NULL) && (memcmp(buf, "entry 00000", 11) == 0));
+    free(buf);
+
+    /* small files from a big folder can go in the file cache instead. */
+    CHECK(PHYSFS_setFileCache(1024 * 1024, 64 * 1024));
+    CHECK(openCounted("head.txt", 6507, &hits, &misses));
+    CHECK((hits == 0) && (misses == 1));
+    CHECK(openCounted("head.txt", 6507, &hits, &misses));
+    CHECK((hits == 1) && (misses == 0));
+    CHECK(PHYSFS_setFileCache(0, 0));
+
+    CHECK(PHYSFS_unmount(fixture("stream.7z")));
+
+    /* streams check each file's CRC as it goes by. */
+    if (CHECK(PHYSFS_mount(fixture("stream-bad.7z"), NULL, 1)))
+    {
+        CHECK(readFailsCorrupt("huge.bin"));
+        CHECK(PHYSFS_unmount(fixture("stream-bad.7z")));
+    } /* if */
+} /* test_7z */
+
+
+/* Mount (fname) from inside the search path with PHYSFS_mountHandle(). */
+static int mountNested(const char *fname, const char *mntpoint)
+{
+    PHYSFS_File *f = PHYSFS_openRead(fname);
+    if (f == NULL)
+        return 0;
+    else if (PHYSFS_mountHandle(f, fname, mntpoint, 1))
+        return 1;
+    PHYSFS_close(f);
+    return 0;
+} /* mountNested */
+
+
+static void test_io(void)
+{
+    static const char *hello = "hello from the bottom\n";
+    TestIoState state;
+    PHYSFS_uint64 len;
+    const void *ptr;
+    PHYSFS_File *f;
+    PHYSFS_File *g;
+    PHYSFS_Io *io;
+    char buf[8];
+
+    memset(&state, '\0', sizeof (state));
+    state.buf = (const PHYSFS_uint8 *) loadFixture("nested.zip", &state.len);
+    if (state.buf == NULL)
+        return;
+
+    /* newer than we know about: refused, and left to the caller. */
+    io = createTestIo(&state, 2, 0);
+    if (CHECK(io != NULL))
+    {
+        CHECK(!PHYSFS_mountIo(io, "v2.zip", NULL, 1));
+        CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_UNSUPPORTED);
+        io->destroy(io);
+    } /* if */
+
+    /* version 0 has no readAt(), so every open file duplicates the Io. */
+    io = createTestIo(&state, 0, 0);
+    if (CHECK(io != NULL) && CHECK(PHYSFS_mountIo(io, "v0.zip", NULL, 1)))
+    {
+        state.duplicates = 0;
+        CHECK(readText("plain.txt", 1950, "entry 00000"));
+        CHECK(readText("packed.txt", 5204, "entry 00000"));
+        CHECK(state.duplicates == 2);
+        CHECK(state.readAts == 0);
+        CHECK(PHYSFS_unmount("v0.zip"));
+    } /* if */
+    CHECK(state.live == 0);
+
+    /*
+     * Version 1 with readAt(): files are read in place, without duplicating
+     *  or moving the archive's Io. Archives inside it are views of views
+     *  by way of file handles, and still end up at our readAt().
+     */
+    io = createTestIo(&state, 1, 0);
+    if (CHECK(io != NULL) && CHECK(PHYSFS_mountIo(io, "v1.zip", NULL, 1)))
+    {
+        state.reads = state.duplicates = state.readAts = 0;
+        CHECK(readText("plain.txt", 1950, "entry 00000"));
+        CHECK(readText("packed.txt", 5204, "entry 00000"));
+        CHECK(state.readAts > 0);
+
+        f = PHYSFS_openRead("plain.txt");
+        g = PHYSFS_openRead("packed.txt");
+        if (CHECK((f != NULL) && (g != NULL)))
+        {
+            CHECK(PHYSFS_getFileMemory(f, &len) == NULL);  /* no map(). */
+            CHECK(PHYSFS_seek(f, 1900) && PHYSFS_seek(g, 5000));
+            CHECK(PHYSFS_readBytes(f, buf, 6) == 6);
+            CHECK(PHYSFS_readBytes(g, buf + 6, 2) == 2);
+            CHECK(PHYSFS_tell(f) == 1906);
+            CHECK(PHYSFS_tell(g) == 5002);
+        } /* if */
+        PHYSFS_close(f);
+        PHYSFS_close(g);
+
+        CHECK(mountNested("inner.zip", "inner"));
+        CHECK(mountNested("inner/deep.zip", "deep"));
+        CHECK(readText("inner/inner.txt", 3253, "entry 00000"));
+        CHECK(readText("deep/hello.txt", 22, hello));
+
+        CHECK(state.reads == 0);
+        CHECK(state.duplicates == 0);
+
+        /* a failing readAt() fails the read, all the way up. */
+        state.failReadAt = 1;
+        CHECK(!readText("deep/hello.txt", 22, hello));
+        CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_IO);
+        CHECK(!readText("plain.txt", 1950, "entry 00000"));
+        state.failReadAt = 0;
+        CHECK(readText("deep/hello.txt", 22, hello));
+
+        CHECK(PHYSFS_unmount("inner/deep.zip"));
+        CHECK(PHYSFS_unmount("inner.zip"));
+        CHECK(PHYSFS_unmount("v1.zip"));
+    } /* if */
+    CHECK(state.live == 0);
+
+    /* with map(), stored files are just pointers into our buffer. */
+    io = createTestIo(&state, 1, 1);
+    if (CHECK(io != NULL) && CHECK(PHYSFS_mountIo(io, "map.zip", NULL, 1)))
+    {
+        f = PHYSFS_openRead("plain.txt");
+        if (CHECK(f != NULL))
+        {
+            ptr = PHYSFS_getFileMemory(f, &len);
+            CHECK((ptr != NULL) && (len == 1950));
+            CHECK(((const PHYSFS_uint8 *) ptr) > state.buf);
+            CHECK(((const PHYSFS_uint8 *) ptr) + len < state.buf + state.len);
+            PHYSFS_close(f);
+        } /* if */
+
+        /* ...even when they're nested a couple of archives down. */
+        state.reads = 0;
+        CHECK(mountNested("inner.zip", "inner"));
+        CHECK(mountNested("inner/deep.zip", "deep"));
+        f = PHYSFS_openRead("deep/hello.txt");
+        if (CHECK(f != NULL))
+        {
+            ptr = PHYSFS_getFileMemory(f, &len);
+            CHECK((ptr != NULL) && (len == 22));
+            CHECK((ptr != NULL) && (memcmp(ptr, hello, 22) == 0));
+            CHECK(((const PHYSFS_uint8 *) ptr) > state.buf);
+            CHECK(((const PHYSFS_uint8 *) ptr) + len < state.buf + state.len);
+            PHYSFS_close(f);
+        } /* if */
+        CHECK(readText("inner/inner.txt", 3253, "entry 00000"));
+        CHECK(state.maps > 0);
+        CHECK(state.reads == 0);
+
+        CHECK(PHYSFS_unmount("inner/deep.zip"));
+        CHECK(PHYSFS_unmount("inner.zip"));
+        CHECK(PHYSFS_unmount("map.zip"));
+    } /* if */
+    CHECK(state.live == 0);
+
+    /* preloading reads the whole archive, and says so first. */
+    CHECK(PHYSFS_preloadArchives(1));
+    io = createTestIo(&state, 1, 0);
+    if (CHECK(io != NULL) && CHECK(PHYSFS_mountIo(io, "hint.zip", NULL, 1)))
+    {
+        CHECK(state.sequential == 1);
+        CHECK(state.lastHint == PHYSFS_IOHINT_NORMAL);
+        CHECK(readText("packed.txt", 5204, "entry 00000"));
+        CHECK(PHYSFS_unmount("hint.zip"));
+    } /* if */
+    CHECK(PHYSFS_preloadArchives(0));
+    CHECK(state.live == 0);
+
+    free((void *) state.buf);
+} /* test_io */
+
+
+/* Is (fname) listed in the root of the search path? */
+static int listed(const char *fname)
+{
+    char **list = PHYSFS_enumerateFiles("");
+    char **i;
+    int retval = 0;
+    for (i = list; (i != NULL) && (*i != NULL); i++)
+        retval |= (strcmp(*i, fname) == 0);
+    PHYSFS_freeList(list);
+    return retval;
+} /* listed */
+
+
+/* Find (str) in (buf); NULL if it's not there. */
+static PHYSFS_uint8 *findBytes(PHYSFS_uint8 *buf, const PHYSFS_uint64 len,
+                               const char *str)
+{
+    const size_t slen = strlen(str);
+    PHYSFS_uint64 i;
+    for (i = 0; (i + slen) <= len; i++)
+    {
+        if (memcmp(buf + i, str, slen) == 0)
+            return buf + i;
+    } /* for */
+    return NULL;
+} /* findBytes */
+
+
+/* Mount (archive), check for (present) and (absent), unmount. */
+static int mountAndList(const char *archive, const char *present,
+                        const char *absent)
+{
+    int retval;
+    if (!PHYSFS_mount(archive, NULL, 1))
+        return 0;
+    retval = listed(present) && !listed(absent);
+    return PHYSFS_unmount(archive) && retval;
+} /* mountAndList */
+
+
+static void test_index(void)
+{
+    /* these go in the current directory, which CTest makes the build dir. */
+    static const char *zip = "regress-index.zip";
+    static const char *idx = "regress-index.zip.physfsidx";
+    static const char *garbage = "this is not an index file at all";
+    PHYSFS_uint8 *data;
+    PHYSFS_uint8 *index = NULL;
+    PHYSFS_uint8 *buf;
+    PHYSFS_uint64 datalen, indexlen = 0, len;
+    PHYSFS_uint8 *ptr;
+    int i;
+
+    data = (PHYSFS_uint8 *) loadFixture("cache.zip", &datalen);
+    if (data == NULL)
+        return;
+
+    remove(idx);
+    if (!CHECK(saveFile(zip, data, datalen)))
+        goto test_index_done;
+
+    /* off by default: nothing gets written. */
+    CHECK(PHYSFS_getArchiveIndexDir() == NULL);
+    CHECK(mountAndList(zip, "b.txt", "q.txt"));
+    CHECK(!fileExists(idx));
+
+    /* the first mount writes one next to the archive. */
+    CHECK(PHYSFS_setArchiveIndexDir(""));
+    CHECK(strcmp(PHYSFS_getArchiveIndexDir(), "") == 0);
+    CHECK(mountAndList(zip, "b.txt", "q.txt"));
+    index = (PHYSFS_uint8 *) loadFile(idx, &indexlen);
+    if (!CHECK((index != NULL) && (indexlen > 8)))
+        goto test_index_done;
+    CHECK(memcmp(index, "PhysIdx\x1A", 8) == 0);
+
+    /* prove the next mount reads it: rename a file in the index only. */
+    ptr = findBytes(index, indexlen, "b.txt");
+    if (CHECK(ptr != NULL))
+    {
+        *ptr = 'q';
+        CHECK(saveFile(idx, index, indexlen));
+        CHECK(mountAndList(zip, "q.txt", "b.txt"));
+        *ptr = 'b';
+    } /* if */
+
+    /* garbage, cut short, or empty: ignored, and written again. */
+    for (i = 0; i < 3; i++)
+    {
+        if (i == 0)
+            CHECK(saveFile(idx, garbage, strlen(garbage)));
+        else
+            CHECK(saveFile(idx, index, (i == 1) ? (indexlen / 2) : 0));
+        CHECK(mountAndList(zip, "b.txt", "q.txt"));
+        buf = (PHYSFS_uint8 *) loadFile(idx, &len);
+        CHECK((buf != NULL) && (len == indexlen));
+        CHECK((buf != NULL) && (memcmp(buf, index, (size_t) len) == 0));
+        free(buf);
+    } /* for */
+
+    /* reading from it resolves entries in the index, but only our copy. */
+    CHECK(PHYSFS_mount(zip, NULL, 1));
+    CHECK(readText("a.txt", 2601, "entry 00000"));
+    CHECK(PHYSFS_unmount(zip));
+    buf = (PHYSFS_uint8 *) loadFile(idx, &len);
+    CHECK((buf != NULL) && (len == indexlen));
+    CHECK((buf != NULL) && (memcmp(buf, index, (size_t) len) == 0));
+    free(buf);
+
+    /*
+     * Change the archive but not its size, probably inside the same second
+     *  of modification time, too: the checksum of its central directory,
+     *  where the names are, catches that.
+     */
+    ptr = findBytes(index, indexlen, "b.txt");
+    if (CHECK(ptr != NULL))
+    {
+        *ptr = 'q';
+        CHECK(saveFile(idx, index, indexlen));  /* a stale, renamed index. */
+        *ptr = 'b';
+    } /* if */
+    while ((ptr = findBytes(data, datalen, "a.txt")) != NULL)
+        *ptr = 'x';
+    CHECK(saveFile(zip, data, datalen));
+    CHECK(mountAndList(zip, "x.txt", "a.txt"));
+    CHECK(mountAndList(zip, "b.txt", "q.txt"));
+    CHECK(PHYSFS_mount(zip, NULL, 1));
+    CHECK(readText("x.txt", 2601, "entry 00000"));
+    CHECK(PHYSFS_unmount(zip));
+
+    /* a different archive altogether. */
+    free(data);
+    data = (PHYSFS_uint8 *) loadFixture("nested.zip", &datalen);
+    CHECK((data != NULL) && saveFile(zip, data, datalen));
+    CHECK(mountAndList(zip, "plain.txt", "b.txt"));
+
+    /* can't be written? It still mounts. */
+    CHECK(PHYSFS_setArchiveIndexDir("no-such-dir/really-not"));
+    CHECK(mountAndList(zip, "plain.txt", "b.txt"));
+
+    CHECK(PHYSFS_setArchiveIndexDir(NULL));
+    CHECK(PHYSFS_getArchiveIndexDir() == NULL);
+
+test_index_done:
+    remove(idx);
+    remove(zip);
+    free(index);
+    free(data);
+} /* test_index */
+
+
+static void test_iso(void)
+{
+    static const char *hello = "hello from joliet\n";
+    char longname[112];
+    char **list;
+
+    if (!CHECK(PHYSFS_mount(fixture("joliet.iso"), NULL, 1)))
+        return;
+
+    /* Joliet names win over the primary volume's 8.3 ones. */
+    CHECK(listed("hello.txt"));
+    CHECK(!listed("HELLO.TXT"));
+    CHECK(readText("hello.txt", 18, hello));
+
+    /* a name as long as a directory record can hold. */
+    memset(longname, 'L', 107);
+    strcpy(longname + 107, ".txt");
+    CHECK(listed(longname));
+    CHECK(readText(longname, 18, hello));
+
+    /* UCS-2 comes out as UTF-8. */
+    list = PHYSFS_enumerateFiles("sub dir");
+    CHECK((list != NULL) && (list[0] != NULL) && (list[1] == NULL));
+    CHECK((list != NULL) && (list[0] != NULL) &&
+          (strcmp(list[0], "h\xC3\xA9llo w\xC3\xB6rld.txt") == 0));
+    PHYSFS_freeList(list);
+    CHECK(readText("sub dir/h\xC3\xA9llo w\xC3\xB6rld.txt", 2601, "entry 00000"));
+
+    CHECK(PHYSFS_unmount(fixture("joliet.iso")));
+} /* test_iso */
+
+
+/*
+ * A scratch directory tree in the current directory, for tests that need a
+ *  real directory: regress-tree/{top.txt,real/f.txt,real/sub/g.txt}, plus
+ *  link.txt -> top.txt and linkdir -> real where there are symlinks.
+ */
+static const char *scratchTree = "regress-tree";
+
+static int writeText(const char *fname, const char *str)
+{
+    PHYSFS_File *f = PHYSFS_openWrite(fname);
+    const PHYSFS_sint64 len = (PHYSFS_sint64) strlen(str);
+    int retval;
+    if (f == NULL)
+        return 0;
+    retval = (PHYSFS_writeBytes(f, str, (PHYSFS_uint64) len) == len);
+    return PHYSFS_close(f) && retval;
+} /* writeText */
+
+
+static void removeTree(void)
+{
+    static const char *files[] = {
+        "regress-tree/real/sub/g.txt", "regress-tree/real/sub",
+        "regress-tree/real/f.txt", "regress-tree/real",
+        "regress-tree/top.txt", "regress-tree"
+    };
+    size_t i;
+
+#ifndef _WIN32
+    remove("regress-tree/link.txt");
+    remove("regress-tree/linkdir");
+#endif
+
+    if (!PHYSFS_setWriteDir("."))
+        return;
+    for (i = 0; i < sizeof (files) / sizeof (files[0]); i++)
+        PHYSFS_delete(files[i]);
+    PHYSFS_setWriteDir(NULL);
+} /* removeTree */
+
+
+/* Returns non-zero if the tree is there, symlinks and all. */
+static int makeTree(void)
+{
+    int retval;
+
+    removeTree();  /* in case an earlier run died. */
+    if (!PHYSFS_setWriteDir("."))
+        return 0;
+    retval = PHYSFS_mkdir("regress-tree/real/sub") &&
+             writeText("regress-tree/top.txt", "top of the tree\n") &&
+             writeText("regress-tree/real/f.txt", "a real file\n") &&
+             writeText("regress-tree/real/sub/g.txt", "further down\n");
+    PHYSFS_setWriteDir(NULL);
+
+#ifndef _WIN32
+    retval = retval && (symlink("real", "regress-tree/linkdir") == 0) &&
+             (symlink("top.txt", "regress-tree/link.txt") == 0);
+#endif
+
+    return retval;
+} /* makeTree */
+
+
+static int sameStat(const PHYSFS_Stat *a, const PHYSFS_Stat *b)
+{
+    return (a->filesize == b->filesize) && (a->modtime == b->modtime) &&
+           (a->createtime == b->createtime) &&
+           (a->accesstime == b->accesstime) &&
+           (a->filetype == b->filetype) && (a->readonly == b->readonly);
+} /* sameStat */
+
+
+/* PHYSFS_statMany() on (paths) must agree with PHYSFS_stat() on each. */
+static void checkStatMany(const char **paths, const PHYSFS_uint32 n)
+{
+    PHYSFS_Stat out[64];
+    int found[64];
+    int justFound[64];
+    PHYSFS_uint32 i;
+
+    if (!CHECK(n <= 64))
+        return;
+    else if (!CHECK(PHYSFS_statMany(paths, out, found, n)))
+        return;
+    CHECK(PHYSFS_statMany(paths, NULL, justFound, n));
+
+    for (i = 0; i < n; i++)
+    {
+        PHYSFS_Stat st;
+        const int rc = PHYSFS_stat(paths[i], &st) ? 1 : 0;
+        int ok = ((found[i] ? 1 : 0) == rc) && ((justFound[i] ? 1 : 0) == rc);
+        if (ok && rc)
+            ok = sameStat(&st, &out[i]);
+        if (!CHECK(ok))
+            printf("  ... for '%s'\n", paths[i]);
+    } /* for */
+} /* checkStatMany */
+
+
+static void test_statmany(void)
+{
+    static const char *paths[] = {
+        "", "/", "a.txt", "empty.txt", "big.txt", "nope.txt", "a.txt/x",
+        "../a.txt", "A.TXT", "m", "m/", "m/n", "m/n/plain.txt",
+        "m/n/packed.txt", "m/n/inner.zip", "m/n/nope", "m/nope/x", "m/n/i",
+        "m/n/i/inner.txt", "m/n/i/deep.zip", "m/n/i/deeper",
+        "m/n/i/deeper/still", "m/n/i/deeper/still/hello.txt",
+        "m/n/i/deeper/nope", "m/a.txt", "m/c.bin", "m/d.txt", "iso",
+        "iso/h\xC3\xA9llo w\xC3\xB6rld.txt", "iso/hello.txt", "iso/sub dir",
+        "t", "t/top.txt", "t/real", "t/real/f.txt", "t/real/sub",
+        "t/real/sub/g.txt", "t/real/nope", "t/link.txt", "t/linkdir",
+        "t/linkdir/f.txt", "t/linkdir/sub/g.txt", "t/nope/f.txt"
+    };
+    const PHYSFS_uint32 n = (PHYSFS_uint32) (sizeof (paths) / sizeof (paths[0]));
+    PHYSFS_Stat st;
+#ifndef _WIN32
+    int found[2];
+#endif
+    int pass;
+
+    if (!CHECK(makeTree()))
+        goto test_statmany_done;
+
+    /* nested mountpoints, one sharing a prefix, and roots on two archives. */
+    CHECK(PHYSFS_mount(fixture("cache.zip"), NULL, 1));
+    CHECK(PHYSFS_mount(fixture("nested.zip"), "m/n", 1));
+    CHECK(mountNested("m/n/inner.zip", "m/n/i"));
+    CHECK(mountNested("m/n/i/deep.zip", "m/n/i/deeper/still"));
+    CHECK(PHYSFS_mount(fixture("folders.7z"), "m", 1));
+    CHECK(PHYSFS_mount(fixture("joliet.iso"), "iso", 1));
+    CHECK(PHYSFS_setRoot(fixture("joliet.iso"), "sub dir"));
+    CHECK(PHYSFS_mount(scratchTree, "t", 1));
+
+    /* make sure the batch covers what it's meant to. */
+    CHECK(PHYSFS_stat("m/n/i/deeper/still/hello.txt", &st));
+    CHECK(PHYSFS_stat("iso/h\xC3\xA9llo w\xC3\xB6rld.txt", &st));
+    CHECK(!PHYSFS_exists("iso/hello.txt"));
+    CHECK(PHYSFS_stat("m/n", &st) && st.readonly);
+
+    for (pass = 0; pass < 4; pass++)
+    {
+        /* symlinks forbidden then permitted, without and with a write dir. */
+        PHYSFS_permitSymbolicLinks(pass & 1);
+        if (pass == 2)
+            CHECK(PHYSFS_setWriteDir(scratchTree));
+        checkStatMany(paths, n);
+    } /* for */
+
+#ifndef _WIN32
+    PHYSFS_permitSymbolicLinks(0);
+    CHECK(PHYSFS_statMany(&paths[n - 3], NULL, found, 2));
+    CHECK(!found[0] && !found[1]);  /* t/linkdir/... is forbidden. */
+    PHYSFS_permitSymbolicLinks(1);
+    CHECK(PHYSFS_statMany(&paths[n - 3], &st, found, 1));
+    CHECK(found[0] && (st.filetype == PHYSFS_FILETYPE_REGULAR));
+    PHYSFS_permitSymbolicLinks(0);
+#endif
+
+    /* and once more with the search path indexed. */
+    CHECK(PHYSFS_indexSearchPath(1));
+    checkStatMany(paths, n);
+    CHECK(PHYSFS_indexSearchPath(0));
+
+    CHECK(PHYSFS_setWriteDir(NULL));
+    CHECK(PHYSFS_unmount(scratchTree));
+    CHECK(PHYSFS_unmount(fixture("joliet.iso")));
+    CHECK(PHYSFS_unmount(fixture("folders.7z")));
+    CHECK(PHYSFS_unmount("m/n/i/deep.zip"));
+    CHECK(PHYSFS_unmount("m/n/inner.zip"));
+    CHECK(PHYSFS_unmount(fixture("nested.zip")));
+    CHECK(PHYSFS_unmount(fixture("cache.zip")));
+
+test_statmany_done:
+    removeTree();
+} /* test_statmany */
+
+
+/* Everything the search path says about one path. */
+typedef struct
+{
+    int exists;
+    const char *realdir;
+    PHYSFS_sint64 filesize;
+    int filetype;
+    PHYSFS_sint64 opened;  /* length of what PHYSFS_openRead() gave, or -1. */
+    PHYSFS_uint32 listed;  /* hash of what PHYSFS_enumerateFiles() gave. */
+} LookupAnswer;
+
+static const char *lookupPaths[] = {
+    "", "a.txt", "b.txt", "c.bin", "d.txt", "big.txt", "empty.txt",
+    "nope.txt", "A.TXT", "m", "m/plain.txt", "m/packed.txt", "m/inner.zip",
+    "m/nope", "m/i", "m/i/inner.txt", "m/i/deep.zip", "m/n",
+    "m/n/good.txt", "m/n/bad-stored.txt", "m/n/plain.txt", "iso",
+    "iso/hello.txt", "iso/sub dir", "iso/h\xC3\xA9llo w\xC3\xB6rld.txt",
+    "iso/sub dir/h\xC3\xA9llo w\xC3\xB6rld.txt", "t", "t/top.txt",
+    "t/real/f.txt", "t/nope", "s", "s/a.txt", "s/nope.txt"
+};
+
+#define LOOKUP_PATHS (sizeof (lookupPaths) / sizeof (lookupPaths[0]))
+
+static void lookup(const char *path, LookupAnswer *answer)
+{
+    PHYSFS_File *f;
+    PHYSFS_Stat st;
+    char **list;
+    char **i;
+
+    memset(answer, '\0', sizeof (*answer));
+    answer->exists = PHYSFS_exists(path);
+    answer->realdir = PHYSFS_getRealDir(path);
+    answer->filesize = -2;
+    if (PHYSFS_stat(path, &st))
+    {
+        answer->filesize = st.filesize;
+        answer->filetype = (int) st.filetype;
+    } /* if */
+
+    answer->opened = -1;
+    f = PHYSFS_openRead(path);
+    if (f != NULL)
+    {
+        answer->opened = PHYSFS_fileLength(f);
+        PHYSFS_close(f);
+    } /* if */
+
+    answer->listed = 5381;
+    list = PHYSFS_enumerateFiles(path);
+    for (i = list; (i != NULL) && (*i != NULL); i++)
+    {
+        const char *ptr;
+        for (ptr = *i; *ptr; ptr++)
+            answer->listed = (answer->listed * 33) ^ (PHYSFS_uint8) *ptr;
+        answer->listed = (answer->listed * 33) ^ '/';
+    } /* for */
+    PHYSFS_freeList(list);
+} /* lookup */
+
+
+static int sameAnswer(const LookupAnswer *a, const LookupAnswer *b)
+{
+    if ((a->realdir == NULL) != (b->realdir == NULL))
+        return 0;
+    else if ((a->realdir != NULL) && (strcmp(a->realdir, b->realdir) != 0))
+        return 0;
+    return (a->exists == b->exists) &&
+           (a->filesize == b->filesize) && (a->filetype == b->filetype) &&
+           (a->opened == b->opened) && (a->listed == b->listed);
+} /* sameAnswer */
+
+
+/*
+ * Every lookup must give the same answer with the index off and on. (stage)
+ *  says how far into the test we are, for the failure messages.
+ */
+static void checkIndexAgrees(const int stage)
+{
+    LookupAnswer off[LOOKUP_PATHS];
+    LookupAnswer on;
+    const int wasIndexed = PHYSFS_searchPathIndexed();
+    size_t i;
+
+    CHECK(PHYSFS_indexSearchPath(0));
+    CHECK(!PHYSFS_searchPathIndexed());
+    for (i = 0; i < LOOKUP_PATHS; i++)
+        lookup(lookupPaths[i], &off[i]);
+
+    CHECK(PHYSFS_indexSearchPath(1));
+    CHECK(PHYSFS_searchPathIndexed());
+    for (i = 0; i < LOOKUP_PATHS; i++)
+    {
+        lookup(lookupPaths[i], &on);
+        if (!CHECK(sameAnswer(&off[i], &on)))
+            printf("  ... for '%s' at stage %d\n", lookupPaths[i], stage);
+    } /* for */
+
+    CHECK(PHYSFS_indexSearchPath(wasIndexed));
+} /* checkIndexAgrees */
+
+
+static void test_searchindex(void)
+{
+    LookupAnswer answer;
+
+    if (!CHECK(makeTree()))
+        goto test_searchindex_done;
+
+    CHECK(PHYSFS_mount(fixture("cache.zip"), NULL, 1));
+    CHECK(PHYSFS_mount(fixture("folders.7z"), NULL, 1));  /* a.txt is shadowed. */
+    CHECK(PHYSFS_mount(fixture("nested.zip"), "m", 1));
+    CHECK(mountNested("m/inner.zip", "m/i"));
+    CHECK(PHYSFS_mount(fixture("crc.zip"), "m/n", 1));
+    CHECK(PHYSFS_mount(fixture("joliet.iso"), "iso", 1));
+    CHECK(PHYSFS_mount(scratchTree, "t", 1));
+    checkIndexAgrees(1);
+
+    /* the shadowing comes out right: a.txt is cache.zip's, d.txt isn't. */
+    lookup("a.txt", &answer);
+    CHECK(answer.realdir && (strcmp(answer.realdir, fixture("cache.zip")) == 0));
+    lookup("d.txt", &answer);
+    CHECK(answer.realdir && (strcmp(answer.realdir, fixture("folders.7z")) == 0));
+
+    /* change the search path with the index on... */
+    CHECK(PHYSFS_indexSearchPath(1));
+    CHECK(PHYSFS_mount(fixture("solid.7z"), NULL, 0));  /* now a.txt is this one's. */
+    CHECK(PHYSFS_unmount("m/inner.zip"));
+    CHECK(PHYSFS_setRoot(fixture("joliet.iso"), "sub dir"));
+    checkIndexAgrees(2);
+    lookup("a.txt", &answer);
+    CHECK(answer.realdir && (strcmp(answer.realdir, fixture("solid.7z")) == 0));
+
+    CHECK(PHYSFS_unmount(fixture("solid.7z")));
+    CHECK(PHYSFS_unmount(fixture("cache.zip")));
+    CHECK(PHYSFS_mount(fixture("solid.7z"), "s", 1));
+    CHECK(PHYSFS_setRoot(fixture("joliet.iso"), NULL));
+    checkIndexAgrees(3);
+
+    /* ...and with it off, so it gets built from scratch next time. */
+    CHECK(PHYSFS_indexSearchPath(0));
+    CHECK(PHYSFS_mount(fixture("cache.zip"), "m", 0));
+    CHECK(PHYSFS_unmount(fixture("crc.zip")));
+    CHECK(mountNested("m/inner.zip", "m/i"));
+    checkIndexAgrees(4);
+
+    CHECK(PHYSFS_indexSearchPath(1));
+    CHECK(PHYSFS_unmount("m/inner.zip"));
+    CHECK(PHYSFS_unmount(fixture("cache.zip")));
+    CHECK(PHYSFS_unmount(fixture("nested.zip")));
+    CHECK(PHYSFS_unmount(fixture("folders.7z")));
+    CHECK(PHYSFS_unmount(fixture("solid.7z")));
+    CHECK(PHYSFS_unmount(fixture("joliet.iso")));
+    CHECK(PHYSFS_unmount(scratchTree));
+    checkIndexAgrees(5);  /* nothing mounted at all. */
+    CHECK(PHYSFS_indexSearchPath(0));
+
+test_searchindex_done:
+    removeTree();
+} /* test_searchindex */
+
+
+/* Look up (count) paths that aren't there; (fmt) gets the number. */
+static void lookupMissing(const char *fmt, const int count)
+{
+    char path[64];
+    int i;
+    for (i = 0; i < count; i++)
+    {
+        snprintf(path, sizeof (path), fmt, i);
+        if (!CHECK(!PHYSFS_exists(path)))
+            printf("  ... for '%s'\n", path);
+    } /* for */
+} /* lookupMissing */
+
+
+/*
+ * Look up (count) missing paths and check that the filters skipped
+ *  (archives) archives for each, give or take a few false positives.
+ */
+static void checkRejected(const char *fmt, const int count, const int archives)
+{
+    const PHYSFS_uint32 lookups = (PHYSFS_uint32) (count * archives);
+    PHYSFS_uint32 rejected, falsePositives;
+    PHYSFS_uint32 rejected2, falsePositives2;
+
+    PHYSFS_getLookupFilterStats(&rejected, &falsePositives);
+    lookupMissing(fmt, count);
+    PHYSFS_getLookupFilterStats(&rejected2, &falsePositives2);
+    rejected2 -= rejected;
+    falsePositives2 -= falsePositives;
+
+    /* each archive is asked once: it's either skipped or let through. */
+    CHECK((rejected2 + falsePositives2) == lookups);
+    CHECK((falsePositives2 * 50) <= lookups);
+} /* checkRejected */
+
+
+/* The paths that have to survive the filters. */
+static void checkFilteredPaths(void)
+{
+    static const char *present[] = {
+        "a.txt", "big.txt", "c.bin", "plain.txt", "inner.zip", "m", "m/n",
+        "m/n/good.txt", "m/n/bad-stored.txt", "r", "r/x.txt", "r/deeper",
+        "r/deeper/y.txt"
+    };
+    static const char *absent[] = {
+        "m/good.txt", "n/good.txt", "good.txt", "r/data", "r/data/x.txt",
+        "r/other/z.txt", "r/top.txt", "data/x.txt", "x.txt", "deeper/y.txt"
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof (present) / sizeof (present[0]); i++)
+    {
+        if (!CHECK(PHYSFS_exists(present[i])))
+            printf("  ... for '%s'\n", present[i]);
+    } /* for */
+
+    for (i = 0; i < sizeof (absent) / sizeof (absent[0]); i++)
+    {
+        if (!CHECK(!PHYSFS_exists(absent[i])))
+            printf("  ... for '%s'\n", absent[i]);
+    } /* for */
+} /* checkFilteredPaths */
+
+
+static void test_filter(void)
+{
+    static const char *root[] = {
+        "cache.zip", "folders.7z", "nested.zip", "zstd.zip", "solid.7z"
+    };
+    static const char *paths[3] = { "r/x.txt", "r/nope.txt", "m/n/nope.txt" };
+    PHYSFS_uint32 rejected, falsePositives;
+    PHYSFS_uint32 rejected2, falsePositives2;
+    int found[3];
+    size_t i;
+
+    for (i = 0; i < sizeof (root) / sizeof (root[0]); i++)
+        CHECK(PHYSFS_mount(fixture(root[i]), NULL, 1));
+    CHECK(PHYSFS_mount(fixture("crc.zip"), "m/n", 1));
+    CHECK(PHYSFS_mount(fixture("tree.zip"), "r", 1));
+    CHECK(PHYSFS_setRoot(fixture("tree.zip"), "data"));
+
+    /* no false negatives, with a root and under a mountpoint. */
+    checkFilteredPaths();
+
+    /*
+     * Misses skip every archive that could have had them: the five at the
+     *  root, plus the one mounted under the path, if any.
+     */
+    checkRejected("missing-%03d.txt", 200, 5);
+    checkRejected("m/n/missing-%03d.txt", 200, 6);
+    checkRejected("r/missing-%03d.txt", 200, 6);
+    checkRejected("r/deeper/missing-%03d.txt", 200, 6);
+    checkRejected("r/data/missing-%03d.txt", 200, 6);
+
+    /* PHYSFS_statMany() uses the same filters. */
+    PHYSFS_getLookupFilterStats(&rejected, &falsePositives);
+    CHECK(PHYSFS_statMany(paths, NULL, found, 3));
+    CHECK(found[0] && !found[1] && !found[2]);
+    PHYSFS_getLookupFilterStats(&rejected2, &falsePositives2);
+    /* six archives for each of three paths, less the one that has r/x.txt. */
+    CHECK(((rejected2 - rejected) + (falsePositives2 - falsePositives)) == 17);
+    CHECK((rejected2 - rejected) >= 15);
+
+    /* moving the root rebuilds the filter. */
+    CHECK(PHYSFS_setRoot(fixture("tree.zip"), "other"));
+    CHECK(PHYSFS_exists("r/z.txt"));
+    CHECK(!PHYSFS_exists("r/x.txt"));
+    CHECK(PHYSFS_setRoot(fixture("tree.zip"), NULL));
+    CHECK(PHYSFS_exists("r/data/x.txt"));
+    CHECK(PHYSFS_exists("r/top.txt"));
+    CHECK(!PHYSFS_exists("r/x.txt"));
+    CHECK(PHYSFS_setRoot(fixture("tree.zip"), "data"));
+
+    /* the index covers the archives it can and doesn't change the answers. */
+    CHECK(PHYSFS_indexSearchPath(1));
+    checkFilteredPaths();
+    CHECK(PHYSFS_indexSearchPath(0));
+
+    CHECK(PHYSFS_unmount(fixture("tree.zip")));
+    CHECK(PHYSFS_unmount(fixture("crc.zip")));
+    for (i = 0; i < sizeof (root) / sizeof (root[0]); i++)
+        CHECK(PHYSFS_unmount(fixture(root[i])));
+} /* test_filter */
+
+
+#ifndef _WIN32
+/* Swap regress-tree/real for a symlink to it, or back, behind our back. */
+static int swapRealDir(const int toLink)
+{
+    if (toLink)
+    {
+        return (rename("regress-tree/real", "regress-tree/moved") == 0) &&
+               (symlink("moved", "regress-tree/real") == 0);
+    } /* if */
+
+    return (remove("regress-tree/real") == 0) &&
+           (rename("regress-tree/moved", "regress-tree/real") == 0);
+} /* swapRealDir */
+
+
+/* Is (fname) refused because there's a symlink in the way? */
+static int symlinkForbidden(const char *fname)
+{
+    PHYSFS_Stat st;
+    if (PHYSFS_stat(fname, &st))
+        return 0;
+    return (PHYSFS_getLastErrorCode() == PHYSFS_ERR_SYMLINK_FORBIDDEN);
+} /* symlinkForbidden */
+
+
+static void test_symlinks(void)
+{
+    PHYSFS_File *f;
+    int swapped = 0;
+
+    if (!CHECK(makeTree()))
+        goto test_symlinks_done;
+
+    CHECK(PHYSFS_mount(scratchTree, "t", 1));
+    CHECK(PHYSFS_setWriteDir(scratchTree));
+
+    /* a symlinked parent is refused every time, cached or not. */
+    CHECK(symlinkForbidden("t/linkdir/f.txt"));
+    CHECK(symlinkForbidden("t/linkdir/f.txt"));
+    CHECK(symlinkForbidden("t/linkdir/sub/g.txt"));
+    CHECK(symlinkForbidden("t/link.txt"));
+    CHECK(PHYSFS_openRead("t/linkdir/sub/g.txt") == NULL);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_SYMLINK_FORBIDDEN);
+    CHECK(PHYSFS_openWrite("linkdir/new.txt") == NULL);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_SYMLINK_FORBIDDEN);
+
+    /* real directories go in the cache... */
+    CHECK(PHYSFS_exists("t/real/f.txt"));
+    CHECK(PHYSFS_exists("t/real/sub/g.txt"));
+    CHECK(readText("t/real/sub/g.txt", 13, "further down\n"));
+
+    /* ...and PHYSFS_mkdir() throws them out, along with everyone else's. */
+    if (!CHECK(swapRealDir(1)))
+        goto test_symlinks_done;
+    swapped = 1;
+    CHECK(PHYSFS_mkdir("scratch"));
+    CHECK(symlinkForbidden("t/real/f.txt"));
+    CHECK(symlinkForbidden("t/real/sub/g.txt"));
+    CHECK(PHYSFS_openWrite("real/new.txt") == NULL);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_SYMLINK_FORBIDDEN);
+
+    /* put it back; it's found again, and cached again... */
+    if (!CHECK(swapRealDir(0)))
+        goto test_symlinks_done;
+    swapped = 0;
+    CHECK(PHYSFS_exists("t/real/f.txt"));
+    CHECK(PHYSFS_exists("t/real/sub/g.txt"));
+    f = PHYSFS_openWrite("real/sub/new.txt");
+    CHECK(f != NULL);
+    CHECK((f != NULL) && PHYSFS_close(f));
+
+    /* ...and PHYSFS_delete() throws them out, too. */
+    if (!CHECK(swapRealDir(1)))
+        goto test_symlinks_done;
+    swapped = 1;
+    CHECK(PHYSFS_delete("scratch"));
+    CHECK(symlinkForbidden("t/real/f.txt"));
+    CHECK(symlinkForbidden("t/real/sub/new.txt"));
+    CHECK(PHYSFS_delete("real/sub/new.txt") == 0);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_SYMLINK_FORBIDDEN);
+
+    /* permitted symlinks don't need the cache at all. */
+    PHYSFS_permitSymbolicLinks(1);
+    CHECK(PHYSFS_exists("t/real/sub/new.txt"));
+    CHECK(PHYSFS_exists("t/linkdir/sub/g.txt"));
+    PHYSFS_permitSymbolicLinks(0);
+
+test_symlinks_done:
+    if (swapped)
+        CHECK(swapRealDir(0));
+    PHYSFS_setWriteDir(NULL);
+    PHYSFS_unmount(scratchTree);
+    remove("regress-tree/real/sub/new.txt");
+    remove("regress-tree/scratch");
+    removeTree();
+} /* test_symlinks */
+#endif
+
+
+#if TEST_REGRESS_HAVE_PTHREAD
+static const char *longRoot = "a/root/that/is/longer/than/anything/mounted/yet/"
+                              "so/it/will/not/fit/in/front/of/the/path/that/"
+                              "PHYSFS_enumerate/already/set/aside/room/for";
+
+static pthread_mutex_t mutatorLock = PTHREAD_MUTEX_INITIALIZER;
+static int mutatorDone = 0;
+
+static int isMutatorDone(void)
+{
+    int retval;
+    pthread_mutex_lock(&mutatorLock);
+    retval = mutatorDone;
+    pthread_mutex_unlock(&mutatorLock);
+    return retval;
+} /* isMutatorDone */
+
+static PHYSFS_EnumerateCallbackResult countEntries(void *data,
+                                      const char *origdir, const char *fname)
+{
+    (*((int *) data))++;
+    return PHYSFS_ENUM_OK;
+} /* countEntries */
+
+
+/* The first callback gives a later archive a root longer than any so far. */
+static PHYSFS_EnumerateCallbackResult growRoot(void *data,
+                                      const char *origdir, const char *fname)
+{
+    int *calls = (int *) data;
+    if ((*calls)++ == 0)
+        CHECK(PHYSFS_setRoot(fixture("nested.zip"), longRoot));
+    return PHYSFS_ENUM_OK;
+} /* growRoot */
+
+
+/* Readers: open, read, stat and enumerate until the mutator is done. */
+static void *readerThread(void *data)
+{
+    int *bad = (int *) data;
+    PHYSFS_uint64 len;
+    PHYSFS_uint8 *buf;
+    PHYSFS_Stat st;
+    int count;
+
+    do
+    {
+        buf = slurp("a.txt", &len);
+        *bad += (buf == NULL) || (len != 2601);
+        free(buf);
+
+        *bad += !PHYSFS_stat("b.txt", &st) || (st.filesize != 3901);
+
+        count = 0;
+        *bad += !PHYSFS_enumerate("", countEntries, &count) || (count < 4);
+
+        /* these come and go, but must be right when they're there. */
+        buf = slurp("extra/plain.txt", &len);
+        *bad += (buf != NULL) && (len != 1950);
+        free(buf);
+        count = 0;
+        *bad += !PHYSFS_enumerate("extra", countEntries, &count);
+    } while (!isMutatorDone());
+
+    return NULL;
+} /* readerThread */
+
+
+/* Mutator: mount, change roots, unmount; unmounts may have to wait. */
+static void *mutatorThread(void *data)
+{
+    static const char *roots[] = { NULL, "x", NULL, "inner.zip", NULL };
+    const char *archive = fixture("nested.zip");
+    int *bad = (int *) data;
+    int i, j;
+
+    for (i = 0; i < 2000; i++)
+    {
+        if (!PHYSFS_mount(archive, "extra", 1))
+        {
+            (*bad)++;
+            break;
+        } /* if */
+
+        for (j = 0; j < (int) (sizeof (roots) / sizeof (roots[0])); j++)
+            *bad += !PHYSFS_setRoot(archive, (j == i % 5) ? longRoot : roots[j]);
+
+        while (!PHYSFS_unmount(archive))
+        {
+            if (PHYSFS_getLastErrorCode() != PHYSFS_ERR_FILES_STILL_OPEN)
+            {
+                (*bad)++;
+                break;
+            } /* if */
+            sched_yield();
+        } /* while */
+    } /* for */
+
+    pthread_mutex_lock(&mutatorLock);
+    mutatorDone = 1;
+    pthread_mutex_unlock(&mutatorLock);
+    return NULL;
+} /* mutatorThread */
+
+
+static void test_threads(void)
+{
+    pthread_t readers[4];
+    pthread_t mutator;
+    int bad[4];
+    int mutatorBad = 0;
+    int calls = 0;
+    int i;
+
+    if (!PHYSFS_allowConcurrentReads(1))
+    {
+        CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_UNSUPPORTED);
+        printf("concurrent reads aren't supported here; skipping.\n");
+        return;
+    } /* if */
+
+    if (!CHECK(PHYSFS_mount(fixture("cache.zip"), NULL, 1)))
+        return;
+
+    /*
+     * Callbacks run unlocked in this mode, so one can change the search
+     *  path in the middle of PHYSFS_enumerate().
+     */
+    if (CHECK(PHYSFS_mount(fixture("nested.zip"), NULL, 1)))
+    {
+        CHECK(PHYSFS_enumerate("", growRoot, &calls));
+        CHECK(calls == 4);  /* just cache.zip: nested.zip has no such root. */
+        CHECK(PHYSFS_setRoot(fixture("nested.zip"), NULL));
+        CHECK(listed("plain.txt"));
+        CHECK(PHYSFS_unmount(fixture("nested.zip")));
+    } /* if */
+
+    mutatorDone = 0;
+    for (i = 0; i < 4; i++)
+    {
+        bad[i] = 0;
+        CHECK(pthread_create(&readers[i], NULL, readerThread, &bad[i]) == 0);
+    } /* for */
+    CHECK(pthread_create(&mutator, NULL, mutatorThread, &mutatorBad) == 0);
+
+    pthread_join(mutator, NULL);
+    CHECK(mutatorBad == 0);
+    for (i = 0; i < 4; i++)
+    {
+        pthread_join(readers[i], NULL);
+        CHECK(bad[i] == 0);
+    } /* for */
+
+    CHECK(PHYSFS_unmount(fixture("cache.zip")));
+    CHECK(PHYSFS_allowConcurrentReads(0));
+} /* test_threads */
+#endif
+
+
+typedef struct
+{
+    const char *name;
+    void (*func)(void);
+} TestGroup;
+
+static const TestGroup groups[] =
+{
+    { "zstd", test_zstd },
+    { "filecache", test_filecache },
+    { "crc", test_crc },
+    { "7z", test_7z },
+    { "io", test_io },
+    { "index", test_index },
+    { "iso", test_iso },
+    { "statmany", test_statmany },
+    { "searchindex", test_searchindex },
+    { "filter", test_filter },
+#ifndef _WIN32
+    { "symlinks", test_symlinks },
+#endif
+#if TEST_REGRESS_HAVE_PTHREAD
+    { "threads", test_threads },
+#endif
+    { NULL, NULL }
+};
+
+
+int main(int argc, char **argv)
+{
+    const TestGroup *i;
+    int ran = 0;
+
+    if (argc < 2)
+    {
+        printf("USAGE: %s <testDataDir> [group]\n", argv[0]);
+        return 2;
+    } /* if */
+
+    datadir = argv[1];
+
+    if (!PHYSFS_init(argv[0]))
+    {
+        printf("PHYSFS_init() failed: %s\n",
+               PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+        return 1;
+    } /* if */
+
+    for (i = groups; i->name != NULL; i++)
+    {
+        if ((argc < 3) || (strcmp(argv[2], i->name) == 0))
+        {
+            printf("%s...\n", i->name);
+            i->func();
+            ran++;
+        } /* if */
+    } /* for */
+
+    if (!PHYSFS_deinit())
+    {
+        printf("PHYSFS_deinit() failed: %s\n",
+               PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+        failures++;
+    } /* if */
+
+    if (ran == 0)
+    {
+        printf("No test group named '%s'.\n", argv[2]);
+        return 2;
+    } /* if */
+
+    printf("%d failure%s.\n", failures, (failures == 1) ? "" : "s");
+    return (failures == 0) ? 0 : 1;
+} /* main */
+
+/* end of test_regress.c ... */